@@ -0,0 +1,289 @@
+#include "MockServer.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+static const char* const WORDS[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit"
+};
+
+MockServer::MockServer() : MockServer(Options()) {
+}
+
+MockServer::MockServer(const Options& opts, int requestedPort)
+    : listenFd(-1), port(0), running(false), requests(0), options(opts) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        throw std::runtime_error(std::string("Failed to create socket: ") + std::strerror(errno));
+    }
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)requestedPort);
+    socklen_t length = sizeof(address);
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 128) != 0 ||
+        getsockname(listenFd, (sockaddr*)&address, &length) != 0) {
+        int error = errno;
+        close(listenFd);
+        throw std::runtime_error("Failed to listen on port " + std::to_string(requestedPort) +
+                                 ": " + std::strerror(error));
+    }
+    port = ntohs(address.sin_port);
+    running = true;
+    acceptor = std::thread(&MockServer::acceptLoop, this);
+}
+
+MockServer::~MockServer() {
+    stop();
+}
+
+std::string MockServer::baseUrl() const {
+    return "http://127.0.0.1:" + std::to_string(port) + "/v1";
+}
+
+void MockServer::setOptions(const Options& opts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    options = opts;
+}
+
+MockServer::Options MockServer::getOptions() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return options;
+}
+
+void MockServer::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    // Wakes accept() and every blocked recv()
+    shutdown(listenFd, SHUT_RDWR);
+    acceptor.join();
+    close(listenFd);
+
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : connections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        threads.swap(workers);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void MockServer::acceptLoop() {
+    while (running) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) {
+            close(fd);
+            return;
+        }
+        connections.push_back(fd);
+        workers.emplace_back(&MockServer::serveConnection, this, fd);
+    }
+}
+
+void MockServer::serveConnection(int fd) {
+    std::string buffer;
+    Request request;
+    while (running && readRequest(fd, buffer, request) && respond(fd, request) && request.keepAlive) {
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.erase(std::remove(connections.begin(), connections.end(), fd), connections.end());
+    close(fd);
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// Read one request; buffer carries bytes past it over to the next call
+bool MockServer::readRequest(int fd, std::string& buffer, Request& request) {
+    char chunk[16384];
+    size_t headEnd;
+    while ((headEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, (size_t)n);
+    }
+
+    std::string head = buffer.substr(0, headEnd);
+    std::transform(head.begin(), head.end(), head.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    size_t pathStart = head.find(' ');
+    size_t pathEnd = head.find(' ', pathStart + 1);
+    if (pathStart == std::string::npos || pathEnd == std::string::npos) {
+        return false;
+    }
+    request.path = buffer.substr(pathStart + 1, pathEnd - pathStart - 1);
+    request.keepAlive = head.find("\r\nconnection: close") == std::string::npos;
+
+    size_t contentLength = 0;
+    size_t header = head.find("\r\ncontent-length:");
+    if (header != std::string::npos) {
+        contentLength = std::strtoul(head.c_str() + header + 17, nullptr, 10);
+    }
+    if (head.find("\r\nexpect: 100-continue") != std::string::npos &&
+        !sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) {
+        return false;
+    }
+
+    buffer.erase(0, headEnd + 4);
+    while (buffer.size() < contentLength) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, (size_t)n);
+    }
+    request.body = buffer.substr(0, contentLength);
+    buffer.erase(0, contentLength);
+    return true;
+}
+
+// Fail errorRate of all requests, spread evenly: request n fails when it
+// takes floor(n * rate) past another integer
+static bool shouldFail(uint64_t n, double rate) {
+    return rate > 0 && (uint64_t)((double)n * rate) != (uint64_t)((double)(n - 1) * rate);
+}
+
+static std::string chunk(const std::string& data) {
+    char size[32];
+    std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    return size + data + "\r\n";
+}
+
+bool MockServer::respond(int fd, const Request& request) {
+    uint64_t n = ++requests;
+    Options opts = getOptions();
+    if (opts.latencyMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(opts.latencyMs));
+    }
+
+    bool claude = request.path.size() >= 9 &&
+                  request.path.compare(request.path.size() - 9, 9, "/messages") == 0;
+    bool openai = request.path.find("/chat/completions") != std::string::npos;
+    std::string connection = request.keepAlive ? "keep-alive" : "close";
+    if (!claude && !openai) {
+        std::string body = "{\"error\":{\"message\":\"unknown path\"}}";
+        return sendAll(fd, "HTTP/1.1 404 Not Found\r\nContent-Type: application/json\r\n"
+                           "Content-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: " + connection + "\r\n\r\n" + body);
+    }
+    if (shouldFail(n, opts.errorRate)) {
+        std::string body = "{\"error\":{\"message\":\"mock failure\",\"type\":\"server_error\"}}";
+        return sendAll(fd, "HTTP/1.1 " + std::to_string(opts.errorStatus) + " Mock Error\r\n"
+                           "Content-Type: application/json\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: " + connection +
+                           "\r\n\r\n" + body);
+    }
+
+    long inputTokens = (long)request.body.size() / 4;
+    long outputTokens = (long)opts.replyTokens;
+    bool stream = request.body.find("\"stream\":true") != std::string::npos ||
+                  request.body.find("\"stream\": true") != std::string::npos;
+
+    if (!stream) {
+        std::string text;
+        for (size_t i = 0; i < opts.replyTokens; ++i) {
+            text += WORDS[i % 8];
+            text += ' ';
+        }
+        std::string body;
+        if (claude) {
+            body = "{\"id\":\"msg_mock\",\"type\":\"message\",\"role\":\"assistant\",\"model\":\"mock\","
+                   "\"content\":[{\"type\":\"text\",\"text\":\"" + text + "\"}],"
+                   "\"stop_reason\":\"end_turn\",\"usage\":{\"input_tokens\":" +
+                   std::to_string(inputTokens) + ",\"output_tokens\":" +
+                   std::to_string(outputTokens) + "}}";
+        } else {
+            body = "{\"id\":\"chatcmpl-mock\",\"object\":\"chat.completion\",\"model\":\"mock\","
+                   "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"" +
+                   text + "\"},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":" +
+                   std::to_string(inputTokens) + ",\"completion_tokens\":" +
+                   std::to_string(outputTokens) + ",\"total_tokens\":" +
+                   std::to_string(inputTokens + outputTokens) + "}}";
+        }
+        return sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                           "Content-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: " + connection + "\r\n\r\n" + body);
+    }
+
+    if (!sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                     "Transfer-Encoding: chunked\r\nConnection: " + connection + "\r\n\r\n")) {
+        return false;
+    }
+    if (claude && !sendAll(fd, chunk("event: message_start\ndata: {\"type\":\"message_start\","
+                                     "\"message\":{\"id\":\"msg_mock\",\"usage\":{\"input_tokens\":" +
+                                     std::to_string(inputTokens) + ",\"output_tokens\":0}}}\n\n"))) {
+        return false;
+    }
+    for (size_t i = 0; i < opts.replyTokens; ++i) {
+        if (i > 0 && opts.tokenDelayUs > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.tokenDelayUs));
+        }
+        std::string word = std::string(WORDS[i % 8]) + " ";
+        std::string event = claude
+            ? "event: content_block_delta\ndata: {\"type\":\"content_block_delta\",\"index\":0,"
+              "\"delta\":{\"type\":\"text_delta\",\"text\":\"" + word + "\"}}\n\n"
+            : "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"" + word + "\"}}]}\n\n";
+        if (!sendAll(fd, chunk(event))) {
+            return false;
+        }
+    }
+    std::string tail = claude
+        ? "event: message_delta\ndata: {\"type\":\"message_delta\",\"delta\":{\"stop_reason\":"
+          "\"end_turn\"},\"usage\":{\"output_tokens\":" + std::to_string(outputTokens) + "}}\n\n"
+          "event: message_stop\ndata: {\"type\":\"message_stop\"}\n\n"
+        : "data: {\"choices\":[],\"usage\":{\"prompt_tokens\":" + std::to_string(inputTokens) +
+          ",\"completion_tokens\":" + std::to_string(outputTokens) + "}}\n\ndata: [DONE]\n\n";
+    return sendAll(fd, chunk(tail) + "0\r\n\r\n");
+}
+
+} // namespace caichat
+} // namespace opencog
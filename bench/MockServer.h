@@ -0,0 +1,88 @@
+#ifndef MOCKSERVER_H
+#define MOCKSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Local stand-in for the OpenAI and Anthropic APIs, so the clients can be
+ * measured without a provider.
+ *
+ * Answers POST .../chat/completions in the OpenAI format and POST
+ * .../messages in the Anthropic format, streamed as Server-Sent Events
+ * when the body asks for "stream":true. Point a client at it through its
+ * base URL: OpenAIClient("key", server.baseUrl()). Connections are
+ * HTTP/1.1 keep-alive, one thread each.
+ */
+class MockServer {
+public:
+    struct Options {
+        unsigned latencyMs = 0;       // before the response starts
+        unsigned tokenDelayUs = 0;    // between streamed tokens
+        size_t replyTokens = 16;      // words per reply
+        double errorRate = 0;         // fraction of requests that fail
+        int errorStatus = 500;
+    };
+
+    /**
+     * Listen on 127.0.0.1:port; port 0 picks a free one
+     */
+    MockServer();
+    explicit MockServer(const Options& options, int port = 0);
+    ~MockServer();
+
+    MockServer(const MockServer&) = delete;
+    MockServer& operator=(const MockServer&) = delete;
+
+    int getPort() const { return port; }
+
+    /**
+     * Base URL for the clients, "http://127.0.0.1:<port>/v1"
+     */
+    std::string baseUrl() const;
+
+    void setOptions(const Options& options);
+    Options getOptions() const;
+
+    uint64_t requestCount() const { return requests.load(); }
+
+    /**
+     * Close the listening socket and all connections
+     */
+    void stop();
+
+private:
+    struct Request {
+        std::string path;
+        std::string body;
+        bool keepAlive = true;
+    };
+
+    void acceptLoop();
+    void serveConnection(int fd);
+    bool readRequest(int fd, std::string& buffer, Request& request);
+    bool respond(int fd, const Request& request);
+
+    int listenFd;
+    int port;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> requests;
+
+    mutable std::mutex mutex;
+    Options options;
+    std::thread acceptor;
+    std::vector<int> connections;
+    std::vector<std::thread> workers;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // MOCKSERVER_H
@@ -0,0 +1,855 @@
+// Client overhead benchmarks against local mock providers:
+//   caichat-bench [--benchmark_filter=<regex>] [--benchmark_format=json]
+//
+// Reports per-request overhead, throughput at N requests in flight, JSON
+// costs over history sizes and heap allocations per request, so
+// regressions show up without paying a provider.
+
+#include "MockServer.h"
+#include "caichat/AtomStore.h"
+#include "caichat/ChatCompletion.h"
+#include "caichat/CoalescingClient.h"
+#include "caichat/HTTPClient.h"
+#include "caichat/HedgingClient.h"
+#include "caichat/JSONScanner.h"
+#include "caichat/JSONWriter.h"
+#include "caichat/LLMClient.h"
+#include "caichat/Metrics.h"
+#include "caichat/RoutingClient.h"
+#include "caichat/SessionJournal.h"
+#include "caichat/Tokenizer.h"
+#include "caichat/VectorIndex.h"
+#include <benchmark/benchmark.h>
+#ifdef HAVE_JSONCPP
+#include <json/json.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace opencog::caichat;
+
+// Heap allocations of this process, counted by the replacement operator
+// new. Kept out of line, so GCC does not pair the malloc and free it would
+// otherwise see through inlining as mismatched with new and delete.
+static std::atomic<uint64_t> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Allocations per iteration since start
+static benchmark::Counter allocationsSince(uint64_t start) {
+    return benchmark::Counter((double)(allocations.load() - start),
+                              benchmark::Counter::kAvgIterations);
+}
+
+// Base URLs of the mock providers
+struct Mocks {
+    std::string instant;     // no latency, 16-token replies
+    std::string slow;        // 20 ms latency
+    std::string streaming;   // 64 tokens, streamed when asked
+};
+static Mocks mocks;
+
+// The mock servers run in a child process, so their threads' allocations
+// and CPU time stay out of the measurements. The child exits when our end
+// of the pipe closes.
+static void startMocks() {
+    int ports[2], alive[2];
+    if (pipe(ports) != 0 || pipe(alive) != 0) {
+        std::perror("pipe");
+        std::exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        std::exit(1);
+    }
+    if (pid == 0) {
+        close(ports[0]);
+        close(alive[1]);
+        MockServer::Options slow;
+        slow.latencyMs = 20;
+        MockServer::Options streaming;
+        streaming.replyTokens = 64;
+        MockServer instantServer, slowServer(slow), streamingServer(streaming);
+        int list[3] = {instantServer.getPort(), slowServer.getPort(), streamingServer.getPort()};
+        if (write(ports[1], list, sizeof(list)) != (ssize_t)sizeof(list)) {
+            _exit(1);
+        }
+        char byte;
+        while (read(alive[0], &byte, 1) > 0) {
+        }
+        _exit(0);
+    }
+    close(ports[1]);
+    close(alive[0]);
+    int list[3];
+    if (read(ports[0], list, sizeof(list)) != (ssize_t)sizeof(list)) {
+        std::fprintf(stderr, "Mock servers failed to start\n");
+        std::exit(1);
+    }
+    close(ports[0]);
+    std::string host = "http://127.0.0.1:";
+    mocks.instant = host + std::to_string(list[0]) + "/v1";
+    mocks.slow = host + std::to_string(list[1]) + "/v1";
+    mocks.streaming = host + std::to_string(list[2]) + "/v1";
+}
+
+static std::vector<Message> history(size_t count, size_t length) {
+    std::vector<Message> messages;
+    for (size_t i = 0; i < count; ++i) {
+        messages.emplace_back(i % 2 ? Role::Assistant : Role::User, std::string(length, 'a' + (char)(i % 26)));
+    }
+    if (messages.empty() || messages.back().role != Role::User) {
+        messages.emplace_back(Role::User, "And now?");
+    }
+    return messages;
+}
+
+// One blocking request with a one-message history: the client's fixed
+// cost per request over a loopback connection. /1 reuses the pooled
+// handle and its connection; /0 empties the pool first, so every request
+// pays for a fresh handle and connection as without the pool.
+template <typename Client>
+static void BM_Request(benchmark::State& state) {
+    bool pooled = state.range(0) != 0;
+    Client client("bench-key", mocks.instant);
+    std::vector<Message> messages = history(1, 64);
+    client.chatCompletion(messages, "bench");   // connect outside the timing
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        if (!pooled) {
+            ConnectionPool::instance().clear();
+        }
+        benchmark::DoNotOptimize(client.chatCompletion(messages, "bench"));
+    }
+    state.counters["allocs"] = allocationsSince(start);
+}
+BENCHMARK_TEMPLATE(BM_Request, OpenAIClient)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_Request, ClaudeClient)->Arg(0)->Arg(1);
+
+// A streamed 64-token reply, tokens delivered through the callback
+template <typename Client>
+static void BM_Stream(benchmark::State& state) {
+    Client client("bench-key", mocks.streaming);
+    std::vector<Message> messages = history(1, 64);
+    size_t tokens = 0;
+    auto onToken = [&tokens](const std::string&) { tokens++; };
+    client.chatCompletionStream(messages, onToken, "bench");
+    tokens = 0;
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client.chatCompletionStream(messages, onToken, "bench"));
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.counters["tokens/s"] = benchmark::Counter((double)tokens, benchmark::Counter::kIsRate);
+}
+BENCHMARK_TEMPLATE(BM_Stream, OpenAIClient);
+BENCHMARK_TEMPLATE(BM_Stream, ClaudeClient);
+
+// Batches of N concurrent requests on the event loop against a provider
+// answering in 20 ms; perfect overlap gives N / 20 ms
+static void BM_Throughput(benchmark::State& state) {
+    size_t concurrency = (size_t)state.range(0);
+    OpenAIClient client("bench-key", mocks.slow);
+    std::vector<Message> messages = history(1, 64);
+    for (auto _ : state) {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = concurrency;
+        size_t failed = 0;
+        for (size_t i = 0; i < concurrency; ++i) {
+            client.submitChatCompletion(messages,
+                [&](const std::string&, std::exception_ptr error) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed += error ? 1 : 0;
+                    if (--remaining == 0) {
+                        done.notify_one();
+                    }
+                }, "bench");
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return remaining == 0; });
+        if (failed) {
+            state.SkipWithError("request failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed((int64_t)(state.iterations() * concurrency));
+}
+BENCHMARK(BM_Throughput)->RangeMultiplier(4)->Range(1, 64)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Bursts of N identical requests against the 20 ms provider, sent as is
+// and through the coalescer; "sent" is provider requests per burst
+static void BM_Coalesce(benchmark::State& state) {
+    size_t concurrency = (size_t)state.range(0);
+    bool coalesce = state.range(1) != 0;
+    std::unique_ptr<LLMClient> client(new OpenAIClient("bench-key", mocks.slow));
+    if (coalesce) {
+        client.reset(new CoalescingClient(std::move(client)));
+    }
+    std::vector<Message> messages = history(1, 64);
+    std::string model = coalesce ? "coalesced" : "direct";
+    Counter& requests = Metrics::instance().forModel("openai", model).requests;
+    uint64_t sent = requests.get();
+    for (auto _ : state) {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = concurrency;
+        size_t failed = 0;
+        for (size_t i = 0; i < concurrency; ++i) {
+            client->submitChatCompletion(messages,
+                [&](const std::string&, std::exception_ptr error) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed += error ? 1 : 0;
+                    if (--remaining == 0) {
+                        done.notify_one();
+                    }
+                }, model);
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return remaining == 0; });
+        if (failed) {
+            state.SkipWithError("request failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed((int64_t)(state.iterations() * concurrency));
+    state.counters["sent"] = (double)(requests.get() - sent) / (double)state.iterations();
+}
+BENCHMARK(BM_Coalesce)->ArgsProduct({{1, 8, 64}, {0, 1}})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// The instant mock posing as a local model, so the router treats it as one
+class LocalStandIn : public LLMClient {
+public:
+    LocalStandIn() : inner("bench-key", mocks.instant) {}
+    std::string chatCompletion(const std::vector<Message>& messages, const std::string& model) override {
+        return inner.chatCompletion(messages, model);
+    }
+    void setApiKey(const std::string&) override {}
+    std::string getProviderName() const override { return "ggml"; }
+
+private:
+    OpenAIClient inner;
+};
+
+// Three short prompts and one of ~4000 tokens, sent in turn to the 20 ms
+// provider or routed between it and a local stand-in; "local" is the
+// share of requests the router kept local
+static void BM_Route(benchmark::State& state) {
+    bool routed = state.range(0) != 0;
+    std::shared_ptr<LLMClient> remote = std::make_shared<OpenAIClient>("bench-key", mocks.slow);
+    std::unique_ptr<LLMClient> client;
+    RoutingClient* router = nullptr;
+    if (routed) {
+        std::vector<RoutingClient::Backend> backends = {{std::make_shared<LocalStandIn>(), ""},
+                                                        {remote, ""}};
+        router = new RoutingClient(std::move(backends), RoutingClient::Options());
+        client.reset(router);
+    } else {
+        client.reset(new OpenAIClient("bench-key", mocks.slow));
+    }
+    std::vector<Message> shortPrompt = history(1, 64);
+    std::vector<Message> longPrompt = history(16, 1024);
+    for (auto _ : state) {
+        for (int i = 0; i < 4; ++i) {
+            benchmark::DoNotOptimize(client->chatCompletion(i == 3 ? longPrompt : shortPrompt));
+        }
+    }
+    state.SetItemsProcessed((int64_t)(state.iterations() * 4));
+    if (router) {
+        std::vector<RoutingClient::BackendStats> stats = router->getStats();
+        state.counters["local"] = (double)stats[0].routed / (double)(stats[0].routed + stats[1].routed);
+    }
+}
+BENCHMARK(BM_Route)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Full round trip with a history of N 256-byte messages; the request
+// serialization and response parse times come from the client's metrics
+static void BM_History(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    OpenAIClient client("bench-key", mocks.instant);
+    std::vector<Message> messages = history(count, 256);
+    std::string model = "history-" + std::to_string(count);
+    client.chatCompletion(messages, model);
+    ModelMetrics& metrics = Metrics::instance().forModel("openai", model);
+    metrics.reset();
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client.chatCompletion(messages, model));
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.counters["serialize_us"] = (double)metrics.phases[ModelMetrics::SERIALIZE].quantile(0.5);
+    state.counters["parse_us"] = (double)metrics.phases[ModelMetrics::PARSE].quantile(0.5);
+    state.SetBytesProcessed((int64_t)(state.iterations() * count * 256));
+}
+BENCHMARK(BM_History)->RangeMultiplier(4)->Range(1, 1024)->Unit(benchmark::kMicrosecond);
+
+// BM_History as a ChatCompletion turn sends it: the earlier messages'
+// encoding is kept in a PromptPrefix, only the newest one is serialized
+template <typename Client>
+static void BM_HistoryReuse(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    Client client("bench-key", mocks.instant);
+    std::vector<Message> messages = history(count, 256);
+    std::string model = "reuse-" + std::to_string(count);
+    PromptPrefix prefix;
+    prefix.track(0, messages.size() - 1);
+    PromptPrefix::Scope scope(prefix);
+    client.chatCompletion(messages, model);
+    ModelMetrics& metrics = Metrics::instance().forModel(client.getProviderName(), model);
+    metrics.reset();
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client.chatCompletion(messages, model));
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.counters["serialize_us"] = (double)metrics.phases[ModelMetrics::SERIALIZE].quantile(0.5);
+    state.SetBytesProcessed((int64_t)(state.iterations() * count * 256));
+}
+BENCHMARK_TEMPLATE(BM_HistoryReuse, OpenAIClient)->RangeMultiplier(4)->Range(1, 1024)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_HistoryReuse, ClaudeClient)->RangeMultiplier(4)->Range(1, 1024)
+    ->Unit(benchmark::kMicrosecond);
+
+// One ChatCompletion turn on top of a history of N 256-byte messages.
+// The turn's two messages are removed again afterwards, so every
+// iteration sees the same history; that also re-encodes it each time, so
+// the timings here overstate a real turn. The point is allocs, the heap
+// allocations per turn, which must not grow with N.
+template <typename Turn>
+static void runTurns(benchmark::State& state, std::unique_ptr<LLMClient> client, Turn turn) {
+    ChatCompletion chat(std::move(client), "bench");
+    chat.setContextBudget(0);
+    for (Message& message : history((size_t)state.range(0), 256)) {
+        chat.getConversation().append(std::move(message));
+    }
+    auto once = [&] {
+        turn(chat);
+        chat.getConversation().removeLast();
+        chat.getConversation().removeLast();
+    };
+    once();
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        once();
+    }
+    state.counters["allocs"] = allocationsSince(start);
+}
+
+static void BM_Turn(benchmark::State& state) {
+    runTurns(state, std::unique_ptr<LLMClient>(new OpenAIClient("bench-key", mocks.instant)),
+             [](ChatCompletion& chat) { chat.sendMessage("Next question"); });
+}
+BENCHMARK(BM_Turn)->RangeMultiplier(8)->Range(1, 4096)->Unit(benchmark::kMicrosecond);
+
+// The tool loop works on a copy of the history
+static void BM_TurnWithTools(benchmark::State& state) {
+    ToolExecutor executor;
+    std::vector<ToolDefinition> tools;
+    runTurns(state, std::unique_ptr<LLMClient>(new OpenAIClient("bench-key", mocks.instant)),
+             [&](ChatCompletion& chat) { chat.sendMessageWithTools("Next question", tools, executor); });
+}
+BENCHMARK(BM_TurnWithTools)->RangeMultiplier(8)->Range(1, 4096)->Unit(benchmark::kMicrosecond);
+
+// Hedged requests keep a copy of the messages for every attempt
+static void BM_TurnHedged(benchmark::State& state) {
+    HedgingClient::Backend backend;
+    backend.client = std::make_shared<OpenAIClient>("bench-key", mocks.instant);
+    HedgingClient::Options options;
+    options.mode = HedgingClient::Mode::Failover;
+    runTurns(state, std::unique_ptr<LLMClient>(new HedgingClient({backend}, options)),
+             [](ChatCompletion& chat) { chat.sendMessage("Next question"); });
+}
+BENCHMARK(BM_TurnHedged)->RangeMultiplier(8)->Range(1, 4096)->Unit(benchmark::kMicrosecond);
+
+// Serializing a history of N 256-byte messages in the chat request shape
+static void BM_SerializeHistory(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    std::vector<Message> messages = history(count, 256);
+    std::string body;
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        body.clear();
+        JSONWriter json(body);
+        json.beginObject();
+        json.key("model").value("bench");
+        json.key("messages").beginArray();
+        for (const Message& message : messages) {
+            json.beginObject();
+            json.key("role").value(roleName(message.role));
+            json.key("content").value(message.content);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_SerializeHistory)->RangeMultiplier(4)->Range(1, 1024);
+
+// Extracting the reply and usage from a response with an N-token reply
+static void BM_ParseResponse(benchmark::State& state) {
+    std::string text;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        text += "word\\n ";
+    }
+    std::string body = "{\"id\":\"chatcmpl-bench\",\"object\":\"chat.completion\",\"model\":\"bench\","
+                       "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"" +
+                       text + "\"},\"finish_reason\":\"stop\"}],"
+                       "\"usage\":{\"prompt_tokens\":12,\"completion_tokens\":34}}";
+    std::string content;
+    long tokens = 0;
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        JSONValue root(body);
+        root.getString({"choices", 0, "message", "content"}, content);
+        root.getInt({"usage", "completion_tokens"}, tokens);
+        benchmark::DoNotOptimize(content.data());
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_ParseResponse)->RangeMultiplier(8)->Range(16, 16384);
+
+// JSONWriter and JSONValue against jsoncpp, which the clients used before,
+// on chat requests and responses of about 1 KB, 100 KB and 1 MB. The
+// jsoncpp variants are built when it is installed.
+static std::vector<Message> historyOfSize(size_t bytes) {
+    return history(std::max<size_t>(1, bytes / (256 + 32)), 256);
+}
+
+static std::string responseOfSize(size_t bytes) {
+    std::string text;
+    while (text.size() < bytes) {
+        text += "word\\n ";
+    }
+    return "{\"id\":\"chatcmpl-bench\",\"object\":\"chat.completion\",\"model\":\"bench\","
+           "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"" +
+           text + "\"},\"finish_reason\":\"stop\"}],"
+           "\"usage\":{\"prompt_tokens\":12,\"completion_tokens\":34}}";
+}
+
+static void BM_JSONWrite(benchmark::State& state) {
+    std::vector<Message> messages = historyOfSize((size_t)state.range(0));
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        JSONWriter json(body);
+        json.beginObject();
+        json.key("model").value("bench");
+        json.key("messages").beginArray();
+        for (const Message& message : messages) {
+            json.beginObject();
+            json.key("role").value(roleName(message.role));
+            json.key("content").value(message.content);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_JSONWrite)->Arg(1 << 10)->Arg(100 << 10)->Arg(1 << 20);
+
+static void BM_JSONRead(benchmark::State& state) {
+    std::string body = responseOfSize((size_t)state.range(0));
+    std::string content;
+    long tokens = 0;
+    for (auto _ : state) {
+        JSONValue root(body);
+        root.getString({"choices", 0, "message", "content"}, content);
+        root.getInt({"usage", "completion_tokens"}, tokens);
+        benchmark::DoNotOptimize(content.data());
+    }
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_JSONRead)->Arg(1 << 10)->Arg(100 << 10)->Arg(1 << 20);
+
+#ifdef HAVE_JSONCPP
+static void BM_JSONWriteJsoncpp(benchmark::State& state) {
+    std::vector<Message> messages = historyOfSize((size_t)state.range(0));
+    Json::StreamWriterBuilder builder;
+    std::string body;
+    for (auto _ : state) {
+        Json::Value request;
+        request["model"] = "bench";
+        Json::Value jsonMessages(Json::arrayValue);
+        for (const Message& message : messages) {
+            Json::Value jsonMessage;
+            jsonMessage["role"] = roleName(message.role);
+            jsonMessage["content"] = message.content.str();
+            jsonMessages.append(jsonMessage);
+        }
+        request["messages"] = jsonMessages;
+        body = Json::writeString(builder, request);
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_JSONWriteJsoncpp)->Arg(1 << 10)->Arg(100 << 10)->Arg(1 << 20);
+
+static void BM_JSONReadJsoncpp(benchmark::State& state) {
+    std::string body = responseOfSize((size_t)state.range(0));
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string content;
+    long tokens = 0;
+    for (auto _ : state) {
+        Json::Value root;
+        std::string errors;
+        if (!reader->parse(body.data(), body.data() + body.size(), &root, &errors)) {
+            state.SkipWithError(errors.c_str());
+            break;
+        }
+        content = root["choices"][0]["message"]["content"].asString();
+        tokens = root["usage"]["completion_tokens"].asInt();
+        benchmark::DoNotOptimize(content.data());
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed((int64_t)(state.iterations() * body.size()));
+}
+BENCHMARK(BM_JSONReadJsoncpp)->Arg(1 << 10)->Arg(100 << 10)->Arg(1 << 20);
+#endif
+
+static const char* const VOCABULARY_WORDS[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with", "was", "on",
+    "be", "by", "this", "are", "from", "or", "have", "an", "they", "which", "one", "you",
+    "were", "all", "we", "when", "there", "can", "more", "if", "no", "out", "so", "what",
+    "time", "up", "about", "into", "than", "them", "only", "other", "new", "some", "could",
+    "these", "two", "may", "first", "then", "any", "like", "model", "token", "request",
+    "response", "message", "history", "session", "context", "const", "std", "string",
+    "size_t", "return", "struct", "class", "void", "auto", "include", "namespace", "static",
+    "vector", "value", "length", "count", "index", "result", "error", "json", "data",
+};
+
+// A real cl100k_base vocabulary when one is installed, else one built
+// from every prefix of common words so merging still does real work
+static std::shared_ptr<const Tokenizer> benchTokenizer() {
+    std::shared_ptr<const Tokenizer> tokenizer = Tokenizer::forModel("gpt-4");
+    if (tokenizer) {
+        return tokenizer;
+    }
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    auto base64 = [](const std::string& bytes) {
+        std::string out;
+        for (size_t i = 0; i < bytes.size(); i += 3) {
+            uint32_t n = (uint32_t)(unsigned char)bytes[i] << 16;
+            if (i + 1 < bytes.size()) n |= (uint32_t)(unsigned char)bytes[i + 1] << 8;
+            if (i + 2 < bytes.size()) n |= (uint32_t)(unsigned char)bytes[i + 2];
+            out += alphabet[(n >> 18) & 63];
+            out += alphabet[(n >> 12) & 63];
+            out += i + 1 < bytes.size() ? alphabet[(n >> 6) & 63] : '=';
+            out += i + 2 < bytes.size() ? alphabet[n & 63] : '=';
+        }
+        return out;
+    };
+    std::vector<std::string> tokens;
+    for (int b = 0; b < 256; ++b) {
+        tokens.push_back(std::string(1, (char)b));
+    }
+    for (size_t length = 2; length <= 9; ++length) {
+        for (const char* word : VOCABULARY_WORDS) {
+            for (const std::string& spelled : {std::string(word), " " + std::string(word)}) {
+                if (spelled.size() >= length &&
+                    std::find(tokens.begin(), tokens.end(), spelled.substr(0, length)) == tokens.end()) {
+                    tokens.push_back(spelled.substr(0, length));
+                }
+            }
+        }
+    }
+    char path[] = "/tmp/caichat-bench-vocab-XXXXXX";
+    int fd = mkstemp(path);
+    std::string file;
+    for (size_t rank = 0; rank < tokens.size(); ++rank) {
+        file += base64(tokens[rank]) + " " + std::to_string(rank) + "\n";
+    }
+    if (fd < 0 || write(fd, file.data(), file.size()) != (ssize_t)file.size()) {
+        std::fprintf(stderr, "Cannot write %s\n", path);
+        std::exit(1);
+    }
+    close(fd);
+    tokenizer = Tokenizer::load(path);
+    unlink(path);
+    return tokenizer;
+}
+
+// Token counting over 1 MB of prose (0) or C++-like code (1)
+static void BM_Tokenize(benchmark::State& state) {
+    static std::shared_ptr<const Tokenizer> tokenizer = benchTokenizer();
+    const size_t words = sizeof(VOCABULARY_WORDS) / sizeof(VOCABULARY_WORDS[0]);
+    std::string text;
+    for (size_t i = 0; text.size() < (1 << 20); ++i) {
+        const char* word = VOCABULARY_WORDS[(i * 7919) % words];
+        if (state.range(0) == 0) {
+            text += i % 12 == 11 ? ". " : " ";
+            text += word;
+        } else {
+            text += i % 6 == 0 ? "\n    " : " ";
+            text += word;
+            text += i % 3 == 0 ? "_" + std::to_string(i % 100) + "(" : i % 3 == 1 ? "->" : ");";
+        }
+    }
+    size_t tokens = 0;
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        tokens = tokenizer->count(text);
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.counters["bytes/token"] = (double)text.size() / (double)tokens;
+    state.SetBytesProcessed((int64_t)(state.iterations() * text.size()));
+}
+BENCHMARK(BM_Tokenize)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Conversation batches of N 128-byte messages written into one growing
+// AtomStore: atoms added per second and allocations per batch
+static void BM_AtomBatch(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    std::vector<Message> messages;
+    for (size_t i = 0; i < 4096; ++i) {
+        messages.emplace_back(i % 2 ? Role::Assistant : Role::User,
+                              std::to_string(i) + std::string(124, 'a' + (char)(i % 26)));
+    }
+    AtomStore store;
+    ConversationLog log(store, "bench");
+    size_t next = 0;
+    uint64_t start = allocations.load();
+    for (auto _ : state) {
+        if (next + count > messages.size()) {
+            next = 0;
+        }
+        log.write(messages.data() + next, count);
+        next += count;
+    }
+    state.counters["allocs"] = allocationsSince(start);
+    state.counters["atoms"] = benchmark::Counter((double)store.size(), benchmark::Counter::kIsRate);
+    state.SetItemsProcessed((int64_t)(state.iterations() * count));
+}
+BENCHMARK(BM_AtomBatch)->RangeMultiplier(4)->Range(1, 256)->Unit(benchmark::kMicrosecond);
+
+// Related concepts of one concept among N, each described by 8 others:
+// the incoming-set walk must not grow with N
+static void BM_AtomRelated(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    AtomStore store;
+    AtomBatch batch;
+    for (size_t i = 0; i < count; ++i) {
+        AtomBatch::Ref concept = batch.node(AtomType::ConceptNode, "concept-" + std::to_string(i));
+        AtomBatch::Ref description = batch.node(AtomType::PredicateNode, "description");
+        for (size_t k = 1; k <= 8; ++k) {
+            AtomBatch::Ref other =
+                batch.node(AtomType::ConceptNode, "concept-" + std::to_string((i + k * 37) % count));
+            batch.link(AtomType::EvaluationLink,
+                       {description, batch.link(AtomType::ListLink, {concept, other})});
+        }
+        if (batch.size() >= 4096) {
+            store.commit(batch);
+            batch.clear();
+        }
+    }
+    store.commit(batch);
+    std::string name = "concept-" + std::to_string(count / 2);
+    for (auto _ : state) {
+        auto related = store.related(name, 10);
+        benchmark::DoNotOptimize(related.data());
+    }
+    state.counters["atoms"] = (double)store.size();
+}
+BENCHMARK(BM_AtomRelated)->RangeMultiplier(8)->Range(64, 262144);
+
+// Vectors like embeddings of knowledge base chunks: clustered around
+// topics rather than uniformly random, which no index handles well
+static const size_t VECTOR_DIMENSION = 384;
+static const size_t VECTOR_TOPICS = 1024;
+
+class VectorSource {
+public:
+    explicit VectorSource(uint32_t seed) : topics(VECTOR_TOPICS * VECTOR_DIMENSION), rng(seed) {
+        std::mt19937 topicRng(1);
+        std::normal_distribution<float> normal;
+        for (float& x : topics) {
+            x = normal(topicRng);
+        }
+    }
+
+    const float* next() {
+        std::normal_distribution<float> noise(0, 0.5f);
+        const float* topic = &topics[(rng() % VECTOR_TOPICS) * VECTOR_DIMENSION];
+        vector.resize(VECTOR_DIMENSION);
+        for (size_t i = 0; i < VECTOR_DIMENSION; ++i) {
+            vector[i] = topic[i] + noise(rng);
+        }
+        return vector.data();
+    }
+
+private:
+    std::vector<float> topics;
+    std::vector<float> vector;
+    std::mt19937 rng;
+};
+
+// The index of the running configuration; one at a time, as 10^6 float32
+// vectors alone take 1.5 GB. HNSW indexes take minutes to build at 10^6.
+static const VectorIndex& benchIndex(size_t count, VectorIndex::Mode mode,
+                                     VectorIndex::Storage storage) {
+    static std::unique_ptr<VectorIndex> index;
+    if (!index || index->size() != count || index->getOptions().mode != mode ||
+        index->getOptions().storage != storage) {
+        index.reset();
+        VectorIndex::Options options;
+        options.mode = mode;
+        options.storage = storage;
+        index.reset(new VectorIndex(VECTOR_DIMENSION, options));
+        VectorSource source(2);
+        for (size_t i = 0; i < count; ++i) {
+            index->add("chunk-" + std::to_string(i), source.next());
+        }
+    }
+    return *index;
+}
+
+// Top-10 search over N chunks, exact (0) or HNSW (1), float32 (0) or
+// int8 (1) storage; HNSW reports its recall against the exact top 10
+static void BM_VectorSearch(benchmark::State& state) {
+    VectorIndex::Mode mode = state.range(1) ? VectorIndex::Mode::HNSW : VectorIndex::Mode::Exact;
+    VectorIndex::Storage storage = state.range(2) ? VectorIndex::Storage::Int8
+                                                  : VectorIndex::Storage::Float32;
+    const VectorIndex& index = benchIndex((size_t)state.range(0), mode, storage);
+    VectorSource source(3);
+    std::vector<std::vector<float>> queries(64);
+    for (std::vector<float>& query : queries) {
+        const float* vector = source.next();
+        query.assign(vector, vector + VECTOR_DIMENSION);
+    }
+    size_t next = 0;
+    for (auto _ : state) {
+        std::vector<VectorIndex::Result> results = index.search(queries[next++ % queries.size()].data(), 10);
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+    if (mode == VectorIndex::Mode::HNSW) {
+        size_t found = 0;
+        for (const std::vector<float>& query : queries) {
+            std::vector<VectorIndex::Result> exact = index.searchExact(query.data(), 10);
+            for (const VectorIndex::Result& result : index.search(query.data(), 10)) {
+                for (const VectorIndex::Result& expected : exact) {
+                    found += result.id == expected.id;
+                }
+            }
+        }
+        state.counters["recall"] = (double)found / (double)(queries.size() * 10);
+    }
+}
+BENCHMARK(BM_VectorSearch)->ArgsProduct({{100000, 1000000}, {0, 1}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+// Session of N 256-byte messages whose log is brought up to date after
+// each turn: only the turn is appended, so the cost must not grow with N
+static void BM_SessionRecord(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    char dir[] = "/tmp/caichat-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    {
+        SessionJournal journal(dir);
+        ChatCompletion chat(std::unique_ptr<LLMClient>(new OpenAIClient("bench-key", mocks.instant)));
+        chat.setTrimPolicy(TrimPolicy::None);
+        ConversationHistory& conversation = chat.getConversation();
+        for (const Message& msg : history(count, 256)) {
+            conversation.append(msg);
+        }
+        journal.record("bench", "openai", chat);
+        Text question(std::string(256, 'q'));
+        Text reply(std::string(256, 'r'));
+        uint64_t start = allocations.load();
+        for (auto _ : state) {
+            conversation.append(Role::User, question);
+            conversation.append(Role::Assistant, reply);
+            journal.record("bench", "openai", chat);
+        }
+        state.counters["allocs"] = allocationsSince(start);
+        journal.remove("bench");
+    }
+    rmdir(dir);
+}
+BENCHMARK(BM_SessionRecord)->RangeMultiplier(8)->Range(1, 4096)->Unit(benchmark::kMicrosecond);
+
+// Warm restart: N saved sessions of 20 messages each read back and
+// restored into sessions with clients
+static void BM_SessionRestore(benchmark::State& state) {
+    size_t count = (size_t)state.range(0);
+    char dir[] = "/tmp/caichat-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    {
+        SessionJournal journal(dir);
+        std::vector<Message> messages = history(20, 256);
+        for (size_t i = 0; i < count; ++i) {
+            ChatCompletion chat(std::unique_ptr<LLMClient>(new OpenAIClient("bench-key", mocks.instant)));
+            chat.setSystemMessage("You are a helpful assistant.");
+            for (const Message& msg : messages) {
+                chat.getConversation().append(msg);
+            }
+            journal.record("bench-" + std::to_string(i), "openai", chat);
+        }
+        journal.sync();
+        std::vector<std::string> paths = journal.list();
+        for (auto _ : state) {
+            std::vector<std::unique_ptr<ChatCompletion>> sessions;
+            sessions.reserve(paths.size());
+            for (const std::string& path : paths) {
+                SessionSnapshot snapshot = SessionJournal::load(path);
+                sessions.push_back(snapshot.restore(
+                    std::unique_ptr<LLMClient>(new OpenAIClient("bench-key", mocks.instant))));
+            }
+            benchmark::DoNotOptimize(sessions.data());
+        }
+        state.SetItemsProcessed((int64_t)(state.iterations() * count));
+        for (size_t i = 0; i < count; ++i) {
+            journal.remove("bench-" + std::to_string(i));
+        }
+    }
+    rmdir(dir);
+}
+BENCHMARK(BM_SessionRestore)->RangeMultiplier(8)->Range(64, 4096)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+    startMocks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Standalone mock LLM server, for pointing the Scheme tests or a REPL at:
+//   caichat-mock-server --port 8080 --latency-ms 200 --tokens 64
+//   OPENAI_BASE_URL=http://127.0.0.1:8080/v1 guile ...
+
+#include "MockServer.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <pthread.h>
+
+using opencog::caichat::MockServer;
+
+static void usage(const char* program) {
+    std::fprintf(stderr,
+                 "Usage: %s [--port N] [--latency-ms N] [--tokens N] [--token-delay-us N]\n"
+                 "          [--error-rate F] [--error-status N]\n",
+                 program);
+}
+
+int main(int argc, char** argv) {
+    MockServer::Options options;
+    int port = 8080;
+    for (int i = 1; i < argc; ++i) {
+        const char* flag = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (!std::strcmp(flag, "--port")) {
+            port = std::atoi(value);
+        } else if (!std::strcmp(flag, "--latency-ms")) {
+            options.latencyMs = (unsigned)std::atoi(value);
+        } else if (!std::strcmp(flag, "--tokens")) {
+            options.replyTokens = (size_t)std::atol(value);
+        } else if (!std::strcmp(flag, "--token-delay-us")) {
+            options.tokenDelayUs = (unsigned)std::atoi(value);
+        } else if (!std::strcmp(flag, "--error-rate")) {
+            options.errorRate = std::atof(value);
+        } else if (!std::strcmp(flag, "--error-status")) {
+            options.errorStatus = std::atoi(value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // Block the stop signals in every thread, then wait for one here
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        MockServer server(options, port);
+        std::printf("%s\n", server.baseUrl().c_str());
+        std::fflush(stdout);
+        int signal = 0;
+        sigwait(&signals, &signal);
+        server.stop();
+        std::printf("%llu requests\n", (unsigned long long)server.requestCount());
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -27,16 +27,12 @@ check_dependencies() {
         missing_deps+=("libcurl-dev")
     fi
     
-    if ! pkg-config --exists jsoncpp; then
-        missing_deps+=("libjsoncpp-dev")
-    fi
-    
     if [ ${#missing_deps[@]} -ne 0 ]; then
         echo "Missing dependencies: ${missing_deps[*]}"
         echo "Please install them first:"
-        echo "  Ubuntu/Debian: sudo apt-get install cmake build-essential pkg-config guile-3.0-dev libcurl4-openssl-dev libjsoncpp-dev"
-        echo "  Fedora: sudo dnf install cmake gcc-c++ pkg-config guile-devel libcurl-devel jsoncpp-devel"
-        echo "  macOS: brew install cmake pkg-config guile curl jsoncpp"
+        echo "  Ubuntu/Debian: sudo apt-get install cmake build-essential pkg-config guile-3.0-dev libcurl4-openssl-dev"
+        echo "  Fedora: sudo dnf install cmake gcc-c++ pkg-config guile-devel libcurl-devel"
+        echo "  macOS: brew install cmake pkg-config guile curl"
         exit 1
     fi
     
@@ -0,0 +1,334 @@
+#include "AtomStore.h"
+#include "Hash.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace opencog {
+namespace caichat {
+
+// Separate seeds keep a node and a link with the same bytes apart
+static const uint64_t NODE_SEED = 0x6e6f64650a0b0c0dULL;
+static const uint64_t LINK_SEED = 0x6c696e6b0e0f1011ULL;
+
+const char* atomTypeName(AtomType type) {
+    switch (type) {
+        case AtomType::ConceptNode: return "ConceptNode";
+        case AtomType::PredicateNode: return "PredicateNode";
+        case AtomType::ItemNode: return "ItemNode";
+        case AtomType::SentenceNode: return "SentenceNode";
+        case AtomType::ListLink: return "ListLink";
+        case AtomType::EvaluationLink: return "EvaluationLink";
+        case AtomType::MemberLink: return "MemberLink";
+        case AtomType::InheritanceLink: return "InheritanceLink";
+    }
+    return "Atom";
+}
+
+bool isNodeType(AtomType type) {
+    return type < AtomType::ListLink;
+}
+
+static uint64_t nodeHash(AtomType type, const char* name, size_t length) {
+    return Hasher(NODE_SEED).update((uint64_t)type).update(name, length).digest();
+}
+
+static uint64_t linkHash(AtomType type, const AtomId* ids, size_t length) {
+    return Hasher(LINK_SEED).update((uint64_t)type).update(ids, length * sizeof(AtomId)).digest();
+}
+
+AtomBatch::Ref AtomBatch::node(AtomType type, const std::string& name) {
+    if (!isNodeType(type)) {
+        throw std::invalid_argument(std::string(atomTypeName(type)) + " is not a node type");
+    }
+    entries.push_back({nodeHash(type, name.data(), name.size()), names.size(),
+                       (uint32_t)name.size(), type});
+    names += name;
+    return (Ref)(entries.size() - 1);
+}
+
+AtomBatch::Ref AtomBatch::link(AtomType type, std::initializer_list<Ref> outgoing) {
+    if (isNodeType(type)) {
+        throw std::invalid_argument(std::string(atomTypeName(type)) + " is not a link type");
+    }
+    for (Ref ref : outgoing) {
+        if (ref >= entries.size()) {
+            throw std::invalid_argument("Link refers to an atom outside its batch");
+        }
+    }
+    entries.push_back({0, refs.size(), (uint32_t)outgoing.size(), type});
+    refs.insert(refs.end(), outgoing.begin(), outgoing.end());
+    return (Ref)(entries.size() - 1);
+}
+
+void AtomBatch::clear() {
+    entries.clear();
+    names.clear();
+    refs.clear();
+}
+
+AtomStore::AtomStore() : nodes(0) {
+}
+
+AtomStore& AtomStore::instance() {
+    static AtomStore store;
+    return store;
+}
+
+AtomId AtomStore::lookupNode(AtomType type, const char* name, size_t length,
+                             uint64_t hash) const {
+    if (slots.empty()) {
+        return NO_ATOM;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i] != NO_ATOM; i = (i + 1) & mask) {
+        const Atom& atom = atoms[slots[i]];
+        if (atom.hash == hash && atom.type == type && atom.length == length &&
+            std::memcmp(names.data() + atom.offset, name, length) == 0) {
+            return slots[i];
+        }
+    }
+    return NO_ATOM;
+}
+
+AtomId AtomStore::lookupLink(AtomType type, const AtomId* outgoingIds, size_t length,
+                             uint64_t hash) const {
+    if (slots.empty()) {
+        return NO_ATOM;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i] != NO_ATOM; i = (i + 1) & mask) {
+        const Atom& atom = atoms[slots[i]];
+        if (atom.hash == hash && atom.type == type && atom.length == length &&
+            std::memcmp(outgoing.data() + atom.offset, outgoingIds,
+                        length * sizeof(AtomId)) == 0) {
+            return slots[i];
+        }
+    }
+    return NO_ATOM;
+}
+
+// Keep the index at most half full so probe runs stay short
+void AtomStore::grow() {
+    std::vector<AtomId> table(std::max<size_t>(1024, slots.size() * 2), NO_ATOM);
+    size_t mask = table.size() - 1;
+    for (AtomId id = 0; id < atoms.size(); ++id) {
+        size_t i = atoms[id].hash & mask;
+        while (table[i] != NO_ATOM) {
+            i = (i + 1) & mask;
+        }
+        table[i] = id;
+    }
+    slots.swap(table);
+}
+
+AtomId AtomStore::insert(const Atom& atom) {
+    if (atoms.size() >= NO_ATOM) {
+        throw std::length_error("AtomStore is full");
+    }
+    if ((atoms.size() + 1) * 2 > slots.size()) {
+        grow();
+    }
+    AtomId id = (AtomId)atoms.size();
+    size_t mask = slots.size() - 1;
+    size_t i = atom.hash & mask;
+    while (slots[i] != NO_ATOM) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = id;
+    atoms.push_back(atom);
+    incoming.emplace_back();
+    if (isNodeType(atom.type)) {
+        ++nodes;
+    }
+    return id;
+}
+
+void AtomStore::commit(const AtomBatch& batch, std::vector<AtomId>* ids) {
+    static thread_local std::vector<AtomId> scratch;
+    std::vector<AtomId>& resolved = ids ? *ids : scratch;
+    resolved.clear();
+    resolved.reserve(batch.entries.size());
+
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    for (const AtomBatch::Entry& entry : batch.entries) {
+        AtomId id;
+        if (isNodeType(entry.type)) {
+            const char* name = batch.names.data() + entry.offset;
+            id = lookupNode(entry.type, name, entry.length, entry.hash);
+            if (id == NO_ATOM) {
+                id = insert({entry.hash, names.size(), entry.length, entry.type});
+                names.append(name, entry.length);
+            }
+        } else {
+            // Resolve the outgoing set in place at the end of the pool;
+            // it stays there only if the link is new
+            size_t start = outgoing.size();
+            for (uint32_t k = 0; k < entry.length; ++k) {
+                outgoing.push_back(resolved[batch.refs[entry.offset + k]]);
+            }
+            uint64_t hash = linkHash(entry.type, outgoing.data() + start, entry.length);
+            id = lookupLink(entry.type, outgoing.data() + start, entry.length, hash);
+            if (id != NO_ATOM) {
+                outgoing.resize(start);
+            } else {
+                id = insert({hash, start, entry.length, entry.type});
+                for (uint32_t k = 0; k < entry.length; ++k) {
+                    std::vector<AtomId>& links = incoming[outgoing[start + k]];
+                    // An atom listed twice in one link is recorded once
+                    if (links.empty() || links.back() != id) {
+                        links.push_back(id);
+                    }
+                }
+            }
+        }
+        resolved.push_back(id);
+    }
+}
+
+AtomId AtomStore::findNode(AtomType type, const std::string& name) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return lookupNode(type, name.data(), name.size(), nodeHash(type, name.data(), name.size()));
+}
+
+AtomType AtomStore::getType(AtomId atom) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return atoms.at(atom).type;
+}
+
+std::string AtomStore::getName(AtomId atom) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    const Atom& a = atoms.at(atom);
+    return isNodeType(a.type) ? names.substr(a.offset, a.length) : std::string();
+}
+
+std::vector<AtomId> AtomStore::getOutgoing(AtomId atom) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    const Atom& a = atoms.at(atom);
+    if (isNodeType(a.type)) {
+        return {};
+    }
+    return std::vector<AtomId>(outgoing.begin() + a.offset, outgoing.begin() + a.offset + a.length);
+}
+
+std::vector<AtomId> AtomStore::getIncoming(AtomId atom) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return incoming.at(atom);
+}
+
+size_t AtomStore::countIncoming(AtomId atom, AtomType type) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    if (atom >= atoms.size()) {
+        return 0;
+    }
+    size_t count = 0;
+    for (AtomId link : incoming[atom]) {
+        count += atoms[link].type == type;
+    }
+    return count;
+}
+
+std::vector<std::pair<std::string, size_t>> AtomStore::related(const std::string& concept,
+                                                               size_t limit) const {
+    std::vector<std::pair<std::string, size_t>> result;
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    AtomId self = lookupNode(AtomType::ConceptNode, concept.data(), concept.size(),
+                             nodeHash(AtomType::ConceptNode, concept.data(), concept.size()));
+    if (self == NO_ATOM) {
+        return result;
+    }
+
+    std::unordered_map<AtomId, size_t> shared;
+    auto visit = [&](AtomId link, AtomId skip) {
+        const Atom& a = atoms[link];
+        for (uint32_t k = 0; k < a.length; ++k) {
+            AtomId member = outgoing[a.offset + k];
+            if (member != self && member != skip && atoms[member].type == AtomType::ConceptNode) {
+                ++shared[member];
+            }
+        }
+    };
+    for (AtomId link : incoming[self]) {
+        visit(link, NO_ATOM);
+        if (atoms[link].type == AtomType::ListLink) {
+            for (AtomId parent : incoming[link]) {
+                visit(parent, link);
+            }
+        }
+    }
+
+    result.reserve(shared.size());
+    for (const auto& entry : shared) {
+        const Atom& a = atoms[entry.first];
+        result.emplace_back(names.substr(a.offset, a.length), entry.second);
+    }
+    lock.unlock();
+
+    std::sort(result.begin(), result.end(), [](const std::pair<std::string, size_t>& a,
+                                               const std::pair<std::string, size_t>& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (limit > 0 && result.size() > limit) {
+        result.resize(limit);
+    }
+    return result;
+}
+
+size_t AtomStore::size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return atoms.size();
+}
+
+size_t AtomStore::nodeCount() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return nodes;
+}
+
+size_t AtomStore::linkCount() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return atoms.size() - nodes;
+}
+
+ConversationLog::ConversationLog(AtomStore& s, const std::string& id)
+    : store(s), session(id),
+      count(s.countIncoming(s.findNode(AtomType::ConceptNode, id), AtomType::MemberLink)) {
+}
+
+void ConversationLog::write(const Message* messages, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    batch.clear();
+    AtomBatch::Ref sessionRef = batch.node(AtomType::ConceptNode, session);
+    AtomBatch::Ref role = batch.node(AtomType::PredicateNode, "role");
+    AtomBatch::Ref content = batch.node(AtomType::PredicateNode, "content");
+    AtomBatch::Ref next = batch.node(AtomType::PredicateNode, "next");
+    std::string prefix = session + "/";
+    AtomBatch::Ref previous = count > 0
+        ? batch.node(AtomType::ItemNode, prefix + std::to_string(count - 1))
+        : NO_ATOM;
+
+    for (size_t i = 0; i < n; ++i) {
+        const Message& msg = messages[i];
+        AtomBatch::Ref item = batch.node(AtomType::ItemNode, prefix + std::to_string(count + i));
+        batch.link(AtomType::MemberLink, {item, sessionRef});
+        batch.link(AtomType::EvaluationLink,
+                   {role, batch.link(AtomType::ListLink,
+                                     {item, batch.node(AtomType::ConceptNode, roleName(msg.role))})});
+        batch.link(AtomType::EvaluationLink,
+                   {content, batch.link(AtomType::ListLink,
+                                        {item, batch.node(AtomType::SentenceNode, msg.content)})});
+        if (previous != NO_ATOM) {
+            batch.link(AtomType::EvaluationLink,
+                       {next, batch.link(AtomType::ListLink, {previous, item})});
+        }
+        previous = item;
+    }
+    store.commit(batch);
+    count += n;
+}
+
+} // namespace caichat
+} // namespace opencog
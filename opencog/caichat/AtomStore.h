@@ -0,0 +1,192 @@
+#ifndef ATOMSTORE_H
+#define ATOMSTORE_H
+
+#include "LLMClient.h"
+#include <cstdint>
+#include <initializer_list>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Atom types written by the conversation bridge, named after their
+ * OpenCog counterparts
+ */
+enum class AtomType : uint8_t {
+    ConceptNode,
+    PredicateNode,
+    ItemNode,
+    SentenceNode,
+    ListLink,
+    EvaluationLink,
+    MemberLink,
+    InheritanceLink
+};
+
+const char* atomTypeName(AtomType type);
+bool isNodeType(AtomType type);
+
+typedef uint32_t AtomId;
+static const AtomId NO_ATOM = 0xffffffffu;
+
+/**
+ * Atoms to add to an AtomStore in one commit. node() and link() return
+ * references that are only meaningful within this batch; links refer to
+ * earlier entries of the same batch. Node hashes are computed here, so
+ * commit() holds the store lock only for the index probes.
+ *
+ * clear() keeps the buffers, so a batch reused turn after turn stops
+ * allocating once it has seen its largest turn.
+ */
+class AtomBatch {
+public:
+    typedef uint32_t Ref;
+
+    Ref node(AtomType type, const std::string& name);
+    Ref link(AtomType type, std::initializer_list<Ref> outgoing);
+
+    size_t size() const { return entries.size(); }
+    void clear();
+
+private:
+    friend class AtomStore;
+
+    struct Entry {
+        uint64_t hash;      // nodes only; link hashes need the resolved ids
+        size_t offset;      // into names (nodes) or refs (links)
+        uint32_t length;
+        AtomType type;
+    };
+
+    std::vector<Entry> entries;
+    std::string names;
+    std::vector<Ref> refs;
+};
+
+/**
+ * Hash-consed table of nodes and links with incoming sets, the in-process
+ * AtomSpace the Scheme atomspace module reads and writes.
+ *
+ * A node is identified by its type and name, a link by its type and
+ * outgoing set; adding an existing atom returns the existing id. Both
+ * kinds are found through one open-addressing index keyed by a 64-bit
+ * hash stored with each atom, so lookups do not allocate. Every atom
+ * keeps the links that contain it, which makes "what refers to X"
+ * proportional to the answer rather than to the table.
+ *
+ * Atoms are never removed. Readers run concurrently; commit() takes the
+ * write lock once per batch.
+ */
+class AtomStore {
+public:
+    AtomStore();
+
+    AtomStore(const AtomStore&) = delete;
+    AtomStore& operator=(const AtomStore&) = delete;
+
+    /**
+     * Store shared by the Scheme bindings
+     */
+    static AtomStore& instance();
+
+    /**
+     * Add every atom of batch, reusing atoms already present. ids, when
+     * given, receives the id of each batch reference in order.
+     */
+    void commit(const AtomBatch& batch, std::vector<AtomId>* ids = nullptr);
+
+    /**
+     * Id of a node, or NO_ATOM
+     */
+    AtomId findNode(AtomType type, const std::string& name) const;
+
+    AtomType getType(AtomId atom) const;
+    std::string getName(AtomId atom) const;
+    std::vector<AtomId> getOutgoing(AtomId atom) const;
+    std::vector<AtomId> getIncoming(AtomId atom) const;
+
+    /**
+     * Number of links of type that contain atom
+     */
+    size_t countIncoming(AtomId atom, AtomType type) const;
+
+    /**
+     * ConceptNodes sharing a link with the named concept, either directly
+     * or as members of the same ListLink (the arguments of an
+     * EvaluationLink), with the number of links they share, most shared
+     * first. limit 0 returns all.
+     */
+    std::vector<std::pair<std::string, size_t>> related(const std::string& concept,
+                                                        size_t limit = 0) const;
+
+    size_t size() const;
+    size_t nodeCount() const;
+    size_t linkCount() const;
+
+private:
+    struct Atom {
+        uint64_t hash;
+        size_t offset;      // into names (nodes) or outgoing (links)
+        uint32_t length;
+        AtomType type;
+    };
+
+    AtomId lookupNode(AtomType type, const char* name, size_t length, uint64_t hash) const;
+    AtomId lookupLink(AtomType type, const AtomId* outgoingIds, size_t length,
+                      uint64_t hash) const;
+    AtomId insert(const Atom& atom);
+    void grow();
+
+    mutable std::shared_timed_mutex mutex;
+    std::vector<Atom> atoms;
+    std::string names;                           // node names, back to back
+    std::vector<AtomId> outgoing;                // link outgoing sets, back to back
+    std::vector<std::vector<AtomId>> incoming;   // per atom
+    std::vector<AtomId> slots;                   // hash index, NO_ATOM when empty
+    size_t nodes;
+};
+
+/**
+ * Writes a session's messages into an AtomStore, one batch per call:
+ *
+ *   (MemberLink (ItemNode "<session>/<n>") (ConceptNode "<session>"))
+ *   (EvaluationLink (PredicateNode "role")
+ *                   (ListLink (ItemNode "<session>/<n>") (ConceptNode "user")))
+ *   (EvaluationLink (PredicateNode "content")
+ *                   (ListLink (ItemNode "<session>/<n>") (SentenceNode "<text>")))
+ *   (EvaluationLink (PredicateNode "next")
+ *                   (ListLink (ItemNode "<session>/<n-1>") (ItemNode "<session>/<n>")))
+ *
+ * Messages are numbered in the order written, continuing after those
+ * already stored for the session.
+ */
+class ConversationLog {
+public:
+    ConversationLog(AtomStore& store, const std::string& session);
+
+    /**
+     * Append messages in one commit
+     */
+    void write(const Message* messages, size_t count);
+    void write(const std::vector<Message>& messages) { write(messages.data(), messages.size()); }
+
+    /**
+     * Messages stored for the session so far
+     */
+    size_t getCount() const { return count; }
+
+private:
+    AtomStore& store;
+    std::string session;
+    size_t count;
+    AtomBatch batch;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // ATOMSTORE_H
@@ -0,0 +1,161 @@
+#include "BatchRunner.h"
+#include "Tokenizer.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace opencog {
+namespace caichat {
+
+// TokenBucket implementation
+TokenBucket::TokenBucket(double ratePerMinute)
+    : rate(0), capacity(0), available(0), lastRefill(Clock::now()) {
+    setRate(ratePerMinute);
+}
+
+void TokenBucket::setRate(double ratePerMinute) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rate = ratePerMinute > 0 ? ratePerMinute / 60.0 : 0;
+    capacity = ratePerMinute > 0 ? ratePerMinute : 0;
+    // Start full so a fresh batch is not throttled up front
+    available = capacity;
+    lastRefill = Clock::now();
+}
+
+double TokenBucket::getRate() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rate * 60.0;
+}
+
+void TokenBucket::refill(Clock::time_point now) {
+    std::chrono::duration<double> elapsed = now - lastRefill;
+    available = std::min(capacity, available + elapsed.count() * rate);
+    lastRefill = now;
+}
+
+void TokenBucket::acquire(double amount) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (rate > 0) {
+        double wanted = std::min(amount, capacity);
+        refill(Clock::now());
+        if (available >= wanted) {
+            available -= wanted;
+            return;
+        }
+        auto wait = std::chrono::duration<double>((wanted - available) / rate);
+        lock.unlock();
+        std::this_thread::sleep_for(wait);
+        lock.lock();
+    }
+}
+
+// RateLimiter implementation
+RateLimiter& RateLimiter::forProvider(const std::string& provider) {
+    static std::mutex registryMutex;
+    static std::map<std::string, std::unique_ptr<RateLimiter>> registry;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto& limiter = registry[provider];
+    if (!limiter) {
+        limiter.reset(new RateLimiter());
+    }
+    return *limiter;
+}
+
+void RateLimiter::configure(double requestsPerMinute, double tokensPerMinute) {
+    requests.setRate(requestsPerMinute);
+    tokens.setRate(tokensPerMinute);
+}
+
+void RateLimiter::acquire(size_t tokenCount) {
+    requests.acquire(1);
+    tokens.acquire((double)tokenCount);
+}
+
+// BatchRunner implementation
+BatchRunner::BatchRunner(LLMClient& c, size_t n)
+    : client(c), concurrency(n > 0 ? n : 1) {
+}
+
+void BatchRunner::setConcurrency(size_t n) {
+    concurrency = n > 0 ? n : 1;
+}
+
+size_t BatchRunner::getConcurrency() const {
+    return concurrency;
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<std::vector<Message>>& conversations,
+                                          const std::string& model) {
+    RateLimiter& limiter = RateLimiter::forProvider(client.getProviderName());
+
+    // Shared with callbacks that may run on the engine thread, and may
+    // still be running if a submit throws and run() unwinds
+    struct State {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t inFlight = 0;
+        std::vector<BatchResult> results;
+    };
+    auto state = std::make_shared<State>();
+    state->results.resize(conversations.size());
+
+    for (size_t i = 0; i < conversations.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->done.wait(lock, [&] { return state->inFlight < concurrency; });
+            state->inFlight++;
+        }
+
+        try {
+            limiter.acquire(countTokens(conversations[i], model));
+
+            client.submitChatCompletion(conversations[i],
+                [state, i](const std::string& content, std::exception_ptr error) {
+                    BatchResult& slot = state->results[i];
+                    if (error) {
+                        slot.ok = false;
+                        try {
+                            std::rethrow_exception(error);
+                        } catch (const std::exception& e) {
+                            slot.error = e.what();
+                        } catch (...) {
+                            slot.error = "Unknown error";
+                        }
+                    } else {
+                        slot.ok = true;
+                        slot.content = content;
+                    }
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->inFlight--;
+                    state->done.notify_all();
+                }, model);
+        } catch (...) {
+            // This item never started; let the ones that did finish first
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->inFlight--;
+            state->done.wait(lock, [&] { return state->inFlight == 0; });
+            throw;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->inFlight == 0; });
+    return std::move(state->results);
+}
+
+std::vector<BatchResult> BatchRunner::runPrompts(const std::vector<std::string>& prompts,
+                                                 const std::string& model) {
+    std::vector<std::vector<Message>> conversations;
+    conversations.reserve(prompts.size());
+    for (const auto& prompt : prompts) {
+        std::vector<Message> messages;
+        messages.emplace_back(Role::User, prompt);
+        conversations.push_back(std::move(messages));
+    }
+    return run(conversations, model);
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,115 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include "LLMClient.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Thread-safe token bucket. A rate of 0 disables limiting.
+ */
+class TokenBucket {
+public:
+    TokenBucket(double ratePerMinute = 0);
+
+    /**
+     * Change the rate; the bucket holds at most one minute's worth
+     */
+    void setRate(double ratePerMinute);
+    double getRate() const;
+
+    /**
+     * Block until amount tokens are available and take them. Requests
+     * larger than the bucket are clamped to its capacity.
+     */
+    void acquire(double amount);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void refill(Clock::time_point now);
+
+    mutable std::mutex mutex;
+    double rate;        // tokens per second
+    double capacity;
+    double available;
+    Clock::time_point lastRefill;
+};
+
+/**
+ * Requests/min and tokens/min limits of one provider, shared by every
+ * client of that provider in the process
+ */
+class RateLimiter {
+public:
+    /**
+     * Limiter for a provider as returned by LLMClient::getProviderName()
+     */
+    static RateLimiter& forProvider(const std::string& provider);
+
+    /**
+     * Set limits; 0 means unlimited (the default)
+     */
+    void configure(double requestsPerMinute, double tokensPerMinute);
+
+    /**
+     * Block until one request costing the given number of tokens may start
+     */
+    void acquire(size_t tokens);
+
+private:
+    TokenBucket requests;
+    TokenBucket tokens;
+};
+
+/**
+ * Outcome of one batch item
+ */
+struct BatchResult {
+    bool ok = false;
+    std::string content;   // reply when ok
+    std::string error;     // error message otherwise
+};
+
+/**
+ * Runs many independent completions through one client with a bounded
+ * number in flight, honouring the provider's RateLimiter. Requests go
+ * through LLMClient::submitChatCompletion, so HTTP providers share the
+ * async event loop instead of using a thread per request.
+ */
+class BatchRunner {
+public:
+    BatchRunner(LLMClient& client, size_t concurrency = 8);
+
+    void setConcurrency(size_t concurrency);
+    size_t getConcurrency() const;
+
+    /**
+     * Run every conversation; results are in input order and a failing
+     * item does not stop the others. If starting a request throws, the
+     * ones already started finish before the exception propagates.
+     */
+    std::vector<BatchResult> run(const std::vector<std::vector<Message>>& conversations,
+                                 const std::string& model = "");
+
+    /**
+     * Run single-prompt conversations
+     */
+    std::vector<BatchResult> runPrompts(const std::vector<std::string>& prompts,
+                                        const std::string& model = "");
+
+private:
+    LLMClient& client;
+    size_t concurrency;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // BATCHRUNNER_H
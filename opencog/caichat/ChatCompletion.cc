@@ -1,42 +1,187 @@
 #include "ChatCompletion.h"
+#include "Tokenizer.h"
+#include <stdexcept>
 
 namespace opencog {
 namespace caichat {
 
+// Tokens left free in the context window for the model's reply
+static const size_t REPLY_RESERVE = 1024;
+
 ChatCompletion::ChatCompletion(std::unique_ptr<LLMClient> llmClient, const std::string& model)
     : client(std::move(llmClient)), defaultModel(model) {
+    fitContextWindow();
+    // Budget in real tokens when the model's vocabulary is at hand. Local
+    // models keep the estimate unless named by their GGUF file.
+    std::shared_ptr<const Tokenizer> tokenizer;
+    if (client->getProviderName() != "ggml" || !model.empty()) {
+        tokenizer = Tokenizer::forModel(model);
+    }
+    if (tokenizer) {
+        history.setTokenEstimator([tokenizer](const std::string& text) {
+            return tokenizer->count(text) + Tokenizer::MESSAGE_TOKENS;
+        });
+    }
+    history.setSummarizer([this](const std::string& previousSummary,
+                                 const std::vector<Message>& dropped) {
+        return summarize(previousSummary, dropped);
+    });
+}
+
+std::string ChatCompletion::summarize(const std::string& previousSummary,
+                                      const std::vector<Message>& dropped) {
+    std::string transcript;
+    if (!previousSummary.empty()) {
+        transcript += "Earlier summary: " + previousSummary + "\n\n";
+    }
+    for (const auto& msg : dropped) {
+        transcript += roleName(msg.role);
+        transcript += ": ";
+        transcript += msg.content.str();
+        transcript += "\n";
+    }
+    
+    std::vector<Message> request;
+    request.emplace_back(Role::System, "Summarize the following conversation in a few sentences. "
+                                   "Keep names, facts and decisions; omit pleasantries.");
+    request.emplace_back(Role::User, std::move(transcript));
+    return client->chatCompletion(request, defaultModel);
+}
+
+// Each turn leaves its message and the reply at the end of the history
+void ChatCompletion::finishTurn() {
+    if (!observer) {
+        return;
+    }
+    const std::vector<Message>& messages = history.getMessages();
+    try {
+        observer(messages, messages.size() >= 2 ? messages.size() - 2 : 0);
+    } catch (...) {
+        // Observing must not cost the caller the reply
+    }
 }
 
-std::string ChatCompletion::sendMessage(const std::string& message, const std::string& role) {
-    // Add user message to history
-    conversationHistory.emplace_back(role, message);
+Text ChatCompletion::sendMessage(Text message, Role role) {
+    // Add user message to history and trim to the context budget
+    history.append(role, std::move(message));
+    history.fit();
     
-    // Get response from LLM
-    std::string response = client->chatCompletion(conversationHistory, defaultModel);
+    // Get response from LLM; the history so far stays as it is, so its
+    // encoding is reused next turn
+    prefix.track(history.getRevision(), history.getMessages().size());
+    PromptPrefix::Scope scope(prefix);
+    Text response;
+    try {
+        response = client->chatCompletion(history.getMessages(), defaultModel);
+    } catch (...) {
+        history.removeLast();
+        throw;
+    }
     
     // Add assistant response to history
-    conversationHistory.emplace_back("assistant", response);
+    history.append(Role::Assistant, response);
+    finishTurn();
+    
+    return response;
+}
+
+Text ChatCompletion::sendMessageStream(Text message, TokenCallback onToken, Role role) {
+    history.append(role, std::move(message));
+    history.fit();
+    
+    prefix.track(history.getRevision(), history.getMessages().size());
+    PromptPrefix::Scope scope(prefix);
+    Text response;
+    try {
+        response = client->chatCompletionStream(history.getMessages(), onToken, defaultModel);
+    } catch (...) {
+        // Keep the history consistent with what the model has answered
+        history.removeLast();
+        throw;
+    }
+    
+    history.append(Role::Assistant, response);
+    finishTurn();
     
     return response;
 }
 
+Text ChatCompletion::sendMessageWithTools(Text message,
+                                          const std::vector<ToolDefinition>& tools,
+                                          const ToolExecutor& executor,
+                                          size_t maxRounds) {
+    history.append(Role::User, std::move(message));
+    history.fit();
+    
+    // Tool calls and results live only in this turn's request, so trimming
+    // the history never separates a call from its result
+    std::vector<Message> messages = history.getMessages();
+    prefix.track(history.getRevision(), messages.size());
+    PromptPrefix::Scope scope(prefix);
+    ChatReply reply;
+    try {
+        for (size_t round = 0; ; ++round) {
+            reply = client->chatCompletionWithTools(messages, tools, defaultModel);
+            if (reply.toolCalls.empty()) {
+                break;
+            }
+            if (round == maxRounds) {
+                throw std::runtime_error("Tool calls did not finish within " +
+                                         std::to_string(maxRounds) + " rounds");
+            }
+            Message call(Role::Assistant, std::move(reply.content));
+            call.toolCalls = reply.toolCalls;
+            messages.push_back(std::move(call));
+            for (const ToolResult& result : executor.runAll(reply.toolCalls)) {
+                messages.push_back(ToolExecutor::toMessage(result));
+            }
+        }
+    } catch (...) {
+        history.removeLast();
+        throw;
+    }
+    
+    Text response(std::move(reply.content));
+    history.append(Role::Assistant, response);
+    finishTurn();
+    return response;
+}
+
 const std::vector<Message>& ChatCompletion::getHistory() const {
-    return conversationHistory;
+    return history.getMessages();
 }
 
 void ChatCompletion::clearHistory() {
-    conversationHistory.clear();
+    history.clear();
 }
 
 void ChatCompletion::setSystemMessage(const std::string& message) {
-    // Remove existing system message if any
-    auto it = conversationHistory.begin();
-    if (it != conversationHistory.end() && it->role == "system") {
-        conversationHistory.erase(it);
-    }
-    
-    // Add new system message at the beginning
-    conversationHistory.insert(conversationHistory.begin(), Message("system", message));
+    history.setSystemMessage(message);
+}
+
+ConversationHistory& ChatCompletion::getConversation() {
+    return history;
+}
+
+void ChatCompletion::setContextBudget(size_t tokens) {
+    history.setTokenBudget(tokens);
+}
+
+void ChatCompletion::fitContextWindow() {
+    size_t window = client->contextWindow(defaultModel);
+    history.setTokenBudget(window > 2 * REPLY_RESERVE ? window - REPLY_RESERVE : window / 2);
+}
+
+void ChatCompletion::setTrimPolicy(TrimPolicy policy) {
+    history.setTrimPolicy(policy);
+}
+
+void ChatCompletion::setTokenEstimator(TokenEstimator estimator) {
+    history.setTokenEstimator(std::move(estimator));
+}
+
+void ChatCompletion::setTurnObserver(TurnObserver turnObserver) {
+    observer = std::move(turnObserver);
 }
 
 LLMClient* ChatCompletion::getClient() const {
@@ -44,4 +189,4 @@ LLMClient* ChatCompletion::getClient() const {
 }
 
 } // namespace caichat
-} // namespace opencog
\ No newline at end of file
+} // namespace opencog
@@ -2,28 +2,62 @@
 #define CHATCOMPLETION_H
 
 #include "LLMClient.h"
+#include "ConversationHistory.h"
+#include "ToolExecutor.h"
+#include <functional>
 #include <memory>
 #include <vector>
 
 namespace opencog {
 namespace caichat {
 
+/**
+ * Called after each completed turn with the history and the index of the
+ * turn's first message; the turn's messages run to the end of history
+ */
+typedef std::function<void(const std::vector<Message>& history, size_t first)> TurnObserver;
+
 /**
  * Chat session management
  */
 class ChatCompletion {
 private:
     std::unique_ptr<LLMClient> client;
-    std::vector<Message> conversationHistory;
-    std::string defaultModel;
+    ConversationHistory history;
+    Name defaultModel;
+    PromptPrefix prefix;   // encoded history, reused by the next turn
+    TurnObserver observer;
+    
+    std::string summarize(const std::string& previousSummary,
+                          const std::vector<Message>& dropped);
+    void finishTurn();
     
 public:
     ChatCompletion(std::unique_ptr<LLMClient> llmClient, const std::string& model = "");
     
     /**
-     * Send a message and get response
+     * Send a message and get response. The message and the reply are
+     * kept in the history without copying their text.
+     */
+    Text sendMessage(Text message, Role role = Role::User);
+    
+    /**
+     * Send a message and stream the response token by token. The complete
+     * reply is appended to the history once the stream ends.
      */
-    std::string sendMessage(const std::string& message, const std::string& role = "user");
+    Text sendMessageStream(Text message, TokenCallback onToken, Role role = Role::User);
+    
+    /**
+     * Send a message offering tools. Each time the model calls tools, the
+     * calls run concurrently through executor and their results go back
+     * in one follow-up request; throws if the model is still calling
+     * tools after maxRounds rounds. Only the message and the final reply
+     * are kept in the history.
+     */
+    Text sendMessageWithTools(Text message,
+                              const std::vector<ToolDefinition>& tools,
+                              const ToolExecutor& executor,
+                              size_t maxRounds = 8);
     
     /**
      * Get conversation history
@@ -40,10 +74,42 @@ public:
      */
     void setSystemMessage(const std::string& message);
     
+    /**
+     * History manager; the token budget defaults to the model's context
+     * window less room for the reply
+     */
+    ConversationHistory& getConversation();
+    
+    /**
+     * Convenience setters forwarding to the history manager
+     */
+    void setContextBudget(size_t tokens);
+    void setTrimPolicy(TrimPolicy policy);
+    void setTokenEstimator(TokenEstimator estimator);
+    
+    /**
+     * Reset the token budget to the client's context window less room for
+     * the reply, as on construction; e.g. after a local model's context
+     * size changed
+     */
+    void fitContextWindow();
+    
+    /**
+     * Observe completed turns, e.g. to log them; an empty function stops.
+     * The observer runs on the thread that sent the message, and its
+     * exceptions are dropped so the reply still reaches the caller.
+     */
+    void setTurnObserver(TurnObserver turnObserver);
+    
     /**
      * Get the underlying client
      */
     LLMClient* getClient() const;
+    
+    /**
+     * Model sent with each request ("" = the provider's default)
+     */
+    const std::string& getModel() const { return defaultModel; }
 };
 
 } // namespace caichat
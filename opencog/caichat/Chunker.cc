@@ -0,0 +1,119 @@
+#include "Chunker.h"
+#include <algorithm>
+
+namespace opencog {
+namespace caichat {
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool isContinuation(char c) {
+    return (c & 0xc0) == 0x80;
+}
+
+Chunker::Chunker(size_t max, size_t overlapChars, ChunkCallback callback)
+    : maxChars(std::max<size_t>(max, 16)), overlap(overlapChars), onChunk(std::move(callback)),
+      bufferPosition(0), head(0), emitted(0) {
+    // Every chunk must contribute new text
+    overlap = std::min(overlap, maxChars / 4);
+}
+
+void Chunker::feed(const char* data, size_t length) {
+    buffer.append(data, length);
+    // Chunks are cut from head onwards; consumed text is erased once at
+    // the end so a large feed stays linear
+    head = 0;
+    while (buffer.size() - head > maxChars) {
+        size_t cut = findCut();
+        emit(cut);
+        size_t start = nextStart(cut);
+        head += start;
+        bufferPosition += start;
+        emitted = cut - start;
+    }
+    buffer.erase(0, head);
+    head = 0;
+}
+
+void Chunker::finish() {
+    if (buffer.size() > emitted) {
+        emit(buffer.size());
+    }
+    buffer.clear();
+    bufferPosition = 0;
+    emitted = 0;
+}
+
+// End of the chunk at the front of the buffer. Candidates are searched in
+// the second half of the window so chunks stay reasonably full.
+size_t Chunker::findCut() const {
+    size_t low = std::max(maxChars / 2, emitted + 1);
+    size_t paragraph = 0;
+    size_t sentence = 0;
+    size_t word = 0;
+    const char* text = buffer.data() + head;
+    for (size_t i = maxChars; i > low; --i) {
+        char before = text[i - 1];
+        if (!isSpace(text[i])) {
+            continue;
+        }
+        if (before == '\n' && i >= 2 && text[i - 2] == '\n') {
+            paragraph = i;
+            break;
+        }
+        if (!sentence && (before == '.' || before == '!' || before == '?' || before == '\n')) {
+            sentence = i;
+        }
+        if (!word) {
+            word = i;
+        }
+    }
+    if (paragraph) {
+        return paragraph;
+    }
+    if (sentence) {
+        return sentence;
+    }
+    if (word) {
+        return word;
+    }
+
+    // No break at all: cut at the window, outside any UTF-8 sequence
+    size_t cut = maxChars;
+    while (cut > low && isContinuation(text[cut])) {
+        --cut;
+    }
+    return cut;
+}
+
+// Start of the next chunk: overlap bytes before cut, moved forward to the
+// next word
+size_t Chunker::nextStart(size_t cut) const {
+    if (overlap == 0) {
+        return cut;
+    }
+    const char* text = buffer.data() + head;
+    size_t start = cut - overlap;
+    size_t word = start;
+    while (word < cut && !isSpace(text[word])) {
+        ++word;
+    }
+    while (word < cut && isSpace(text[word])) {
+        ++word;
+    }
+    if (word < cut) {
+        return word;
+    }
+    while (start < cut && isContinuation(text[start])) {
+        ++start;
+    }
+    return start;
+}
+
+void Chunker::emit(size_t end) {
+    onChunk(buffer.substr(head, end), bufferPosition);
+}
+
+} // namespace caichat
+} // namespace opencog
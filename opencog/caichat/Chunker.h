@@ -0,0 +1,56 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <functional>
+#include <string>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Splits a stream of text into overlapping chunks for embedding.
+ *
+ * Each chunk is at most maxChars bytes. Chunks end at the last sentence
+ * or paragraph break in the second half of the window, else at the last
+ * whitespace, and never inside a UTF-8 sequence. Consecutive chunks share
+ * about overlap bytes, starting on a word boundary.
+ *
+ * Text can be fed in arbitrary pieces, so files are chunked while they
+ * are read without holding them in memory.
+ */
+class Chunker {
+public:
+    /**
+     * Receives each chunk and its byte position in the whole text
+     */
+    typedef std::function<void(const std::string& text, size_t position)> ChunkCallback;
+
+    Chunker(size_t maxChars, size_t overlap, ChunkCallback onChunk);
+
+    void feed(const char* data, size_t length);
+    void feed(const std::string& text) { feed(text.data(), text.size()); }
+
+    /**
+     * Emit the remaining text and reset for the next document
+     */
+    void finish();
+
+private:
+    // Offsets relative to head
+    size_t findCut() const;
+    size_t nextStart(size_t cut) const;
+    void emit(size_t end);
+
+    size_t maxChars;
+    size_t overlap;
+    ChunkCallback onChunk;
+    std::string buffer;     // text from bufferPosition on
+    size_t bufferPosition;
+    size_t head;            // start of the current chunk within buffer
+    size_t emitted;         // leading bytes of buffer already in a chunk
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // CHUNKER_H
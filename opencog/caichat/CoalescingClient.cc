@@ -0,0 +1,353 @@
+#include "CoalescingClient.h"
+#include "HTTPClient.h"
+#include "Metrics.h"
+#include "ResponseCache.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * One provider request and everyone waiting on it. Fields are guarded by
+ * mutex; content grows while a streaming leader receives tokens.
+ */
+struct Flight {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done = false;
+    std::string content;
+    std::exception_ptr error;
+    unsigned participants = 1;
+    std::map<unsigned, CompletionCallback> waiters;   // asynchronous participants
+    unsigned nextWaiter = 0;
+    CancelHandle cancel;                              // asynchronous leaders only
+};
+
+typedef std::shared_ptr<Flight> FlightPtr;
+
+/**
+ * Flights by request key, sharded so unrelated requests do not contend.
+ * A flight is in the table from its first request until it completes or
+ * is abandoned, and never done while there; locks are always taken table
+ * shard first, then flight.
+ */
+struct FlightTable {
+    static const size_t SHARDS = 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, FlightPtr> flights;
+    };
+    Shard shards[SHARDS];
+
+    static FlightTable& instance() {
+        static FlightTable table;
+        return table;
+    }
+
+    Shard& shard(uint64_t key) { return shards[key % SHARDS]; }
+
+    // The flight for key, joined as a follower, or a new one led by the
+    // caller (leader set to true)
+    FlightPtr join(uint64_t key, bool& leader) {
+        Shard& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.flights.find(key);
+        if (it != s.flights.end()) {
+            std::lock_guard<std::mutex> flightLock(it->second->mutex);
+            ++it->second->participants;
+            leader = false;
+            return it->second;
+        }
+        leader = true;
+        FlightPtr flight = std::make_shared<Flight>();
+        s.flights.emplace(key, flight);
+        return flight;
+    }
+
+    // Remove flight unless a newer flight has taken its key; call with the
+    // shard locked
+    static void erase(Shard& s, uint64_t key, const FlightPtr& flight) {
+        auto it = s.flights.find(key);
+        if (it != s.flights.end() && it->second == flight) {
+            s.flights.erase(it);
+        }
+    }
+
+    // Publish the result to every participant
+    void finish(uint64_t key, const FlightPtr& flight, const std::string& content,
+                std::exception_ptr error) {
+        {
+            Shard& s = shard(key);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            erase(s, key, flight);
+        }
+        std::map<unsigned, CompletionCallback> waiters;
+        {
+            std::lock_guard<std::mutex> lock(flight->mutex);
+            flight->done = true;
+            flight->content = content;
+            flight->error = error;
+            waiters.swap(flight->waiters);
+        }
+        flight->changed.notify_all();
+        for (auto& waiter : waiters) {
+            waiter.second(content, error);
+        }
+    }
+
+    // A participant stops waiting. The last one to leave an unfinished
+    // flight abandons it: later requests start afresh, and the provider
+    // request is cancelled if it can be.
+    void leave(uint64_t key, const FlightPtr& flight) {
+        CancelHandle abandoned;
+        {
+            Shard& s = shard(key);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            std::lock_guard<std::mutex> flightLock(flight->mutex);
+            if (--flight->participants == 0 && !flight->done) {
+                erase(s, key, flight);
+                abandoned = flight->cancel;
+            }
+        }
+        if (abandoned) {
+            abandoned->cancel();
+        }
+    }
+
+    // A streaming leader whose callback failed: true if it left the others
+    // to the stream, false if it was alone and the flight is now closed to
+    // newcomers so the transfer can be aborted
+    bool detach(uint64_t key, const FlightPtr& flight) {
+        Shard& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::lock_guard<std::mutex> flightLock(flight->mutex);
+        if (flight->participants > 1) {
+            --flight->participants;
+            return true;
+        }
+        erase(s, key, flight);
+        return false;
+    }
+
+    size_t size() {
+        size_t total = 0;
+        for (Shard& s : shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            total += s.flights.size();
+        }
+        return total;
+    }
+};
+
+static void countFollower(const std::string& provider, const std::string& model) {
+    if (Metrics::isEnabled()) {
+        Metrics::instance().forModel(provider, model).coalesced.add();
+    }
+}
+
+CoalescingClient::CoalescingClient(std::unique_ptr<LLMClient> client)
+    : inner(std::move(client)) {
+}
+
+size_t CoalescingClient::inFlight() {
+    return FlightTable::instance().size();
+}
+
+uint64_t CoalescingClient::key(const std::vector<Message>& messages, const std::string& model) const {
+    return ResponseCache::requestKey(inner->getIdentity(), model, messages);
+}
+
+std::string CoalescingClient::chatCompletion(const std::vector<Message>& messages,
+                                             const std::string& model) {
+    FlightTable& table = FlightTable::instance();
+    uint64_t k = key(messages, model);
+    bool leader;
+    FlightPtr flight = table.join(k, leader);
+    if (leader) {
+        std::string content;
+        try {
+            content = inner->chatCompletion(messages, model);
+        } catch (...) {
+            table.finish(k, flight, "", std::current_exception());
+            throw;
+        }
+        table.finish(k, flight, content, nullptr);
+        return content;
+    }
+
+    countFollower(inner->getProviderName(), model);
+    std::unique_lock<std::mutex> lock(flight->mutex);
+    flight->changed.wait(lock, [&] { return flight->done; });
+    if (flight->error) {
+        std::rethrow_exception(flight->error);
+    }
+    return flight->content;
+}
+
+void CoalescingClient::submitChatCompletion(const std::vector<Message>& messages,
+                                            CompletionCallback onDone,
+                                            const std::string& model,
+                                            CancelHandle cancel) {
+    FlightTable& table = FlightTable::instance();
+    uint64_t k = key(messages, model);
+    bool leader;
+    FlightPtr flight = table.join(k, leader);
+    if (leader) {
+        flight->cancel = std::make_shared<Cancellation>();
+    } else {
+        countFollower(inner->getProviderName(), model);
+    }
+
+    unsigned id = 0;
+    bool waiting = false;
+    std::string content;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(flight->mutex);
+        if (!flight->done) {
+            id = flight->nextWaiter++;
+            flight->waiters.emplace(id, onDone);
+            waiting = true;
+        } else {
+            content = flight->content;
+            error = flight->error;
+        }
+    }
+    if (!waiting) {
+        onDone(content, error);
+        return;
+    }
+
+    if (cancel) {
+        cancel->onCancel([k, flight, id] {
+            CompletionCallback waiter;
+            {
+                std::lock_guard<std::mutex> lock(flight->mutex);
+                auto it = flight->waiters.find(id);
+                if (it == flight->waiters.end()) {
+                    return;   // already answered
+                }
+                waiter = std::move(it->second);
+                flight->waiters.erase(it);
+            }
+            FlightTable::instance().leave(k, flight);
+            waiter("", std::make_exception_ptr(std::runtime_error(AsyncHTTPEngine::CANCELLED)));
+        });
+    }
+
+    if (leader) {
+        inner->submitChatCompletion(messages, [k, flight](const std::string& result, std::exception_ptr failure) {
+            FlightTable::instance().finish(k, flight, result, failure);
+        }, model, flight->cancel);
+    }
+}
+
+std::string CoalescingClient::chatCompletionStream(const std::vector<Message>& messages,
+                                                   TokenCallback onToken,
+                                                   const std::string& model) {
+    FlightTable& table = FlightTable::instance();
+    uint64_t k = key(messages, model);
+    bool leader;
+    FlightPtr flight = table.join(k, leader);
+    if (leader) {
+        std::exception_ptr callbackError;
+        auto relay = [&](const std::string& token) {
+            {
+                std::lock_guard<std::mutex> lock(flight->mutex);
+                flight->content += token;
+            }
+            flight->changed.notify_all();
+            if (callbackError) {
+                return;
+            }
+            try {
+                onToken(token);
+            } catch (...) {
+                if (!table.detach(k, flight)) {
+                    throw;
+                }
+                callbackError = std::current_exception();
+            }
+        };
+        std::string content;
+        try {
+            content = inner->chatCompletionStream(messages, relay, model);
+        } catch (...) {
+            table.finish(k, flight, "", std::current_exception());
+            throw;
+        }
+        table.finish(k, flight, content, nullptr);
+        if (callbackError) {
+            std::rethrow_exception(callbackError);
+        }
+        return content;
+    }
+
+    // Replay what the leader has received, then follow its stream
+    countFollower(inner->getProviderName(), model);
+    size_t sent = 0;
+    std::unique_lock<std::mutex> lock(flight->mutex);
+    for (;;) {
+        flight->changed.wait(lock, [&] { return flight->done || flight->content.size() > sent; });
+        if (flight->error) {
+            std::rethrow_exception(flight->error);
+        }
+        if (flight->content.size() > sent) {
+            std::string chunk = flight->content.substr(sent);
+            sent = flight->content.size();
+            lock.unlock();
+            try {
+                onToken(chunk);
+            } catch (...) {
+                table.leave(k, flight);
+                throw;
+            }
+            lock.lock();
+        } else if (flight->done) {
+            return flight->content;
+        }
+    }
+}
+
+ChatReply CoalescingClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                    const std::vector<ToolDefinition>& tools,
+                                                    const std::string& model) {
+    return inner->chatCompletionWithTools(messages, tools, model);
+}
+
+std::vector<Embedding> CoalescingClient::embed(const std::vector<std::string>& inputs,
+                                               const std::string& model) {
+    return inner->embed(inputs, model);
+}
+
+void CoalescingClient::setApiKey(const std::string& key) {
+    inner->setApiKey(key);
+}
+
+std::string CoalescingClient::getProviderName() const {
+    return inner->getProviderName();
+}
+
+std::string CoalescingClient::getIdentity() const {
+    return inner->getIdentity();
+}
+
+size_t CoalescingClient::contextWindow(const std::string& model) const {
+    return inner->contextWindow(model);
+}
+
+LLMClient* CoalescingClient::getUnderlyingClient() {
+    return inner->getUnderlyingClient();
+}
+
+Usage CoalescingClient::getLastUsage() const {
+    return inner->getLastUsage();
+}
+
+} // namespace caichat
+} // namespace opencog
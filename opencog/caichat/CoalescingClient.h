@@ -0,0 +1,76 @@
+#ifndef COALESCINGCLIENT_H
+#define COALESCINGCLIENT_H
+
+#include "LLMClient.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * LLMClient sending identical concurrent requests only once.
+ *
+ * Requests are keyed by the wrapped client's identity (provider plus
+ * endpoint and credentials, or local model; see LLMClient::getIdentity),
+ * model and messages. The first request for a key leads a flight in a
+ * process-wide table; requests for the same key arriving from any client
+ * of equal identity while it is in flight join it instead of going to
+ * the provider. Blocking and
+ * asynchronous followers get the leader's reply, streaming followers
+ * replay the tokens received so far and then follow the leader's stream.
+ * A failed request fails every participant with the same error.
+ *
+ * Cancelling an asynchronous participant only detaches it; the provider
+ * request is cancelled once every participant has, and a flight that is
+ * abandoned this way is dropped from the table so later requests start a
+ * new one. A streaming leader whose own callback throws keeps streaming
+ * for its followers and rethrows when the reply is complete.
+ *
+ * Only chat completions are coalesced; tool turns and embeddings pass
+ * through. Followers do not touch the provider, so their getLastUsage()
+ * is the usage of this client's own last request.
+ */
+class CoalescingClient : public LLMClient {
+public:
+    explicit CoalescingClient(std::unique_ptr<LLMClient> client);
+
+    std::string chatCompletion(const std::vector<Message>& messages,
+                               const std::string& model = "") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "") override;
+    void setApiKey(const std::string& key) override;
+    std::string getProviderName() const override;
+    std::string getIdentity() const override;
+    size_t contextWindow(const std::string& model = "") const override;
+    LLMClient* getUnderlyingClient() override;
+    LLMClient* getWrappedClient() override { return inner.get(); }
+    Usage getLastUsage() const override;
+
+    /**
+     * Requests in flight across all coalescing clients
+     */
+    static size_t inFlight();
+
+private:
+    uint64_t key(const std::vector<Message>& messages, const std::string& model) const;
+
+    std::unique_ptr<LLMClient> inner;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // COALESCINGCLIENT_H
@@ -0,0 +1,224 @@
+#include "ConversationHistory.h"
+#include <cstring>
+#include <iterator>
+
+namespace opencog {
+namespace caichat {
+
+ConversationHistory::ConversationHistory(size_t budget)
+    : totalTokens(0), revision(0), hasSystemSlot(false), pinSystem(true),
+      tokenBudget(budget), policy(TrimPolicy::SlidingWindow),
+      estimator(&ConversationHistory::estimateTokens) {
+}
+
+void ConversationHistory::append(Message message) {
+    size_t tokens = estimator(message.content);
+    messages.push_back(std::move(message));
+    tokenCounts.push_back(tokens);
+    totalTokens += tokens;
+}
+
+void ConversationHistory::append(Role role, Text content) {
+    append(Message(role, std::move(content)));
+}
+
+void ConversationHistory::removeLast() {
+    if (messages.size() > firstTurn()) {
+        totalTokens -= tokenCounts.back();
+        messages.pop_back();
+        tokenCounts.pop_back();
+        revision++;
+    }
+}
+
+void ConversationHistory::clear() {
+    messages.clear();
+    tokenCounts.clear();
+    totalTokens = 0;
+    systemMessage.clear();
+    summary.clear();
+    hasSystemSlot = false;
+    revision++;
+}
+
+void ConversationHistory::setSystemMessage(const std::string& message) {
+    systemMessage = message;
+    refreshSystemSlot();
+}
+
+void ConversationHistory::setSummary(const std::string& text) {
+    summary = text;
+    refreshSystemSlot();
+}
+
+void ConversationHistory::setPinSystemMessage(bool pin) {
+    pinSystem = pin;
+}
+
+void ConversationHistory::setTokenBudget(size_t tokens) {
+    tokenBudget = tokens;
+}
+
+void ConversationHistory::setTrimPolicy(TrimPolicy p) {
+    policy = p;
+}
+
+void ConversationHistory::setSummarizer(Summarizer fn) {
+    summarizer = std::move(fn);
+}
+
+void ConversationHistory::setTokenEstimator(TokenEstimator fn) {
+    estimator = fn ? std::move(fn) : TokenEstimator(&ConversationHistory::estimateTokens);
+    totalTokens = 0;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        tokenCounts[i] = estimator(messages[i].content);
+        totalTokens += tokenCounts[i];
+    }
+}
+
+// Rebuild the first slot from the system message and running summary.
+// The slot is inserted or erased only when it appears or disappears;
+// otherwise the content is replaced in place.
+void ConversationHistory::refreshSystemSlot() {
+    revision++;
+    std::string content = systemMessage;
+    if (!summary.empty()) {
+        if (!content.empty()) {
+            content += "\n\n";
+        }
+        content += "Summary of the earlier conversation:\n";
+        content += summary;
+    }
+
+    if (content.empty()) {
+        if (hasSystemSlot) {
+            totalTokens -= tokenCounts.front();
+            messages.erase(messages.begin());
+            tokenCounts.erase(tokenCounts.begin());
+            hasSystemSlot = false;
+        }
+        return;
+    }
+
+    size_t tokens = estimator(content);
+    if (hasSystemSlot) {
+        totalTokens -= tokenCounts.front();
+        messages.front().content = std::move(content);
+        tokenCounts.front() = tokens;
+    } else {
+        messages.insert(messages.begin(), Message(Role::System, std::move(content)));
+        tokenCounts.insert(tokenCounts.begin(), tokens);
+        hasSystemSlot = true;
+    }
+    totalTokens += tokens;
+}
+
+// Drop the oldest turns until the total is at most target, always keeping
+// the newest message and never leaving an assistant reply first
+size_t ConversationHistory::dropOldest(size_t target, std::vector<Message>* dropped) {
+    size_t first = firstTurn();
+    size_t end = first;
+    size_t tokens = totalTokens;
+
+    while (tokens > target && end + 1 < messages.size()) {
+        tokens -= tokenCounts[end++];
+    }
+    while (end > first && end + 1 < messages.size() && messages[end].role != Role::User) {
+        tokens -= tokenCounts[end++];
+    }
+    if (end == first) {
+        return 0;
+    }
+
+    if (dropped) {
+        dropped->insert(dropped->end(),
+                        std::make_move_iterator(messages.begin() + first),
+                        std::make_move_iterator(messages.begin() + end));
+    }
+    messages.erase(messages.begin() + first, messages.begin() + end);
+    tokenCounts.erase(tokenCounts.begin() + first, tokenCounts.begin() + end);
+    totalTokens = tokens;
+    revision++;
+    return end - first;
+}
+
+size_t ConversationHistory::fit() {
+    if (policy == TrimPolicy::None || tokenBudget == 0 || totalTokens <= tokenBudget) {
+        return 0;
+    }
+
+    // An unpinned system message is the oldest message and goes first
+    if (!pinSystem && !systemMessage.empty()) {
+        systemMessage.clear();
+        refreshSystemSlot();
+        if (totalTokens <= tokenBudget) {
+            return 0;
+        }
+    }
+
+    size_t target = tokenBudget / 4 * 3;
+    if (policy == TrimPolicy::SlidingWindow || !summarizer) {
+        return dropOldest(target, nullptr);
+    }
+
+    std::vector<Message> dropped;
+    size_t removed = dropOldest(target, &dropped);
+    if (!dropped.empty()) {
+        try {
+            summary = summarizer(summary, dropped);
+        } catch (...) {
+            // Keep the previous summary; the turns are dropped regardless
+        }
+        // A summary that crowds out the conversation is worse than none
+        if (estimator(summary) > tokenBudget / 4) {
+            summary.clear();
+        }
+        refreshSystemSlot();
+    }
+    // A long summary can push the total back over; trim plainly then
+    if (totalTokens > tokenBudget) {
+        removed += dropOldest(target, nullptr);
+    }
+    return removed;
+}
+
+size_t ConversationHistory::estimateTokens(const std::string& text) {
+    return text.size() / 4 + 4;
+}
+
+size_t ConversationHistory::contextWindow(const std::string& provider, const std::string& model) {
+    struct Window {
+        const char* prefix;
+        size_t tokens;
+    };
+    // Longer prefixes first
+    static const Window windows[] = {
+        {"gpt-4o", 128000},
+        {"gpt-4.1", 1000000},
+        {"gpt-4-turbo", 128000},
+        {"gpt-4-32k", 32768},
+        {"gpt-4", 8192},
+        {"gpt-3.5-turbo", 16385},
+        {"o1", 128000},
+        {"o3", 200000},
+        {"claude", 200000},
+    };
+
+    std::string name = model;
+    if (name.empty()) {
+        if (provider == "openai") {
+            name = "gpt-3.5-turbo";
+        } else if (provider == "claude") {
+            name = "claude";
+        }
+    }
+    for (const Window& w : windows) {
+        if (name.compare(0, std::strlen(w.prefix), w.prefix) == 0) {
+            return w.tokens;
+        }
+    }
+    return 8192;
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,162 @@
+#ifndef CONVERSATIONHISTORY_H
+#define CONVERSATIONHISTORY_H
+
+#include "LLMClient.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Estimated token count of a piece of text
+ */
+typedef std::function<size_t(const std::string& text)> TokenEstimator;
+
+/**
+ * Produces a summary of messages dropped from the history. The previous
+ * summary (possibly empty) is passed so it can be folded in.
+ */
+typedef std::function<std::string(const std::string& previousSummary,
+                                  const std::vector<Message>& dropped)> Summarizer;
+
+/**
+ * What to do with the oldest turns once the history exceeds its budget
+ */
+enum class TrimPolicy {
+    None,             // keep everything
+    SlidingWindow,    // drop the oldest turns
+    SummarizeOldest   // replace the oldest turns with a running summary
+};
+
+/**
+ * Token-aware message history of one conversation.
+ *
+ * Messages are kept in the exact layout sent to the provider, so a turn
+ * hands the vector to the client without rebuilding it. The system
+ * message (with any running summary folded in) occupies a fixed first
+ * slot and is updated in place. Token counts are estimated once per
+ * message and kept alongside it.
+ *
+ * When the estimate exceeds the budget, the oldest turns are trimmed down
+ * to three quarters of it. Trimming in one larger step keeps the request
+ * prefix stable for several turns instead of shifting it on every one.
+ * A summary larger than a quarter of the budget is discarded. The newest
+ * message is never dropped, so a single oversized message is still sent
+ * as is.
+ */
+class ConversationHistory {
+public:
+    explicit ConversationHistory(size_t tokenBudget = 0);
+
+    /**
+     * Messages to send, system message first
+     */
+    const std::vector<Message>& getMessages() const { return messages; }
+
+    /**
+     * Changes whenever a message already in the history is replaced or
+     * removed; appending keeps it. While it is unchanged, the messages of
+     * an earlier getMessages() are still the leading ones.
+     */
+    uint64_t getRevision() const { return revision; }
+
+    void append(Message message);
+    void append(Role role, Text content);
+
+    /**
+     * Remove the newest message, e.g. after a failed request
+     */
+    void removeLast();
+
+    /**
+     * Remove everything including the system message and summary
+     */
+    void clear();
+
+    void setSystemMessage(const std::string& message);
+    const std::string& getSystemMessage() const { return systemMessage; }
+    const std::string& getSummary() const { return summary; }
+
+    /**
+     * Replace the running summary, e.g. when restoring a saved session
+     */
+    void setSummary(const std::string& text);
+
+    /**
+     * Index of the first conversation message, after the system slot
+     */
+    size_t firstTurn() const { return hasSystemSlot ? 1 : 0; }
+
+    /**
+     * Whether the system message is exempt from trimming (default true)
+     */
+    void setPinSystemMessage(bool pin);
+    bool getPinSystemMessage() const { return pinSystem; }
+
+    /**
+     * Maximum estimated tokens of the whole history; 0 means unlimited
+     */
+    void setTokenBudget(size_t tokens);
+    size_t getTokenBudget() const { return tokenBudget; }
+
+    void setTrimPolicy(TrimPolicy policy);
+    TrimPolicy getTrimPolicy() const { return policy; }
+
+    void setSummarizer(Summarizer fn);
+
+    /**
+     * Replace the token estimator and re-estimate all messages
+     */
+    void setTokenEstimator(TokenEstimator fn);
+
+    /**
+     * Current estimated size of the history in tokens
+     */
+    size_t getTokenCount() const { return totalTokens; }
+
+    /**
+     * Trim according to the policy until the history fits the budget.
+     * Returns the number of messages removed.
+     */
+    size_t fit();
+
+    /**
+     * Default estimator: about four characters per token plus a small
+     * per-message overhead
+     */
+    static size_t estimateTokens(const std::string& text);
+
+    /**
+     * Context window of a remote model in tokens, by model name prefix.
+     * An empty model name resolves to the provider's default model. Prefer
+     * LLMClient::contextWindow, which knows local models' context size.
+     */
+    static size_t contextWindow(const std::string& provider, const std::string& model);
+
+private:
+    void refreshSystemSlot();
+    size_t dropOldest(size_t target, std::vector<Message>* dropped);
+
+    std::vector<Message> messages;
+    std::vector<size_t> tokenCounts;   // parallel to messages
+    size_t totalTokens;
+    uint64_t revision;
+
+    std::string systemMessage;
+    std::string summary;
+    bool hasSystemSlot;
+    bool pinSystem;
+
+    size_t tokenBudget;
+    TrimPolicy policy;
+    Summarizer summarizer;
+    TokenEstimator estimator;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // CONVERSATIONHISTORY_H
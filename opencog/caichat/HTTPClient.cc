@@ -0,0 +1,554 @@
+#include "HTTPClient.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace opencog {
+namespace caichat {
+
+// ConnectionPool implementation
+ConnectionPool& ConnectionPool::instance() {
+    static ConnectionPool pool;
+    return pool;
+}
+
+ConnectionPool::ConnectionPool()
+    : share(nullptr), maxConnections(16), idleTimeout(60), transferTimeout(600), stallTimeout(60),
+      created(0), reused(0) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // Connection caches stay per handle: libcurl does not support sharing
+    // CURL_LOCK_DATA_CONNECT between concurrently running threads.
+    share = curl_share_init();
+    if (share) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+}
+
+ConnectionPool::~ConnectionPool() {
+    clear();
+    if (share) {
+        curl_share_cleanup(share);
+    }
+}
+
+void ConnectionPool::lockShare(CURL*, curl_lock_data data, curl_lock_access, void* self) {
+    static_cast<ConnectionPool*>(self)->shareLocks[data].lock();
+}
+
+void ConnectionPool::unlockShare(CURL*, curl_lock_data data, void* self) {
+    static_cast<ConnectionPool*>(self)->shareLocks[data].unlock();
+}
+
+std::string ConnectionPool::hostKey(const std::string& url) {
+    size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    return url.substr(0, end);
+}
+
+void ConnectionPool::configure(CURL* handle) const {
+    long transfer;
+    long stall;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        transfer = transferTimeout;
+        stall = stallTimeout;
+    }
+    if (share) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    }
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, idleTimeout);
+    // A stalled upstream must not hold a caller or a streamed reply forever
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT, transfer);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, stall > 0 ? 1L : 0L);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, stall);
+}
+
+void ConnectionPool::expireIdle(HostPool& pool, Clock::time_point now) {
+    auto limit = std::chrono::seconds(idleTimeout);
+    auto it = pool.idle.begin();
+    while (it != pool.idle.end()) {
+        if (now - it->since > limit) {
+            curl_easy_cleanup(it->handle);
+            it = pool.idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+CURL* ConnectionPool::acquire(const std::string& url) {
+    std::string key = hostKey(url);
+    CURL* handle = nullptr;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        HostPool& pool = hosts[key];
+        available.wait(lock, [&] { return pool.inUse < maxConnections; });
+
+        expireIdle(pool, Clock::now());
+        pool.inUse++;
+
+        if (!pool.idle.empty()) {
+            // Most recently used first: its connection is the least likely to be stale
+            handle = pool.idle.back().handle;
+            pool.idle.pop_back();
+            reused++;
+        }
+    }
+
+    if (handle) {
+        // Keeps the live connection, DNS cache and TLS session ids
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+        if (!handle) {
+            std::lock_guard<std::mutex> lock(mutex);
+            hosts[key].inUse--;
+            available.notify_one();
+            throw std::runtime_error("Failed to initialize CURL");
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        created++;
+    }
+
+    configure(handle);
+    return handle;
+}
+
+void ConnectionPool::release(const std::string& url, CURL* handle, bool reusable) {
+    std::string key = hostKey(url);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        HostPool& pool = hosts[key];
+        if (pool.inUse > 0) {
+            pool.inUse--;
+        }
+        if (reusable && pool.idle.size() < maxConnections) {
+            pool.idle.push_back(IdleHandle{handle, Clock::now()});
+            handle = nullptr;
+        }
+    }
+    available.notify_all();
+
+    if (handle) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+void ConnectionPool::setMaxConnections(size_t max) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxConnections = max > 0 ? max : 1;
+    }
+    available.notify_all();
+}
+
+size_t ConnectionPool::getMaxConnections() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxConnections;
+}
+
+void ConnectionPool::setIdleTimeout(long seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idleTimeout = seconds > 0 ? seconds : 1;
+}
+
+long ConnectionPool::getIdleTimeout() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idleTimeout;
+}
+
+void ConnectionPool::setTimeouts(long transferSeconds, long stallSeconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    transferTimeout = std::max(transferSeconds, 0L);
+    stallTimeout = std::max(stallSeconds, 0L);
+}
+
+long ConnectionPool::getTransferTimeout() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return transferTimeout;
+}
+
+long ConnectionPool::getStallTimeout() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stallTimeout;
+}
+
+void ConnectionPool::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : hosts) {
+        for (auto& idle : entry.second.idle) {
+            curl_easy_cleanup(idle.handle);
+        }
+        entry.second.idle.clear();
+    }
+}
+
+ConnectionPool::Stats ConnectionPool::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    stats.created = created;
+    stats.reused = reused;
+    for (const auto& entry : hosts) {
+        stats.idle += entry.second.idle.size();
+        stats.inUse += entry.second.inUse;
+    }
+    return stats;
+}
+
+// HTTP request helpers
+struct WriteContext {
+    CURL* handle;
+    HTTPResponse* response;
+    const HTTPRequest* request;
+    std::exception_ptr error;
+};
+
+static size_t WriteCallback(void* contents, size_t size, size_t nmemb, WriteContext* context) {
+    size_t totalSize = size * nmemb;
+    if (context->request->onData) {
+        long code = 0;
+        curl_easy_getinfo(context->handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code == 200) {
+            try {
+                context->request->onData((const char*)contents, totalSize);
+            } catch (...) {
+                context->error = std::current_exception();
+                return 0;  // aborts the transfer with CURLE_WRITE_ERROR
+            }
+            return totalSize;
+        }
+    }
+    context->response->data.append((char*)contents, totalSize);
+    return totalSize;
+}
+
+// Split curl's cumulative timestamps into the phases of the transfer
+static void readTimings(CURL* curl, HTTPTimings& timings) {
+    curl_off_t dns = 0, connect = 0, tls = 0, start = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_off_t ready = tls > connect ? tls : connect;
+    timings.reused = connects == 0;
+    if (!timings.reused) {
+        timings.dns = (uint64_t)dns;
+        timings.connect = connect > dns ? (uint64_t)(connect - dns) : 0;
+        timings.tls = tls > connect ? (uint64_t)(tls - connect) : 0;
+    }
+    timings.ttfb = start > ready ? (uint64_t)(start - ready) : 0;
+    timings.transfer = total > start ? (uint64_t)(total - start) : 0;
+    timings.total = (uint64_t)total;
+}
+
+static struct curl_slist* prepareHandle(CURL* curl, const HTTPRequest& request,
+                                        WriteContext* context) {
+    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, context);
+
+    if (!request.body.empty()) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request.body.size());
+    }
+
+    struct curl_slist* headerList = nullptr;
+    for (const auto& header : request.headers) {
+        headerList = curl_slist_append(headerList, header.c_str());
+    }
+    if (headerList) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
+    }
+    return headerList;
+}
+
+struct AsyncHTTPEngine::Transfer {
+    uint64_t id;
+    HTTPRequest request;
+    Callback onDone;
+    HTTPResponse response;
+    WriteContext context;
+    struct curl_slist* headerList = nullptr;
+};
+
+// AsyncHTTPEngine implementation
+const char* const AsyncHTTPEngine::CANCELLED = "Request cancelled";
+
+AsyncHTTPEngine& AsyncHTTPEngine::instance() {
+    static AsyncHTTPEngine engine;
+    return engine;
+}
+
+AsyncHTTPEngine::AsyncHTTPEngine() : multi(nullptr), running(false), nextId(1), inFlight(0) {
+    // Make sure the pool (and curl_global_init) outlives the engine
+    ConnectionPool::instance();
+
+    multi = curl_multi_init();
+    if (!multi) {
+        throw std::runtime_error("Failed to initialize CURL multi handle");
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+AsyncHTTPEngine::~AsyncHTTPEngine() {
+    if (loop.joinable()) {
+        running = false;
+        curl_multi_wakeup(multi);
+        loop.join();
+    }
+    for (auto& entry : active) {
+        curl_multi_remove_handle(multi, entry.first);
+        curl_easy_cleanup(entry.first);
+        curl_slist_free_all(entry.second->headerList);
+    }
+    for (CURL* handle : spareHandles) {
+        curl_easy_cleanup(handle);
+    }
+    curl_multi_cleanup(multi);
+}
+
+uint64_t AsyncHTTPEngine::submit(HTTPRequest request, Callback onDone) {
+    std::unique_ptr<Transfer> transfer(new Transfer());
+    transfer->request = std::move(request);
+    transfer->onDone = std::move(onDone);
+
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = nextId++;
+        transfer->id = id;
+        queue.push_back(std::move(transfer));
+        inFlight++;
+        if (!loop.joinable()) {
+            running = true;
+            loop = std::thread(&AsyncHTTPEngine::run, this);
+        }
+    }
+    curl_multi_wakeup(multi);
+    return id;
+}
+
+void AsyncHTTPEngine::cancel(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled.push_back(id);
+    }
+    curl_multi_wakeup(multi);
+}
+
+size_t AsyncHTTPEngine::pending() const {
+    return inFlight;
+}
+
+void AsyncHTTPEngine::startTransfer(std::unique_ptr<Transfer> transfer) {
+    CURL* handle;
+    if (!spareHandles.empty()) {
+        handle = spareHandles.back();
+        spareHandles.pop_back();
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+    }
+
+    if (!handle) {
+        inFlight--;
+        transfer->onDone(transfer->response, "Failed to initialize CURL");
+        return;
+    }
+
+    ConnectionPool::instance().configure(handle);
+    // Wait for an HTTP/2 connection to multiplex on rather than opening a new one
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    transfer->context = WriteContext{handle, &transfer->response, &transfer->request, nullptr};
+    transfer->headerList = prepareHandle(handle, transfer->request, &transfer->context);
+
+    curl_multi_add_handle(multi, handle);
+    active[handle] = std::move(transfer);
+}
+
+void AsyncHTTPEngine::finishTransfer(CURL* handle, CURLcode result) {
+    auto it = active.find(handle);
+    if (it == active.end()) {
+        return;
+    }
+    std::unique_ptr<Transfer> transfer = std::move(it->second);
+    active.erase(it);
+
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &transfer->response.code);
+    readTimings(handle, transfer->response.timings);
+    curl_multi_remove_handle(multi, handle);
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(transfer->headerList);
+    transfer->headerList = nullptr;
+
+    if (result == CURLE_OK) {
+        spareHandles.push_back(handle);
+    } else {
+        curl_easy_cleanup(handle);
+    }
+
+    inFlight--;
+    std::string error;
+    if (transfer->context.error) {
+        try {
+            std::rethrow_exception(transfer->context.error);
+        } catch (const std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "Stream callback failed";
+        }
+    } else if (result != CURLE_OK) {
+        error = "HTTP request failed: " + std::string(curl_easy_strerror(result));
+    }
+    try {
+        transfer->onDone(transfer->response, error);
+    } catch (...) {
+        // A throwing callback must not take down the event loop
+    }
+}
+
+// Called on the loop thread after the queue has been drained, so the
+// transfer is either active or already finished
+void AsyncHTTPEngine::cancelTransfer(uint64_t id) {
+    for (auto it = active.begin(); it != active.end(); ++it) {
+        if (it->second->id != id) {
+            continue;
+        }
+        CURL* handle = it->first;
+        std::unique_ptr<Transfer> transfer = std::move(it->second);
+        active.erase(it);
+
+        // The connection is mid-response; drop the handle rather than reuse it
+        curl_multi_remove_handle(multi, handle);
+        curl_easy_cleanup(handle);
+        curl_slist_free_all(transfer->headerList);
+        transfer->headerList = nullptr;
+
+        inFlight--;
+        try {
+            transfer->onDone(transfer->response, CANCELLED);
+        } catch (...) {
+        }
+        return;
+    }
+}
+
+void AsyncHTTPEngine::run() {
+    // Reused across iterations: a std::deque allocates even when empty,
+    // and a large upload takes many iterations
+    std::deque<std::unique_ptr<Transfer>> incoming;
+    std::vector<uint64_t> cancelling;
+    while (running) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long)ConnectionPool::instance().getMaxConnections());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            incoming.swap(queue);
+            cancelling.swap(cancelled);
+        }
+        for (auto& transfer : incoming) {
+            startTransfer(std::move(transfer));
+        }
+        for (uint64_t id : cancelling) {
+            cancelTransfer(id);
+        }
+        incoming.clear();
+        cancelling.clear();
+
+        int stillRunning = 0;
+        curl_multi_perform(multi, &stillRunning);
+
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+            if (msg->msg == CURLMSG_DONE) {
+                finishTransfer(msg->easy_handle, msg->data.result);
+            }
+        }
+
+        curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+}
+
+static thread_local DeadlineScope::Clock::time_point threadDeadline = DeadlineScope::Clock::time_point::max();
+
+DeadlineScope::DeadlineScope(Clock::time_point deadline) : previous(threadDeadline) {
+    threadDeadline = std::min(previous, deadline);
+}
+
+DeadlineScope::~DeadlineScope() {
+    threadDeadline = previous;
+}
+
+DeadlineScope::Clock::time_point DeadlineScope::current() {
+    return threadDeadline;
+}
+
+HTTPResponse makeHTTPRequest(const HTTPRequest& request) {
+    long remainingMs = -1;
+    if (threadDeadline != DeadlineScope::Clock::time_point::max()) {
+        remainingMs = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+            threadDeadline - DeadlineScope::Clock::now()).count();
+        if (remainingMs <= 0) {
+            throw HTTPError("HTTP request failed: deadline passed", 0);
+        }
+    }
+
+    ConnectionPool& pool = ConnectionPool::instance();
+    CURL* curl = pool.acquire(request.url);
+    HTTPResponse response;
+    WriteContext context{curl, &response, &request, nullptr};
+
+    struct curl_slist* headerList = prepareHandle(curl, request, &context);
+    long transferMs = pool.getTransferTimeout() * 1000;
+    if (remainingMs > 0 && (transferMs == 0 || remainingMs < transferMs)) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remainingMs);
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.code);
+    readTimings(curl, response.timings);
+
+    // The handle keeps a pointer to the header list until its next reset
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    if (headerList) {
+        curl_slist_free_all(headerList);
+    }
+    pool.release(request.url, curl, res == CURLE_OK);
+
+    if (context.error) {
+        std::rethrow_exception(context.error);
+    }
+    if (res != CURLE_OK) {
+        throw HTTPError("HTTP request failed: " + std::string(curl_easy_strerror(res)), 0);
+    }
+
+    return response;
+}
+
+HTTPResponse makeHTTPRequest(const std::string& url, const std::string& postData,
+                             const std::vector<std::string>& headers) {
+    HTTPRequest request;
+    request.url = url;
+    request.body = postData;
+    request.headers = headers;
+    return makeHTTPRequest(request);
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,270 @@
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "Metrics.h"
+#include <curl/curl.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Result of an HTTP request
+ */
+struct HTTPResponse {
+    std::string data;
+    long code = 0;
+    HTTPTimings timings;
+};
+
+/**
+ * A failed request: a transport error (code 0) or an error status from
+ * the server. Transport errors, 429 and 5xx are worth retrying.
+ */
+class HTTPError : public std::runtime_error {
+public:
+    HTTPError(const std::string& message, long status)
+        : std::runtime_error(message), code(status) {}
+
+    long getCode() const { return code; }
+    bool isRetryable() const { return code == 0 || code == 429 || code >= 500; }
+
+private:
+    long code;
+};
+
+/**
+ * A fully prepared HTTP request. A non-empty body makes it a POST.
+ *
+ * When onData is set, body chunks of a 200 response are passed to it as
+ * they arrive instead of being collected in HTTPResponse::data (error
+ * bodies are still collected). Throwing from onData aborts the transfer
+ * and the exception is rethrown to the caller.
+ */
+struct HTTPRequest {
+    std::string url;
+    std::string body;
+    std::vector<std::string> headers;
+    std::function<void(const char* bytes, size_t length)> onData;
+};
+
+/**
+ * Process-wide pool of reusable CURL easy handles, shared by all LLMClient
+ * instances. Handles are grouped per scheme://host:port so that a released
+ * handle keeps its live (keep-alive, HTTP/2 where negotiated) connection
+ * for the next request to the same endpoint. DNS results and TLS sessions
+ * are shared across all handles through a CURLSH object.
+ */
+class ConnectionPool {
+public:
+    struct Stats {
+        size_t created = 0;   // handles created with curl_easy_init
+        size_t reused = 0;    // acquisitions served from the idle list
+        size_t idle = 0;      // handles currently parked in the pool
+        size_t inUse = 0;     // handles currently checked out
+    };
+
+    static ConnectionPool& instance();
+
+    /**
+     * Take a handle for the given URL, blocking while the host already has
+     * getMaxConnections() handles checked out. The handle is reset and has
+     * the pool-wide options applied.
+     */
+    CURL* acquire(const std::string& url);
+
+    /**
+     * Return a handle obtained from acquire(). Pass reusable = false after
+     * a transport error so the handle and its connection are dropped.
+     */
+    void release(const std::string& url, CURL* handle, bool reusable = true);
+
+    /**
+     * Maximum number of concurrent handles per host (default 16)
+     */
+    void setMaxConnections(size_t max);
+    size_t getMaxConnections() const;
+
+    /**
+     * Seconds an unused handle (and its connection) is kept (default 60)
+     */
+    void setIdleTimeout(long seconds);
+    long getIdleTimeout() const;
+
+    /**
+     * Seconds a whole transfer may take, and seconds a transfer may
+     * receive less than a byte per second before it is aborted as stalled
+     * (defaults 600 and 60, 0 = no limit). Either failure is a retryable
+     * transport error.
+     */
+    void setTimeouts(long transferSeconds, long stallSeconds);
+    long getTransferTimeout() const;
+    long getStallTimeout() const;
+
+    /**
+     * Close all idle handles
+     */
+    void clear();
+
+    Stats getStats() const;
+
+    /**
+     * Apply the pool-wide options (shared DNS/TLS cache, HTTP/2,
+     * keep-alive) to a handle that is not managed by the pool
+     */
+    void configure(CURL* handle) const;
+
+    static std::string hostKey(const std::string& url);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct IdleHandle {
+        CURL* handle;
+        Clock::time_point since;
+    };
+
+    struct HostPool {
+        std::vector<IdleHandle> idle;
+        size_t inUse = 0;
+    };
+
+    ConnectionPool();
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    void expireIdle(HostPool& pool, Clock::time_point now);
+
+    static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* self);
+    static void unlockShare(CURL*, curl_lock_data data, void* self);
+
+    CURLSH* share;
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::map<std::string, HostPool> hosts;
+    size_t maxConnections;
+    long idleTimeout;
+    long transferTimeout;
+    long stallTimeout;
+    size_t created;
+    size_t reused;
+};
+
+/**
+ * Single event-loop thread driving curl_multi, so any number of requests
+ * can be in flight without a thread per request. Transfers to the same
+ * host are multiplexed over HTTP/2 where the server supports it and are
+ * capped at ConnectionPool::getMaxConnections() connections per host.
+ */
+class AsyncHTTPEngine {
+public:
+    /**
+     * Completion callback, invoked on the engine thread. error is empty on
+     * success; otherwise it holds the transport error message. Callbacks
+     * must not block.
+     */
+    typedef std::function<void(HTTPResponse& response, const std::string& error)> Callback;
+
+    static AsyncHTTPEngine& instance();
+
+    /**
+     * Queue a request. The event-loop thread is started on first use.
+     * @return Id for cancel()
+     */
+    uint64_t submit(HTTPRequest request, Callback onDone);
+
+    /**
+     * Abort a queued or running request; its callback is invoked with the
+     * error CANCELLED. Does nothing if the request has already finished.
+     */
+    void cancel(uint64_t id);
+
+    static const char* const CANCELLED;
+
+    /**
+     * Number of queued and running transfers
+     */
+    size_t pending() const;
+
+private:
+    struct Transfer;
+
+    AsyncHTTPEngine();
+    ~AsyncHTTPEngine();
+    AsyncHTTPEngine(const AsyncHTTPEngine&) = delete;
+    AsyncHTTPEngine& operator=(const AsyncHTTPEngine&) = delete;
+
+    void run();
+    void startTransfer(std::unique_ptr<Transfer> transfer);
+    void finishTransfer(CURL* handle, CURLcode result);
+    void cancelTransfer(uint64_t id);
+
+    CURLM* multi;
+    std::thread loop;
+    std::atomic<bool> running;
+    mutable std::mutex mutex;
+    std::deque<std::unique_ptr<Transfer>> queue;
+    std::vector<uint64_t> cancelled;
+    uint64_t nextId;
+    std::atomic<size_t> inFlight;
+
+    // Owned by the loop thread only
+    std::map<CURL*, std::unique_ptr<Transfer>> active;
+    std::vector<CURL*> spareHandles;
+};
+
+/**
+ * Deadline for the blocking requests this thread makes while the scope
+ * lasts: they fail with a retryable transport error once it has passed.
+ * Scopes nest, and the earliest deadline applies.
+ */
+class DeadlineScope {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit DeadlineScope(Clock::time_point deadline);
+    ~DeadlineScope();
+
+    DeadlineScope(const DeadlineScope&) = delete;
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+    /**
+     * Deadline of this thread, Clock::time_point::max() when there is none
+     */
+    static Clock::time_point current();
+
+private:
+    Clock::time_point previous;
+};
+
+/**
+ * Perform a blocking request on a pooled handle, within the thread's
+ * DeadlineScope if any
+ */
+HTTPResponse makeHTTPRequest(const HTTPRequest& request);
+
+/**
+ * Perform a blocking request on a pooled handle. A non-empty postData
+ * makes it a POST.
+ */
+HTTPResponse makeHTTPRequest(const std::string& url, const std::string& postData,
+                             const std::vector<std::string>& headers);
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // HTTPCLIENT_H
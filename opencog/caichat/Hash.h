@@ -0,0 +1,78 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Fast non-cryptographic 64-bit hashing used for cache and dedup keys.
+ * Processes 8 bytes per step with a multiply-xorshift mix; callers that
+ * hash several fields feed them through one Hasher so field boundaries
+ * are part of the key.
+ */
+class Hasher {
+public:
+    explicit Hasher(uint64_t seed = 0x9e3779b97f4a7c15ULL) : state(seed ^ 0x243f6a8885a308d3ULL) {}
+
+    Hasher& update(const void* data, size_t length) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        // Length first, so ("ab","c") and ("a","bc") differ
+        mix(length);
+        while (length >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            mix(word);
+            p += 8;
+            length -= 8;
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, p, length);
+        mix(tail);
+        return *this;
+    }
+
+    Hasher& update(const std::string& text) {
+        return update(text.data(), text.size());
+    }
+
+    Hasher& update(uint64_t value) {
+        mix(value);
+        return *this;
+    }
+
+    uint64_t digest() const {
+        uint64_t h = state;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    void mix(uint64_t word) {
+        state ^= word * 0x9fb21c651e98df25ULL;
+        state = (state << 27) | (state >> 37);
+        state *= 0x9e3779b97f4a7c15ULL;
+    }
+
+    uint64_t state;
+};
+
+inline uint64_t hashBytes(const void* data, size_t length) {
+    return Hasher().update(data, length).digest();
+}
+
+inline uint64_t hashString(const std::string& text) {
+    return hashBytes(text.data(), text.size());
+}
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // HASH_H
@@ -0,0 +1,529 @@
+#include "HedgingClient.h"
+#include "HTTPClient.h"
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace opencog {
+namespace caichat {
+
+typedef std::chrono::steady_clock Clock;
+
+// LatencyTracker implementation
+LatencyTracker::LatencyTracker(size_t size) : next(0), window(size > 0 ? size : 1) {
+}
+
+void LatencyTracker::record(std::chrono::milliseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.size() < window) {
+        samples.push_back((long)latency.count());
+    } else {
+        samples[next] = (long)latency.count();
+    }
+    next = (next + 1) % window;
+}
+
+std::chrono::milliseconds LatencyTracker::quantile(double q, std::chrono::milliseconds fallback) const {
+    std::vector<long> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (samples.size() < MIN_SAMPLES) {
+            return fallback;
+        }
+        sorted = samples;
+    }
+    size_t rank = std::min(sorted.size() - 1, (size_t)(q * (double)sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return std::chrono::milliseconds(sorted[rank]);
+}
+
+size_t LatencyTracker::count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return samples.size();
+}
+
+// Failures worth sending to another backend
+static bool isRetryable(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const HTTPError& e) {
+        return e.isRetryable();
+    } catch (...) {
+        return false;
+    }
+}
+
+static HTTPError timedOut(const HedgingClient::Options& options) {
+    return HTTPError("Request timed out after " + std::to_string(options.timeoutMs) + " ms", 0);
+}
+
+static std::mutex defaultOptionsMutex;
+static HedgingClient::Options defaultOptions;
+
+void HedgingClient::setDefaultOptions(const Options& opts) {
+    std::lock_guard<std::mutex> lock(defaultOptionsMutex);
+    defaultOptions = opts;
+}
+
+HedgingClient::Options HedgingClient::getDefaultOptions() {
+    std::lock_guard<std::mutex> lock(defaultOptionsMutex);
+    return defaultOptions;
+}
+
+HedgingClient::HedgingClient(std::vector<Backend> list, const Options& opts)
+    : state(std::make_shared<State>()) {
+    if (list.empty()) {
+        throw std::runtime_error("HedgingClient needs at least one backend");
+    }
+    state->backends = std::move(list);
+    state->options = opts;
+    if (state->options.maxAttempts == 0) {
+        state->options.maxAttempts = 1;
+    }
+}
+
+bool HedgingClient::isSpec(const std::string& provider) {
+    std::string mode = provider.substr(0, provider.find(':'));
+    return mode.size() < provider.size() &&
+           (mode == "hedge" || mode == "race" || mode == "failover");
+}
+
+std::unique_ptr<HedgingClient> HedgingClient::fromSpec(const std::string& spec, const Options& opts) {
+    if (!isSpec(spec)) {
+        throw std::runtime_error("Invalid hedging spec: " + spec);
+    }
+    size_t colon = spec.find(':');
+    std::string mode = spec.substr(0, colon);
+    Options options = opts;
+    options.mode = mode == "race" ? Mode::Race : mode == "failover" ? Mode::Failover : Mode::Hedge;
+
+    std::vector<Backend> backends;
+    size_t start = colon + 1;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(start, end - start);
+        if (!item.empty()) {
+            size_t slash = item.find('/');
+            Backend backend;
+            backend.client = ClientFactory::createClient(item.substr(0, slash));
+            if (slash != std::string::npos) {
+                backend.model = item.substr(slash + 1);
+            }
+            backends.push_back(std::move(backend));
+        }
+        start = end + 1;
+    }
+    return std::unique_ptr<HedgingClient>(new HedgingClient(std::move(backends), options));
+}
+
+std::chrono::milliseconds HedgingClient::State::hedgeDelay() const {
+    std::chrono::milliseconds delay = latencies.quantile(
+        options.hedgeQuantile, std::chrono::milliseconds(options.initialHedgeDelayMs));
+    return std::max(delay, std::chrono::milliseconds(options.minHedgeDelayMs));
+}
+
+// Exponential backoff with equal jitter, so retries of concurrent
+// requests spread out instead of arriving together
+std::chrono::milliseconds HedgingClient::State::backoff(unsigned retry) const {
+    static thread_local std::mt19937 random(std::random_device{}());
+    unsigned long cap = std::min<unsigned long>((unsigned long)options.backoffMs << std::min(retry, 16u),
+                                                30000);
+    std::uniform_int_distribution<unsigned long> jitter(0, cap / 2);
+    return std::chrono::milliseconds(cap / 2 + jitter(random));
+}
+
+/**
+ * One thread firing the hedge, backoff and deadline timers of every
+ * request in flight, so no request needs a thread of its own
+ */
+class RequestTimers {
+public:
+    static RequestTimers& instance() {
+        static RequestTimers timers;
+        return timers;
+    }
+
+    void schedule(Clock::time_point when, std::function<void()> fire) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable()) {
+            thread = std::thread([this] { run(); });
+        }
+        bool earliest = timers.empty() || when < timers.begin()->first;
+        timers.emplace(when, std::move(fire));
+        if (earliest) {
+            changed.notify_one();
+        }
+    }
+
+    ~RequestTimers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+private:
+    RequestTimers() : stopping(false) {}
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (timers.empty()) {
+                changed.wait(lock);
+                continue;
+            }
+            Clock::time_point when = timers.begin()->first;
+            if (Clock::now() < when) {
+                changed.wait_until(lock, when);
+                continue;
+            }
+            std::function<void()> fire = std::move(timers.begin()->second);
+            timers.erase(timers.begin());
+            lock.unlock();
+            try {
+                fire();
+            } catch (...) {
+                // A throwing timer must not stop the others
+            }
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::multimap<Clock::time_point, std::function<void()>> timers;
+    std::thread thread;
+    bool stopping;
+};
+
+// State of one request shared by its attempts and timers; guarded by mutex
+struct HedgingClient::Request {
+    std::shared_ptr<State> state;
+    std::vector<Message> messages;
+    std::string model;
+    CompletionCallback onDone;
+
+    std::mutex mutex;
+    bool settled = false;        // onDone has been called or is being called
+    bool done = false;           // an attempt succeeded
+    bool cancelled = false;
+    std::string content;
+    std::exception_ptr error;    // last failure
+    unsigned failures = 0;       // retryable failures not yet acted on
+    bool fatal = false;          // a failure retrying cannot fix
+    unsigned launched = 0;
+    unsigned running = 0;
+    unsigned retries = 0;
+    Clock::time_point deadline = Clock::time_point::max();
+    Clock::time_point lastLaunch;
+    Clock::time_point retryAt = Clock::time_point::max();   // retry waiting out its backoff
+    Clock::time_point timerAt = Clock::time_point::max();   // earliest pending timer
+    std::vector<CancelHandle> attempts;
+};
+
+// Count a retry or hedge against the backend it is sent to
+void HedgingClient::count(const Backend& backend, const std::string& model,
+                          Counter ModelMetrics::*reason) {
+    if (Metrics::isEnabled()) {
+        ModelMetrics& metrics = Metrics::instance().forModel(backend.client->getProviderName(),
+                                                             backend.model.empty() ? model : backend.model);
+        (metrics.*reason).add();
+    }
+}
+
+// Start one more attempt on the next backend in turn
+void HedgingClient::launch(const std::shared_ptr<Request>& request, Counter ModelMetrics::*reason) {
+    const State& state = *request->state;
+    CancelHandle attempt = std::make_shared<Cancellation>();
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(request->mutex);
+        if (request->settled) {
+            return;
+        }
+        index = request->launched++ % state.backends.size();
+        request->running++;
+        request->lastLaunch = Clock::now();
+        request->attempts.push_back(attempt);
+    }
+    const Backend& backend = state.backends[index];
+    if (reason) {
+        count(backend, request->model, reason);
+    }
+    Clock::time_point start = Clock::now();
+    backend.client->submitChatCompletion(request->messages,
+        [request, start](const std::string& content, std::exception_ptr error) {
+            {
+                std::lock_guard<std::mutex> lock(request->mutex);
+                request->running--;
+                if (!request->done && !request->settled) {
+                    if (!error) {
+                        request->done = true;
+                        request->content = content;
+                        request->state->latencies.record(std::chrono::duration_cast<std::chrono::milliseconds>(
+                            Clock::now() - start));
+                    } else {
+                        request->error = error;
+                        if (isRetryable(error)) {
+                            request->failures++;
+                        } else {
+                            request->fatal = true;
+                        }
+                    }
+                }
+            }
+            advance(request);
+        },
+        backend.model.empty() ? request->model : backend.model, attempt);
+}
+
+// Move a request on whenever something changes (submission, a finished
+// attempt, cancellation or a timer): launch the attempts its mode, hedge
+// delay and failures call for, settle it once an attempt has succeeded or
+// nothing is left to try, and otherwise set a timer for the next decision
+void HedgingClient::advance(const std::shared_ptr<Request>& request) {
+    const State& state = *request->state;
+    const Options& options = state.options;
+    for (;;) {
+        Counter ModelMetrics::*reason = nullptr;
+        Clock::time_point wake = Clock::time_point::max();
+        bool schedule = false;
+        bool settle = false;
+        CompletionCallback onDone;
+        std::string content;
+        std::exception_ptr error;
+        std::vector<CancelHandle> attempts;
+        {
+            std::lock_guard<std::mutex> lock(request->mutex);
+            if (request->settled) {
+                return;
+            }
+            Clock::time_point now = Clock::now();
+            bool canLaunch = request->launched < options.maxAttempts && !request->fatal;
+            if (request->done || request->cancelled) {
+                settle = true;
+            } else if (now >= request->deadline) {
+                request->error = std::make_exception_ptr(timedOut(options));
+                settle = true;
+            } else if (request->retryAt != Clock::time_point::max()) {
+                if (now >= request->retryAt) {
+                    request->retryAt = Clock::time_point::max();
+                    reason = &ModelMetrics::retries;
+                } else {
+                    wake = request->retryAt;
+                }
+            } else if (request->failures > 0 && canLaunch) {
+                request->failures--;
+                request->retryAt = now + state.backoff(request->retries++);
+                wake = request->retryAt;
+            } else if (request->running == 0) {
+                settle = true;   // failed with nothing left to try
+            } else if (options.mode == Mode::Hedge && canLaunch) {
+                Clock::time_point hedgeAt = request->lastLaunch + state.hedgeDelay();
+                if (now >= hedgeAt) {
+                    reason = &ModelMetrics::hedges;
+                } else {
+                    wake = hedgeAt;
+                }
+            }
+
+            if (settle) {
+                request->settled = true;
+                onDone = std::move(request->onDone);
+                content = request->content;
+                if (request->done) {
+                    error = nullptr;
+                } else if (request->cancelled) {
+                    error = std::make_exception_ptr(std::runtime_error(AsyncHTTPEngine::CANCELLED));
+                } else {
+                    error = request->error ? request->error : std::make_exception_ptr(
+                        std::runtime_error("All backends failed"));
+                }
+                attempts.swap(request->attempts);
+            } else if (!reason) {
+                wake = std::min(wake, request->deadline);
+                if (wake < request->timerAt) {
+                    request->timerAt = wake;
+                    schedule = true;
+                }
+            }
+        }
+
+        if (settle) {
+            // Abort whatever is still running, then report
+            for (const CancelHandle& attempt : attempts) {
+                attempt->cancel();
+            }
+            onDone(error ? "" : content, error);
+            return;
+        }
+        if (reason) {
+            launch(request, reason);
+            continue;
+        }
+        if (schedule) {
+            // Holds the request, which may wait on nothing else (a backoff)
+            RequestTimers::instance().schedule(wake, [request, wake] {
+                {
+                    std::lock_guard<std::mutex> lock(request->mutex);
+                    if (request->timerAt == wake) {
+                        request->timerAt = Clock::time_point::max();
+                    }
+                }
+                advance(request);
+            });
+        }
+        return;
+    }
+}
+
+void HedgingClient::submitChatCompletion(const std::vector<Message>& messages,
+                                         CompletionCallback onDone,
+                                         const std::string& model,
+                                         CancelHandle cancel) {
+    const Options& options = state->options;
+    auto request = std::make_shared<Request>();
+    request->state = state;
+    request->messages = messages;
+    request->model = model;
+    request->onDone = onDone;
+    if (options.timeoutMs) {
+        request->deadline = Clock::now() + std::chrono::milliseconds(options.timeoutMs);
+    }
+    if (cancel) {
+        cancel->onCancel([request] {
+            {
+                std::lock_guard<std::mutex> lock(request->mutex);
+                request->cancelled = true;
+            }
+            advance(request);
+        });
+    }
+    unsigned initial = options.mode == Mode::Race
+        ? std::min<unsigned>((unsigned)state->backends.size(), options.maxAttempts) : 1;
+    for (unsigned i = 0; i < initial; ++i) {
+        launch(request);
+    }
+    advance(request);
+}
+
+std::string HedgingClient::chatCompletion(const std::vector<Message>& messages,
+                                          const std::string& model) {
+    return chatCompletionAsync(messages, model).get();
+}
+
+// Try backends one after another while failures are retryable and the
+// deadline has not passed
+template <typename Result, typename Fn>
+Result HedgingClient::failover(const std::string& model, Fn fn) {
+    const Options& options = state->options;
+    Clock::time_point deadline = options.timeoutMs
+        ? Clock::now() + std::chrono::milliseconds(options.timeoutMs)
+        : Clock::time_point::max();
+    for (unsigned attempt = 0; ; ++attempt) {
+        const Backend& backend = state->backends[attempt % state->backends.size()];
+        if (attempt > 0) {
+            count(backend, model, &ModelMetrics::retries);
+        }
+        try {
+            DeadlineScope scope(deadline);
+            return fn(backend);
+        } catch (const HTTPError& e) {
+            if (!e.isRetryable() || attempt + 1 >= options.maxAttempts) {
+                throw;
+            }
+        }
+        Clock::time_point resume = Clock::now() + state->backoff(attempt);
+        if (resume >= deadline) {
+            throw timedOut(options);
+        }
+        std::this_thread::sleep_until(resume);
+    }
+}
+
+std::string HedgingClient::chatCompletionStream(const std::vector<Message>& messages,
+                                                TokenCallback onToken,
+                                                const std::string& model) {
+    bool started = false;
+    return failover<std::string>(model, [&](const Backend& backend) {
+        try {
+            return backend.client->chatCompletionStream(messages,
+                [&](const std::string& token) {
+                    started = true;
+                    onToken(token);
+                },
+                backend.model.empty() ? model : backend.model);
+        } catch (const HTTPError& e) {
+            if (started) {
+                throw std::runtime_error(e.what());   // not retryable once tokens are out
+            }
+            throw;
+        }
+    });
+}
+
+ChatReply HedgingClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                 const std::vector<ToolDefinition>& tools,
+                                                 const std::string& model) {
+    return failover<ChatReply>(model, [&](const Backend& backend) {
+        return backend.client->chatCompletionWithTools(messages, tools,
+                                                       backend.model.empty() ? model : backend.model);
+    });
+}
+
+std::vector<Embedding> HedgingClient::embed(const std::vector<std::string>& inputs,
+                                            const std::string& model) {
+    return failover<std::vector<Embedding>>(model, [&](const Backend& backend) {
+        return backend.client->embed(inputs, backend.model.empty() ? model : backend.model);
+    });
+}
+
+void HedgingClient::setApiKey(const std::string& key) {
+    std::string provider = getProviderName();
+    for (Backend& backend : state->backends) {
+        if (backend.client->getProviderName() == provider) {
+            backend.client->setApiKey(key);
+        }
+    }
+}
+
+std::string HedgingClient::getProviderName() const {
+    return state->backends.front().client->getProviderName();
+}
+
+std::string HedgingClient::getIdentity() const {
+    std::string identity = "hedge(";
+    for (const Backend& backend : state->backends) {
+        identity += backend.client->getIdentity() + "/" + backend.model + ",";
+    }
+    return identity + ")";
+}
+
+size_t HedgingClient::contextWindow(const std::string& model) const {
+    size_t window = 0;
+    for (const Backend& backend : state->backends) {
+        size_t tokens = backend.client->contextWindow(backend.model.empty() ? model : backend.model);
+        if (window == 0 || tokens < window) {
+            window = tokens;
+        }
+    }
+    return window;
+}
+
+LLMClient* HedgingClient::getUnderlyingClient() {
+    return state->backends.front().client->getUnderlyingClient();
+}
+
+} // namespace caichat
+} // namespace opencog
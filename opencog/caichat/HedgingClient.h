@@ -0,0 +1,164 @@
+#ifndef HEDGINGCLIENT_H
+#define HEDGINGCLIENT_H
+
+#include "LLMClient.h"
+#include "Metrics.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Tracks recent request latencies to derive a hedging delay
+ */
+class LatencyTracker {
+public:
+    explicit LatencyTracker(size_t window = 256);
+
+    void record(std::chrono::milliseconds latency);
+
+    /**
+     * Latency below which the given fraction of recent requests finished;
+     * fallback until enough samples have been recorded
+     */
+    std::chrono::milliseconds quantile(double q, std::chrono::milliseconds fallback) const;
+
+    size_t count() const;
+
+private:
+    static const size_t MIN_SAMPLES = 20;
+
+    mutable std::mutex mutex;
+    std::vector<long> samples;   // ring buffer, milliseconds
+    size_t next;
+    size_t window;
+};
+
+/**
+ * LLMClient spreading each request over several backends to cut tail
+ * latency and ride out failing providers.
+ *
+ * Hedge:    send to the first backend; if it has not answered within the
+ *           recent p95 latency, also send to the next one. The first
+ *           success wins.
+ * Race:     send to every backend at once; the first success wins.
+ * Failover: send to one backend at a time.
+ *
+ * In every mode a transport error, 429 or 5xx moves on to the next
+ * backend after a jittered exponential backoff, up to maxAttempts
+ * requests in total. Requests that lose are cancelled, which aborts
+ * their transfers on the curl_multi loop. Backends may repeat a provider
+ * to hedge over a second connection.
+ *
+ * Streaming and embeddings fail over only: a reply that has started
+ * streaming cannot be switched to another backend.
+ *
+ * Every request, asynchronous or blocking, fails once timeoutMs has
+ * passed; blocking attempts run in a DeadlineScope, so their transfers
+ * are aborted at the deadline.
+ *
+ * Asynchronous requests take no thread of their own: attempts finish on
+ * the curl_multi loop, and one timer thread shared by all clients fires
+ * hedge, backoff and deadline timers. Requests in flight keep the
+ * backends alive, so the client may be destroyed before they finish.
+ */
+class HedgingClient : public LLMClient {
+public:
+    enum class Mode { Hedge, Race, Failover };
+
+    struct Options {
+        Mode mode = Mode::Hedge;
+        double hedgeQuantile = 0.95;
+        unsigned initialHedgeDelayMs = 2000;   // until enough latencies are known
+        unsigned minHedgeDelayMs = 50;
+        unsigned maxAttempts = 3;
+        unsigned backoffMs = 250;              // doubled per retry, full jitter
+        unsigned timeoutMs = 120000;           // whole request, 0 = none
+    };
+
+    struct Backend {
+        std::shared_ptr<LLMClient> client;
+        std::string model;   // "" = the model passed to each call
+    };
+
+    HedgingClient(std::vector<Backend> backends, const Options& options);
+
+    /**
+     * Parse "mode:provider[/model],provider[/model],..." (mode is hedge,
+     * race or failover) into backends created by ClientFactory
+     */
+    static std::unique_ptr<HedgingClient> fromSpec(const std::string& spec, const Options& options);
+    static bool isSpec(const std::string& provider);
+
+    /**
+     * Options for clients created by ClientFactory from a spec
+     */
+    static void setDefaultOptions(const Options& options);
+    static Options getDefaultOptions();
+
+    std::string chatCompletion(const std::vector<Message>& messages,
+                               const std::string& model = "") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "") override;
+    void setApiKey(const std::string& key) override;
+
+    /**
+     * Provider of the first backend, so context windows and rate limits
+     * follow the primary provider
+     */
+    std::string getProviderName() const override;
+
+    /**
+     * Identities of all backends, any of which may answer
+     */
+    std::string getIdentity() const override;
+
+    /**
+     * Smallest window of the backends, as any of them may be asked
+     */
+    size_t contextWindow(const std::string& model = "") const override;
+    LLMClient* getUnderlyingClient() override;
+
+    const LatencyTracker& getLatencies() const { return state->latencies; }
+
+private:
+    // Shared with every request in flight, so attempts that finish after
+    // the client is gone still have their backends and latency tracker
+    struct State {
+        std::vector<Backend> backends;
+        Options options;
+        LatencyTracker latencies;
+
+        std::chrono::milliseconds hedgeDelay() const;
+        std::chrono::milliseconds backoff(unsigned retry) const;
+    };
+
+    struct Request;
+
+    static void advance(const std::shared_ptr<Request>& request);
+    static void launch(const std::shared_ptr<Request>& request, Counter ModelMetrics::*reason = nullptr);
+    static void count(const Backend& backend, const std::string& model, Counter ModelMetrics::*reason);
+    template <typename Result, typename Fn>
+    Result failover(const std::string& model, Fn fn);
+
+    std::shared_ptr<State> state;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // HEDGINGCLIENT_H
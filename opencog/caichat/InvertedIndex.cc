@@ -0,0 +1,168 @@
+#include "InvertedIndex.h"
+#include <algorithm>
+#include <cmath>
+
+namespace opencog {
+namespace caichat {
+
+constexpr float InvertedIndex::K1;
+constexpr float InvertedIndex::B;
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static uint32_t getVarint(const uint8_t*& p) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= (uint32_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (uint32_t)(*p++) << shift;
+    return value;
+}
+
+static bool isTermByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c >= 0x80;
+}
+
+void InvertedIndex::tokenize(const char* text, size_t length,
+                             const std::function<void(const std::string& term)>& fn) {
+    std::string term;
+    for (size_t i = 0; i <= length; ++i) {
+        unsigned char c = i < length ? (unsigned char)text[i] : ' ';
+        if (isTermByte(c)) {
+            term.push_back((c >= 'A' && c <= 'Z') ? (char)(c + 32) : (char)c);
+        } else if (!term.empty()) {
+            fn(term);
+            term.clear();
+        }
+    }
+}
+
+InvertedIndex::InvertedIndex() : totalLength(0), liveDocs(0) {
+}
+
+void InvertedIndex::add(uint32_t doc, const char* text, size_t length) {
+    if (doc < lengths.size() && lengths[doc] != 0) {
+        return;   // already indexed
+    }
+    std::unordered_map<std::string, uint32_t> counts;
+    uint32_t termCount = 0;
+    tokenize(text, length, [&](const std::string& term) {
+        counts[term]++;
+        termCount++;
+    });
+
+    if (lengths.size() <= doc) {
+        lengths.resize(doc + 1, 0);
+    }
+    lengths[doc] = std::max<uint32_t>(termCount, 1);
+    totalLength += lengths[doc];
+    liveDocs++;
+
+    for (const auto& entry : counts) {
+        Postings& postings = terms[entry.first];
+        // The first delta is the id itself
+        putVarint(postings.bytes, postings.bytes.empty() ? doc : doc - postings.lastDoc);
+        putVarint(postings.bytes, entry.second);
+        postings.lastDoc = doc;
+        postings.docFrequency++;
+    }
+}
+
+void InvertedIndex::remove(uint32_t doc, const char* text, size_t length) {
+    if (doc >= lengths.size() || lengths[doc] == 0) {
+        return;
+    }
+    // Postings keep the entry; searches skip documents of length 0
+    std::unordered_map<std::string, bool> seen;
+    tokenize(text, length, [&](const std::string& term) {
+        if (!seen[term]) {
+            seen[term] = true;
+            auto it = terms.find(term);
+            if (it != terms.end() && it->second.docFrequency > 0) {
+                it->second.docFrequency--;
+            }
+        }
+    });
+    totalLength -= lengths[doc];
+    lengths[doc] = 0;
+    liveDocs--;
+}
+
+std::vector<InvertedIndex::Result> InvertedIndex::search(const std::string& query, size_t k) const {
+    std::vector<Result> results;
+    if (liveDocs == 0 || k == 0) {
+        return results;
+    }
+
+    std::vector<std::string> queryTerms;
+    tokenize(query.data(), query.size(), [&](const std::string& term) {
+        if (std::find(queryTerms.begin(), queryTerms.end(), term) == queryTerms.end()) {
+            queryTerms.push_back(term);
+        }
+    });
+
+    // Term-at-a-time accumulation
+    float averageLength = (float)totalLength / (float)liveDocs;
+    std::unordered_map<uint32_t, float> scores;
+    for (const std::string& term : queryTerms) {
+        auto it = terms.find(term);
+        if (it == terms.end() || it->second.docFrequency == 0) {
+            continue;
+        }
+        const Postings& postings = it->second;
+        float df = (float)postings.docFrequency;
+        float idf = std::log(1.0f + ((float)liveDocs - df + 0.5f) / (df + 0.5f));
+
+        const uint8_t* p = postings.bytes.data();
+        const uint8_t* end = p + postings.bytes.size();
+        uint32_t doc = 0;
+        bool first = true;
+        while (p < end) {
+            uint32_t delta = getVarint(p);
+            uint32_t tf = getVarint(p);
+            doc = first ? delta : doc + delta;
+            first = false;
+            uint32_t length = lengths[doc];
+            if (length == 0) {
+                continue;   // removed
+            }
+            float norm = K1 * (1.0f - B + B * (float)length / averageLength);
+            scores[doc] += idf * ((float)tf * (K1 + 1.0f)) / ((float)tf + norm);
+        }
+    }
+
+    results.reserve(scores.size());
+    for (const auto& entry : scores) {
+        results.push_back(Result{entry.first, entry.second});
+    }
+    auto better = [](const Result& a, const Result& b) {
+        return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+    };
+    if (results.size() > k) {
+        std::partial_sort(results.begin(), results.begin() + k, results.end(), better);
+        results.resize(k);
+    } else {
+        std::sort(results.begin(), results.end(), better);
+    }
+    return results;
+}
+
+size_t InvertedIndex::getPostingBytes() const {
+    size_t bytes = 0;
+    for (const auto& entry : terms) {
+        bytes += entry.second.bytes.size();
+    }
+    return bytes;
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,79 @@
+#ifndef INVERTEDINDEX_H
+#define INVERTEDINDEX_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Keyword index with BM25 ranking.
+ *
+ * Terms are maximal runs of letters, digits, '_' and non-ASCII bytes,
+ * lowercased, so identifiers such as ERR_CONN_RESET or 0x80004005 stay
+ * whole. Each term's posting list is a byte string of varint-encoded
+ * (document id delta, term frequency) pairs; documents must be added in
+ * increasing id order.
+ *
+ * Not synchronized; the owner serializes writes against searches.
+ */
+class InvertedIndex {
+public:
+    struct Result {
+        uint32_t doc;
+        float score;   // BM25, higher is better
+    };
+
+    InvertedIndex();
+
+    /**
+     * Index a document; doc must be larger than every id added before
+     */
+    void add(uint32_t doc, const char* text, size_t length);
+
+    /**
+     * Stop returning a document. Its text is needed to update the term
+     * statistics.
+     */
+    void remove(uint32_t doc, const char* text, size_t length);
+
+    /**
+     * k best documents for the query terms, best first
+     */
+    std::vector<Result> search(const std::string& query, size_t k) const;
+
+    size_t getDocumentCount() const { return liveDocs; }
+    size_t getTermCount() const { return terms.size(); }
+    size_t getPostingBytes() const;
+
+    /**
+     * Call fn with each lowercased term of text
+     */
+    static void tokenize(const char* text, size_t length,
+                         const std::function<void(const std::string& term)>& fn);
+
+    // BM25 parameters
+    static constexpr float K1 = 1.2f;
+    static constexpr float B = 0.75f;
+
+private:
+    struct Postings {
+        std::vector<uint8_t> bytes;
+        uint32_t lastDoc = 0;
+        uint32_t docFrequency = 0;   // live documents containing the term
+    };
+
+    std::unordered_map<std::string, Postings> terms;
+    std::vector<uint32_t> lengths;   // terms per document, 0 once removed
+    uint64_t totalLength;            // over live documents
+    size_t liveDocs;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // INVERTEDINDEX_H
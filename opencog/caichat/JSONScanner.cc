@@ -0,0 +1,379 @@
+#include "JSONScanner.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace opencog {
+namespace caichat {
+
+// Scanning helpers. All return nullptr on malformed input.
+static const char* skipWhitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        ++p;
+    }
+    return p;
+}
+
+// p points at the opening quote; returns the position after the closing one
+static const char* skipString(const char* p, const char* end) {
+    ++p;
+    while (p < end) {
+        const char* quote = static_cast<const char*>(std::memchr(p, '"', end - p));
+        if (!quote) {
+            return nullptr;
+        }
+        // The quote is escaped if preceded by an odd number of backslashes
+        size_t backslashes = 0;
+        for (const char* q = quote - 1; q >= p && *q == '\\'; --q) {
+            ++backslashes;
+        }
+        if (backslashes % 2 == 0) {
+            return quote + 1;
+        }
+        p = quote + 1;
+    }
+    return nullptr;
+}
+
+static const char* skipValue(const char* p, const char* end) {
+    p = skipWhitespace(p, end);
+    if (p >= end) {
+        return nullptr;
+    }
+    if (*p == '"') {
+        return skipString(p, end);
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (p < end) {
+            char c = *p;
+            if (c == '"') {
+                p = skipString(p, end);
+                if (!p) {
+                    return nullptr;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    return p + 1;
+                }
+            }
+            ++p;
+        }
+        return nullptr;
+    }
+    // Number or literal
+    const char* start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+           *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+        ++p;
+    }
+    return p > start ? p : nullptr;
+}
+
+static void appendUTF8(std::string& out, unsigned long cp) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xc0 | (cp >> 6)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xe0 | (cp >> 12)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    } else {
+        out.push_back((char)(0xf0 | (cp >> 18)));
+        out.push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    }
+}
+
+static bool parseHex4(const char* p, const char* end, unsigned long& out) {
+    if (end - p < 4) {
+        return false;
+    }
+    out = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        out <<= 4;
+        if (c >= '0' && c <= '9') out |= c - '0';
+        else if (c >= 'a' && c <= 'f') out |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') out |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// Decode the string literal starting at p (the opening quote)
+static bool decodeString(const char* p, const char* end, std::string& out) {
+    const char* close = skipString(p, end);
+    if (!close) {
+        return false;
+    }
+    const char* s = p + 1;
+    const char* e = close - 1;
+
+    out.clear();
+    out.reserve(e - s);
+    while (s < e) {
+        const char* backslash = static_cast<const char*>(std::memchr(s, '\\', e - s));
+        if (!backslash) {
+            out.append(s, e - s);
+            break;
+        }
+        out.append(s, backslash - s);
+        s = backslash + 1;
+        if (s >= e) {
+            return false;
+        }
+        switch (*s++) {
+            case '"':  out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/':  out.push_back('/'); break;
+            case 'b':  out.push_back('\b'); break;
+            case 'f':  out.push_back('\f'); break;
+            case 'n':  out.push_back('\n'); break;
+            case 'r':  out.push_back('\r'); break;
+            case 't':  out.push_back('\t'); break;
+            case 'u': {
+                unsigned long cp;
+                if (!parseHex4(s, e, cp)) {
+                    return false;
+                }
+                s += 4;
+                if (cp >= 0xd800 && cp <= 0xdbff && e - s >= 6 && s[0] == '\\' && s[1] == 'u') {
+                    unsigned long low;
+                    if (parseHex4(s + 2, e, low) && low >= 0xdc00 && low <= 0xdfff) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        s += 6;
+                    }
+                }
+                appendUTF8(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Compare a raw key literal (between quotes) with a plain name
+static bool keyEquals(const char* keyStart, const char* keyEnd, const char* name) {
+    size_t length = keyEnd - keyStart;
+    if (!std::memchr(keyStart, '\\', length)) {
+        return std::strlen(name) == length && std::memcmp(keyStart, name, length) == 0;
+    }
+    std::string decoded;
+    return decodeString(keyStart - 1, keyEnd + 1, decoded) && decoded == name;
+}
+
+// JSONValue implementation
+JSONValue::JSONValue(const char* data, size_t length)
+    : begin(skipWhitespace(data, data + length)), end(data + length) {
+}
+
+JSONValue::JSONValue(const std::string& json)
+    : JSONValue(json.data(), json.size()) {
+}
+
+JSONValue::Type JSONValue::type() const {
+    if (!begin || begin >= end) {
+        return Invalid;
+    }
+    switch (*begin) {
+        case '{': return Object;
+        case '[': return Array;
+        case '"': return String;
+        case 't':
+        case 'f': return Bool;
+        case 'n': return Null;
+        default:
+            return (*begin == '-' || (*begin >= '0' && *begin <= '9')) ? Number : Invalid;
+    }
+}
+
+JSONValue JSONValue::member(const char* name) const {
+    if (type() != Object) {
+        return JSONValue();
+    }
+    const char* p = begin + 1;
+    while (true) {
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != '"') {
+            return JSONValue();
+        }
+        const char* keyEnd = skipString(p, end);
+        if (!keyEnd) {
+            return JSONValue();
+        }
+        bool match = keyEquals(p + 1, keyEnd - 1, name);
+
+        p = skipWhitespace(keyEnd, end);
+        if (p >= end || *p != ':') {
+            return JSONValue();
+        }
+        p = skipWhitespace(p + 1, end);
+        if (match) {
+            return JSONValue(p, end, true);
+        }
+
+        p = skipValue(p, end);
+        if (!p) {
+            return JSONValue();
+        }
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != ',') {
+            return JSONValue();
+        }
+        ++p;
+    }
+}
+
+JSONValue JSONValue::element(int index) const {
+    if (type() != Array || index < 0) {
+        return JSONValue();
+    }
+    const char* p = skipWhitespace(begin + 1, end);
+    if (p < end && *p == ']') {
+        return JSONValue();
+    }
+    for (int i = 0; ; ++i) {
+        p = skipWhitespace(p, end);
+        if (i == index) {
+            return JSONValue(p, end, true);
+        }
+        p = skipValue(p, end);
+        if (!p) {
+            return JSONValue();
+        }
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != ',') {
+            return JSONValue();
+        }
+        ++p;
+    }
+}
+
+JSONValue JSONValue::find(std::initializer_list<JSONPath> path) const {
+    JSONValue current = *this;
+    for (const JSONPath& step : path) {
+        current = step.key ? current.member(step.key) : current.element(step.index);
+        if (!current.isValid()) {
+            break;
+        }
+    }
+    return current;
+}
+
+bool JSONValue::getString(std::initializer_list<JSONPath> path, std::string& out) const {
+    return find(path).asString(out);
+}
+
+bool JSONValue::getNumber(std::initializer_list<JSONPath> path, double& out) const {
+    return find(path).asNumber(out);
+}
+
+bool JSONValue::getInt(std::initializer_list<JSONPath> path, long& out) const {
+    double number;
+    if (!find(path).asNumber(number)) {
+        return false;
+    }
+    out = (long)number;
+    return true;
+}
+
+bool JSONValue::asString(std::string& out) const {
+    return type() == String && decodeString(begin, end, out);
+}
+
+bool JSONValue::asNumber(double& out) const {
+    if (type() != Number) {
+        return false;
+    }
+    // Copy out first: the buffer is not necessarily NUL-terminated
+    const char* stop = skipValue(begin, end);
+    if (!stop || stop - begin >= 64) {
+        return false;
+    }
+    char buf[64];
+    std::memcpy(buf, begin, stop - begin);
+    buf[stop - begin] = '\0';
+    char* parsed = nullptr;
+    out = std::strtod(buf, &parsed);
+    return parsed != buf;
+}
+
+bool JSONValue::asBool(bool& out) const {
+    if (type() != Bool) {
+        return false;
+    }
+    out = (*begin == 't');
+    return true;
+}
+
+void JSONValue::forEach(const std::function<void(const JSONValue& element)>& fn) const {
+    if (type() != Array) {
+        return;
+    }
+    const char* p = skipWhitespace(begin + 1, end);
+    if (p < end && *p == ']') {
+        return;
+    }
+    while (p && p < end) {
+        p = skipWhitespace(p, end);
+        fn(JSONValue(p, end, true));
+        p = skipValue(p, end);
+        if (!p) {
+            return;
+        }
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != ',') {
+            return;
+        }
+        ++p;
+    }
+}
+
+void JSONValue::forEachMember(const std::function<void(const std::string& key, const JSONValue& value)>& fn) const {
+    if (type() != Object) {
+        return;
+    }
+    const char* p = begin + 1;
+    std::string key;
+    while (true) {
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != '"' || !decodeString(p, end, key)) {
+            return;
+        }
+        p = skipWhitespace(skipString(p, end), end);
+        if (p >= end || *p != ':') {
+            return;
+        }
+        p = skipWhitespace(p + 1, end);
+        fn(key, JSONValue(p, end, true));
+        p = skipValue(p, end);
+        if (!p) {
+            return;
+        }
+        p = skipWhitespace(p, end);
+        if (p >= end || *p != ',') {
+            return;
+        }
+        ++p;
+    }
+}
+
+std::string JSONValue::raw() const {
+    if (!isValid()) {
+        return std::string();
+    }
+    const char* stop = skipValue(begin, end);
+    return stop ? std::string(begin, stop) : std::string();
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,89 @@
+#ifndef JSONSCANNER_H
+#define JSONSCANNER_H
+
+#include <functional>
+#include <initializer_list>
+#include <string>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * One step of a lookup path: an object member name or an array index
+ */
+struct JSONPath {
+    JSONPath(const char* name) : key(name), index(-1) {}
+    JSONPath(int i) : key(nullptr), index(i) {}
+
+    const char* key;
+    int index;
+};
+
+/**
+ * Read-only view of a JSON value inside a larger buffer.
+ *
+ * Lookups walk the raw text and skip everything that is not on the
+ * requested path, so pulling a few fields out of a large response costs
+ * one forward scan and no document tree. Only the extracted string is
+ * unescaped and copied. The underlying buffer must outlive the view.
+ */
+class JSONValue {
+public:
+    enum Type { Invalid, Null, Bool, Number, String, Array, Object };
+
+    JSONValue() : begin(nullptr), end(nullptr) {}
+    JSONValue(const char* data, size_t length);
+    explicit JSONValue(const std::string& json);
+    explicit JSONValue(std::string&&) = delete;   // the view would dangle
+
+    Type type() const;
+    bool isValid() const { return type() != Invalid; }
+
+    /**
+     * Value at path, or an Invalid value if any step is missing
+     */
+    JSONValue find(std::initializer_list<JSONPath> path) const;
+
+    /**
+     * Convenience lookups; return false if missing or of another type
+     */
+    bool getString(std::initializer_list<JSONPath> path, std::string& out) const;
+    bool getNumber(std::initializer_list<JSONPath> path, double& out) const;
+    bool getInt(std::initializer_list<JSONPath> path, long& out) const;
+
+    /**
+     * Decode this value; false if it is not of the requested type
+     */
+    bool asString(std::string& out) const;
+    bool asNumber(double& out) const;
+    bool asBool(bool& out) const;
+
+    /**
+     * Call fn for each element of an array value
+     */
+    void forEach(const std::function<void(const JSONValue& element)>& fn) const;
+
+    /**
+     * Call fn for each member of an object value
+     */
+    void forEachMember(const std::function<void(const std::string& key, const JSONValue& value)>& fn) const;
+
+    /**
+     * Raw JSON text of this value
+     */
+    std::string raw() const;
+
+private:
+    JSONValue(const char* b, const char* e, bool) : begin(b), end(e) {}
+
+    JSONValue member(const char* key) const;
+    JSONValue element(int index) const;
+
+    const char* begin;   // first character of the value
+    const char* end;     // end of the enclosing buffer (not of the value)
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // JSONSCANNER_H
@@ -0,0 +1,151 @@
+#include "JSONWriter.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace opencog {
+namespace caichat {
+
+JSONWriter::JSONWriter(std::string& buffer) : out(buffer), afterKey(false) {
+}
+
+void JSONWriter::separator() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (!first.empty()) {
+        if (!first.back()) {
+            out.push_back(',');
+        }
+        first.back() = false;
+    }
+}
+
+JSONWriter& JSONWriter::beginObject() {
+    separator();
+    out.push_back('{');
+    first.push_back(true);
+    return *this;
+}
+
+JSONWriter& JSONWriter::endObject() {
+    out.push_back('}');
+    first.pop_back();
+    return *this;
+}
+
+JSONWriter& JSONWriter::beginArray() {
+    separator();
+    out.push_back('[');
+    first.push_back(true);
+    return *this;
+}
+
+JSONWriter& JSONWriter::endArray() {
+    out.push_back(']');
+    first.pop_back();
+    return *this;
+}
+
+JSONWriter& JSONWriter::key(const char* name) {
+    separator();
+    appendEscaped(out, name, std::strlen(name));
+    out.push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+JSONWriter& JSONWriter::key(const std::string& name) {
+    separator();
+    appendEscaped(out, name.data(), name.size());
+    out.push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+JSONWriter& JSONWriter::value(const std::string& text) {
+    return value(text.data(), text.size());
+}
+
+JSONWriter& JSONWriter::value(const char* text) {
+    return value(text, std::strlen(text));
+}
+
+JSONWriter& JSONWriter::value(const char* text, size_t length) {
+    separator();
+    appendEscaped(out, text, length);
+    return *this;
+}
+
+JSONWriter& JSONWriter::value(int64_t number) {
+    separator();
+    char buf[24];
+    int n = std::snprintf(buf, sizeof(buf), "%lld", (long long)number);
+    out.append(buf, n);
+    return *this;
+}
+
+JSONWriter& JSONWriter::value(double number) {
+    separator();
+    if (!std::isfinite(number)) {
+        out.append("null");
+        return *this;
+    }
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%.17g", number);
+    out.append(buf, n);
+    return *this;
+}
+
+JSONWriter& JSONWriter::value(bool flag) {
+    separator();
+    out.append(flag ? "true" : "false");
+    return *this;
+}
+
+JSONWriter& JSONWriter::null() {
+    separator();
+    out.append("null");
+    return *this;
+}
+
+JSONWriter& JSONWriter::raw(const std::string& json) {
+    separator();
+    out.append(json);
+    return *this;
+}
+
+void JSONWriter::appendEscaped(std::string& out, const char* text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+
+    out.push_back('"');
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Copy the clean run in one go, then the escape
+        out.append(text + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"':  out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            case '\b': out.append("\\b"); break;
+            case '\f': out.append("\\f"); break;
+            default: {
+                char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(esc, 6);
+            }
+        }
+    }
+    out.append(text + runStart, length - runStart);
+    out.push_back('"');
+}
+
+} // namespace caichat
+} // namespace opencog
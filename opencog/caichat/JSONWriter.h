@@ -0,0 +1,68 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Streaming JSON writer appending straight into a caller-owned buffer.
+ * No intermediate document is built, so message contents are copied
+ * exactly once (with escaping) into the request body. Commas between
+ * members and elements are inserted automatically.
+ *
+ *     JSONWriter w(body);
+ *     w.beginObject();
+ *     w.key("model").value(model);
+ *     w.key("messages").beginArray();
+ *     ...
+ */
+class JSONWriter {
+public:
+    explicit JSONWriter(std::string& buffer);
+
+    JSONWriter& beginObject();
+    JSONWriter& endObject();
+    JSONWriter& beginArray();
+    JSONWriter& endArray();
+
+    /**
+     * Member name inside an object; must be followed by a value
+     */
+    JSONWriter& key(const char* name);
+    JSONWriter& key(const std::string& name);
+
+    JSONWriter& value(const std::string& text);
+    JSONWriter& value(const char* text);
+    JSONWriter& value(const char* text, size_t length);
+    JSONWriter& value(int64_t number);
+    JSONWriter& value(int number) { return value((int64_t)number); }
+    JSONWriter& value(double number);
+    JSONWriter& value(bool flag);
+    JSONWriter& null();
+
+    /**
+     * Insert pre-serialized JSON as the next value
+     */
+    JSONWriter& raw(const std::string& json);
+
+    /**
+     * Append text as a JSON string literal with escaping
+     */
+    static void appendEscaped(std::string& out, const char* text, size_t length);
+
+private:
+    void separator();
+
+    std::string& out;
+    std::vector<bool> first;   // per open container: no member written yet
+    bool afterKey;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // JSONWRITER_H
@@ -0,0 +1,801 @@
+#include "KnowledgeBase.h"
+#include "Chunker.h"
+#include "ConversationHistory.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+// File layout: 8-byte magic, then 4-byte aligned records of
+// [RecordHeader][id][text][padding][dimension floats], native byte order.
+// For documents the text is the metadata, for settings the id is the key
+// and the text the value.
+static const char KB_MAGIC[8] = {'C', 'A', 'I', 'K', 'B', 'A', 'S', '1'};
+
+enum RecordType : uint32_t {
+    RECORD_DOCUMENT = 1,   // starts (or replaces) a document
+    RECORD_CHUNK = 2,
+    RECORD_REMOVE = 3,
+    RECORD_SETTING = 4
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t idLength;
+    uint32_t textLength;
+    uint32_t dimension;
+    uint64_t position;   // byte offset of a chunk in its document
+};
+
+static uint64_t padded(uint64_t length) {
+    return (length + 3) & ~(uint64_t)3;
+}
+
+static uint64_t recordSize(const RecordHeader& header) {
+    return sizeof(RecordHeader) + padded((uint64_t)header.idLength + header.textLength) +
+           (uint64_t)header.dimension * sizeof(float);
+}
+
+static void encodeRecord(std::string& out, uint32_t type, const std::string& id,
+                         const char* text, size_t textLength,
+                         const float* vector = nullptr, size_t dimension = 0,
+                         uint64_t position = 0) {
+    RecordHeader header;
+    header.type = type;
+    header.idLength = (uint32_t)id.size();
+    header.textLength = (uint32_t)textLength;
+    header.dimension = (uint32_t)dimension;
+    header.position = position;
+
+    size_t start = out.size();
+    out.resize(start + recordSize(header), '\0');
+    char* p = &out[start];
+    std::memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    std::memcpy(p, id.data(), id.size());
+    std::memcpy(p + id.size(), text, textLength);
+    p += padded(id.size() + textLength);
+    if (dimension) {
+        std::memcpy(p, vector, dimension * sizeof(float));
+    }
+}
+
+static void encodeRecord(std::string& out, uint32_t type, const std::string& id,
+                         const std::string& text) {
+    encodeRecord(out, type, id, text.data(), text.size());
+}
+
+KnowledgeBase::KnowledgeBase(const std::string& file)
+    : path(file), fd(-1), map(nullptr), mapCapacity(0), fileSize(0),
+      liveChunks(0), maxChars(1500), overlap(200), hybridWeight(0.5f) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open knowledge base " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat knowledge base " + path);
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    if (size == 0) {
+        if (::write(fd, KB_MAGIC, sizeof(KB_MAGIC)) != (ssize_t)sizeof(KB_MAGIC)) {
+            ::close(fd);
+            throw std::runtime_error("Failed to initialize knowledge base " + path);
+        }
+        size = sizeof(KB_MAGIC);
+    }
+
+    try {
+        mapFile(size);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (std::memcmp(map, KB_MAGIC, sizeof(KB_MAGIC)) != 0) {
+        munmap(const_cast<char*>(map), mapCapacity);
+        ::close(fd);
+        throw std::runtime_error("Not a caichat knowledge base: " + path);
+    }
+
+    fileSize = sizeof(KB_MAGIC);
+    indexRecords(map + fileSize, fileSize, size - fileSize);
+    if (fileSize != size && ftruncate(fd, (off_t)fileSize) != 0) {
+        fileSize = size;   // keep the torn tail rather than append after it
+    }
+}
+
+KnowledgeBase::~KnowledgeBase() {
+    if (map) {
+        munmap(const_cast<char*>(map), mapCapacity);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+// The mapping reserves address space beyond the end of the file so
+// appends rarely need a new mapping; only bytes below fileSize are read.
+void KnowledgeBase::mapFile(uint64_t size) {
+    if (map && size <= mapCapacity) {
+        return;
+    }
+    uint64_t capacity = std::max<uint64_t>(size * 2, 1 << 20);
+    void* region = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("Failed to map knowledge base " + path);
+    }
+    if (map) {
+        munmap(const_cast<char*>(map), mapCapacity);
+    }
+    map = static_cast<const char*>(region);
+    mapCapacity = capacity;
+}
+
+// Apply records to the in-memory index; fileSize advances past each
+// complete record and stops at a torn one
+void KnowledgeBase::indexRecords(const char* data, uint64_t fileOffset, uint64_t length) {
+    uint64_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= length) {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        uint64_t size = recordSize(header);
+        if (offset + size > length) {
+            break;
+        }
+        std::string id(data + offset + sizeof(header), header.idLength);
+        const char* text = data + offset + sizeof(header) + header.idLength;
+
+        switch (header.type) {
+        case RECORD_DOCUMENT: {
+            uint32_t index = documentFor(id);
+            retireDocument(docs[index]);
+            docs[index].live = true;
+            docs[index].metadata.assign(text, header.textLength);
+            break;
+        }
+        case RECORD_CHUNK: {
+            uint32_t index = documentFor(id);
+            DocEntry& doc = docs[index];
+            uint32_t chunk = (uint32_t)chunks.size();
+            chunks.push_back(Chunk{fileOffset + offset, index, true});
+            doc.chunks.push_back(chunk);
+            doc.length = std::max<size_t>(doc.length, header.position + header.textLength);
+            ++liveChunks;
+            indexVector(chunk);
+            if (keywords) {
+                keywords->add(chunk, text, header.textLength);
+            }
+            break;
+        }
+        case RECORD_REMOVE: {
+            auto it = docsById.find(id);
+            if (it != docsById.end()) {
+                retireDocument(docs[it->second]);
+                docsById.erase(it);
+            }
+            break;
+        }
+        case RECORD_SETTING:
+            settings[id].assign(text, header.textLength);
+            break;
+        default:
+            break;   // written by a newer version
+        }
+
+        offset += size;
+        fileSize = fileOffset + offset;
+    }
+}
+
+// Index of the live document with this id, creating it if needed
+uint32_t KnowledgeBase::documentFor(const std::string& id) {
+    auto it = docsById.find(id);
+    if (it != docsById.end()) {
+        return it->second;
+    }
+    uint32_t index = (uint32_t)docs.size();
+    docs.emplace_back();
+    docs.back().id = id;
+    docsById[id] = index;
+    return index;
+}
+
+void KnowledgeBase::retireDocument(DocEntry& doc) {
+    for (uint32_t chunk : doc.chunks) {
+        if (chunks[chunk].live) {
+            chunks[chunk].live = false;
+            --liveChunks;
+            if (vectors) {
+                vectors->remove(std::to_string(chunk));
+            }
+            if (keywords) {
+                size_t length;
+                const char* body = chunkBody(chunk, length);
+                keywords->remove(chunk, body, length);
+            }
+        }
+    }
+    doc.chunks.clear();
+    doc.length = 0;
+    doc.live = false;
+}
+
+// Text of a chunk, in place in the mapping
+const char* KnowledgeBase::chunkBody(uint32_t chunk, size_t& length) const {
+    RecordHeader header;
+    const char* record = map + chunks[chunk].offset;
+    std::memcpy(&header, record, sizeof(header));
+    length = header.textLength;
+    return record + sizeof(header) + header.idLength;
+}
+
+// Add a chunk's embedding to the vector index once it exists
+void KnowledgeBase::indexVector(uint32_t chunk) {
+    if (!vectors) {
+        return;
+    }
+    RecordHeader header;
+    const char* record = map + chunks[chunk].offset;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.dimension != vectors->getDimension()) {
+        return;   // embedded with a different model
+    }
+    const float* vector = reinterpret_cast<const float*>(
+        record + sizeof(header) + padded((uint64_t)header.idLength + header.textLength));
+    vectors->add(std::to_string(chunk), vector);
+}
+
+void KnowledgeBase::writeRecords(const std::string& records) {
+    if (records.empty()) {
+        return;
+    }
+    // One write per call so a crash leaves at most one torn batch at the end
+    size_t written = 0;
+    while (written < records.size()) {
+        ssize_t n = ::write(fd, records.data() + written, records.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write knowledge base " + path + ": " + std::strerror(errno));
+        }
+        written += (size_t)n;
+    }
+
+    uint64_t offset = fileSize;
+    mapFile(offset + records.size());
+    indexRecords(map + offset, offset, records.size());
+}
+
+std::string KnowledgeBase::getSetting(const std::string& key) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    auto it = settings.find(key);
+    return it == settings.end() ? "" : it->second;
+}
+
+void KnowledgeBase::setSetting(const std::string& key, const std::string& value) {
+    std::string record;
+    encodeRecord(record, RECORD_SETTING, key, value);
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    writeRecords(record);
+}
+
+void KnowledgeBase::setEmbedder(Embedder fn) {
+    std::lock_guard<std::mutex> lock(embedderMutex);
+    embedder = std::move(fn);
+}
+
+bool KnowledgeBase::hasEmbedder() const {
+    std::lock_guard<std::mutex> lock(embedderMutex);
+    return (bool)embedder;
+}
+
+KnowledgeBase::Embedder KnowledgeBase::getEmbedder() const {
+    std::lock_guard<std::mutex> lock(embedderMutex);
+    return embedder;
+}
+
+void KnowledgeBase::setChunking(size_t chars, size_t overlapChars) {
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    maxChars = chars;
+    overlap = overlapChars;
+}
+
+void KnowledgeBase::chunkText(const std::string& content,
+                              const std::function<void(const std::string&, size_t)>& onChunk) const {
+    size_t chars;
+    size_t overlapChars;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(mutex);
+        chars = maxChars;
+        overlapChars = overlap;
+    }
+    Chunker chunker(chars, overlapChars, onChunk);
+    chunker.feed(content);
+    chunker.finish();
+}
+
+void KnowledgeBase::addDocument(const std::string& id, const std::string& content,
+                                const std::string& metadata) {
+    addDocuments({Document{id, content, metadata}});
+}
+
+void KnowledgeBase::addDocument(const std::string& id, const std::string& content,
+                                const std::string& metadata, const Embedding& embedding) {
+    std::string records;
+    encodeRecord(records, RECORD_DOCUMENT, id, metadata);
+    encodeRecord(records, RECORD_CHUNK, id, content.data(), content.size(),
+                 embedding.data(), embedding.size());
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    writeRecords(records);
+}
+
+void KnowledgeBase::addDocuments(const std::vector<Document>& documents) {
+    struct Piece {
+        size_t document;
+        std::string text;
+        size_t position;
+    };
+    std::vector<Piece> pieces;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        chunkText(documents[i].content, [&](const std::string& text, size_t position) {
+            pieces.push_back(Piece{i, text, position});
+        });
+    }
+
+    // Embed every chunk of every document in one call so the provider
+    // can batch them
+    std::vector<Embedding> embeddings;
+    Embedder embed = getEmbedder();
+    if (embed && !pieces.empty()) {
+        std::vector<std::string> texts;
+        texts.reserve(pieces.size());
+        for (const Piece& piece : pieces) {
+            texts.push_back(piece.text);
+        }
+        embeddings = embed(texts);
+    }
+
+    std::string records;
+    size_t next = 0;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const Document& doc = documents[i];
+        encodeRecord(records, RECORD_DOCUMENT, doc.id, doc.metadata);
+        for (; next < pieces.size() && pieces[next].document == i; ++next) {
+            const Piece& piece = pieces[next];
+            const Embedding* vector = next < embeddings.size() ? &embeddings[next] : nullptr;
+            encodeRecord(records, RECORD_CHUNK, doc.id, piece.text.data(), piece.text.size(),
+                         vector ? vector->data() : nullptr, vector ? vector->size() : 0,
+                         piece.position);
+        }
+    }
+
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    writeRecords(records);
+}
+
+size_t KnowledgeBase::ingestFiles(const std::vector<std::string>& paths, const std::string& metadata,
+                                  size_t workers) {
+    // Chunks travel from the reading thread to the workers in batches;
+    // the queue is bounded so reading never runs far ahead of embedding
+    struct Batch {
+        std::vector<std::string> ids;
+        std::vector<std::string> texts;
+        std::vector<size_t> positions;
+        size_t bytes = 0;
+    };
+    const size_t BATCH_CHUNKS = 128;
+    const size_t BATCH_BYTES = 512 * 1024;
+    workers = std::max<size_t>(workers, 1);
+    const size_t QUEUE_LIMIT = workers * 2;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<Batch> queue;
+    bool closed = false;
+    std::exception_ptr failure;
+    std::atomic<size_t> added(0);
+    Embedder embed = getEmbedder();
+
+    auto work = [&] {
+        for (;;) {
+            Batch batch;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&] { return !queue.empty() || closed; });
+                if (queue.empty()) {
+                    return;
+                }
+                batch = std::move(queue.front());
+                queue.pop_front();
+            }
+            queueChanged.notify_all();
+
+            try {
+                std::vector<Embedding> embeddings;
+                if (embed) {
+                    embeddings = embed(batch.texts);
+                }
+                std::string records;
+                for (size_t i = 0; i < batch.texts.size(); ++i) {
+                    const Embedding* vector = i < embeddings.size() ? &embeddings[i] : nullptr;
+                    encodeRecord(records, RECORD_CHUNK, batch.ids[i],
+                                 batch.texts[i].data(), batch.texts[i].size(),
+                                 vector ? vector->data() : nullptr, vector ? vector->size() : 0,
+                                 batch.positions[i]);
+                }
+                std::unique_lock<std::shared_timed_mutex> lock(mutex);
+                writeRecords(records);
+                added += batch.texts.size();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                closed = true;
+                queue.clear();
+                queueChanged.notify_all();
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < workers; ++i) {
+        pool.emplace_back(work);
+    }
+
+    // Returns false once the workers have given up
+    auto submit = [&](Batch& pending) {
+        if (pending.texts.empty()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [&] { return queue.size() < QUEUE_LIMIT || closed; });
+        if (closed) {
+            return false;
+        }
+        queue.push_back(std::move(pending));
+        pending = Batch();
+        queueChanged.notify_all();
+        return true;
+    };
+
+    // Errors while reading are reported after the workers have stopped
+    std::exception_ptr readFailure;
+    try {
+        Batch batch;
+        bool running = true;
+        std::set<std::string> seen;
+        std::vector<char> buffer(64 * 1024);
+        for (const std::string& file : paths) {
+            if (!running || !seen.insert(file).second) {
+                continue;
+            }
+            std::ifstream in(file, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("Failed to read " + file);
+            }
+
+            // The document record goes out before any of its chunks
+            std::string record;
+            encodeRecord(record, RECORD_DOCUMENT, file, metadata);
+            size_t chars;
+            size_t overlapChars;
+            {
+                std::unique_lock<std::shared_timed_mutex> lock(mutex);
+                writeRecords(record);
+                chars = maxChars;
+                overlapChars = overlap;
+            }
+
+            Chunker chunker(chars, overlapChars, [&](const std::string& text, size_t position) {
+                batch.ids.push_back(file);
+                batch.texts.push_back(text);
+                batch.positions.push_back(position);
+                batch.bytes += text.size();
+                if (batch.texts.size() >= BATCH_CHUNKS || batch.bytes >= BATCH_BYTES) {
+                    running = running && submit(batch);
+                }
+            });
+            while (running && in) {
+                in.read(buffer.data(), buffer.size());
+                chunker.feed(buffer.data(), (size_t)in.gcount());
+            }
+            chunker.finish();
+        }
+        if (running) {
+            submit(batch);
+        }
+    } catch (...) {
+        readFailure = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        closed = true;
+    }
+    queueChanged.notify_all();
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    if (readFailure) {
+        std::rethrow_exception(readFailure);
+    }
+    return added;
+}
+
+bool KnowledgeBase::removeDocument(const std::string& id) {
+    std::string record;
+    encodeRecord(record, RECORD_REMOVE, id, "");
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    if (!docsById.count(id)) {
+        return false;
+    }
+    writeRecords(record);
+    return true;
+}
+
+std::vector<KnowledgeBase::DocumentInfo> KnowledgeBase::listDocuments() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    std::vector<DocumentInfo> result;
+    result.reserve(docsById.size());
+    for (const DocEntry& doc : docs) {
+        if (doc.live) {
+            result.push_back(DocumentInfo{doc.id, doc.length, doc.chunks.size(), doc.metadata});
+        }
+    }
+    return result;
+}
+
+size_t KnowledgeBase::getDocumentCount() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return docsById.size();
+}
+
+size_t KnowledgeBase::getChunkCount() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return liveChunks;
+}
+
+// Called with the lock held in either mode
+KnowledgeBase::Hit KnowledgeBase::makeHit(uint32_t chunk, float score) const {
+    RecordHeader header;
+    const char* record = map + chunks[chunk].offset;
+    std::memcpy(&header, record, sizeof(header));
+    const DocEntry& doc = docs[chunks[chunk].doc];
+
+    Hit hit;
+    hit.docId = doc.id;
+    hit.text.assign(record + sizeof(header) + header.idLength, header.textLength);
+    hit.metadata = doc.metadata;
+    hit.position = (size_t)header.position;
+    hit.score = score;
+    return hit;
+}
+
+std::vector<KnowledgeBase::Hit> KnowledgeBase::searchText(const std::string& text, size_t limit) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    std::vector<Hit> hits;
+    for (uint32_t i = 0; i < chunks.size(); ++i) {
+        if (!chunks[i].live) {
+            continue;
+        }
+        RecordHeader header;
+        const char* record = map + chunks[i].offset;
+        std::memcpy(&header, record, sizeof(header));
+        const char* body = record + sizeof(header) + header.idLength;
+        if (memmem(body, header.textLength, text.data(), text.size())) {
+            hits.push_back(makeHit(i, 1.0f));
+            if (limit && hits.size() == limit) {
+                break;
+            }
+        }
+    }
+    return hits;
+}
+
+// Called with the lock held in shared mode
+void KnowledgeBase::ensureVectorIndex() const {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    if (vectors) {
+        return;
+    }
+
+    // The first embedded chunk decides the dimension
+    uint32_t dimension = 0;
+    for (const Chunk& chunk : chunks) {
+        RecordHeader header;
+        std::memcpy(&header, map + chunk.offset, sizeof(header));
+        if (chunk.live && header.dimension) {
+            dimension = header.dimension;
+            break;
+        }
+    }
+    if (!dimension) {
+        return;
+    }
+
+    VectorIndex::Options options;
+    options.mode = liveChunks > HNSW_THRESHOLD ? VectorIndex::Mode::HNSW : VectorIndex::Mode::Exact;
+    std::unique_ptr<VectorIndex> index(new VectorIndex(dimension, options));
+    for (uint32_t i = 0; i < chunks.size(); ++i) {
+        if (!chunks[i].live) {
+            continue;
+        }
+        RecordHeader header;
+        const char* record = map + chunks[i].offset;
+        std::memcpy(&header, record, sizeof(header));
+        if (header.dimension == dimension) {
+            index->add(std::to_string(i), reinterpret_cast<const float*>(
+                record + sizeof(header) + padded((uint64_t)header.idLength + header.textLength)));
+        }
+    }
+    vectors = std::move(index);
+}
+
+std::vector<KnowledgeBase::Hit> KnowledgeBase::searchVector(const Embedding& query, size_t k) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    ensureVectorIndex();
+    std::vector<Hit> hits;
+    if (!vectors || query.size() != vectors->getDimension()) {
+        return hits;
+    }
+    for (const VectorIndex::Result& result : vectors->search(query.data(), k)) {
+        hits.push_back(makeHit((uint32_t)std::stoul(result.id), result.score));
+    }
+    return hits;
+}
+
+// Called with the lock held in shared mode
+void KnowledgeBase::ensureKeywordIndex() const {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    if (keywords) {
+        return;
+    }
+    std::unique_ptr<InvertedIndex> index(new InvertedIndex());
+    for (uint32_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].live) {
+            size_t length;
+            const char* body = chunkBody(i, length);
+            index->add(i, body, length);
+        }
+    }
+    keywords = std::move(index);
+}
+
+std::vector<KnowledgeBase::Hit> KnowledgeBase::searchKeywords(const std::string& query, size_t k) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    ensureKeywordIndex();
+    std::vector<Hit> hits;
+    for (const InvertedIndex::Result& result : keywords->search(query, k)) {
+        hits.push_back(makeHit(result.doc, result.score));
+    }
+    return hits;
+}
+
+void KnowledgeBase::setHybridWeight(float weight) {
+    std::lock_guard<std::mutex> lock(embedderMutex);
+    hybridWeight = std::min(1.0f, std::max(0.0f, weight));
+}
+
+// Scale the scores of one ranking to [0, 1] so BM25 and cosine scores
+// can be added: divided by the best score, or shifted first if some are
+// negative
+static void normalizeScores(std::vector<KnowledgeBase::Hit>& hits) {
+    if (hits.empty()) {
+        return;
+    }
+    float high = hits.front().score, low = 0.0f;
+    for (const KnowledgeBase::Hit& hit : hits) {
+        high = std::max(high, hit.score);
+        low = std::min(low, hit.score);
+    }
+    for (KnowledgeBase::Hit& hit : hits) {
+        hit.score = high > low ? (hit.score - low) / (high - low) : 1.0f;
+    }
+}
+
+std::vector<KnowledgeBase::Hit> KnowledgeBase::search(const std::string& query, size_t k) const {
+    if (k == 0) {
+        return std::vector<Hit>();
+    }
+    Embedder embed;
+    float weight;
+    {
+        std::lock_guard<std::mutex> lock(embedderMutex);
+        embed = embedder;
+        weight = hybridWeight;
+    }
+
+    // Each ranking contributes a wider candidate pool than k so a chunk
+    // ranked moderately by both can beat one ranked high by only one
+    size_t pool = k * CANDIDATE_FACTOR;
+    std::vector<Hit> lexical = searchKeywords(query, pool);
+    std::vector<Hit> semantic;
+    if (embed && weight > 0.0f) {
+        std::vector<Embedding> embeddings = embed({query});
+        if (!embeddings.empty()) {
+            semantic = searchVector(embeddings[0], pool);
+        }
+    }
+    if (semantic.empty() && lexical.empty()) {
+        return searchText(query, k);
+    }
+    if (semantic.empty()) {
+        weight = 0.0f;
+    } else if (lexical.empty()) {
+        weight = 1.0f;
+    }
+    normalizeScores(lexical);
+    normalizeScores(semantic);
+
+    // Chunk identity is (document, position)
+    std::map<std::pair<std::string, size_t>, Hit> merged;
+    for (Hit& hit : semantic) {
+        hit.score *= weight;
+        merged[std::make_pair(hit.docId, hit.position)] = std::move(hit);
+    }
+    for (Hit& hit : lexical) {
+        auto key = std::make_pair(hit.docId, hit.position);
+        auto it = merged.find(key);
+        if (it != merged.end()) {
+            it->second.score += (1.0f - weight) * hit.score;
+        } else {
+            hit.score *= 1.0f - weight;
+            merged[key] = std::move(hit);
+        }
+    }
+
+    std::vector<Hit> hits;
+    hits.reserve(merged.size());
+    for (auto& entry : merged) {
+        hits.push_back(std::move(entry.second));
+    }
+    std::stable_sort(hits.begin(), hits.end(),
+                     [](const Hit& a, const Hit& b) { return a.score > b.score; });
+    if (hits.size() > k) {
+        hits.resize(k);
+    }
+    return hits;
+}
+
+std::vector<KnowledgeBase::Hit> KnowledgeBase::searchContext(const std::string& query,
+                                                             size_t maxTokens, size_t k) const {
+    std::vector<Hit> context;
+    size_t used = 0;
+    for (Hit& hit : search(query, k)) {
+        size_t tokens = ConversationHistory::estimateTokens(hit.docId) +
+                        ConversationHistory::estimateTokens(hit.text);
+        if (used + tokens > maxTokens) {
+            continue;   // a smaller, lower ranked chunk may still fit
+        }
+        used += tokens;
+        context.push_back(std::move(hit));
+    }
+    return context;
+}
+
+} // namespace caichat
+} // namespace opencog
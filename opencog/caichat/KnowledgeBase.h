@@ -0,0 +1,230 @@
+#ifndef KNOWLEDGEBASE_H
+#define KNOWLEDGEBASE_H
+
+#include "LLMClient.h"
+#include "InvertedIndex.h"
+#include "VectorIndex.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Persistent store of document chunks for retrieval.
+ *
+ * Everything lives in one append-only file of records (documents with
+ * their metadata, chunks with their text and embedding, removals and
+ * settings). Opening the file maps it into memory and indexes the record
+ * headers only; chunk text and vectors are read in place from the
+ * mapping, so a large knowledge base opens without re-parsing or copying.
+ * Replacing or removing a document appends a record; the old bytes stay
+ * in the file.
+ *
+ * The vector index for similarity search and the BM25 keyword index are
+ * built from the mapped chunks on the first query that needs them and
+ * kept up to date afterwards.
+ *
+ * Searches may run concurrently with each other; writes are serialized.
+ */
+class KnowledgeBase {
+public:
+    /**
+     * Computes embeddings for a list of texts (e.g. LLMClient::embed)
+     */
+    typedef std::function<std::vector<Embedding>(const std::vector<std::string>& texts)> Embedder;
+
+    struct Document {
+        std::string id;
+        std::string content;
+        std::string metadata;
+    };
+
+    struct DocumentInfo {
+        std::string id;
+        size_t length;   // bytes of content
+        size_t chunks;
+        std::string metadata;
+    };
+
+    struct Hit {
+        std::string docId;
+        std::string text;
+        std::string metadata;
+        size_t position;   // of the chunk in its document
+        float score;       // similarity, BM25, hybrid (0..1), or 1 for text matches
+    };
+
+    /**
+     * Open or create the file at path.
+     * Throws std::runtime_error if it cannot be opened or is not a
+     * knowledge base file.
+     */
+    explicit KnowledgeBase(const std::string& path);
+    ~KnowledgeBase();
+
+    KnowledgeBase(const KnowledgeBase&) = delete;
+    KnowledgeBase& operator=(const KnowledgeBase&) = delete;
+
+    /**
+     * Persistent string settings, e.g. "description" or the embedding
+     * provider; "" if unset
+     */
+    std::string getSetting(const std::string& key) const;
+    void setSetting(const std::string& key, const std::string& value);
+
+    /**
+     * Function used to embed new chunks and text queries; without one,
+     * chunks are stored without vectors and search ranks by keywords only
+     */
+    void setEmbedder(Embedder embedder);
+    bool hasEmbedder() const;
+
+    /**
+     * Chunk size and overlap in bytes for documents added from now on
+     */
+    void setChunking(size_t maxChars, size_t overlap);
+
+    /**
+     * Add or replace a document, chunking and embedding its content
+     */
+    void addDocument(const std::string& id, const std::string& content,
+                     const std::string& metadata = "");
+
+    /**
+     * Add or replace a document as a single chunk with a given embedding
+     */
+    void addDocument(const std::string& id, const std::string& content,
+                     const std::string& metadata, const Embedding& embedding);
+
+    /**
+     * Add or replace many documents, embedding all their chunks together
+     */
+    void addDocuments(const std::vector<Document>& documents);
+
+    /**
+     * Stream files from disk into the knowledge base: each file becomes a
+     * document named by its path, chunked as it is read, and its chunks
+     * are embedded and written by a pool of worker threads.
+     * @return Number of chunks added
+     */
+    size_t ingestFiles(const std::vector<std::string>& paths, const std::string& metadata = "",
+                       size_t workers = 4);
+
+    /**
+     * Remove a document; returns false if it does not exist
+     */
+    bool removeDocument(const std::string& id);
+
+    std::vector<DocumentInfo> listDocuments() const;
+    size_t getDocumentCount() const;
+    size_t getChunkCount() const;
+
+    /**
+     * Chunks containing text, in insertion order (limit 0 = all)
+     */
+    std::vector<Hit> searchText(const std::string& text, size_t limit = 0) const;
+
+    /**
+     * k chunks most similar to an embedding, best first
+     */
+    std::vector<Hit> searchVector(const Embedding& query, size_t k) const;
+
+    /**
+     * k chunks ranked by BM25 over the query terms, best first
+     */
+    std::vector<Hit> searchKeywords(const std::string& query, size_t k) const;
+
+    /**
+     * Hybrid search: the keyword ranking and, when there is an embedder
+     * and the knowledge base holds vectors, the similarity ranking are
+     * normalized to 0..1 and mixed by the hybrid weight. Falls back to
+     * substring search when neither finds anything.
+     */
+    std::vector<Hit> search(const std::string& query, size_t k) const;
+
+    /**
+     * Best of the top k hybrid hits that fit in maxTokens (estimated),
+     * in rank order; for building a prompt context
+     */
+    std::vector<Hit> searchContext(const std::string& query, size_t maxTokens, size_t k = 20) const;
+
+    /**
+     * Share of the similarity ranking in hybrid scores: 0 ranks by
+     * keywords only, 1 by embeddings only; default 0.5
+     */
+    void setHybridWeight(float weight);
+
+    const std::string& getPath() const { return path; }
+
+private:
+    // Exact scans are fast enough below this many vectors
+    static const size_t HNSW_THRESHOLD = 20000;
+    // Candidates taken from each ranking per hybrid result
+    static const size_t CANDIDATE_FACTOR = 4;
+
+    struct Chunk {
+        uint64_t offset;   // of the record in the file
+        uint32_t doc;
+        bool live;
+    };
+
+    struct DocEntry {
+        std::string id;
+        std::string metadata;
+        std::vector<uint32_t> chunks;
+        size_t length = 0;
+        bool live = true;
+    };
+
+    // Called with the write lock held
+    void writeRecords(const std::string& records);
+    void indexRecords(const char* data, uint64_t fileOffset, uint64_t length);
+    void mapFile(uint64_t size);
+    void retireDocument(DocEntry& doc);
+    uint32_t documentFor(const std::string& id);
+    void indexVector(uint32_t chunk);
+    const char* chunkBody(uint32_t chunk, size_t& length) const;
+
+    void chunkText(const std::string& content, const std::function<void(const std::string&, size_t)>& onChunk) const;
+    Hit makeHit(uint32_t chunk, float score) const;
+    void ensureVectorIndex() const;
+    void ensureKeywordIndex() const;
+    Embedder getEmbedder() const;
+
+    std::string path;
+    int fd;
+    const char* map;
+    uint64_t mapCapacity;
+    uint64_t fileSize;
+
+    mutable std::shared_timed_mutex mutex;
+    std::vector<Chunk> chunks;
+    std::vector<DocEntry> docs;
+    std::unordered_map<std::string, uint32_t> docsById;
+    std::map<std::string, std::string> settings;
+    size_t liveChunks;
+    size_t maxChars;
+    size_t overlap;
+
+    mutable std::mutex embedderMutex;
+    Embedder embedder;
+    float hybridWeight;
+
+    // Built lazily; guarded by indexMutex, entries added under the write lock
+    mutable std::mutex indexMutex;
+    mutable std::unique_ptr<VectorIndex> vectors;
+    mutable std::unique_ptr<InvertedIndex> keywords;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // KNOWLEDGEBASE_H
@@ -1,71 +1,300 @@
 #include "LLMClient.h"
-#include <curl/curl.h>
-#include <json/json.h>
+#include "ConversationHistory.h"
+#include "HTTPClient.h"
+#include "SSEParser.h"
+#include "JSONWriter.h"
+#include "JSONScanner.h"
+#include "LlamaEngine.h"
+#include "HedgingClient.h"
+#include "RoutingClient.h"
+#include "Hash.h"
 #include <stdexcept>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
-#include <sstream>
+#include <cstring>
+#include <thread>
 
 namespace opencog {
 namespace caichat {
 
-// Helper function for HTTP requests
-struct HTTPResponse {
-    std::string data;
-    long code;
-};
+const char* roleName(Role role) {
+    switch (role) {
+    case Role::System:
+        return "system";
+    case Role::User:
+        return "user";
+    case Role::Assistant:
+        return "assistant";
+    case Role::Tool:
+        return "tool";
+    }
+    return "user";
+}
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, HTTPResponse* response) {
-    size_t totalSize = size * nmemb;
-    response->data.append((char*)contents, totalSize);
-    return totalSize;
+Role parseRole(const std::string& name) {
+    for (Role role : {Role::System, Role::User, Role::Assistant, Role::Tool}) {
+        if (name == roleName(role)) {
+            return role;
+        }
+    }
+    throw std::invalid_argument("Unknown message role: " + name);
 }
 
-static HTTPResponse makeHTTPRequest(const std::string& url, const std::string& postData, 
-                                   const std::vector<std::string>& headers) {
-    CURL* curl;
-    HTTPResponse response;
-    
-    curl = curl_easy_init();
-    if (!curl) {
-        throw std::runtime_error("Failed to initialize CURL");
+// Base LLMClient implementation
+std::string LLMClient::ask(const std::string& prompt, const std::string& model) {
+    std::vector<Message> messages;
+    messages.emplace_back(Role::User, prompt);
+    return chatCompletion(messages, model);
+}
+
+void Cancellation::cancel() {
+    std::function<void()> abort;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancelled) {
+            return;
+        }
+        cancelled = true;
+        abort.swap(action);
     }
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    
-    if (!postData.empty()) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData.c_str());
+    if (abort) {
+        abort();
     }
-    
-    struct curl_slist* headerList = nullptr;
-    for (const auto& header : headers) {
-        headerList = curl_slist_append(headerList, header.c_str());
+}
+
+bool Cancellation::isCancelled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cancelled;
+}
+
+void Cancellation::onCancel(std::function<void()> abort) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!cancelled) {
+            action = std::move(abort);
+            return;
+        }
     }
-    if (headerList) {
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
+    abort();
+}
+
+static thread_local PromptPrefix* currentPrefix = nullptr;
+
+void PromptPrefix::track(uint64_t rev, size_t stableMessages) {
+    if (rev != revision) {
+        clear();
+        revision = rev;
     }
-    
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.code);
-    
-    if (headerList) {
-        curl_slist_free_all(headerList);
+    stable = stableMessages;
+}
+
+void PromptPrefix::clear() {
+    format.clear();
+    system.clear();
+    json.clear();
+    count = 0;
+    breakpoints = 0;
+}
+
+PromptPrefix::Scope::Scope(PromptPrefix& prefix) : previous(currentPrefix) {
+    currentPrefix = &prefix;
+}
+
+PromptPrefix::Scope::~Scope() {
+    currentPrefix = previous;
+}
+
+PromptPrefix* PromptPrefix::current() {
+    return currentPrefix;
+}
+
+void LLMClient::submitChatCompletion(const std::vector<Message>& messages,
+                                     CompletionCallback onDone,
+                                     const std::string& model,
+                                     CancelHandle cancel) {
+    std::thread([this, messages, onDone, model, cancel]() {
+        if (cancel && cancel->isCancelled()) {
+            onDone("", std::make_exception_ptr(std::runtime_error(AsyncHTTPEngine::CANCELLED)));
+            return;
+        }
+        std::string content;
+        try {
+            content = chatCompletion(messages, model);
+        } catch (...) {
+            onDone("", std::current_exception());
+            return;
+        }
+        onDone(content, nullptr);
+    }).detach();
+}
+
+std::future<std::string> LLMClient::chatCompletionAsync(const std::vector<Message>& messages,
+                                                        const std::string& model) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    std::future<std::string> future = promise->get_future();
+    submitChatCompletion(messages, [promise](const std::string& content, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(content);
+        }
+    }, model);
+    return future;
+}
+
+std::string LLMClient::chatCompletionStream(const std::vector<Message>& messages,
+                                            TokenCallback onToken,
+                                            const std::string& model) {
+    std::string content = chatCompletion(messages, model);
+    onToken(content);
+    return content;
+}
+
+ChatReply LLMClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                             const std::vector<ToolDefinition>& tools,
+                                             const std::string& model) {
+    if (!tools.empty()) {
+        throw std::runtime_error("Tool calls are not supported by " + getProviderName());
     }
-    curl_easy_cleanup(curl);
-    
-    if (res != CURLE_OK) {
-        throw std::runtime_error("HTTP request failed: " + std::string(curl_easy_strerror(res)));
+    ChatReply reply;
+    reply.content = chatCompletion(messages, model);
+    return reply;
+}
+
+std::vector<Embedding> LLMClient::embed(const std::vector<std::string>& /*inputs*/,
+                                        const std::string& /*model*/) {
+    throw std::runtime_error("Embeddings are not supported by " + getProviderName());
+}
+
+// Request bodies for blocking calls are serialized into a per-thread
+// buffer that keeps its capacity from one request to the next
+static thread_local std::string requestBuffer;
+
+// Reserve roughly the final body size so serialization does not reallocate
+static void reserveBody(std::string& body, const std::vector<Message>& messages) {
+    size_t estimate = 256;
+    for (const auto& msg : messages) {
+        estimate += msg.content.size() + msg.content.size() / 16 + 32;
     }
-    
+    body.clear();
+    body.reserve(estimate);
+}
+
+// The current prompt prefix for a request in format, emptied if it was
+// encoded for another format or does not fit these messages; nullptr
+// outside a PromptPrefix::Scope
+static PromptPrefix* prefixFor(const char* format, const std::vector<Message>& messages) {
+    PromptPrefix* prefix = PromptPrefix::current();
+    if (prefix && (prefix->format != format || prefix->count > messages.size() ||
+                   prefix->count > prefix->stable)) {
+        prefix->clear();
+        prefix->format = format;
+    }
+    return prefix;
+}
+
+// View of a complete response body; throws if it is not a JSON object
+static JSONValue parseBody(const std::string& text, const std::string& provider) {
+    JSONValue root(text);
+    if (root.type() != JSONValue::Object) {
+        throw std::runtime_error("Failed to parse " + provider + " response");
+    }
+    return root;
+}
+
+// Usage parsed last on this thread, for the metrics of the call
+static thread_local Usage parsedUsage;
+
+// Perform a blocking request, timing its serialization and transfer
+static HTTPResponse performTimed(const HTTPRequest& request, CallTimer& timer) {
+    timer.sent();
+    parsedUsage = Usage();
+    HTTPResponse response;
+    try {
+        response = makeHTTPRequest(request);
+    } catch (...) {
+        timer.failed();
+        throw;
+    }
+    timer.received(response.timings);
     return response;
 }
 
-// Base LLMClient implementation
-std::string LLMClient::ask(const std::string& prompt, const std::string& model) {
-    std::vector<Message> messages;
-    messages.emplace_back("user", prompt);
-    return chatCompletion(messages, model);
+// Parse a response, timing it and counting its tokens
+template <typename Result, typename Parse>
+static Result parseTimed(CallTimer& timer, Parse parse) {
+    try {
+        Result result = parse();
+        timer.finish(parsedUsage.inputTokens, parsedUsage.outputTokens,
+                     parsedUsage.cacheReadTokens, parsedUsage.cacheWriteTokens);
+        return result;
+    } catch (...) {
+        timer.failed();
+        throw;
+    }
+}
+
+// Send a prepared request on the shared event loop and parse the reply
+template <typename Client>
+static void submitHTTPChat(Client* client, HTTPRequest request,
+                          CompletionCallback onDone, CancelHandle cancel, CallTimer timer,
+                          std::string (Client::*parse)(const HTTPResponse&)) {
+    timer.sent();
+    uint64_t id = AsyncHTTPEngine::instance().submit(std::move(request),
+        [client, onDone, parse, timer](HTTPResponse& response, const std::string& error) mutable {
+            if (error == AsyncHTTPEngine::CANCELLED) {
+                onDone("", std::make_exception_ptr(std::runtime_error(error)));
+                return;
+            }
+            if (!error.empty()) {
+                timer.failed();
+                onDone("", std::make_exception_ptr(HTTPError(error, 0)));
+                return;
+            }
+            timer.received(response.timings);
+            std::string content;
+            try {
+                content = parseTimed<std::string>(timer, [&] { return (client->*parse)(response); });
+            } catch (...) {
+                onDone("", std::current_exception());
+                return;
+            }
+            onDone(content, nullptr);
+        });
+    if (cancel) {
+        cancel->onCancel([id] { AsyncHTTPEngine::instance().cancel(id); });
+    }
+}
+
+std::string LLMClient::getIdentity() const {
+    char address[32];
+    snprintf(address, sizeof(address), "@%p", (const void*)this);
+    return getProviderName() + address;
+}
+
+size_t LLMClient::contextWindow(const std::string& model) const {
+    return ConversationHistory::contextWindow(getProviderName(), model);
+}
+
+// Endpoint plus a digest of the key, so the key itself is not kept around
+static std::string endpointIdentity(const std::string& provider, const std::string& baseUrl,
+                                    const std::string& apiKey) {
+    char key[24];
+    snprintf(key, sizeof(key), " %016llx",
+             (unsigned long long)hashString(apiKey));
+    return provider + " " + baseUrl + key;
+}
+
+Usage LLMClient::getLastUsage() const {
+    std::lock_guard<std::mutex> lock(usageMutex);
+    return lastUsage;
+}
+
+void LLMClient::recordUsage(const Usage& usage) {
+    parsedUsage = usage;
+    std::lock_guard<std::mutex> lock(usageMutex);
+    lastUsage = usage;
 }
 
 // OpenAI Client implementation
@@ -79,47 +308,415 @@ OpenAIClient::OpenAIClient(const std::string& key, const std::string& url)
     }
 }
 
-std::string OpenAIClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+// Schema text, or an empty object schema if none was given
+static const std::string& schemaOrEmpty(const std::string& json) {
+    static const std::string empty = "{\"type\":\"object\",\"properties\":{}}";
+    return json.empty() ? empty : json;
+}
+
+static void writeOpenAIMessage(JSONWriter& json, const Message& msg) {
+    json.beginObject();
+    json.key("role").value(roleName(msg.role));
+    if (msg.toolCalls.empty() || !msg.content.empty()) {
+        json.key("content").value(msg.content);
+    } else {
+        json.key("content").null();
+    }
+    if (!msg.toolCallId.empty()) {
+        json.key("tool_call_id").value(msg.toolCallId);
+    }
+    if (!msg.toolCalls.empty()) {
+        json.key("tool_calls").beginArray();
+        for (const auto& call : msg.toolCalls) {
+            json.beginObject();
+            json.key("id").value(call.id);
+            json.key("type").value("function");
+            json.key("function").beginObject();
+            json.key("name").value(call.name);
+            json.key("arguments").value(call.arguments.empty() ? "{}" : call.arguments);
+            json.endObject();
+            json.endObject();
+        }
+        json.endArray();
+    }
+    json.endObject();
+}
+
+void OpenAIClient::buildChatRequest(const std::vector<Message>& messages, const std::string& model,
+                                    HTTPRequest& request, bool stream,
+                                    const std::vector<ToolDefinition>* tools) const {
     if (apiKey.empty()) {
         throw std::runtime_error("OpenAI API key not set");
     }
     
-    Json::Value request;
-    request["model"] = model.empty() ? "gpt-3.5-turbo" : model;
+    reserveBody(request.body, messages);
+    JSONWriter json(request.body);
+    json.beginObject();
+    json.key("model").value(model.empty() ? "gpt-3.5-turbo" : model);
+    json.key("messages").beginArray();
+    // Copy this conversation's already encoded messages, then encode the
+    // rest, extending the reusable encoding over the stable ones
+    PromptPrefix* prefix = prefixFor("openai", messages);
+    size_t i = 0;
+    if (prefix && prefix->count > 0) {
+        json.raw(prefix->json);
+        i = prefix->count;
+    }
+    size_t end = request.body.size();
+    for (; i < messages.size(); ++i) {
+        writeOpenAIMessage(json, messages[i]);
+        if (prefix && i < prefix->stable) {
+            prefix->json.append(request.body, end, request.body.size() - end);
+            prefix->count = i + 1;
+            end = request.body.size();
+        }
+    }
+    json.endArray();
+    if (tools && !tools->empty()) {
+        json.key("tools").beginArray();
+        for (const auto& tool : *tools) {
+            json.beginObject();
+            json.key("type").value("function");
+            json.key("function").beginObject();
+            json.key("name").value(tool.name);
+            json.key("description").value(tool.description);
+            json.key("parameters").raw(schemaOrEmpty(tool.parameters));
+            json.endObject();
+            json.endObject();
+        }
+        json.endArray();
+    }
+    if (stream) {
+        json.key("stream").value(true);
+        json.key("stream_options").beginObject().key("include_usage").value(true).endObject();
+    }
+    json.endObject();
     
-    Json::Value jsonMessages(Json::arrayValue);
-    for (const auto& msg : messages) {
-        Json::Value jsonMsg;
-        jsonMsg["role"] = msg.role;
-        jsonMsg["content"] = msg.content;
-        jsonMessages.append(jsonMsg);
+    request.url = baseUrl + "/chat/completions";
+    request.headers = {
+        "Content-Type: application/json",
+        "Authorization: Bearer " + apiKey
+    };
+}
+
+static Usage parseOpenAIUsage(const JSONValue& usage) {
+    Usage result;
+    usage.getInt({"prompt_tokens"}, result.inputTokens);
+    usage.getInt({"completion_tokens"}, result.outputTokens);
+    usage.getInt({"prompt_tokens_details", "cached_tokens"}, result.cacheReadTokens);
+    return result;
+}
+
+std::string OpenAIClient::parseChatResponse(const HTTPResponse& response) {
+    if (response.code != 200) {
+        throw HTTPError("OpenAI API request failed with code: " + std::to_string(response.code),
+                        response.code);
+    }
+    
+    JSONValue root = parseBody(response.data, "OpenAI");
+    
+    std::string content;
+    root.getString({"choices", 0, "message", "content"}, content);
+    recordUsage(parseOpenAIUsage(root.find({"usage"})));
+    return content;
+}
+
+ChatReply OpenAIClient::parseChatReply(const HTTPResponse& response) {
+    if (response.code != 200) {
+        throw HTTPError("OpenAI API request failed with code: " + std::to_string(response.code),
+                        response.code);
+    }
+    
+    JSONValue root = parseBody(response.data, "OpenAI");
+    JSONValue message = root.find({"choices", 0, "message"});
+    
+    ChatReply reply;
+    message.getString({"content"}, reply.content);
+    message.find({"tool_calls"}).forEach([&reply](const JSONValue& item) {
+        ToolCall call;
+        item.getString({"id"}, call.id);
+        item.getString({"function", "name"}, call.name);
+        item.getString({"function", "arguments"}, call.arguments);
+        reply.toolCalls.push_back(std::move(call));
+    });
+    recordUsage(parseOpenAIUsage(root.find({"usage"})));
+    return reply;
+}
+
+std::string OpenAIClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+    CallTimer timer("openai", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request);
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    return parseTimed<std::string>(timer, [&] { return parseChatResponse(response); });
+}
+
+void OpenAIClient::submitChatCompletion(const std::vector<Message>& messages,
+                                        CompletionCallback onDone,
+                                        const std::string& model,
+                                        CancelHandle cancel) {
+    CallTimer timer("openai", model);
+    HTTPRequest request;
+    try {
+        buildChatRequest(messages, model, request);
+    } catch (...) {
+        onDone("", std::current_exception());
+        return;
     }
-    request["messages"] = jsonMessages;
+    submitHTTPChat(this, std::move(request), onDone, cancel, timer, &OpenAIClient::parseChatResponse);
+}
+
+std::string OpenAIClient::chatCompletionStream(const std::vector<Message>& messages,
+                                               TokenCallback onToken,
+                                               const std::string& model) {
+    CallTimer timer("openai", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request, true);
     
-    Json::StreamWriterBuilder builder;
-    std::string postData = Json::writeString(builder, request);
+    std::string content;
+    std::string token;
+    SSEParser parser([&](const std::string&, const std::string& data) {
+        if (data == "[DONE]") {
+            return;
+        }
+        JSONValue chunk(data);
+        JSONValue error = chunk.find({"error"});
+        if (error.isValid()) {
+            std::string message;
+            error.getString({"message"}, message);
+            throw std::runtime_error("OpenAI stream error: " + message);
+        }
+        if (chunk.getString({"choices", 0, "delta", "content"}, token) && !token.empty()) {
+            content += token;
+            onToken(token);
+        }
+        JSONValue usage = chunk.find({"usage"});
+        if (usage.type() == JSONValue::Object) {
+            recordUsage(parseOpenAIUsage(usage));
+        }
+    });
+    request.onData = [&parser](const char* bytes, size_t length) {
+        parser.feed(bytes, length);
+    };
     
-    std::vector<std::string> headers = {
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    if (response.code != 200) {
+        timer.failed();
+        throw HTTPError("OpenAI API request failed with code: " + std::to_string(response.code),
+                        response.code);
+    }
+    parser.finish();
+    timer.streamed(parsedUsage.inputTokens, parsedUsage.outputTokens,
+                   parsedUsage.cacheReadTokens, parsedUsage.cacheWriteTokens);
+    return content;
+}
+
+ChatReply OpenAIClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                const std::vector<ToolDefinition>& tools,
+                                                const std::string& model) {
+    CallTimer timer("openai", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request, false, &tools);
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    return parseTimed<ChatReply>(timer, [&] { return parseChatReply(response); });
+}
+
+// Limits of one /embeddings request
+static const size_t MAX_EMBEDDING_INPUTS = 2048;
+static const size_t MAX_EMBEDDING_TOKENS = 300000;
+
+void OpenAIClient::buildEmbeddingRequest(const std::string* inputs, size_t count,
+                                         const std::string& model, HTTPRequest& request) const {
+    size_t estimate = 128;
+    for (size_t i = 0; i < count; ++i) {
+        estimate += inputs[i].size() + inputs[i].size() / 16 + 4;
+    }
+    request.body.reserve(estimate);
+    
+    // base64 floats are a third of the size of decimal text and decode
+    // without number parsing
+    JSONWriter json(request.body);
+    json.beginObject();
+    json.key("model").value(model.empty() ? "text-embedding-3-small" : model);
+    json.key("encoding_format").value("base64");
+    json.key("input").beginArray();
+    for (size_t i = 0; i < count; ++i) {
+        json.value(inputs[i]);
+    }
+    json.endArray();
+    json.endObject();
+    
+    request.url = baseUrl + "/embeddings";
+    request.headers = {
         "Content-Type: application/json",
         "Authorization: Bearer " + apiKey
     };
+}
+
+// Decode base64 little-endian float32 values
+static void decodeBase64Floats(const std::string& text, Embedding& out) {
+    static signed char table[256];
+    static std::once_flag tableInit;
+    std::call_once(tableInit, [] {
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::memset(table, -1, sizeof(table));
+        for (int i = 0; i < 64; ++i) {
+            table[(unsigned char)alphabet[i]] = (signed char)i;
+        }
+    });
     
-    HTTPResponse response = makeHTTPRequest(baseUrl + "/chat/completions", postData, headers);
+    std::string bytes;
+    bytes.reserve(text.size() / 4 * 3);
+    uint32_t bits = 0;
+    int count = 0;
+    for (unsigned char c : text) {
+        if (table[c] < 0) {
+            continue;   // padding or whitespace
+        }
+        bits = (bits << 6) | (uint32_t)table[c];
+        if (++count == 4) {
+            bytes.push_back((char)(bits >> 16));
+            bytes.push_back((char)(bits >> 8));
+            bytes.push_back((char)bits);
+            bits = 0;
+            count = 0;
+        }
+    }
+    if (count == 3) {
+        bytes.push_back((char)(bits >> 10));
+        bytes.push_back((char)(bits >> 2));
+    } else if (count == 2) {
+        bytes.push_back((char)(bits >> 4));
+    }
     
+    out.resize(bytes.size() / sizeof(float));
+    std::memcpy(out.data(), bytes.data(), out.size() * sizeof(float));
+}
+
+long OpenAIClient::parseEmbeddingResponse(const HTTPResponse& response, Embedding* out, size_t count) {
     if (response.code != 200) {
-        throw std::runtime_error("OpenAI API request failed with code: " + std::to_string(response.code));
+        throw HTTPError("OpenAI API request failed with code: " + std::to_string(response.code),
+                        response.code);
     }
     
-    Json::Value jsonResponse;
-    Json::CharReaderBuilder readerBuilder;
-    std::string errors;
-    std::istringstream stream(response.data);
+    JSONValue root = parseBody(response.data, "OpenAI");
+    size_t received = 0;
+    root.find({"data"}).forEach([&](const JSONValue& item) {
+        long index = -1;
+        item.getInt({"index"}, index);
+        if (index < 0 || (size_t)index >= count) {
+            return;
+        }
+        Embedding& embedding = out[index];
+        JSONValue vector = item.find({"embedding"});
+        std::string encoded;
+        if (vector.asString(encoded)) {
+            decodeBase64Floats(encoded, embedding);
+        } else {
+            embedding.clear();
+            double number;
+            vector.forEach([&](const JSONValue& element) {
+                if (element.asNumber(number)) {
+                    embedding.push_back((float)number);
+                }
+            });
+        }
+        ++received;
+    });
+    if (received != count) {
+        throw std::runtime_error("OpenAI returned " + std::to_string(received) +
+                                 " embeddings for " + std::to_string(count) + " inputs");
+    }
+    
+    long inputTokens = 0;
+    root.getInt({"usage", "prompt_tokens"}, inputTokens);
+    return inputTokens;
+}
+
+std::vector<Embedding> OpenAIClient::embed(const std::vector<std::string>& inputs,
+                                           const std::string& model) {
+    if (apiKey.empty()) {
+        throw std::runtime_error("OpenAI API key not set");
+    }
+    
+    // Split into the largest batches the API accepts
+    struct Batch {
+        size_t first;
+        size_t count;
+        HTTPResponse response;
+        std::string error;
+    };
+    std::vector<Batch> batches;
+    size_t tokens = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        size_t estimate = inputs[i].size() / 4 + 1;
+        if (batches.empty() || batches.back().count == MAX_EMBEDDING_INPUTS ||
+            tokens + estimate > MAX_EMBEDDING_TOKENS) {
+            batches.push_back(Batch{i, 0, HTTPResponse(), std::string()});
+            tokens = 0;
+        }
+        batches.back().count++;
+        tokens += estimate;
+    }
+    
+    std::vector<HTTPRequest> requests(batches.size());
+    std::vector<CallTimer> timers;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        timers.emplace_back("openai", model);
+        buildEmbeddingRequest(&inputs[batches[i].first], batches[i].count, model, requests[i]);
+        timers[i].sent();
+    }
     
-    if (!Json::parseFromStream(readerBuilder, stream, &jsonResponse, &errors)) {
-        throw std::runtime_error("Failed to parse OpenAI response: " + errors);
+    // All batches go out at once on the event loop (up to the per-host
+    // connection limit) and are parsed here once every reply is in
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = batches.size();
+    for (size_t i = 0; i < batches.size(); ++i) {
+        AsyncHTTPEngine::instance().submit(std::move(requests[i]),
+            [&, batchPtr = &batches[i]](HTTPResponse& response, const std::string& error) {
+                std::lock_guard<std::mutex> lock(mutex);
+                batchPtr->response = std::move(response);
+                batchPtr->error = error;
+                if (--remaining == 0) {
+                    done.notify_one();
+                }
+            });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return remaining == 0; });
     }
     
-    return jsonResponse["choices"][0]["message"]["content"].asString();
+    std::vector<Embedding> embeddings(inputs.size());
+    long inputTokens = 0;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        Batch& batch = batches[i];
+        if (!batch.error.empty()) {
+            timers[i].failed();
+            throw HTTPError(batch.error, 0);
+        }
+        timers[i].received(batch.response.timings);
+        long tokens;
+        try {
+            tokens = parseEmbeddingResponse(batch.response, &embeddings[batch.first], batch.count);
+        } catch (...) {
+            timers[i].failed();
+            throw;
+        }
+        timers[i].finish(tokens, 0);
+        inputTokens += tokens;
+    }
+    Usage usage;
+    usage.inputTokens = inputTokens;
+    recordUsage(usage);
+    return embeddings;
 }
 
 void OpenAIClient::setApiKey(const std::string& key) {
@@ -130,9 +727,13 @@ std::string OpenAIClient::getProviderName() const {
     return "openai";
 }
 
+std::string OpenAIClient::getIdentity() const {
+    return endpointIdentity(getProviderName(), baseUrl, apiKey);
+}
+
 // Claude Client implementation
 ClaudeClient::ClaudeClient(const std::string& key, const std::string& url) 
-    : apiKey(key), baseUrl(url) {
+    : apiKey(key), baseUrl(url), promptCaching(true) {
     if (apiKey.empty()) {
         const char* envKey = std::getenv("ANTHROPIC_API_KEY");
         if (envKey) {
@@ -141,49 +742,316 @@ ClaudeClient::ClaudeClient(const std::string& key, const std::string& url)
     }
 }
 
-std::string ClaudeClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+// Claude caches the prompt up to each of at most four breakpoints; a
+// marked prefix shorter than the model's minimum (1024 tokens for most)
+// is simply not cached
+static const size_t MAX_BREAKPOINTS = 4;
+
+// Messages of at least this size, about 1024 tokens, are marked as
+// breakpoints: RAG contexts, pasted documents
+static const size_t LARGE_BLOCK = 4096;
+
+static void cacheControl(JSONWriter& json) {
+    json.key("cache_control").beginObject().key("type").value("ephemeral").endObject();
+}
+
+// Text as a plain string, or as a marked text block for a breakpoint
+static void writeClaudeText(JSONWriter& json, const std::string& text, bool breakpoint) {
+    if (!breakpoint) {
+        json.value(text);
+        return;
+    }
+    json.beginArray().beginObject();
+    json.key("type").value("text");
+    json.key("text").value(text);
+    cacheControl(json);
+    json.endObject().endArray();
+}
+
+// Write messages first..last as one element: a single message, or the
+// results of one turn's tool calls, which go back together in a user
+// message. A breakpoint marks the element's last content block.
+static void writeClaudeMessage(JSONWriter& json, const std::vector<Message>& messages,
+                               size_t first, size_t last, bool breakpoint) {
+    const Message& msg = messages[first];
+    json.beginObject();
+    if (msg.role == Role::Tool) {
+        json.key("role").value("user");
+        json.key("content").beginArray();
+        for (size_t i = first; i <= last; ++i) {
+            json.beginObject();
+            json.key("type").value("tool_result");
+            json.key("tool_use_id").value(messages[i].toolCallId);
+            json.key("content").value(messages[i].content);
+            if (breakpoint && i == last) {
+                cacheControl(json);
+            }
+            json.endObject();
+        }
+        json.endArray();
+    } else if (!msg.toolCalls.empty()) {
+        json.key("role").value(roleName(msg.role));
+        json.key("content").beginArray();
+        if (!msg.content.empty()) {
+            json.beginObject();
+            json.key("type").value("text");
+            json.key("text").value(msg.content);
+            json.endObject();
+        }
+        for (size_t i = 0; i < msg.toolCalls.size(); ++i) {
+            const ToolCall& call = msg.toolCalls[i];
+            json.beginObject();
+            json.key("type").value("tool_use");
+            json.key("id").value(call.id);
+            json.key("name").value(call.name);
+            json.key("input").raw(call.arguments.empty() ? "{}" : call.arguments);
+            if (breakpoint && i + 1 == msg.toolCalls.size()) {
+                cacheControl(json);
+            }
+            json.endObject();
+        }
+        json.endArray();
+    } else {
+        json.key("role").value(roleName(msg.role));
+        json.key("content");
+        writeClaudeText(json, msg.content, breakpoint);
+    }
+    json.endObject();
+}
+
+void ClaudeClient::buildChatRequest(const std::vector<Message>& messages, const std::string& model,
+                                    HTTPRequest& request, bool stream,
+                                    const std::vector<ToolDefinition>* tools) const {
     if (apiKey.empty()) {
         throw std::runtime_error("Anthropic API key not set");
     }
     
-    Json::Value request;
-    request["model"] = model.empty() ? "claude-3-sonnet-20240229" : model;
-    request["max_tokens"] = 1000;
+    reserveBody(request.body, messages);
+    JSONWriter json(request.body);
+    json.beginObject();
+    json.key("model").value(model.empty() ? "claude-3-sonnet-20240229" : model);
+    json.key("max_tokens").value(1000);
     
-    Json::Value jsonMessages(Json::arrayValue);
-    for (const auto& msg : messages) {
-        Json::Value jsonMsg;
-        jsonMsg["role"] = msg.role;
-        jsonMsg["content"] = msg.content;
-        jsonMessages.append(jsonMsg);
+    // Breakpoints go to the system prompt and the first large messages, so
+    // earlier ones stay in place as the conversation grows. Within a
+    // ChatCompletion turn one more marks the newest message, and the next
+    // turn reads everything before its own message from the cache.
+    PromptPrefix* prefix = prefixFor(promptCaching ? "claude" : "claude-uncached", messages);
+    size_t budget = promptCaching ? MAX_BREAKPOINTS - (prefix ? 1 : 0) : 0;
+    size_t used = prefix ? prefix->breakpoints : 0;
+    
+    // The Messages API takes the system prompt as a top-level field
+    if (prefix && !prefix->system.empty()) {
+        json.key("system").raw(prefix->system);
+    } else {
+        for (size_t i = 0; i < messages.size(); ++i) {
+            if (messages[i].role == Role::System) {
+                bool breakpoint = used < budget;
+                used += breakpoint ? 1 : 0;
+                json.key("system");
+                size_t start = request.body.size();
+                writeClaudeText(json, messages[i].content, breakpoint);
+                if (prefix && i < prefix->stable) {
+                    prefix->system.assign(request.body, start, request.body.size() - start);
+                    prefix->breakpoints = used;
+                }
+                break;
+            }
+        }
     }
-    request["messages"] = jsonMessages;
     
-    Json::StreamWriterBuilder builder;
-    std::string postData = Json::writeString(builder, request);
+    json.key("messages").beginArray();
+    size_t i = 0;
+    if (prefix && prefix->count > 0) {
+        json.raw(prefix->json);
+        i = prefix->count;
+    }
+    size_t end = request.body.size();
+    for (; i < messages.size(); ++i) {
+        if (messages[i].role == Role::System) {
+            continue;
+        }
+        size_t last = i;
+        size_t size = messages[i].content.size();
+        while (messages[i].role == Role::Tool && last + 1 < messages.size() &&
+               messages[last + 1].role == Role::Tool) {
+            size += messages[++last].content.size();
+        }
+        bool newest = last + 1 == messages.size();
+        bool breakpoint;
+        if (newest && prefix) {
+            breakpoint = promptCaching;
+        } else {
+            breakpoint = used < budget && size >= LARGE_BLOCK;
+            used += breakpoint ? 1 : 0;
+        }
+        writeClaudeMessage(json, messages, i, last, breakpoint);
+        i = last;
+        // The newest message is marked differently next turn, so it stays out
+        if (prefix && !newest && last < prefix->stable) {
+            prefix->json.append(request.body, end, request.body.size() - end);
+            prefix->count = last + 1;
+            prefix->breakpoints = used;
+            end = request.body.size();
+        }
+    }
+    json.endArray();
+    if (tools && !tools->empty()) {
+        json.key("tools").beginArray();
+        for (const auto& tool : *tools) {
+            json.beginObject();
+            json.key("name").value(tool.name);
+            json.key("description").value(tool.description);
+            json.key("input_schema").raw(schemaOrEmpty(tool.parameters));
+            json.endObject();
+        }
+        json.endArray();
+    }
+    if (stream) {
+        json.key("stream").value(true);
+    }
+    json.endObject();
     
-    std::vector<std::string> headers = {
+    request.url = baseUrl + "/messages";
+    request.headers = {
         "Content-Type: application/json",
         "x-api-key: " + apiKey,
         "anthropic-version: 2023-06-01"
     };
+}
+
+static Usage parseClaudeUsage(const JSONValue& usage) {
+    Usage result;
+    usage.getInt({"input_tokens"}, result.inputTokens);
+    usage.getInt({"output_tokens"}, result.outputTokens);
+    usage.getInt({"cache_read_input_tokens"}, result.cacheReadTokens);
+    usage.getInt({"cache_creation_input_tokens"}, result.cacheWriteTokens);
+    return result;
+}
+
+std::string ClaudeClient::parseChatResponse(const HTTPResponse& response) {
+    if (response.code != 200) {
+        throw HTTPError("Claude API request failed with code: " + std::to_string(response.code),
+                        response.code);
+    }
     
-    HTTPResponse response = makeHTTPRequest(baseUrl + "/messages", postData, headers);
+    JSONValue root = parseBody(response.data, "Claude");
     
+    std::string content;
+    root.getString({"content", 0, "text"}, content);
+    recordUsage(parseClaudeUsage(root.find({"usage"})));
+    return content;
+}
+
+ChatReply ClaudeClient::parseChatReply(const HTTPResponse& response) {
     if (response.code != 200) {
-        throw std::runtime_error("Claude API request failed with code: " + std::to_string(response.code));
+        throw HTTPError("Claude API request failed with code: " + std::to_string(response.code),
+                        response.code);
     }
     
-    Json::Value jsonResponse;
-    Json::CharReaderBuilder readerBuilder;
-    std::string errors;
-    std::istringstream stream(response.data);
+    JSONValue root = parseBody(response.data, "Claude");
     
-    if (!Json::parseFromStream(readerBuilder, stream, &jsonResponse, &errors)) {
-        throw std::runtime_error("Failed to parse Claude response: " + errors);
+    ChatReply reply;
+    std::string type;
+    std::string text;
+    root.find({"content"}).forEach([&](const JSONValue& block) {
+        block.getString({"type"}, type);
+        if (type == "text" && block.getString({"text"}, text)) {
+            reply.content += text;
+        } else if (type == "tool_use") {
+            ToolCall call;
+            block.getString({"id"}, call.id);
+            block.getString({"name"}, call.name);
+            call.arguments = block.find({"input"}).raw();
+            reply.toolCalls.push_back(std::move(call));
+        }
+    });
+    recordUsage(parseClaudeUsage(root.find({"usage"})));
+    return reply;
+}
+
+std::string ClaudeClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+    CallTimer timer("claude", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request);
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    return parseTimed<std::string>(timer, [&] { return parseChatResponse(response); });
+}
+
+void ClaudeClient::submitChatCompletion(const std::vector<Message>& messages,
+                                        CompletionCallback onDone,
+                                        const std::string& model,
+                                        CancelHandle cancel) {
+    CallTimer timer("claude", model);
+    HTTPRequest request;
+    try {
+        buildChatRequest(messages, model, request);
+    } catch (...) {
+        onDone("", std::current_exception());
+        return;
     }
+    submitHTTPChat(this, std::move(request), onDone, cancel, timer, &ClaudeClient::parseChatResponse);
+}
+
+std::string ClaudeClient::chatCompletionStream(const std::vector<Message>& messages,
+                                               TokenCallback onToken,
+                                               const std::string& model) {
+    CallTimer timer("claude", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request, true);
+    
+    std::string content;
+    std::string token;
+    Usage usage;
+    SSEParser parser([&](const std::string& event, const std::string& data) {
+        JSONValue chunk(data);
+        if (event == "content_block_delta") {
+            if (chunk.getString({"delta", "text"}, token) && !token.empty()) {
+                content += token;
+                onToken(token);
+            }
+        } else if (event == "message_start") {
+            // Input and cache usage are final here; output arrives at the end
+            usage = parseClaudeUsage(chunk.find({"message", "usage"}));
+        } else if (event == "message_delta") {
+            chunk.getInt({"usage", "output_tokens"}, usage.outputTokens);
+        } else if (event == "error") {
+            std::string message;
+            chunk.getString({"error", "message"}, message);
+            throw std::runtime_error("Claude stream error: " + message);
+        }
+    });
+    request.onData = [&parser](const char* bytes, size_t length) {
+        parser.feed(bytes, length);
+    };
     
-    return jsonResponse["content"][0]["text"].asString();
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    if (response.code != 200) {
+        timer.failed();
+        throw HTTPError("Claude API request failed with code: " + std::to_string(response.code),
+                        response.code);
+    }
+    parser.finish();
+    recordUsage(usage);
+    timer.streamed(usage.inputTokens, usage.outputTokens,
+                   usage.cacheReadTokens, usage.cacheWriteTokens);
+    return content;
+}
+
+ChatReply ClaudeClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                const std::vector<ToolDefinition>& tools,
+                                                const std::string& model) {
+    CallTimer timer("claude", model);
+    HTTPRequest request;
+    request.body.swap(requestBuffer);
+    buildChatRequest(messages, model, request, false, &tools);
+    HTTPResponse response = performTimed(request, timer);
+    requestBuffer.swap(request.body);
+    return parseTimed<ChatReply>(timer, [&] { return parseChatReply(response); });
 }
 
 void ClaudeClient::setApiKey(const std::string& key) {
@@ -194,44 +1062,77 @@ std::string ClaudeClient::getProviderName() const {
     return "claude";
 }
 
+std::string ClaudeClient::getIdentity() const {
+    return endpointIdentity(getProviderName(), baseUrl, apiKey);
+}
+
+void ClaudeClient::setPromptCaching(bool enabled) {
+    promptCaching = enabled;
+}
+
 // GGML Client implementation
 GGMLClient::GGMLClient(const std::string& path, const std::string& type) 
-    : modelPath(path), modelType(type) {
+    : modelPath(path), modelType(type), threads(0), contextSize(4096), window(4096) {
     if (modelPath.empty()) {
         const char* envPath = std::getenv("GGML_MODEL_PATH");
         if (envPath) {
             modelPath = envPath;
         }
     }
+    const char* envThreads = std::getenv("GGML_THREADS");
+    if (envThreads) {
+        threads = std::atoi(envThreads);
+    }
+    updateIdentity();
+}
+
+GGMLClient::~GGMLClient() {
 }
 
-std::string GGMLClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+// Called with sessionMutex held; loads the model on first use
+LlamaEmbedder& GGMLClient::getEmbedder() {
     if (modelPath.empty()) {
         throw std::runtime_error("GGML model path not set");
     }
-    
-    // For now, this is a placeholder implementation
-    // In a real implementation, you would:
-    // 1. Load the GGML model from modelPath
-    // 2. Convert messages to the model's expected format
-    // 3. Run inference
-    // 4. Return the result
-    
-    std::string prompt = "";
-    for (const auto& msg : messages) {
-        if (msg.role == "system") {
-            prompt += "System: " + msg.content + "\n";
-        } else if (msg.role == "user") {
-            prompt += "User: " + msg.content + "\n";
-        } else if (msg.role == "assistant") {
-            prompt += "Assistant: " + msg.content + "\n";
-        }
+    if (!embedder) {
+        LlamaOptions options;
+        options.threads = threads;
+        options.contextSize = contextSize;
+        embedder.reset(new LlamaEmbedder(modelPath, options));
     }
-    prompt += "Assistant: ";
-    
-    // Placeholder response - in real implementation, this would call ggml
-    return "This is a placeholder response from GGML model at " + modelPath + 
-           ". The actual implementation would run inference on the local model.";
+    return *embedder;
+}
+
+// Called with sessionMutex held; loads the model on first use
+LlamaSession& GGMLClient::getSession() {
+    if (modelPath.empty()) {
+        throw std::runtime_error("GGML model path not set");
+    }
+    if (!session) {
+        LlamaOptions options;
+        options.threads = threads;
+        options.contextSize = contextSize;
+        session.reset(new LlamaSession(modelPath, options));
+    }
+    return *session;
+}
+
+std::string GGMLClient::chatCompletion(const std::vector<Message>& messages, const std::string& /*model*/) {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return getSession().generate(messages, nullptr);
+}
+
+std::string GGMLClient::chatCompletionStream(const std::vector<Message>& messages,
+                                             TokenCallback onToken,
+                                             const std::string& /*model*/) {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return getSession().generate(messages, onToken);
+}
+
+std::vector<Embedding> GGMLClient::embed(const std::vector<std::string>& inputs,
+                                         const std::string& /*model*/) {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return getEmbedder().embed(inputs);
 }
 
 void GGMLClient::setApiKey(const std::string& key) {
@@ -243,18 +1144,77 @@ std::string GGMLClient::getProviderName() const {
     return "ggml";
 }
 
+// Called with sessionMutex held (or from the constructor)
+void GGMLClient::updateIdentity() {
+    std::string current = getProviderName() + " " + modelType + " " +
+                          std::to_string(contextSize) + " " + modelPath;
+    std::lock_guard<std::mutex> lock(identityMutex);
+    identity = current;
+    window = contextSize;
+}
+
+std::string GGMLClient::getIdentity() const {
+    std::lock_guard<std::mutex> lock(identityMutex);
+    return identity;
+}
+
+// The session's own context size, whatever the model was trained with
+size_t GGMLClient::contextWindow(const std::string&) const {
+    std::lock_guard<std::mutex> lock(identityMutex);
+    return (size_t)window;
+}
+
 void GGMLClient::setModelPath(const std::string& path) {
-    modelPath = path;
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    if (path != modelPath) {
+        modelPath = path;
+        session.reset();
+        embedder.reset();
+        updateIdentity();
+    }
+}
+
+std::string GGMLClient::getModelPath() const {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return modelPath;
+}
+
+void GGMLClient::setThreads(int count) {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    threads = count;
+    session.reset();
+    embedder.reset();
+}
+
+void GGMLClient::setContextSize(int tokens) {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    contextSize = tokens;
+    session.reset();
+    embedder.reset();
+    updateIdentity();
+}
+
+// Endpoint override from the environment, e.g. for proxies or local stubs
+static std::string baseUrlFromEnv(const char* name, const char* fallback) {
+    const char* url = std::getenv(name);
+    return (url && *url) ? url : fallback;
 }
 
 // ClientFactory implementation
+
 std::unique_ptr<LLMClient> ClientFactory::createClient(const std::string& provider, const std::string& apiKey) {
     if (provider == "openai") {
-        return std::make_unique<OpenAIClient>(apiKey);
+        return std::make_unique<OpenAIClient>(apiKey,
+            baseUrlFromEnv("OPENAI_BASE_URL", "https://api.openai.com/v1"));
     } else if (provider == "claude" || provider == "anthropic") {
-        return std::make_unique<ClaudeClient>(apiKey);
+        return std::make_unique<ClaudeClient>(apiKey,
+            baseUrlFromEnv("ANTHROPIC_BASE_URL", "https://api.anthropic.com/v1"));
     } else if (provider == "ggml" || provider == "local") {
         return std::make_unique<GGMLClient>(apiKey);  // apiKey is used as model path for GGML
+    } else if (HedgingClient::isSpec(provider)) {
+        return HedgingClient::fromSpec(provider, HedgingClient::getDefaultOptions());
+    } else if (RoutingClient::isSpec(provider)) {
+        return RoutingClient::fromSpec(provider, RoutingClient::getDefaultOptions());
     } else {
         throw std::runtime_error("Unknown provider: " + provider);
     }
@@ -1,24 +1,176 @@
 #ifndef LLMCLIENT_H
 #define LLMCLIENT_H
 
+#include "Text.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <functional>
+#include <future>
+#include <exception>
+#include <mutex>
 
 namespace opencog {
 namespace caichat {
 
 /**
- * Message structure for chat completions
+ * A function call requested by the model
+ */
+struct ToolCall {
+    std::string id;          // provider-assigned, echoed back with the result
+    std::string name;
+    std::string arguments;   // JSON object text
+};
+
+/**
+ * A function the model may call
+ */
+struct ToolDefinition {
+    std::string name;
+    std::string description;
+    std::string parameters;   // JSON Schema object text
+};
+
+/**
+ * Author of a message
+ */
+enum class Role : uint8_t { System, User, Assistant, Tool };
+
+/**
+ * "system", "user", "assistant" or "tool"
+ */
+const char* roleName(Role role);
+
+/**
+ * Role named by name; throws std::invalid_argument for any other name
+ */
+Role parseRole(const std::string& name);
+
+/**
+ * Message structure for chat completions. The content is shared, not
+ * copied, when messages are copied.
  */
 struct Message {
-    std::string role;    // "user", "assistant", "system"
+    Role role;
+    Text content;
+    std::vector<ToolCall> toolCalls;   // requested by an assistant turn
+    std::string toolCallId;            // call answered by a Role::Tool message
+    
+    Message(Role r, Text c) : role(r), content(std::move(c)) {}
+};
+
+/**
+ * Reply of a completion that offered tools: text, function calls, or both
+ */
+struct ChatReply {
     std::string content;
+    std::vector<ToolCall> toolCalls;
+};
+
+struct HTTPRequest;
+struct HTTPResponse;
+
+/**
+ * Token accounting reported by the provider for one request
+ */
+struct Usage {
+    long inputTokens = 0;
+    long outputTokens = 0;
+    long cacheReadTokens = 0;    // prompt tokens served from the provider's cache
+    long cacheWriteTokens = 0;   // prompt tokens written to it (Claude)
+};
+
+/**
+ * Encoded request-body JSON of the leading messages of one conversation,
+ * kept between its requests so a turn only serializes the messages added
+ * since the previous one.
+ *
+ * ChatCompletion owns one per conversation and makes it current on its
+ * thread around each request (Scope). The HTTP clients then copy the
+ * encoded messages into the body unchanged and extend the encoding with
+ * the new ones, covering at most the first `stable` messages, which the
+ * owner guarantees will not change. Bodies built on other threads, e.g.
+ * for hedged requests, are encoded in full as before.
+ */
+class PromptPrefix {
+public:
+    /**
+     * Start a request whose first stable messages stay unchanged as long
+     * as revision does; the encoding is dropped if revision moved
+     */
+    void track(uint64_t revision, size_t stable);
+    
+    void clear();
+    
+    /**
+     * Makes a prefix current on this thread for its lifetime
+     */
+    class Scope {
+    public:
+        explicit Scope(PromptPrefix& prefix);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        
+    private:
+        PromptPrefix* previous;
+    };
+    
+    /**
+     * The prefix made current on this thread, or nullptr
+     */
+    static PromptPrefix* current();
+    
+    std::string format;       // provider whose body format the encoding is in
+    std::string system;       // encoded system prompt, for formats with a separate field
+    std::string json;         // encoded messages, comma-separated array elements
+    size_t count = 0;         // messages consumed by json
+    size_t breakpoints = 0;   // cache breakpoints inside system and json
+    size_t stable = 0;
+    uint64_t revision = 0;
+};
+
+/**
+ * Embedding vector of one input text
+ */
+typedef std::vector<float> Embedding;
+
+/**
+ * Completion callback for asynchronous requests. On failure content is
+ * empty and error holds the exception.
+ */
+typedef std::function<void(const std::string& content, std::exception_ptr error)> CompletionCallback;
+
+/**
+ * Lets the caller abandon an asynchronous request. The client that starts
+ * the request registers how to abort it; cancel() runs that once, and the
+ * completion callback then reports an error.
+ */
+class Cancellation {
+public:
+    void cancel();
+    bool isCancelled() const;
+    
+    /**
+     * Set the abort action; it runs immediately if already cancelled
+     */
+    void onCancel(std::function<void()> abort);
     
-    Message(const std::string& r, const std::string& c) : role(r), content(c) {}
+private:
+    mutable std::mutex mutex;
+    bool cancelled = false;
+    std::function<void()> action;
 };
 
+typedef std::shared_ptr<Cancellation> CancelHandle;
+
+/**
+ * Receives each piece of generated text as it is streamed
+ */
+typedef std::function<void(const std::string& token)> TokenCallback;
+
 /**
  * Abstract base class for LLM providers
  */
@@ -44,6 +196,68 @@ public:
     virtual std::string ask(const std::string& prompt, 
                            const std::string& model = "");
     
+    /**
+     * Start a chat completion without blocking the caller
+     * @param messages Vector of conversation messages (copied)
+     * @param onDone Invoked exactly once, possibly on another thread
+     * @param model Model name to use
+     * @param cancel Optional handle to abandon the request with
+     *
+     * HTTP providers run on the shared curl_multi event loop and cancel
+     * by aborting the transfer; the default implementation runs
+     * chatCompletion on a worker thread and can only be cancelled before
+     * it starts. The client must outlive the callback.
+     */
+    virtual void submitChatCompletion(const std::vector<Message>& messages,
+                                      CompletionCallback onDone,
+                                      const std::string& model = "",
+                                      CancelHandle cancel = nullptr);
+    
+    /**
+     * Future-based wrapper around submitChatCompletion
+     */
+    std::future<std::string> chatCompletionAsync(const std::vector<Message>& messages,
+                                                 const std::string& model = "");
+    
+    /**
+     * Send a chat completion request and stream the reply
+     * @param messages Vector of conversation messages
+     * @param onToken Called with each text delta as it arrives
+     * @param model Model name to use
+     * @return The complete response content
+     *
+     * The default implementation delivers the whole reply as one token.
+     */
+    virtual std::string chatCompletionStream(const std::vector<Message>& messages,
+                                             TokenCallback onToken,
+                                             const std::string& model = "");
+    
+    /**
+     * Send a chat completion request offering functions to call
+     * @param messages Conversation, including earlier tool calls and results
+     * @param tools Functions the model may call
+     * @param model Model name to use
+     * @return Reply text and any calls the model made
+     *
+     * The default implementation handles only an empty tool list.
+     */
+    virtual ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                              const std::vector<ToolDefinition>& tools,
+                                              const std::string& model = "");
+    
+    /**
+     * Compute embeddings
+     * @param inputs Texts to embed
+     * @param model Embedding model name
+     * @return One embedding per input, in input order
+     *
+     * Providers split the inputs into as few requests as their limits
+     * allow. The default implementation throws: not every provider offers
+     * embeddings.
+     */
+    virtual std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                         const std::string& model = "");
+    
     /**
      * Set API key for the provider
      */
@@ -53,6 +267,43 @@ public:
      * Get provider name
      */
     virtual std::string getProviderName() const = 0;
+    
+    /**
+     * The concrete provider client; decorators forward to the client they wrap
+     */
+    virtual LLMClient* getUnderlyingClient() { return this; }
+    
+    /**
+     * The client a decorator wraps, nullptr for any other client
+     */
+    virtual LLMClient* getWrappedClient() { return nullptr; }
+    
+    /**
+     * What answers this client's requests besides the provider name: the
+     * endpoint and credentials, or the local model. Clients of equal
+     * identity answer a request alike, so their identical requests may be
+     * coalesced. Unique to the instance unless overridden.
+     */
+    virtual std::string getIdentity() const;
+    
+    /**
+     * Context window in tokens for requests naming the given model. Looked
+     * up by model name (see ConversationHistory::contextWindow) unless the
+     * client knows better, as a local model does.
+     */
+    virtual size_t contextWindow(const std::string& model = "") const;
+    
+    /**
+     * Token usage of the most recently completed request
+     */
+    virtual Usage getLastUsage() const;
+    
+protected:
+    void recordUsage(const Usage& usage);
+    
+private:
+    mutable std::mutex usageMutex;
+    Usage lastUsage;
 };
 
 /**
@@ -63,13 +314,35 @@ private:
     std::string apiKey;
     std::string baseUrl;
     
+    void buildChatRequest(const std::vector<Message>& messages, const std::string& model,
+                          HTTPRequest& request, bool stream = false,
+                          const std::vector<ToolDefinition>* tools = nullptr) const;
+    std::string parseChatResponse(const HTTPResponse& response);
+    ChatReply parseChatReply(const HTTPResponse& response);
+    void buildEmbeddingRequest(const std::string* inputs, size_t count, const std::string& model,
+                               HTTPRequest& request) const;
+    long parseEmbeddingResponse(const HTTPResponse& response, Embedding* out, size_t count);
+    
 public:
     OpenAIClient(const std::string& key = "", const std::string& url = "https://api.openai.com/v1");
     
     std::string chatCompletion(const std::vector<Message>& messages, 
                              const std::string& model = "gpt-3.5-turbo") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "gpt-3.5-turbo",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "gpt-3.5-turbo") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "gpt-3.5-turbo") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "text-embedding-3-small") override;
     void setApiKey(const std::string& key) override;
     std::string getProviderName() const override;
+    std::string getIdentity() const override;
 };
 
 /**
@@ -79,36 +352,102 @@ class ClaudeClient : public LLMClient {
 private:
     std::string apiKey;
     std::string baseUrl;
+    bool promptCaching;
+    
+    void buildChatRequest(const std::vector<Message>& messages, const std::string& model,
+                          HTTPRequest& request, bool stream = false,
+                          const std::vector<ToolDefinition>* tools = nullptr) const;
+    std::string parseChatResponse(const HTTPResponse& response);
+    ChatReply parseChatReply(const HTTPResponse& response);
     
 public:
     ClaudeClient(const std::string& key = "", const std::string& url = "https://api.anthropic.com/v1");
     
     std::string chatCompletion(const std::vector<Message>& messages, 
                              const std::string& model = "claude-3-sonnet-20240229") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "claude-3-sonnet-20240229",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "claude-3-sonnet-20240229") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "claude-3-sonnet-20240229") override;
     void setApiKey(const std::string& key) override;
     std::string getProviderName() const override;
+    std::string getIdentity() const override;
+    
+    /**
+     * Mark the system prompt and large messages as prompt cache
+     * breakpoints (cache_control), plus the newest message inside a
+     * ChatCompletion turn, so the next request reads the conversation
+     * from the cache. On by default. Cache writes cost more than plain
+     * input, reads much less.
+     */
+    void setPromptCaching(bool enabled);
 };
 
+class LlamaSession;
+class LlamaEmbedder;
+
 /**
- * GGML-based local client implementation
+ * Local GGUF model client running inference in-process (llama.cpp).
+ * Each client keeps its own KV cache, so successive turns of one
+ * conversation only evaluate the new tokens. Threads default to the
+ * GGML_THREADS environment variable, else one per hardware thread.
  */
 class GGMLClient : public LLMClient {
 private:
     std::string modelPath;
     std::string modelType;
+    int threads;
+    int contextSize;
+    std::unique_ptr<LlamaSession> session;
+    std::unique_ptr<LlamaEmbedder> embedder;
+    mutable std::mutex sessionMutex;   // inference in one context is sequential
+    std::string identity;              // model path, type and context size
+    int window;                        // contextSize as of the last update
+    mutable std::mutex identityMutex;  // not sessionMutex, held while generating
+    
+    LlamaSession& getSession();
+    LlamaEmbedder& getEmbedder();
+    void updateIdentity();
     
 public:
     GGMLClient(const std::string& path = "", const std::string& type = "llama");
+    ~GGMLClient() override;
     
     std::string chatCompletion(const std::vector<Message>& messages, 
                              const std::string& model = "") override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "") override;
     void setApiKey(const std::string& key) override;
     std::string getProviderName() const override;
+    std::string getIdentity() const override;
+    size_t contextWindow(const std::string& model = "") const override;
     void setModelPath(const std::string& path);
+    std::string getModelPath() const;
+    
+    /**
+     * Inference threads (0 = one per hardware thread) and context size in
+     * tokens; take effect when the model is next loaded
+     */
+    void setThreads(int count);
+    void setContextSize(int tokens);
 };
 
 /**
- * Client factory
+ * Client factory. Besides provider names it accepts
+ *   - "hedge:", "race:" or "failover:" followed by provider[/model],...
+ *     (see HedgingClient);
+ *   - "route:provider[/model],..." with the providers listed cheapest
+ *     first, sending each request to the cheapest backend expected to
+ *     meet the latency SLO (see RoutingClient).
  */
 class ClientFactory {
 public:
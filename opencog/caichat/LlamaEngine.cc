@@ -0,0 +1,413 @@
+#include "LlamaEngine.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#ifdef HAVE_LLAMA
+#include <llama.h>
+#endif
+
+namespace opencog {
+namespace caichat {
+
+// Plain transcript format for models without a chat template
+static std::string plainPrompt(const std::vector<Message>& messages) {
+    std::string prompt;
+    for (const auto& msg : messages) {
+        if (msg.role == Role::System) {
+            prompt += "System: " + msg.content.str() + "\n";
+        } else if (msg.role == Role::User) {
+            prompt += "User: " + msg.content.str() + "\n";
+        } else if (msg.role == Role::Assistant) {
+            prompt += "Assistant: " + msg.content.str() + "\n";
+        }
+    }
+    prompt += "Assistant: ";
+    return prompt;
+}
+
+#ifdef HAVE_LLAMA
+
+// Length of the longest prefix of text not ending in a partial UTF-8 sequence
+static size_t completeUTF8(const std::string& text) {
+    size_t end = text.size();
+    size_t start = end;
+    while (start > 0 && end - start < 4 && (text[start - 1] & 0xc0) == 0x80) {
+        --start;
+    }
+    if (start == 0) {
+        return end;
+    }
+    unsigned char lead = (unsigned char)text[start - 1];
+    size_t need = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+    return (end - (start - 1) >= need) ? end : start - 1;
+}
+
+/**
+ * Loaded model weights, shared by every session on the same file
+ */
+class LlamaModel {
+public:
+    explicit LlamaModel(const std::string& path) {
+        static std::once_flag backendInit;
+        std::call_once(backendInit, [] { llama_backend_init(); });
+
+        llama_model_params params = llama_model_default_params();
+        params.n_gpu_layers = 0;
+        params.use_mmap = true;
+        model = llama_model_load_from_file(path.c_str(), params);
+        if (!model) {
+            throw std::runtime_error("Failed to load GGUF model: " + path);
+        }
+        vocab = llama_model_get_vocab(model);
+    }
+
+    ~LlamaModel() {
+        llama_model_free(model);
+    }
+
+    llama_model* model;
+    const llama_vocab* vocab;
+};
+
+struct LlamaSession::Context {
+    llama_context* ctx = nullptr;
+    llama_sampler* sampler = nullptr;
+
+    ~Context() {
+        if (sampler) {
+            llama_sampler_free(sampler);
+        }
+        if (ctx) {
+            llama_free(ctx);
+        }
+    }
+};
+
+// One loaded model per path for as long as any session uses it
+static std::shared_ptr<LlamaModel> acquireModel(const std::string& path) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<LlamaModel>> models;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<LlamaModel> model = models[path].lock();
+    if (!model) {
+        model = std::make_shared<LlamaModel>(path);
+        models[path] = model;
+    }
+    return model;
+}
+
+LlamaSession::LlamaSession(const std::string& modelPath, const LlamaOptions& opts)
+    : model(acquireModel(modelPath)), context(new Context), options(opts), reusedTokens(0) {
+    int threads = options.threads > 0 ? options.threads
+                                      : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = options.contextSize;
+    params.n_batch = std::min(options.contextSize, 512);
+    params.n_threads = threads;
+    params.n_threads_batch = threads;
+    context->ctx = llama_init_from_model(model->model, params);
+    if (!context->ctx) {
+        throw std::runtime_error("Failed to create llama.cpp context");
+    }
+
+    context->sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(context->sampler, llama_sampler_init_min_p(0.05f, 1));
+    llama_sampler_chain_add(context->sampler, llama_sampler_init_temp(0.8f));
+    llama_sampler_chain_add(context->sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+}
+
+LlamaSession::~LlamaSession() {
+}
+
+bool LlamaSession::available() {
+    return true;
+}
+
+std::string LlamaSession::formatPrompt(const std::vector<Message>& messages) const {
+    const char* tmpl = llama_model_chat_template(model->model, nullptr);
+    if (!tmpl) {
+        return plainPrompt(messages);
+    }
+
+    std::vector<llama_chat_message> chat;
+    size_t length = 0;
+    for (const auto& msg : messages) {
+        chat.push_back({roleName(msg.role), msg.content.c_str()});
+        length += msg.content.size() + 32;
+    }
+
+    std::string buffer(length + 256, '\0');
+    int32_t n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true,
+                                          &buffer[0], (int32_t)buffer.size());
+    if (n > (int32_t)buffer.size()) {
+        buffer.resize(n);
+        n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true,
+                                      &buffer[0], (int32_t)buffer.size());
+    }
+    if (n < 0) {
+        // Template not understood by llama.cpp
+        return plainPrompt(messages);
+    }
+    buffer.resize(n);
+    return buffer;
+}
+
+std::string LlamaSession::generate(const std::vector<Message>& messages, TokenCallback onToken) {
+    const llama_vocab* vocab = model->vocab;
+    llama_context* ctx = context->ctx;
+
+    // Tokenize the whole conversation and compare it with the cache below
+    std::string prompt = formatPrompt(messages);
+    std::vector<llama_token> tokens(prompt.size() + 16);
+    int32_t n = llama_tokenize(vocab, prompt.data(), (int32_t)prompt.size(),
+                               tokens.data(), (int32_t)tokens.size(), true, true);
+    if (n < 0) {
+        tokens.resize(-n);
+        n = llama_tokenize(vocab, prompt.data(), (int32_t)prompt.size(),
+                           tokens.data(), (int32_t)tokens.size(), true, true);
+    }
+    if (n < 0) {
+        throw std::runtime_error("Failed to tokenize prompt");
+    }
+    tokens.resize(n);
+
+    int contextSize = (int)llama_n_ctx(ctx);
+    if ((int)tokens.size() + 1 >= contextSize) {
+        throw std::runtime_error("Prompt of " + std::to_string(tokens.size()) +
+                                 " tokens does not fit the context of " +
+                                 std::to_string(contextSize));
+    }
+
+    // Keep the longest common prefix in the KV cache. At least one token
+    // is always evaluated so there are logits to sample from.
+    size_t keep = 0;
+    while (keep < cachedTokens.size() && keep < tokens.size() &&
+           cachedTokens[keep] == tokens[keep]) {
+        ++keep;
+    }
+    if (keep == tokens.size() && keep > 0) {
+        --keep;
+    }
+    llama_memory_seq_rm(llama_get_memory(ctx), 0, (llama_pos)keep, -1);
+    cachedTokens.resize(keep);
+    reusedTokens = keep;
+
+    // Evaluate the new prompt tokens in batch-sized chunks
+    int batchSize = (int)llama_n_batch(ctx);
+    for (size_t pos = keep; pos < tokens.size(); pos += batchSize) {
+        int count = (int)std::min(tokens.size() - pos, (size_t)batchSize);
+        if (llama_decode(ctx, llama_batch_get_one(&tokens[pos], count)) != 0) {
+            cachedTokens.clear();
+            llama_memory_clear(llama_get_memory(ctx), true);
+            throw std::runtime_error("llama.cpp failed to evaluate the prompt");
+        }
+        cachedTokens.insert(cachedTokens.end(), tokens.begin() + pos, tokens.begin() + pos + count);
+    }
+
+    // Pieces can end inside a UTF-8 sequence; only whole characters are
+    // passed to onToken
+    std::string reply;
+    size_t emitted = 0;
+    char piece[256];
+    for (int i = 0; i < options.maxTokens; ++i) {
+        if ((int)cachedTokens.size() + 1 >= contextSize) {
+            break;
+        }
+        llama_token token = llama_sampler_sample(context->sampler, ctx, -1);
+        if (llama_vocab_is_eog(vocab, token)) {
+            break;
+        }
+
+        int32_t length = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, false);
+        if (length > 0) {
+            reply.append(piece, length);
+            size_t complete = completeUTF8(reply);
+            if (onToken && complete > emitted) {
+                onToken(reply.substr(emitted, complete - emitted));
+                emitted = complete;
+            }
+        }
+
+        if (llama_decode(ctx, llama_batch_get_one(&token, 1)) != 0) {
+            break;
+        }
+        cachedTokens.push_back(token);
+    }
+    if (onToken && reply.size() > emitted) {
+        onToken(reply.substr(emitted));
+    }
+    return reply;
+}
+
+// Sequences packed into one embedding batch
+static const int EMBEDDING_SEQUENCES = 64;
+
+struct LlamaEmbedder::Context {
+    llama_context* ctx = nullptr;
+    llama_batch batch = {};
+    bool batchAllocated = false;
+
+    ~Context() {
+        if (batchAllocated) {
+            llama_batch_free(batch);
+        }
+        if (ctx) {
+            llama_free(ctx);
+        }
+    }
+};
+
+LlamaEmbedder::LlamaEmbedder(const std::string& modelPath, const LlamaOptions& options)
+    : model(acquireModel(modelPath)), context(new Context) {
+    int threads = options.threads > 0 ? options.threads
+                                      : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    // Embedding models attend bidirectionally, so each input has to fit
+    // in a single micro-batch
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = options.contextSize;
+    params.n_batch = options.contextSize;
+    params.n_ubatch = options.contextSize;
+    params.n_seq_max = EMBEDDING_SEQUENCES;
+    params.n_threads = threads;
+    params.n_threads_batch = threads;
+    params.embeddings = true;
+    context->ctx = llama_init_from_model(model->model, params);
+    if (context->ctx && llama_pooling_type(context->ctx) == LLAMA_POOLING_TYPE_NONE) {
+        // Chat models carry no pooling metadata; average the token states
+        llama_free(context->ctx);
+        params.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+        context->ctx = llama_init_from_model(model->model, params);
+    }
+    if (!context->ctx) {
+        throw std::runtime_error("Failed to create llama.cpp embedding context");
+    }
+
+    context->batch = llama_batch_init(options.contextSize, 0, EMBEDDING_SEQUENCES);
+    context->batchAllocated = true;
+}
+
+LlamaEmbedder::~LlamaEmbedder() {
+}
+
+std::vector<Embedding> LlamaEmbedder::embed(const std::vector<std::string>& inputs) {
+    const llama_vocab* vocab = model->vocab;
+    llama_context* ctx = context->ctx;
+    llama_batch& batch = context->batch;
+    int capacity = (int)llama_n_batch(ctx);
+    int dimension = llama_model_n_embd(model->model);
+    bool encoderOnly = llama_model_has_encoder(model->model) && !llama_model_has_decoder(model->model);
+
+    std::vector<Embedding> embeddings(inputs.size());
+    size_t first = 0;   // first input of the pending batch
+
+    auto flush = [&](size_t end) {
+        if (batch.n_tokens == 0) {
+            return;
+        }
+        llama_memory_clear(llama_get_memory(ctx), true);
+        int status = encoderOnly ? llama_encode(ctx, batch) : llama_decode(ctx, batch);
+        if (status != 0) {
+            throw std::runtime_error("llama.cpp failed to compute embeddings");
+        }
+        for (size_t i = first; i < end; ++i) {
+            const float* pooled = llama_get_embeddings_seq(ctx, (llama_seq_id)(i - first));
+            if (!pooled) {
+                throw std::runtime_error("llama.cpp returned no pooled embedding");
+            }
+            embeddings[i].assign(pooled, pooled + dimension);
+        }
+        batch.n_tokens = 0;
+        first = end;
+    };
+
+    std::vector<llama_token> tokens;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const std::string& text = inputs[i];
+        tokens.resize(text.size() + 16);
+        int32_t n = llama_tokenize(vocab, text.data(), (int32_t)text.size(),
+                                   tokens.data(), (int32_t)tokens.size(), true, false);
+        if (n < 0) {
+            tokens.resize(-n);
+            n = llama_tokenize(vocab, text.data(), (int32_t)text.size(),
+                               tokens.data(), (int32_t)tokens.size(), true, false);
+        }
+        if (n < 0) {
+            throw std::runtime_error("Failed to tokenize embedding input");
+        }
+        if (n > capacity) {
+            throw std::runtime_error("Embedding input of " + std::to_string(n) +
+                                     " tokens does not fit the context of " +
+                                     std::to_string(capacity));
+        }
+
+        if (batch.n_tokens + n > capacity || (int)(i - first) == EMBEDDING_SEQUENCES) {
+            flush(i);
+        }
+        llama_seq_id sequence = (llama_seq_id)(i - first);
+        for (int32_t t = 0; t < n; ++t) {
+            int slot = batch.n_tokens++;
+            batch.token[slot] = tokens[t];
+            batch.pos[slot] = t;
+            batch.n_seq_id[slot] = 1;
+            batch.seq_id[slot][0] = sequence;
+            batch.logits[slot] = true;   // outputs are needed for pooling
+        }
+    }
+    flush(inputs.size());
+    return embeddings;
+}
+
+#else // !HAVE_LLAMA
+
+class LlamaModel {
+};
+
+struct LlamaSession::Context {
+};
+
+LlamaSession::LlamaSession(const std::string&, const LlamaOptions& opts)
+    : options(opts), reusedTokens(0) {
+    throw std::runtime_error("Local inference is not available: caichat was built "
+                             "without llama.cpp (configure with -DCAICHAT_WITH_LLAMA=ON)");
+}
+
+LlamaSession::~LlamaSession() {
+}
+
+bool LlamaSession::available() {
+    return false;
+}
+
+std::string LlamaSession::formatPrompt(const std::vector<Message>& messages) const {
+    return plainPrompt(messages);
+}
+
+std::string LlamaSession::generate(const std::vector<Message>&, TokenCallback) {
+    throw std::runtime_error("Local inference is not available");
+}
+
+struct LlamaEmbedder::Context {
+};
+
+LlamaEmbedder::LlamaEmbedder(const std::string&, const LlamaOptions&) {
+    throw std::runtime_error("Local embeddings are not available: caichat was built "
+                             "without llama.cpp (configure with -DCAICHAT_WITH_LLAMA=ON)");
+}
+
+LlamaEmbedder::~LlamaEmbedder() {
+}
+
+std::vector<Embedding> LlamaEmbedder::embed(const std::vector<std::string>&) {
+    throw std::runtime_error("Local embeddings are not available");
+}
+
+#endif // HAVE_LLAMA
+
+} // namespace caichat
+} // namespace opencog
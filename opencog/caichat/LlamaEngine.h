@@ -0,0 +1,105 @@
+#ifndef LLAMAENGINE_H
+#define LLAMAENGINE_H
+
+#include "LLMClient.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+class LlamaModel;
+
+/**
+ * Settings of a local inference session
+ */
+struct LlamaOptions {
+    int threads = 0;          // 0 = one per hardware thread
+    int contextSize = 4096;   // tokens
+    int maxTokens = 1000;     // per reply
+};
+
+/**
+ * In-process inference on a GGUF model with llama.cpp.
+ *
+ * Model weights are memory-mapped and shared: every session opened on the
+ * same file uses one loaded model and the same page-cache pages. Each
+ * session owns its context and remembers which tokens its KV cache holds,
+ * so a new turn only evaluates the tokens after the longest common prefix
+ * with the previous prompt and reply.
+ *
+ * Sessions are not thread-safe; GGMLClient serializes calls.
+ *
+ * Built only with CAICHAT_WITH_LLAMA; otherwise the constructor throws.
+ */
+class LlamaSession {
+public:
+    LlamaSession(const std::string& modelPath, const LlamaOptions& options);
+    ~LlamaSession();
+
+    LlamaSession(const LlamaSession&) = delete;
+    LlamaSession& operator=(const LlamaSession&) = delete;
+
+    /**
+     * Generate the assistant reply to messages, calling onToken (if set)
+     * with each piece of text as it is produced
+     */
+    std::string generate(const std::vector<Message>& messages, TokenCallback onToken);
+
+    /**
+     * Prompt tokens served from the KV cache in the last call
+     */
+    size_t getReusedTokens() const { return reusedTokens; }
+
+    /**
+     * Whether llama.cpp support was compiled in
+     */
+    static bool available();
+
+private:
+    std::string formatPrompt(const std::vector<Message>& messages) const;
+
+    std::shared_ptr<LlamaModel> model;
+    struct Context;
+    std::unique_ptr<Context> context;
+    LlamaOptions options;
+    std::vector<int32_t> cachedTokens;   // tokens currently in the KV cache
+    size_t reusedTokens;
+};
+
+/**
+ * Sentence embeddings from a GGUF model with llama.cpp.
+ *
+ * Uses its own embedding-mode context on the shared, memory-mapped model
+ * weights. Several inputs are packed into each batch as separate
+ * sequences and pooled per sequence (mean pooling unless the model
+ * specifies otherwise).
+ *
+ * Not thread-safe; GGMLClient serializes calls.
+ */
+class LlamaEmbedder {
+public:
+    LlamaEmbedder(const std::string& modelPath, const LlamaOptions& options);
+    ~LlamaEmbedder();
+
+    LlamaEmbedder(const LlamaEmbedder&) = delete;
+    LlamaEmbedder& operator=(const LlamaEmbedder&) = delete;
+
+    /**
+     * One embedding per input. Throws if an input is longer than the
+     * context.
+     */
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs);
+
+private:
+    std::shared_ptr<LlamaModel> model;
+    struct Context;
+    std::unique_ptr<Context> context;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // LLAMAENGINE_H
@@ -0,0 +1,439 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+// Histogram implementation
+Histogram::Histogram() : total(0), sumMicros(0) {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Values below 16 get a bucket each; above, bucket (e - 3) * 16 + s holds
+// the values whose highest bit is e and next four bits are s
+size_t Histogram::bucketFor(uint64_t micros) {
+    const uint64_t sub = 1 << SUB_BITS;
+    if (micros < sub) {
+        return (size_t)micros;
+    }
+    int exponent = 63 - __builtin_clzll(micros);
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    uint64_t mantissa = (micros >> (exponent - SUB_BITS)) - sub;
+    return (size_t)((exponent - SUB_BITS + 1) * sub + mantissa);
+}
+
+// Midpoint of a bucket's range
+uint64_t Histogram::bucketValue(size_t bucket) {
+    const uint64_t sub = 1 << SUB_BITS;
+    if (bucket < sub) {
+        return bucket;
+    }
+    int shift = (int)(bucket / sub) - 1;
+    uint64_t lower = (sub + bucket % sub) << shift;
+    return lower + ((uint64_t)1 << shift) / 2;
+}
+
+void Histogram::record(uint64_t micros) {
+    buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sumMicros.fetch_add(micros, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::quantile(double q) const {
+    // Count from the buckets themselves, which concurrent records may
+    // have updated after total
+    uint64_t counts[BUCKETS];
+    uint64_t n = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        n += counts[i];
+    }
+    if (n == 0) {
+        return 0;
+    }
+    q = q < 0 ? 0 : q > 1 ? 1 : q;
+    uint64_t rank = (uint64_t)(q * (double)n + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketValue(i);
+        }
+    }
+    return bucketValue(BUCKETS - 1);
+}
+
+void Histogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sumMicros.store(0, std::memory_order_relaxed);
+}
+
+// ModelMetrics implementation
+const char* ModelMetrics::phaseName(int phase) {
+    static const char* const NAMES[PHASES] = {
+        "dns", "connect", "tls", "ttfb", "transfer", "total", "serialize", "parse"
+    };
+    return phase >= 0 && phase < PHASES ? NAMES[phase] : "unknown";
+}
+
+void ModelMetrics::recordTransfer(const HTTPTimings& timings) {
+    // Connection phases only when a new connection was made
+    if (!timings.reused) {
+        phases[DNS].record(timings.dns);
+        phases[CONNECT].record(timings.connect);
+        if (timings.tls > 0) {
+            phases[TLS].record(timings.tls);
+        }
+    }
+    phases[TTFB].record(timings.ttfb);
+    phases[TRANSFER].record(timings.transfer);
+    phases[TOTAL].record(timings.total);
+}
+
+void ModelMetrics::reset() {
+    for (Histogram& phase : phases) {
+        phase.reset();
+    }
+    for (Counter* counter : {&requests, &errors, &inputTokens, &outputTokens,
+                             &cacheReadTokens, &cacheWriteTokens, &retries, &hedges, &cacheHits, &cacheMisses,
+                             &coalesced, &routed}) {
+        counter->reset();
+    }
+}
+
+// Metrics implementation
+std::atomic<bool> Metrics::enabled(true);
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics() : serverSocket(-1) {
+    wakePipe[0] = wakePipe[1] = -1;
+}
+
+Metrics::~Metrics() {
+    serve(0);
+}
+
+ModelMetrics& Metrics::forModel(const std::string& provider, const std::string& model) {
+    // Interned, so looking up a known series allocates nothing
+    std::pair<Name, Name> key(provider, model.empty() ? Name("default") : Name(model));
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(mutex);
+        auto it = series.find(key);
+        if (it != series.end()) {
+            return *it->second;
+        }
+    }
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    std::unique_ptr<ModelMetrics>& entry = series[key];
+    if (!entry) {
+        entry.reset(new ModelMetrics());
+    }
+    return *entry;
+}
+
+std::vector<std::pair<std::pair<std::string, std::string>, const ModelMetrics*>>
+Metrics::snapshot() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    std::vector<std::pair<std::pair<std::string, std::string>, const ModelMetrics*>> result;
+    for (const auto& entry : series) {
+        result.emplace_back(std::make_pair(entry.first.first.str(), entry.first.second.str()),
+                            entry.second.get());
+    }
+    // The map is ordered by name identity; report by name (names are unique)
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void Metrics::reset() {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    for (auto& entry : series) {
+        entry.second->reset();
+    }
+}
+
+// Label value with \, " and newline escaped
+static std::string escapeLabel(const std::string& value) {
+    std::string result;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            result += '\\';
+            result += c;
+        } else if (c == '\n') {
+            result += "\\n";
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static std::string seconds(uint64_t micros) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6f", (double)micros / 1e6);
+    return buffer;
+}
+
+std::string Metrics::renderPrometheus() const {
+    auto all = snapshot();
+    std::vector<std::string> labels;
+    for (const auto& entry : all) {
+        labels.push_back("provider=\"" + escapeLabel(entry.first.first) +
+                         "\",model=\"" + escapeLabel(entry.first.second) + "\"");
+    }
+
+    std::ostringstream out;
+    struct Family {
+        const char* name;
+        const char* help;
+        Counter ModelMetrics::*counter;
+        const char* extra;
+    };
+    static const Family FAMILIES[] = {
+        {"caichat_requests_total", "Provider requests completed or failed",
+         &ModelMetrics::requests, nullptr},
+        {"caichat_request_errors_total", "Provider requests that failed",
+         &ModelMetrics::errors, nullptr},
+        {"caichat_tokens_total", "Tokens reported in the provider's usage",
+         &ModelMetrics::inputTokens, "direction=\"input\""},
+        {nullptr, nullptr, &ModelMetrics::outputTokens, "direction=\"output\""},
+        {nullptr, nullptr, &ModelMetrics::cacheReadTokens, "direction=\"cache_read\""},
+        {nullptr, nullptr, &ModelMetrics::cacheWriteTokens, "direction=\"cache_write\""},
+        {"caichat_retries_total", "Requests sent again after a retryable failure",
+         &ModelMetrics::retries, nullptr},
+        {"caichat_hedges_total", "Hedged requests sent while another was pending",
+         &ModelMetrics::hedges, nullptr},
+        {"caichat_cache_hits_total", "Requests answered from the response cache",
+         &ModelMetrics::cacheHits, nullptr},
+        {"caichat_cache_misses_total", "Requests not found in the response cache",
+         &ModelMetrics::cacheMisses, nullptr},
+        {"caichat_coalesced_total", "Requests that waited on an identical request in flight",
+         &ModelMetrics::coalesced, nullptr},
+        {"caichat_routed_total", "Requests a router sent to this model",
+         &ModelMetrics::routed, nullptr},
+    };
+    const char* name = nullptr;
+    for (const Family& family : FAMILIES) {
+        if (family.name) {
+            name = family.name;
+            out << "# HELP " << name << " " << family.help << "\n";
+            out << "# TYPE " << name << " counter\n";
+        }
+        for (size_t i = 0; i < all.size(); ++i) {
+            out << name << "{" << labels[i];
+            if (family.extra) {
+                out << "," << family.extra;
+            }
+            out << "} " << (all[i].second->*family.counter).get() << "\n";
+        }
+    }
+
+    static const double QUANTILES[] = {0.5, 0.9, 0.99};
+    out << "# HELP caichat_phase_seconds Duration of each phase of a provider request\n";
+    out << "# TYPE caichat_phase_seconds summary\n";
+    for (size_t i = 0; i < all.size(); ++i) {
+        for (int phase = 0; phase < ModelMetrics::PHASES; ++phase) {
+            const Histogram& histogram = all[i].second->phases[phase];
+            uint64_t count = histogram.count();
+            if (count == 0) {
+                continue;
+            }
+            std::string series = labels[i] + ",phase=\"" + ModelMetrics::phaseName(phase) + "\"";
+            for (double q : QUANTILES) {
+                out << "caichat_phase_seconds{" << series << ",quantile=\"" << q << "\"} "
+                    << seconds(histogram.quantile(q)) << "\n";
+            }
+            out << "caichat_phase_seconds_sum{" << series << "} " << seconds(histogram.sum()) << "\n";
+            out << "caichat_phase_seconds_count{" << series << "} " << count << "\n";
+        }
+    }
+    return out.str();
+}
+
+void Metrics::writePrometheus(const std::string& path) const {
+    std::string text = renderPrometheus();
+    std::string temp = path + ".tmp." + std::to_string(getpid());
+    FILE* file = std::fopen(temp.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Failed to open " + temp + ": " + std::strerror(errno));
+    }
+    bool ok = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        int error = errno;
+        std::remove(temp.c_str());
+        throw std::runtime_error("Failed to write " + path + ": " + std::strerror(error));
+    }
+}
+
+int Metrics::serve(int port) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if (server.joinable()) {
+        char stop = 0;
+        if (::write(wakePipe[1], &stop, 1) < 0) {
+            // the loop also ends when the pipe is closed below
+        }
+        server.join();
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        close(serverSocket);
+        serverSocket = wakePipe[0] = wakePipe[1] = -1;
+    }
+    if (port <= 0) {
+        return 0;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Failed to create socket: ") + std::strerror(errno));
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    socklen_t length = sizeof(address);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0 ||
+        getsockname(fd, (sockaddr*)&address, &length) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::runtime_error("Failed to listen on port " + std::to_string(port) + ": " +
+                                 std::strerror(error));
+    }
+    if (pipe2(wakePipe, O_CLOEXEC) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::runtime_error(std::string("Failed to create pipe: ") + std::strerror(error));
+    }
+    serverSocket = fd;
+    server = std::thread(&Metrics::acceptLoop, this, fd);
+    return ntohs(address.sin_port);
+}
+
+// Answer every connection with the current metrics, one at a time
+void Metrics::acceptLoop(int socket) {
+    int wake = wakePipe[0];
+    while (true) {
+        pollfd fds[2] = {{socket, POLLIN, 0}, {wake, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        int client = accept4(socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        // Read the request head (whatever it asks for), waiting briefly
+        char buffer[4096];
+        pollfd in = {client, POLLIN, 0};
+        if (poll(&in, 1, 1000) > 0 && recv(client, buffer, sizeof(buffer), 0) < 0) {
+            close(client);
+            continue;
+        }
+        std::string body = renderPrometheus();
+        std::string response = "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += (size_t)n;
+        }
+        close(client);
+    }
+}
+
+// CallTimer implementation
+static uint64_t microsSince(std::chrono::steady_clock::time_point start,
+                            std::chrono::steady_clock::time_point now) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+}
+
+CallTimer::CallTimer(const std::string& provider, const std::string& model)
+    : metrics(Metrics::isEnabled() ? &Metrics::instance().forModel(provider, model) : nullptr),
+      mark(metrics ? Clock::now() : Clock::time_point()) {
+}
+
+void CallTimer::sent() {
+    if (metrics) {
+        Clock::time_point now = Clock::now();
+        metrics->phases[ModelMetrics::SERIALIZE].record(microsSince(mark, now));
+        mark = now;
+    }
+}
+
+void CallTimer::received(const HTTPTimings& timings) {
+    if (metrics) {
+        metrics->recordTransfer(timings);
+        mark = Clock::now();
+    }
+}
+
+void CallTimer::finish(long inputTokens, long outputTokens,
+                       long cacheReadTokens, long cacheWriteTokens) {
+    if (metrics) {
+        metrics->phases[ModelMetrics::PARSE].record(microsSince(mark, Clock::now()));
+        streamed(inputTokens, outputTokens, cacheReadTokens, cacheWriteTokens);
+    }
+}
+
+static uint64_t tokens(long count) {
+    return count > 0 ? (uint64_t)count : 0;
+}
+
+void CallTimer::streamed(long inputTokens, long outputTokens,
+                         long cacheReadTokens, long cacheWriteTokens) {
+    if (metrics) {
+        metrics->requests.add();
+        metrics->inputTokens.add(tokens(inputTokens));
+        metrics->outputTokens.add(tokens(outputTokens));
+        metrics->cacheReadTokens.add(tokens(cacheReadTokens));
+        metrics->cacheWriteTokens.add(tokens(cacheWriteTokens));
+    }
+}
+
+void CallTimer::failed() {
+    if (metrics) {
+        metrics->requests.add();
+        metrics->errors.add();
+    }
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,219 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "Text.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Monotonic counter; increments are a relaxed atomic add
+ */
+class Counter {
+public:
+    Counter() : value(0) {}
+    void add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    void reset() { value.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+/**
+ * Lock-free latency histogram in microseconds with HDR-style log-linear
+ * buckets: 16 linear sub-buckets per power of two, so any recorded value
+ * is reported within 1/16 (6%) of its true value, from 1us to ~19 hours.
+ */
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t micros);
+
+    /**
+     * Value at quantile q (0..1), 0 if nothing was recorded
+     */
+    uint64_t quantile(double q) const;
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sumMicros.load(std::memory_order_relaxed); }
+    void reset();
+
+    static const int SUB_BITS = 4;
+    static const int MAX_EXPONENT = 36;
+    static const size_t BUCKETS = (1 << SUB_BITS) * (MAX_EXPONENT - SUB_BITS + 2);
+
+private:
+    static size_t bucketFor(uint64_t micros);
+    static uint64_t bucketValue(size_t bucket);
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sumMicros;
+};
+
+/**
+ * Durations of the phases of one HTTP transfer in microseconds, from
+ * curl's CURLINFO_*_TIME_T values. The connection phases (DNS, connect,
+ * TLS) are 0 when an open connection was reused.
+ */
+struct HTTPTimings {
+    bool reused = false;
+    uint64_t dns = 0;
+    uint64_t connect = 0;
+    uint64_t tls = 0;
+    uint64_t ttfb = 0;       // request sent to first response byte
+    uint64_t transfer = 0;   // first to last response byte
+    uint64_t total = 0;
+};
+
+/**
+ * All series of one provider and model
+ */
+struct ModelMetrics {
+    enum Phase { DNS, CONNECT, TLS, TTFB, TRANSFER, TOTAL, SERIALIZE, PARSE, PHASES };
+
+    Histogram phases[PHASES];
+    Counter requests;
+    Counter errors;
+    Counter inputTokens;
+    Counter outputTokens;
+    Counter cacheReadTokens;    // input served from the provider's prompt cache
+    Counter cacheWriteTokens;   // input written to it
+    Counter retries;
+    Counter hedges;
+    Counter cacheHits;
+    Counter cacheMisses;
+    Counter coalesced;          // requests that joined an identical one in flight
+    Counter routed;             // requests a router chose this model for
+
+    static const char* phaseName(int phase);
+    void recordTransfer(const HTTPTimings& timings);
+    void reset();
+};
+
+/**
+ * Process-wide metrics registry.
+ *
+ * Series are created on first use and never freed, so callers can keep
+ * the reference from forModel(); recording is then lock-free. Enabled by
+ * default.
+ */
+class Metrics {
+public:
+    static Metrics& instance();
+
+    /**
+     * Series of a provider and model ("" is reported as "default")
+     */
+    ModelMetrics& forModel(const std::string& provider, const std::string& model);
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+
+    /**
+     * Every series with its provider and model
+     */
+    std::vector<std::pair<std::pair<std::string, std::string>, const ModelMetrics*>> snapshot() const;
+
+    /**
+     * Zero all series
+     */
+    void reset();
+
+    /**
+     * Prometheus text exposition format (version 0.0.4)
+     */
+    std::string renderPrometheus() const;
+
+    /**
+     * Write renderPrometheus() to path atomically (write and rename), e.g.
+     * for the node_exporter textfile collector
+     */
+    void writePrometheus(const std::string& path) const;
+
+    /**
+     * Serve renderPrometheus() over HTTP on 127.0.0.1:port from a
+     * background thread; port 0 stops serving. Returns the bound port.
+     */
+    int serve(int port);
+
+private:
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void acceptLoop(int socket);
+
+    static std::atomic<bool> enabled;
+
+    mutable std::shared_timed_mutex mutex;
+    std::map<std::pair<Name, Name>, std::unique_ptr<ModelMetrics>> series;
+
+    std::mutex serverMutex;
+    std::thread server;
+    int serverSocket;
+    int wakePipe[2];
+};
+
+/**
+ * Timing of one provider call: the time since construction is
+ * serialization until sent(), then the transfer, then parsing until
+ * finish(). A copyable value, so asynchronous callbacks can carry it.
+ * Does nothing while metrics are disabled.
+ */
+class CallTimer {
+public:
+    CallTimer(const std::string& provider, const std::string& model);
+
+    /**
+     * The request body is ready
+     */
+    void sent();
+
+    /**
+     * The response arrived; parsing starts now
+     */
+    void received(const HTTPTimings& timings);
+
+    /**
+     * The response was parsed; records its token usage
+     */
+    void finish(long inputTokens, long outputTokens,
+                long cacheReadTokens = 0, long cacheWriteTokens = 0);
+
+    /**
+     * A streamed response ended; its parsing overlapped the transfer, so
+     * no parse time is recorded
+     */
+    void streamed(long inputTokens, long outputTokens,
+                  long cacheReadTokens = 0, long cacheWriteTokens = 0);
+
+    void failed();
+
+    ModelMetrics* getMetrics() const { return metrics; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    ModelMetrics* metrics;
+    Clock::time_point mark;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // METRICS_H
@@ -0,0 +1,408 @@
+#include "ResponseCache.h"
+#include "Hash.h"
+#include "Metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+// On-disk layout: 8-byte magic, then records of
+// [uint64 key][uint32 length][length value bytes], native byte order.
+static const char DISK_MAGIC[8] = {'C', 'A', 'I', 'C', 'A', 'C', 'H', '1'};
+static const size_t RECORD_HEADER = sizeof(uint64_t) + sizeof(uint32_t);
+
+ResponseCache::ResponseCache(size_t maxBytes)
+    : shardBudget(maxBytes / SHARDS), diskFd(-1), diskMap(nullptr), diskMapSize(0),
+      diskSize(0), hits(0), diskHits(0), misses(0), evictions(0) {
+}
+
+ResponseCache::~ResponseCache() {
+    closeDisk();
+}
+
+uint64_t ResponseCache::requestKey(const std::string& client, const std::string& model,
+                                   const std::vector<Message>& messages) {
+    Hasher hasher;
+    hasher.update(client).update(model).update((uint64_t)messages.size());
+    for (const auto& msg : messages) {
+        const char* role = roleName(msg.role);
+        hasher.update(role, std::strlen(role)).update(msg.content);
+        hasher.update((uint64_t)msg.toolCalls.size());
+        for (const ToolCall& call : msg.toolCalls) {
+            hasher.update(call.id).update(call.name).update(call.arguments);
+        }
+        hasher.update(msg.toolCallId);
+    }
+    return hasher.digest();
+}
+
+uint64_t ResponseCache::embeddingKey(const std::string& client, const std::string& model,
+                                     const std::string& text) {
+    Hasher hasher;
+    hasher.update("embedding").update(client).update(model).update(text);
+    return hasher.digest();
+}
+
+bool ResponseCache::get(uint64_t key, std::string& value) {
+    Shard& shard = shardFor(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            value = it->second->value;
+            hits++;
+            return true;
+        }
+    }
+
+    if (readDisk(key, value)) {
+        diskHits++;
+        insertMemory(key, value);
+        return true;
+    }
+
+    misses++;
+    return false;
+}
+
+void ResponseCache::put(uint64_t key, const std::string& value) {
+    insertMemory(key, value);
+    appendDisk(key, value);
+}
+
+void ResponseCache::insertMemory(uint64_t key, const std::string& value) {
+    size_t budget = shardBudget;
+    if (value.size() > budget) {
+        return;  // would evict the whole shard for a single entry
+    }
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.bytes -= it->second->value.size();
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+
+    shard.lru.push_front(Entry{key, value});
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += value.size();
+
+    while (shard.bytes > budget && !shard.lru.empty()) {
+        Entry& victim = shard.lru.back();
+        shard.bytes -= victim.value.size();
+        shard.index.erase(victim.key);
+        shard.lru.pop_back();
+        evictions++;
+    }
+}
+
+void ResponseCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+    }
+}
+
+void ResponseCache::setMaxBytes(size_t maxBytes) {
+    shardBudget = maxBytes / SHARDS;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        while (shard.bytes > shardBudget && !shard.lru.empty()) {
+            Entry& victim = shard.lru.back();
+            shard.bytes -= victim.value.size();
+            shard.index.erase(victim.key);
+            shard.lru.pop_back();
+            evictions++;
+        }
+    }
+}
+
+ResponseCache::Stats ResponseCache::getStats() const {
+    Stats stats;
+    stats.hits = hits;
+    stats.diskHits = diskHits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.entries += shard.index.size();
+        stats.bytes += shard.bytes;
+    }
+    std::lock_guard<std::mutex> lock(diskMutex);
+    stats.diskEntries = diskIndex.size();
+    return stats;
+}
+
+// Disk tier
+void ResponseCache::openDisk(const std::string& path) {
+    std::lock_guard<std::mutex> lock(diskMutex);
+    if (diskFd >= 0) {
+        ::close(diskFd);
+        unmapDisk();
+        diskIndex.clear();
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open cache file " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat cache file " + path);
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    if (size == 0) {
+        if (::write(fd, DISK_MAGIC, sizeof(DISK_MAGIC)) != (ssize_t)sizeof(DISK_MAGIC)) {
+            ::close(fd);
+            throw std::runtime_error("Failed to initialize cache file " + path);
+        }
+        size = sizeof(DISK_MAGIC);
+    } else {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Failed to map cache file " + path);
+        }
+        diskMap = static_cast<const char*>(map);
+        diskMapSize = size;
+
+        if (size < sizeof(DISK_MAGIC) || std::memcmp(diskMap, DISK_MAGIC, sizeof(DISK_MAGIC)) != 0) {
+            unmapDisk();
+            ::close(fd);
+            throw std::runtime_error("Not a caichat cache file: " + path);
+        }
+
+        // Index record headers only; values stay in the mapping until used
+        uint64_t offset = sizeof(DISK_MAGIC);
+        while (offset + RECORD_HEADER <= size) {
+            uint64_t key;
+            uint32_t length;
+            std::memcpy(&key, diskMap + offset, sizeof(key));
+            std::memcpy(&length, diskMap + offset + sizeof(key), sizeof(length));
+            if (offset + RECORD_HEADER + length > size) {
+                break;  // torn write at the tail
+            }
+            diskIndex[key] = DiskRecord{offset + RECORD_HEADER, length};
+            offset += RECORD_HEADER + length;
+        }
+        if (offset != size && ftruncate(fd, (off_t)offset) == 0) {
+            size = offset;
+        }
+    }
+
+    diskFd = fd;
+    diskSize = size;
+}
+
+void ResponseCache::closeDisk() {
+    std::lock_guard<std::mutex> lock(diskMutex);
+    if (diskFd >= 0) {
+        ::close(diskFd);
+        diskFd = -1;
+    }
+    unmapDisk();
+    diskIndex.clear();
+    diskSize = 0;
+}
+
+void ResponseCache::unmapDisk() {
+    if (diskMap) {
+        munmap(const_cast<char*>(diskMap), diskMapSize);
+        diskMap = nullptr;
+        diskMapSize = 0;
+    }
+}
+
+bool ResponseCache::readDisk(uint64_t key, std::string& value) {
+    std::lock_guard<std::mutex> lock(diskMutex);
+    if (diskFd < 0) {
+        return false;
+    }
+    auto it = diskIndex.find(key);
+    if (it == diskIndex.end()) {
+        return false;
+    }
+
+    const DiskRecord& record = it->second;
+    if (record.offset + record.length <= diskMapSize) {
+        value.assign(diskMap + record.offset, record.length);
+        return true;
+    }
+
+    // Appended after the file was mapped
+    value.resize(record.length);
+    ssize_t n = pread(diskFd, &value[0], record.length, (off_t)record.offset);
+    return n == (ssize_t)record.length;
+}
+
+void ResponseCache::appendDisk(uint64_t key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(diskMutex);
+    if (diskFd < 0 || value.size() > UINT32_MAX) {
+        return;
+    }
+
+    // One write per record so concurrent appenders never interleave
+    uint32_t length = (uint32_t)value.size();
+    std::string record(RECORD_HEADER + value.size(), '\0');
+    std::memcpy(&record[0], &key, sizeof(key));
+    std::memcpy(&record[sizeof(key)], &length, sizeof(length));
+    std::memcpy(&record[RECORD_HEADER], value.data(), value.size());
+
+    if (::write(diskFd, record.data(), record.size()) == (ssize_t)record.size()) {
+        diskIndex[key] = DiskRecord{diskSize + RECORD_HEADER, length};
+        diskSize += record.size();
+    }
+}
+
+// CachingClient implementation
+
+// Count cache lookups per provider and model
+static void countLookups(const std::string& provider, const std::string& model,
+                         size_t hits, size_t misses) {
+    if (Metrics::isEnabled()) {
+        ModelMetrics& metrics = Metrics::instance().forModel(provider, model);
+        metrics.cacheHits.add(hits);
+        metrics.cacheMisses.add(misses);
+    }
+}
+
+CachingClient::CachingClient(std::unique_ptr<LLMClient> client, std::shared_ptr<ResponseCache> responseCache)
+    : inner(std::move(client)), cache(std::move(responseCache)) {
+}
+
+std::string CachingClient::chatCompletion(const std::vector<Message>& messages, const std::string& model) {
+    std::string provider = inner->getProviderName();
+    uint64_t key = ResponseCache::requestKey(inner->getIdentity(), model, messages);
+    std::string response;
+    bool hit = cache->get(key, response);
+    countLookups(provider, model, hit, !hit);
+    if (hit) {
+        return response;
+    }
+    response = inner->chatCompletion(messages, model);
+    cache->put(key, response);
+    return response;
+}
+
+void CachingClient::submitChatCompletion(const std::vector<Message>& messages,
+                                         CompletionCallback onDone,
+                                         const std::string& model,
+                                         CancelHandle cancel) {
+    std::string provider = inner->getProviderName();
+    uint64_t key = ResponseCache::requestKey(inner->getIdentity(), model, messages);
+    std::string response;
+    bool hit = cache->get(key, response);
+    countLookups(provider, model, hit, !hit);
+    if (hit) {
+        onDone(response, nullptr);
+        return;
+    }
+    std::shared_ptr<ResponseCache> store = cache;
+    inner->submitChatCompletion(messages, [store, key, onDone](const std::string& content, std::exception_ptr error) {
+        if (!error) {
+            store->put(key, content);
+        }
+        onDone(content, error);
+    }, model, cancel);
+}
+
+std::string CachingClient::chatCompletionStream(const std::vector<Message>& messages,
+                                                TokenCallback onToken,
+                                                const std::string& model) {
+    std::string provider = inner->getProviderName();
+    uint64_t key = ResponseCache::requestKey(inner->getIdentity(), model, messages);
+    std::string response;
+    bool hit = cache->get(key, response);
+    countLookups(provider, model, hit, !hit);
+    if (hit) {
+        onToken(response);
+        return response;
+    }
+    response = inner->chatCompletionStream(messages, onToken, model);
+    cache->put(key, response);
+    return response;
+}
+
+ChatReply CachingClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                 const std::vector<ToolDefinition>& tools,
+                                                 const std::string& model) {
+    return inner->chatCompletionWithTools(messages, tools, model);
+}
+
+// Embeddings are stored as their raw float bytes
+std::vector<Embedding> CachingClient::embed(const std::vector<std::string>& inputs,
+                                            const std::string& model) {
+    std::string provider = inner->getProviderName();
+    std::string identity = inner->getIdentity();
+    std::vector<Embedding> embeddings(inputs.size());
+    std::vector<uint64_t> keys(inputs.size());
+    std::vector<size_t> missing;
+    std::vector<std::string> missingInputs;
+    std::string value;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        keys[i] = ResponseCache::embeddingKey(identity, model, inputs[i]);
+        if (cache->get(keys[i], value) && value.size() % sizeof(float) == 0) {
+            embeddings[i].resize(value.size() / sizeof(float));
+            std::memcpy(embeddings[i].data(), value.data(), value.size());
+        } else {
+            missing.push_back(i);
+            missingInputs.push_back(inputs[i]);
+        }
+    }
+    countLookups(provider, model, inputs.size() - missing.size(), missing.size());
+    if (missing.empty()) {
+        return embeddings;
+    }
+    
+    std::vector<Embedding> computed = inner->embed(missingInputs, model);
+    for (size_t j = 0; j < missing.size() && j < computed.size(); ++j) {
+        size_t i = missing[j];
+        embeddings[i] = std::move(computed[j]);
+        value.assign(reinterpret_cast<const char*>(embeddings[i].data()),
+                     embeddings[i].size() * sizeof(float));
+        cache->put(keys[i], value);
+    }
+    return embeddings;
+}
+
+void CachingClient::setApiKey(const std::string& key) {
+    inner->setApiKey(key);
+}
+
+std::string CachingClient::getProviderName() const {
+    return inner->getProviderName();
+}
+
+std::string CachingClient::getIdentity() const {
+    return inner->getIdentity();
+}
+
+size_t CachingClient::contextWindow(const std::string& model) const {
+    return inner->contextWindow(model);
+}
+
+LLMClient* CachingClient::getUnderlyingClient() {
+    return inner->getUnderlyingClient();
+}
+
+Usage CachingClient::getLastUsage() const {
+    return inner->getLastUsage();
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,166 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "LLMClient.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Content-addressed cache of byte strings keyed by a 64-bit hash.
+ *
+ * The memory tier is a sharded LRU bounded by total bytes; each shard has
+ * its own lock so concurrent lookups rarely contend. The optional disk
+ * tier is an append-only record file that is memory-mapped and indexed
+ * when opened, so cached values survive process restarts.
+ */
+class ResponseCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;        // served from memory
+        uint64_t diskHits = 0;    // served from the disk tier
+        uint64_t misses = 0;
+        uint64_t evictions = 0;   // dropped from memory to stay under budget
+        uint64_t entries = 0;     // currently in memory
+        uint64_t bytes = 0;       // currently in memory
+        uint64_t diskEntries = 0;
+    };
+
+    explicit ResponseCache(size_t maxBytes = 64 * 1024 * 1024);
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    /**
+     * Look up a value, promoting disk hits into memory
+     */
+    bool get(uint64_t key, std::string& value);
+
+    /**
+     * Insert or replace a value; also appended to the disk tier if open
+     */
+    void put(uint64_t key, const std::string& value);
+
+    /**
+     * Attach a persistent tier, creating the file if needed.
+     * Throws std::runtime_error if the file cannot be opened.
+     */
+    void openDisk(const std::string& path);
+    void closeDisk();
+
+    /**
+     * Drop all in-memory entries (the disk tier is kept)
+     */
+    void clear();
+
+    void setMaxBytes(size_t maxBytes);
+    Stats getStats() const;
+
+    /**
+     * Cache key of a chat request to the client of the given identity
+     * (LLMClient::getIdentity()), covering tool calls and results
+     */
+    static uint64_t requestKey(const std::string& client, const std::string& model,
+                               const std::vector<Message>& messages);
+
+    /**
+     * Cache key of the embedding of one input text
+     */
+    static uint64_t embeddingKey(const std::string& client, const std::string& model,
+                                 const std::string& text);
+
+private:
+    static const size_t SHARDS = 16;
+
+    struct Entry {
+        uint64_t key;
+        std::string value;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;   // front = most recently used
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    struct DiskRecord {
+        uint64_t offset;   // of the value bytes
+        uint32_t length;
+    };
+
+    Shard& shardFor(uint64_t key) { return shards[key % SHARDS]; }
+    void insertMemory(uint64_t key, const std::string& value);
+    bool readDisk(uint64_t key, std::string& value);
+    void appendDisk(uint64_t key, const std::string& value);
+    void unmapDisk();
+
+    Shard shards[SHARDS];
+    std::atomic<size_t> shardBudget;
+
+    mutable std::mutex diskMutex;
+    int diskFd;
+    const char* diskMap;
+    size_t diskMapSize;
+    uint64_t diskSize;
+    std::unordered_map<uint64_t, DiskRecord> diskIndex;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> diskHits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
+/**
+ * LLMClient decorator answering repeated requests from a ResponseCache.
+ * Only deterministic workloads (e.g. temperature 0) should be cached.
+ * Embeddings are cached per input text, so only new or changed inputs
+ * reach the provider. Tool-calling turns are not cached: their results
+ * depend on the outside world. Entries are keyed by the wrapped client's
+ * identity, so clients of different endpoints, credentials or local
+ * models never share them.
+ */
+class CachingClient : public LLMClient {
+private:
+    std::unique_ptr<LLMClient> inner;
+    std::shared_ptr<ResponseCache> cache;
+
+public:
+    CachingClient(std::unique_ptr<LLMClient> client, std::shared_ptr<ResponseCache> responseCache);
+
+    std::string chatCompletion(const std::vector<Message>& messages,
+                             const std::string& model = "") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "") override;
+    void setApiKey(const std::string& key) override;
+    std::string getProviderName() const override;
+    std::string getIdentity() const override;
+    size_t contextWindow(const std::string& model = "") const override;
+    LLMClient* getUnderlyingClient() override;
+    LLMClient* getWrappedClient() override { return inner.get(); }
+    Usage getLastUsage() const override;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // RESPONSECACHE_H
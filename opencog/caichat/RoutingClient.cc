@@ -0,0 +1,437 @@
+#include "RoutingClient.h"
+#include "Metrics.h"
+#include "Tokenizer.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace opencog {
+namespace caichat {
+
+// DecayingAverage implementation
+const double DecayingAverage::MAX_WEIGHT = 9;
+
+double DecayingAverage::decayed(Clock::time_point now, std::chrono::milliseconds halfLife) const {
+    if (weight == 0) {
+        return 0;
+    }
+    double age = std::chrono::duration<double, std::milli>(now - last).count();
+    return weight * std::exp2(-std::max(age, 0.0) / (double)std::max<long long>(halfLife.count(), 1));
+}
+
+void DecayingAverage::add(double sample, Clock::time_point now, std::chrono::milliseconds halfLife) {
+    double w = std::min(decayed(now, halfLife), MAX_WEIGHT);
+    value = (value * w + sample) / (w + 1);
+    weight = w + 1;
+    last = now;
+}
+
+bool DecayingAverage::isLive(Clock::time_point now, std::chrono::milliseconds halfLife) const {
+    return decayed(now, halfLife) >= 0.5;
+}
+
+// Reply length assumed until a backend has answered
+static const double DEFAULT_REPLY_TOKENS = 256;
+
+// One routed request, from the decision to its outcome
+struct RoutingClient::Call {
+    size_t backend;
+    size_t promptClass;
+    std::string model;   // sent to the backend
+    Clock::time_point start;
+};
+
+static std::mutex defaultOptionsMutex;
+static RoutingClient::Options defaultOptions;
+
+void RoutingClient::setDefaultOptions(const Options& opts) {
+    std::lock_guard<std::mutex> lock(defaultOptionsMutex);
+    defaultOptions = opts;
+}
+
+RoutingClient::Options RoutingClient::getDefaultOptions() {
+    std::lock_guard<std::mutex> lock(defaultOptionsMutex);
+    return defaultOptions;
+}
+
+RoutingClient::RoutingClient(std::vector<Backend> list, const Options& opts)
+    : state(std::make_shared<State>()) {
+    if (list.empty()) {
+        throw std::runtime_error("RoutingClient needs at least one backend");
+    }
+    State& s = *state;
+    s.backends = std::move(list);
+    s.options = opts;
+    s.stats.resize(s.backends.size());
+    s.inFlight.reset(new std::atomic<unsigned>[s.backends.size()]);
+    for (size_t i = 0; i < s.backends.size(); ++i) {
+        s.inFlight[i] = 0;
+        s.local.push_back(s.backends[i].client->getProviderName() == "ggml");
+        s.windows.push_back(s.backends[i].client->contextWindow(s.backends[i].model));
+        if (s.windows[i] > s.windows[s.primary]) {
+            s.primary = i;
+        }
+    }
+}
+
+bool RoutingClient::isSpec(const std::string& provider) {
+    return provider.compare(0, 6, "route:") == 0;
+}
+
+std::unique_ptr<RoutingClient> RoutingClient::fromSpec(const std::string& spec, const Options& opts) {
+    if (!isSpec(spec)) {
+        throw std::runtime_error("Invalid routing spec: " + spec);
+    }
+    std::vector<Backend> backends;
+    size_t start = spec.find(':') + 1;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(start, end - start);
+        if (!item.empty()) {
+            size_t slash = item.find('/');
+            Backend backend;
+            backend.client = ClientFactory::createClient(item.substr(0, slash));
+            if (slash != std::string::npos) {
+                backend.model = item.substr(slash + 1);
+            }
+            backends.push_back(std::move(backend));
+        }
+        start = end + 1;
+    }
+    return std::unique_ptr<RoutingClient>(new RoutingClient(std::move(backends), opts));
+}
+
+void RoutingClient::setLatencySLO(std::chrono::milliseconds slo) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->options.latencySloMs = (unsigned)std::max<long long>(slo.count(), 0);
+}
+
+size_t RoutingClient::promptClass(size_t tokens) {
+    return tokens <= 512 ? 0 : tokens <= 2048 ? 1 : tokens <= 8192 ? 2 : 3;
+}
+
+bool RoutingClient::isLocal(size_t backend) const {
+    return state->local[backend];
+}
+
+std::string RoutingClient::modelFor(size_t backend, const std::string& model) const {
+    return state->backends[backend].model.empty() ? model : state->backends[backend].model;
+}
+
+// Expected latency of a request on backend in milliseconds, negative
+// without live statistics; call with mutex held. A prompt class nobody
+// has measured borrows the nearest measured one.
+double RoutingClient::predict(size_t backend, size_t promptTokens, Clock::time_point now) const {
+    const Stats& s = state->stats[backend];
+    std::chrono::milliseconds halfLife(state->options.halfLifeMs);
+    size_t wanted = promptClass(promptTokens);
+    const DecayingAverage* ttfb = nullptr;
+    for (size_t distance = 0; distance < CLASSES && !ttfb; ++distance) {
+        if (wanted >= distance && s.ttfbMs[wanted - distance].isLive(now, halfLife)) {
+            ttfb = &s.ttfbMs[wanted - distance];
+        } else if (wanted + distance < CLASSES && s.ttfbMs[wanted + distance].isLive(now, halfLife)) {
+            ttfb = &s.ttfbMs[wanted + distance];
+        }
+    }
+    if (!ttfb) {
+        return -1;
+    }
+    double predicted = ttfb->get();
+    if (s.msPerToken.isLive(now, halfLife)) {
+        double replyTokens = s.replyTokens.empty() ? DEFAULT_REPLY_TOKENS : s.replyTokens.get();
+        predicted += replyTokens * s.msPerToken.get();
+    }
+    if (isLocal(backend)) {
+        predicted *= 1 + state->inFlight[backend].load(std::memory_order_relaxed);
+    }
+    return predicted;
+}
+
+RoutingClient::Decision RoutingClient::route(const std::vector<Message>& messages,
+                                             const std::string& model, bool withTools) const {
+    Decision decision;
+    decision.promptTokens = countTokens(messages, model);
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    Clock::time_point now = Clock::now();
+    std::chrono::milliseconds halfLife(state->options.halfLifeMs);
+    size_t n = state->backends.size();
+    std::vector<double> predicted(n);
+    std::vector<bool> eligible(n), healthy(n);
+    for (size_t i = 0; i < n; ++i) {
+        bool local = isLocal(i);
+        eligible[i] = decision.promptTokens < state->windows[i] && !(local && withTools) &&
+                      !(local && decision.promptTokens > state->options.shortPromptTokens);
+        const DecayingAverage& errors = state->stats[i].errors;
+        healthy[i] = !errors.isLive(now, halfLife) || errors.get() <= state->options.maxErrorRate;
+        predicted[i] = predict(i, decision.promptTokens, now);
+    }
+    auto acceptable = [&](size_t i) {
+        return eligible[i] && healthy[i] &&
+               (predicted[i] < 0 || state->options.latencySloMs == 0 || predicted[i] <= state->options.latencySloMs);
+    };
+    auto choose = [&](size_t i, const char* reason) {
+        decision.backend = i;
+        decision.predictedMs = predicted[i];
+        decision.reason = predicted[i] < 0 ? "untried" : reason;
+        return decision;
+    };
+
+    for (size_t i = 0; i < n; ++i) {
+        if (isLocal(i) && acceptable(i)) {
+            return choose(i, "local");
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (!isLocal(i) && acceptable(i)) {
+            return choose(i, "slo");
+        }
+    }
+
+    // Nothing meets the SLO: the soonest expected answer, counting the
+    // retries a failing backend would cost
+    size_t best = n;
+    double bestScore = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!eligible[i] || predicted[i] < 0) {
+            continue;
+        }
+        double errorRate = state->stats[i].errors.isLive(now, halfLife) ? state->stats[i].errors.get() : 0;
+        double score = predicted[i] / std::max(1 - errorRate, 0.05);
+        if (best == n || score < bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    if (best == n) {
+        best = state->primary;
+        for (size_t i = 0; i < n; ++i) {
+            if (eligible[i]) {
+                best = i;
+                break;
+            }
+        }
+    }
+    return choose(best, "fastest");
+}
+
+RoutingClient::Call RoutingClient::begin(const std::vector<Message>& messages,
+                                         const std::string& model, bool withTools) {
+    Decision decision = route(messages, model, withTools);
+    Call call;
+    call.backend = decision.backend;
+    call.promptClass = promptClass(decision.promptTokens);
+    call.model = modelFor(decision.backend, model);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->stats[call.backend].routed++;
+        state->last = decision;
+        state->routedAny = true;
+    }
+    state->inFlight[call.backend].fetch_add(1, std::memory_order_relaxed);
+    if (Metrics::isEnabled()) {
+        Metrics::instance().forModel(state->backends[call.backend].client->getProviderName(), call.model).routed.add();
+    }
+    call.start = Clock::now();
+    return call;
+}
+
+// Learn from a finished call. Without a stream the time to the first
+// token is not visible, so it is taken as the latency less the
+// generation time known from earlier streams.
+void RoutingClient::State::finish(const Call& call, const std::string* reply,
+                           Clock::time_point firstToken, unsigned chunks) {
+    Clock::time_point now = Clock::now();
+    inFlight[call.backend].fetch_sub(1, std::memory_order_relaxed);
+    double replyTokens = reply ? (double)countTokens(*reply, call.model) : 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::chrono::milliseconds halfLife(options.halfLifeMs);
+    Stats& s = stats[call.backend];
+    s.errors.add(reply ? 0 : 1, now, halfLife);
+    if (!reply) {
+        return;
+    }
+    double total = std::chrono::duration<double, std::milli>(now - call.start).count();
+    if (chunks > 1 && replyTokens > 1) {
+        double ttfb = std::chrono::duration<double, std::milli>(firstToken - call.start).count();
+        s.ttfbMs[call.promptClass].add(ttfb, now, halfLife);
+        s.msPerToken.add((total - ttfb) / replyTokens, now, halfLife);
+    } else {
+        double generation = s.msPerToken.empty() ? 0 : replyTokens * s.msPerToken.get();
+        s.ttfbMs[call.promptClass].add(std::max(total - generation, 0.0), now, halfLife);
+    }
+    s.replyTokens.add(replyTokens, now, halfLife);
+}
+
+// The call ended for a reason of the caller's (a cancellation or a
+// failing token callback), which says nothing about the backend
+void RoutingClient::State::abandon(const Call& call) {
+    inFlight[call.backend].fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool RoutingClient::getLastDecision(Decision& decision) const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    decision = state->last;
+    return state->routedAny;
+}
+
+std::vector<RoutingClient::BackendStats> RoutingClient::getStats() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    Clock::time_point now = Clock::now();
+    std::chrono::milliseconds halfLife(state->options.halfLifeMs);
+    std::vector<BackendStats> result;
+    for (size_t i = 0; i < state->backends.size(); ++i) {
+        const Stats& s = state->stats[i];
+        BackendStats b;
+        b.provider = state->backends[i].client->getProviderName();
+        b.model = state->backends[i].model;
+        b.routed = s.routed;
+        b.inFlight = state->inFlight[i].load(std::memory_order_relaxed);
+        for (const DecayingAverage& ttfb : s.ttfbMs) {
+            if (ttfb.isLive(now, halfLife)) {
+                b.ttfbMs = ttfb.get();
+                break;
+            }
+        }
+        if (s.msPerToken.isLive(now, halfLife) && s.msPerToken.get() > 0) {
+            b.tokensPerSecond = 1000 / s.msPerToken.get();
+        }
+        if (s.errors.isLive(now, halfLife)) {
+            b.errorRate = s.errors.get();
+        }
+        result.push_back(std::move(b));
+    }
+    return result;
+}
+
+std::string RoutingClient::chatCompletion(const std::vector<Message>& messages,
+                                          const std::string& model) {
+    Call call = begin(messages, model, false);
+    std::string content;
+    try {
+        content = state->backends[call.backend].client->chatCompletion(messages, call.model);
+    } catch (...) {
+        state->finish(call, nullptr);
+        throw;
+    }
+    state->finish(call, &content);
+    return content;
+}
+
+void RoutingClient::submitChatCompletion(const std::vector<Message>& messages,
+                                         CompletionCallback onDone,
+                                         const std::string& model,
+                                         CancelHandle cancel) {
+    Call call = begin(messages, model, false);
+    std::shared_ptr<State> routing = state;
+    routing->backends[call.backend].client->submitChatCompletion(messages,
+        [routing, call, onDone, cancel](const std::string& content, std::exception_ptr error) {
+            if (!error) {
+                routing->finish(call, &content);
+            } else if (cancel && cancel->isCancelled()) {
+                routing->abandon(call);
+            } else {
+                routing->finish(call, nullptr);
+            }
+            onDone(content, error);
+        },
+        call.model, cancel);
+}
+
+std::string RoutingClient::chatCompletionStream(const std::vector<Message>& messages,
+                                                TokenCallback onToken,
+                                                const std::string& model) {
+    Call call = begin(messages, model, false);
+    Clock::time_point firstToken;
+    unsigned chunks = 0;
+    bool callerFailed = false;
+    std::string content;
+    try {
+        content = state->backends[call.backend].client->chatCompletionStream(messages,
+            [&](const std::string& token) {
+                if (chunks++ == 0) {
+                    firstToken = Clock::now();
+                }
+                try {
+                    onToken(token);
+                } catch (...) {
+                    callerFailed = true;
+                    throw;
+                }
+            },
+            call.model);
+    } catch (...) {
+        if (callerFailed) {
+            state->abandon(call);
+        } else {
+            state->finish(call, nullptr);
+        }
+        throw;
+    }
+    state->finish(call, &content, firstToken, chunks);
+    return content;
+}
+
+ChatReply RoutingClient::chatCompletionWithTools(const std::vector<Message>& messages,
+                                                 const std::vector<ToolDefinition>& tools,
+                                                 const std::string& model) {
+    Call call = begin(messages, model, !tools.empty());
+    ChatReply reply;
+    try {
+        reply = state->backends[call.backend].client->chatCompletionWithTools(messages, tools, call.model);
+    } catch (...) {
+        state->finish(call, nullptr);
+        throw;
+    }
+    state->finish(call, &reply.content);
+    return reply;
+}
+
+std::vector<Embedding> RoutingClient::embed(const std::vector<std::string>& inputs,
+                                            const std::string& model) {
+    return state->backends.front().client->embed(inputs, modelFor(0, model));
+}
+
+void RoutingClient::setApiKey(const std::string& key) {
+    std::string provider = getProviderName();
+    for (Backend& backend : state->backends) {
+        if (backend.client->getProviderName() == provider) {
+            backend.client->setApiKey(key);
+        }
+    }
+}
+
+std::string RoutingClient::getProviderName() const {
+    return state->backends[state->primary].client->getProviderName();
+}
+
+std::string RoutingClient::getIdentity() const {
+    std::string identity = "route(";
+    for (const Backend& backend : state->backends) {
+        identity += backend.client->getIdentity() + "/" + backend.model + ",";
+    }
+    return identity + ")";
+}
+
+size_t RoutingClient::contextWindow(const std::string& model) const {
+    return state->backends[state->primary].client->contextWindow(modelFor(state->primary, model));
+}
+
+LLMClient* RoutingClient::getUnderlyingClient() {
+    return state->backends.front().client->getUnderlyingClient();
+}
+
+Usage RoutingClient::getLastUsage() const {
+    Decision decision;
+    if (!getLastDecision(decision)) {
+        return LLMClient::getLastUsage();
+    }
+    return state->backends[decision.backend].client->getLastUsage();
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,226 @@
+#ifndef ROUTINGCLIENT_H
+#define ROUTINGCLIENT_H
+
+#include "LLMClient.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Moving average whose samples lose weight with age: the weight of what
+ * was seen before halves every half-life, and is capped so a new sample
+ * always counts for at least a tenth. Not thread-safe.
+ */
+class DecayingAverage {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    void add(double sample, Clock::time_point now, std::chrono::milliseconds halfLife);
+
+    /**
+     * Whether enough recent samples back the value: one sample stays
+     * live for one half-life, more for longer
+     */
+    bool isLive(Clock::time_point now, std::chrono::milliseconds halfLife) const;
+
+    double get() const { return value; }
+    bool empty() const { return weight == 0; }
+
+private:
+    static const double MAX_WEIGHT;
+
+    double decayed(Clock::time_point now, std::chrono::milliseconds halfLife) const;
+
+    double value = 0;
+    double weight = 0;
+    Clock::time_point last;
+};
+
+/**
+ * LLMClient sending each request to the backend that should answer it
+ * soonest for the least money.
+ *
+ * Backends are listed cheapest first. For every backend the router keeps
+ * decaying averages of the time to the first token (per prompt length
+ * class, as prefill grows with the prompt), of the generation time per
+ * reply token, of the reply length and of the error rate, all measured
+ * around the calls it makes. From these it predicts each backend's
+ * latency for a request:
+ *
+ *   time to first token + expected reply tokens * time per token
+ *
+ * multiplied by the requests already waiting on a local backend, which
+ * runs one at a time. A request goes to
+ *   - a local (GGML) backend if its prompt is at most shortPromptTokens
+ *     and the backend is healthy and predicted within the latency SLO;
+ *   - else the first remote backend in the list that is healthy and
+ *     within the SLO, or has no live statistics yet (so a backend is
+ *     tried again once its old failures or slow replies have decayed);
+ *   - else the backend with the lowest predicted latency.
+ * Healthy means an error rate of at most maxErrorRate. Backends whose
+ * context window is too small for the prompt are skipped, and local
+ * backends are not offered tool turns.
+ *
+ * A failed request is not retried on another backend; it counts against
+ * the backend's error rate. Embeddings always use the first backend,
+ * since vectors from different models cannot be compared.
+ */
+class RoutingClient : public LLMClient {
+public:
+    struct Options {
+        unsigned latencySloMs = 3000;        // 0 = none: cheapest healthy backend
+        unsigned shortPromptTokens = 512;    // longest prompt for a local backend
+        double maxErrorRate = 0.25;
+        unsigned halfLifeMs = 60000;         // of the latency and error averages
+    };
+
+    struct Backend {
+        std::shared_ptr<LLMClient> client;
+        std::string model;   // "" = the model passed to each call
+    };
+
+    /**
+     * Where a request went and why
+     */
+    struct Decision {
+        size_t backend = 0;
+        size_t promptTokens = 0;
+        double predictedMs = -1;  // negative when the backend had no live statistics
+        const char* reason = "";  // "local", "slo", "untried" or "fastest"
+    };
+
+    /**
+     * Averages of one backend as seen now; negative when unknown
+     */
+    struct BackendStats {
+        std::string provider;
+        std::string model;
+        uint64_t routed = 0;
+        unsigned inFlight = 0;
+        double ttfbMs = -1;           // for the shortest prompts measured
+        double tokensPerSecond = -1;
+        double errorRate = -1;
+    };
+
+    RoutingClient(std::vector<Backend> backends, const Options& options);
+
+    /**
+     * Parse "route:provider[/model],provider[/model],..." into backends
+     * created by ClientFactory, cheapest first
+     */
+    static std::unique_ptr<RoutingClient> fromSpec(const std::string& spec, const Options& options);
+    static bool isSpec(const std::string& provider);
+
+    /**
+     * Options for clients created by ClientFactory from a spec
+     */
+    static void setDefaultOptions(const Options& options);
+    static Options getDefaultOptions();
+
+    void setLatencySLO(std::chrono::milliseconds slo);
+
+    /**
+     * Pick a backend for messages without sending anything
+     */
+    Decision route(const std::vector<Message>& messages, const std::string& model,
+                   bool withTools = false) const;
+
+    /**
+     * The decision behind the most recent request, if any
+     */
+    bool getLastDecision(Decision& decision) const;
+
+    std::vector<BackendStats> getStats() const;
+    const std::vector<Backend>& getBackends() const { return state->backends; }
+
+    std::string chatCompletion(const std::vector<Message>& messages,
+                               const std::string& model = "") override;
+    void submitChatCompletion(const std::vector<Message>& messages,
+                              CompletionCallback onDone,
+                              const std::string& model = "",
+                              CancelHandle cancel = nullptr) override;
+    std::string chatCompletionStream(const std::vector<Message>& messages,
+                                     TokenCallback onToken,
+                                     const std::string& model = "") override;
+    ChatReply chatCompletionWithTools(const std::vector<Message>& messages,
+                                      const std::vector<ToolDefinition>& tools,
+                                      const std::string& model = "") override;
+    std::vector<Embedding> embed(const std::vector<std::string>& inputs,
+                                 const std::string& model = "") override;
+    void setApiKey(const std::string& key) override;
+
+    /**
+     * Provider of the backend with the largest context window, so session
+     * histories are budgeted for it; prompts too long for the others skip
+     * them
+     */
+    std::string getProviderName() const override;
+
+    /**
+     * Identities of all backends, any of which may answer
+     */
+    std::string getIdentity() const override;
+
+    /**
+     * Window of the largest backend, where prompts too long for the
+     * others go
+     */
+    size_t contextWindow(const std::string& model = "") const override;
+    LLMClient* getUnderlyingClient() override;
+    Usage getLastUsage() const override;
+
+private:
+    typedef DecayingAverage::Clock Clock;
+
+    // Prompt length classes: up to 512, 2048, 8192 tokens and longer
+    static const size_t CLASSES = 4;
+    static size_t promptClass(size_t tokens);
+
+    struct Stats {
+        DecayingAverage ttfbMs[CLASSES];
+        DecayingAverage msPerToken;
+        DecayingAverage replyTokens;
+        DecayingAverage errors;
+        uint64_t routed = 0;
+    };
+
+    struct Call;
+
+    // Shared with the requests in flight, so those finishing after the
+    // client is gone can still report to their backend's statistics
+    struct State {
+        std::vector<Backend> backends;
+        std::vector<size_t> windows;   // context window of each backend
+        std::vector<bool> local;       // runs on this machine, one request at a time
+        Options options;
+        size_t primary = 0;            // backend with the largest window
+
+        mutable std::mutex mutex;      // guards options, stats, last and routedAny
+        std::vector<Stats> stats;
+        std::unique_ptr<std::atomic<unsigned>[]> inFlight;
+        Decision last;
+        bool routedAny = false;
+
+        void finish(const Call& call, const std::string* reply,
+                    Clock::time_point firstToken = Clock::time_point(), unsigned chunks = 0);
+        void abandon(const Call& call);
+    };
+
+    bool isLocal(size_t backend) const;
+    double predict(size_t backend, size_t promptTokens, Clock::time_point now) const;
+    Call begin(const std::vector<Message>& messages, const std::string& model, bool withTools);
+    std::string modelFor(size_t backend, const std::string& model) const;
+
+    std::shared_ptr<State> state;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // ROUTINGCLIENT_H
@@ -0,0 +1,102 @@
+#include "SSEParser.h"
+#include <cstring>
+
+namespace opencog {
+namespace caichat {
+
+SSEParser::SSEParser(EventHandler h)
+    : handler(std::move(h)), hasData(false), skipLineFeed(false) {
+}
+
+void SSEParser::feed(const char* bytes, size_t length) {
+    size_t pos = 0;
+    if (skipLineFeed && length > 0) {
+        if (bytes[0] == '\n') {
+            pos = 1;
+        }
+        skipLineFeed = false;
+    }
+
+    while (pos < length) {
+        const char* start = bytes + pos;
+        const char* end = static_cast<const char*>(std::memchr(start, '\n', length - pos));
+        const char* cr = static_cast<const char*>(std::memchr(start, '\r', (end ? end : bytes + length) - start));
+        if (cr) {
+            end = cr;
+        }
+        if (!end) {
+            buffer.append(start, length - pos);
+            return;
+        }
+
+        size_t lineLength = end - start;
+        if (buffer.empty()) {
+            processLine(start, lineLength);
+        } else {
+            buffer.append(start, lineLength);
+            processLine(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+
+        pos += lineLength + 1;
+        if (*end == '\r') {
+            if (pos < length) {
+                if (bytes[pos] == '\n') {
+                    pos++;
+                }
+            } else {
+                skipLineFeed = true;
+            }
+        }
+    }
+}
+
+void SSEParser::finish() {
+    if (!buffer.empty()) {
+        processLine(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    dispatch();
+}
+
+void SSEParser::processLine(const char* line, size_t length) {
+    if (length == 0) {
+        dispatch();
+        return;
+    }
+    if (line[0] == ':') {
+        return;  // comment / keep-alive
+    }
+
+    const char* colon = static_cast<const char*>(std::memchr(line, ':', length));
+    size_t fieldLength = colon ? colon - line : length;
+    const char* value = colon ? colon + 1 : line + length;
+    size_t valueLength = (line + length) - value;
+    if (valueLength > 0 && value[0] == ' ') {
+        value++;
+        valueLength--;
+    }
+
+    if (fieldLength == 4 && std::memcmp(line, "data", 4) == 0) {
+        if (hasData) {
+            data.push_back('\n');
+        }
+        data.append(value, valueLength);
+        hasData = true;
+    } else if (fieldLength == 5 && std::memcmp(line, "event", 5) == 0) {
+        eventName.assign(value, valueLength);
+    }
+    // "id" and "retry" are not used by the LLM providers
+}
+
+void SSEParser::dispatch() {
+    if (hasData) {
+        handler(eventName.empty() ? "message" : eventName, data);
+    }
+    eventName.clear();
+    data.clear();
+    hasData = false;
+}
+
+} // namespace caichat
+} // namespace opencog
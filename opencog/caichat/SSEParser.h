@@ -0,0 +1,47 @@
+#ifndef SSEPARSER_H
+#define SSEPARSER_H
+
+#include <functional>
+#include <string>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Incremental Server-Sent Events parser. Bytes are fed as they arrive from
+ * the network in arbitrarily sized chunks; each complete event is handed to
+ * the handler with its event name ("message" when none was given) and its
+ * data lines joined by '\n'.
+ */
+class SSEParser {
+public:
+    typedef std::function<void(const std::string& event, const std::string& data)> EventHandler;
+
+    explicit SSEParser(EventHandler handler);
+
+    /**
+     * Consume a chunk of the stream
+     */
+    void feed(const char* bytes, size_t length);
+
+    /**
+     * Dispatch a trailing event that was not terminated by a blank line
+     */
+    void finish();
+
+private:
+    void processLine(const char* line, size_t length);
+    void dispatch();
+
+    EventHandler handler;
+    std::string buffer;      // incomplete line carried over between chunks
+    std::string eventName;
+    std::string data;
+    bool hasData;
+    bool skipLineFeed;       // previous chunk ended on '\r'
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // SSEPARSER_H
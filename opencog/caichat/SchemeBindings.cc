@@ -1,34 +1,175 @@
 #include "LLMClient.h"
+#include "AtomStore.h"
 #include "ChatCompletion.h"
+#include "CoalescingClient.h"
+#include "HTTPClient.h"
+#include "HedgingClient.h"
+#include "KnowledgeBase.h"
+#include "Metrics.h"
+#include "BatchRunner.h"
+#include "ResponseCache.h"
+#include "RoutingClient.h"
+#include "SessionJournal.h"
+#include "SessionRegistry.h"
+#include "Tokenizer.h"
+#include "ToolExecutor.h"
+#include "VectorIndex.h"
 #include <libguile.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <memory>
 #include <map>
+#include <mutex>
 
 namespace opencog {
 namespace caichat {
 
-// Global storage for chat sessions
-static std::map<std::string, std::unique_ptr<ChatCompletion>> chatSessions;
+// Outstanding caichat-ask-async requests, keyed by handle
+struct PendingAsk {
+    std::unique_ptr<LLMClient> client;
+    std::future<std::string> result;
+};
+static std::map<unsigned long, PendingAsk> pendingAsks;
+static std::mutex pendingAsksMutex;
+static unsigned long nextAskHandle = 1;
+
+// Response cache shared by all clients while caching is enabled
+static std::shared_ptr<ResponseCache> responseCache;
+static std::mutex responseCacheMutex;
+
+// Identical requests in flight at the same time are sent once; opt-in
+static std::atomic<bool> coalescing(false);
+
+// Embeddings are deterministic, so they are always cached; re-embedding
+// an unchanged document costs only the lookups. Clients are kept per
+// provider and model so local models stay loaded between calls.
+static std::shared_ptr<ResponseCache> embeddingCache;
+static std::map<std::string, std::shared_ptr<LLMClient>> embeddingClients;
+static std::mutex embeddingClientsMutex;
+
+// Open knowledge bases by name
+static std::map<std::string, std::shared_ptr<KnowledgeBase>> knowledgeBases;
+static std::mutex knowledgeBasesMutex;
+
+// Tools offered to models; the executor is created on first use, rooted
+// at $LLM_ROOT_DIR or the current directory
+static std::shared_ptr<ToolExecutor> toolExecutor;
+static std::mutex toolExecutorMutex;
+
+// Named vector indexes; the map lock only guards lookups, each index
+// synchronizes its own adds and searches
+static std::map<std::string, std::shared_ptr<VectorIndex>> vectorIndexes;
+static std::mutex vectorIndexesMutex;
+
+// Session logs by directory; "" is SessionJournal::defaultDirectory().
+// The lock also serializes restores, so a session is loaded only once.
+static std::map<std::string, std::shared_ptr<SessionJournal>> sessionJournals;
+static std::mutex sessionJournalsMutex;
 
 // Helper function to convert SCM string to C++ string
 std::string scm_to_string(SCM scm_str) {
-    char* c_str = scm_to_utf8_string(scm_str);
-    std::string result(c_str);
+    size_t length;
+    char* c_str = scm_to_utf8_stringn(scm_str, &length);
+    std::string result(c_str, length);
     free(c_str);
     return result;
 }
 
+// Create a provider client, wrapped in the coalescer and the response
+// cache when enabled; cache hits never reach the coalescer
+static std::unique_ptr<LLMClient> createClient(const std::string& provider,
+                                               const std::string& api_key = "") {
+    auto client = ClientFactory::createClient(provider, api_key);
+    if (coalescing.load(std::memory_order_relaxed)) {
+        client.reset(new CoalescingClient(std::move(client)));
+    }
+    std::lock_guard<std::mutex> lock(responseCacheMutex);
+    if (responseCache) {
+        client.reset(new CachingClient(std::move(client), responseCache));
+    }
+    return client;
+}
+
+// Run fn outside Guile mode so other Scheme threads and the collector keep
+// running while it waits on the network. fn must not touch SCM values.
+// Exceptions are caught before returning into Guile and reported in error.
+template <typename Fn>
+static bool withoutGuile(std::string& error, Fn fn) {
+    struct Call {
+        Fn* fn;
+        std::string* error;
+        bool ok;
+    } call = {&fn, &error, false};
+    scm_without_guile([](void* data) -> void* {
+        Call* c = static_cast<Call*>(data);
+        try {
+            (*c->fn)();
+            c->ok = true;
+        } catch (const std::exception& e) {
+            *c->error = e.what();
+        }
+        return nullptr;
+    }, &call);
+    return call.ok;
+}
+
+// Run fn on a session while holding the session's lock. Waiting for the
+// lock and the turn itself happen outside Guile mode. A saved session's
+// log is brought up to date before the lock is released. Returns false
+// with error set if the session does not exist or fn throws; callers
+// raise the Scheme error only after the lock has been released.
+template <typename Fn>
+static bool withSession(const std::string& session_id, std::string& error, Fn fn) {
+    return withoutGuile(error, [&] {
+        SessionRegistry::SessionPtr session = SessionRegistry::instance().find(session_id);
+        if (!session) {
+            throw std::runtime_error("Session not found");
+        }
+        std::lock_guard<std::mutex> lock(session->mutex);
+        fn(*session->chat);
+        if (session->journal) {
+            session->journal->record(session_id, session->provider, *session->chat);
+        }
+    });
+}
+
+// Journal for a directory, created on first use; call with
+// sessionJournalsMutex held
+static std::shared_ptr<SessionJournal> journalFor(const std::string& dir) {
+    std::shared_ptr<SessionJournal>& journal = sessionJournals[dir];
+    if (!journal) {
+        journal = std::make_shared<SessionJournal>(dir.empty() ? SessionJournal::defaultDirectory() : dir);
+    }
+    return journal;
+}
+
+// Register a session restored from snapshot, continuing its log; false if
+// a session with its ID is already open. Call with sessionJournalsMutex
+// held.
+static bool restoreSession(const std::shared_ptr<SessionJournal>& journal,
+                           const SessionSnapshot& snapshot) {
+    if (SessionRegistry::instance().find(snapshot.id)) {
+        return false;
+    }
+    auto session = std::make_shared<SessionRegistry::Session>(
+        snapshot.restore(createClient(snapshot.provider)), snapshot.provider);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    journal->attach(snapshot, *session->chat);
+    session->journal = journal;
+    return SessionRegistry::instance().insert(snapshot.id, session);
+}
+
 // Scheme wrapper: Create LLM client
 SCM caichat_create_client(SCM provider_scm, SCM api_key_scm) {
     std::string provider = scm_to_string(provider_scm);
     std::string api_key = scm_is_string(api_key_scm) ? scm_to_string(api_key_scm) : "";
     
     try {
-        auto client = ClientFactory::createClient(provider, api_key);
+        auto client = createClient(provider, api_key);
         auto session = std::make_unique<ChatCompletion>(std::move(client));
         
-        std::string session_id = provider + "_session";
-        chatSessions[session_id] = std::move(session);
+        std::string session_id = SessionRegistry::instance().add(provider, std::move(session));
         
         return scm_from_utf8_string(session_id.c_str());
     } catch (const std::exception& e) {
@@ -43,21 +184,333 @@ SCM caichat_send_message(SCM session_id_scm, SCM message_scm) {
     std::string session_id = scm_to_string(session_id_scm);
     std::string message = scm_to_string(message_scm);
     
-    auto it = chatSessions.find(session_id);
-    if (it == chatSessions.end()) {
+    Text response;
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            response = chat.sendMessage(std::move(message));
+        })) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string("Session not found")));
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
         return SCM_BOOL_F;
     }
+    return scm_from_utf8_string(response.c_str());
+}
+
+// Token procedure invocation from outside Guile mode, guarded against
+// non-local exits
+struct TokenProcCall {
+    SCM proc;
+    const std::string* token;
+    SCM thrownKey;
+    SCM thrownArgs;
+};
+
+static SCM invokeTokenProc(void* data) {
+    TokenProcCall* call = static_cast<TokenProcCall*>(data);
+    return scm_call_1(call->proc, scm_from_utf8_string(call->token->c_str()));
+}
+
+static SCM tokenProcThrew(void* data, SCM key, SCM args) {
+    TokenProcCall* call = static_cast<TokenProcCall*>(data);
+    call->thrownKey = key;
+    call->thrownArgs = args;
+    return SCM_BOOL_F;
+}
+
+static void* callTokenProc(void* data) {
+    scm_internal_catch(SCM_BOOL_T, invokeTokenProc, data, tokenProcThrew, data);
+    return nullptr;
+}
+
+// Scheme wrapper: Send message, calling token-proc with each streamed token
+SCM caichat_send_message_stream(SCM session_id_scm, SCM message_scm, SCM token_proc) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::string message = scm_to_string(message_scm);
     
-    try {
-        std::string response = it->second->sendMessage(message);
-        return scm_from_utf8_string(response.c_str());
-    } catch (const std::exception& e) {
+    // The stream runs outside Guile mode and re-enters it for each token.
+    // A non-local exit from token-proc must not unwind through the HTTP
+    // transfer or skip the session unlock, so it is caught, the stream is
+    // aborted and the throw is re-raised afterwards.
+    TokenProcCall call = {token_proc, nullptr, SCM_BOOL_F, SCM_EOL};
+    Text response;
+    std::string error;
+    bool ok = withSession(session_id, error, [&](ChatCompletion& chat) {
+        response = chat.sendMessageStream(std::move(message), [&call](const std::string& token) {
+            call.token = &token;
+            scm_with_guile(callTokenProc, &call);
+            if (scm_is_true(call.thrownKey)) {
+                throw std::runtime_error("Token procedure raised an error");
+            }
+        });
+    });
+    if (scm_is_true(call.thrownKey)) {
+        scm_throw(call.thrownKey, call.thrownArgs);
+        return SCM_BOOL_F;
+    }
+    if (!ok) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string(e.what())));
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(response.c_str());
+}
+
+// The shared tool executor, loading the tool declarations the first time
+static std::shared_ptr<ToolExecutor> getToolExecutor() {
+    std::lock_guard<std::mutex> lock(toolExecutorMutex);
+    if (!toolExecutor) {
+        toolExecutor = std::make_shared<ToolExecutor>();
+    }
+    return toolExecutor;
+}
+
+static std::vector<std::string> scm_to_strings(SCM list) {
+    std::vector<std::string> strings;
+    for (SCM rest = list; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        SCM item = scm_car(rest);
+        strings.push_back(scm_is_symbol(item) ? scm_to_string(scm_symbol_to_string(item))
+                                              : scm_to_string(item));
+    }
+    return strings;
+}
+
+// Scheme wrapper: Send message offering tools (names, default all loaded
+// tools); tool calls run concurrently and the final reply is returned
+SCM caichat_send_message_with_tools(SCM session_id_scm, SCM message_scm, SCM tools_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::string message = scm_to_string(message_scm);
+    std::vector<std::string> names;
+    if (!SCM_UNBNDP(tools_scm)) {
+        names = scm_to_strings(tools_scm);
+    }
+    std::shared_ptr<ToolExecutor> executor = getToolExecutor();
+    
+    Text response;
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            if (executor->getDefinitions().empty()) {
+                executor->loadTools();
+            }
+            response = chat.sendMessageWithTools(std::move(message), executor->getDefinitions(names), *executor);
+        })) {
+        executor.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(response.c_str());
+}
+
+// Scheme wrapper: Use the tools/, agents/ and scripts/ under path
+SCM caichat_tools_set_root(SCM path_scm) {
+    std::string path = scm_to_string(path_scm);
+    std::lock_guard<std::mutex> lock(toolExecutorMutex);
+    toolExecutor = std::make_shared<ToolExecutor>(path);
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Load the tool declarations, or an agent's functions;
+// returns the number loaded
+SCM caichat_tools_load(SCM agent_scm) {
+    std::string agent = SCM_UNBNDP(agent_scm) ? "" : scm_to_string(agent_scm);
+    std::shared_ptr<ToolExecutor> executor = getToolExecutor();
+    size_t loaded = 0;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            loaded = agent.empty() ? executor->loadTools() : executor->loadAgent(agent);
+        })) {
+        executor.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_size_t(loaded);
+}
+
+// Scheme wrapper: Names of the loaded tools
+SCM caichat_tools_list() {
+    std::vector<ToolDefinition> definitions = getToolExecutor()->getDefinitions();
+    SCM list = SCM_EOL;
+    for (auto it = definitions.rbegin(); it != definitions.rend(); ++it) {
+        list = scm_cons(scm_from_utf8_string(it->name.c_str()), list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Timeout in milliseconds of one tool, or of every tool
+// without its own
+SCM caichat_tools_set_timeout(SCM timeout_scm, SCM tool_scm) {
+    unsigned timeout = scm_to_uint(timeout_scm);
+    std::shared_ptr<ToolExecutor> executor = getToolExecutor();
+    if (SCM_UNBNDP(tool_scm)) {
+        ToolExecutor::Options options = executor->getOptions();
+        options.timeoutMs = timeout;
+        executor->setOptions(options);
+    } else {
+        executor->setTimeout(scm_to_string(tool_scm), timeout);
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Most tool processes run at once
+SCM caichat_tools_set_parallel(SCM count_scm) {
+    std::shared_ptr<ToolExecutor> executor = getToolExecutor();
+    ToolExecutor::Options options = executor->getOptions();
+    options.maxParallel = scm_to_size_t(count_scm);
+    executor->setOptions(options);
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Run a tool with a JSON arguments string; returns
+// (ok? output)
+SCM caichat_run_tool(SCM name_scm, SCM arguments_scm) {
+    ToolCall call;
+    call.name = scm_to_string(name_scm);
+    call.arguments = scm_to_string(arguments_scm);
+    std::shared_ptr<ToolExecutor> executor = getToolExecutor();
+    ToolResult result;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            if (!executor->hasTool(call.name)) {
+                executor->loadTools();
+            }
+            result = executor->run(call);
+        })) {
+        executor.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_list_2(scm_from_bool(result.ok), scm_from_utf8_string(result.output.c_str()));
+}
+
+// Scheme wrapper: Retry policy of "hedge:", "race:" and "failover:"
+// clients created from now on
+SCM caichat_set_hedge_options(SCM attempts_scm, SCM backoff_scm, SCM timeout_scm, SCM quantile_scm) {
+    HedgingClient::Options options = HedgingClient::getDefaultOptions();
+    options.maxAttempts = scm_to_uint(attempts_scm);
+    options.backoffMs = scm_to_uint(backoff_scm);
+    if (!SCM_UNBNDP(timeout_scm)) {
+        options.timeoutMs = scm_to_uint(timeout_scm);
+    }
+    if (!SCM_UNBNDP(quantile_scm)) {
+        options.hedgeQuantile = scm_to_double(quantile_scm);
+    }
+    HedgingClient::setDefaultOptions(options);
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Latency SLO and routing thresholds of "route:" clients
+// created from now on
+SCM caichat_set_route_options(SCM slo_scm, SCM short_scm, SCM error_rate_scm, SCM half_life_scm) {
+    RoutingClient::Options options = RoutingClient::getDefaultOptions();
+    options.latencySloMs = scm_to_uint(slo_scm);
+    if (!SCM_UNBNDP(short_scm)) {
+        options.shortPromptTokens = scm_to_uint(short_scm);
+    }
+    if (!SCM_UNBNDP(error_rate_scm)) {
+        options.maxErrorRate = scm_to_double(error_rate_scm);
+    }
+    if (!SCM_UNBNDP(half_life_scm)) {
+        options.halfLifeMs = (unsigned)(scm_to_double(half_life_scm) * 1000);
+    }
+    RoutingClient::setDefaultOptions(options);
+    return SCM_BOOL_T;
+}
+
+// The router behind a session's cache and coalescer; throws if the
+// session was not created from a "route:" spec
+static RoutingClient& routerOf(ChatCompletion& chat) {
+    for (LLMClient* client = chat.getClient(); client; client = client->getWrappedClient()) {
+        if (RoutingClient* router = dynamic_cast<RoutingClient*>(client)) {
+            return *router;
+        }
+    }
+    throw std::runtime_error("Session does not route its requests");
+}
+
+// Optional double for Scheme: #f when negative (unknown)
+static SCM optionalDouble(double value) {
+    return value < 0 ? SCM_BOOL_F : scm_from_double(value);
+}
+
+// Scheme wrapper: Latency SLO of a routed session in milliseconds
+SCM caichat_set_latency_slo(SCM session_id_scm, SCM ms_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    unsigned ms = scm_to_uint(ms_scm);
+
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            routerOf(chat).setLatencySLO(std::chrono::milliseconds(ms));
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Where a routed session's last request went and why, as
+// an alist; #f before its first request
+SCM caichat_last_route(SCM session_id_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+
+    RoutingClient::Decision decision;
+    bool routed = false;
+    std::string provider, model;
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            RoutingClient& router = routerOf(chat);
+            routed = router.getLastDecision(decision);
+            if (routed) {
+                const RoutingClient::Backend& backend = router.getBackends()[decision.backend];
+                provider = backend.client->getProviderName();
+                model = backend.model;
+            }
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    if (!routed) {
+        return SCM_BOOL_F;
+    }
+    return scm_list_5(
+        scm_cons(scm_from_utf8_symbol("provider"), scm_from_utf8_string(provider.c_str())),
+        scm_cons(scm_from_utf8_symbol("model"), scm_from_utf8_string(model.c_str())),
+        scm_cons(scm_from_utf8_symbol("reason"), scm_from_utf8_symbol(decision.reason)),
+        scm_cons(scm_from_utf8_symbol("prompt-tokens"), scm_from_size_t(decision.promptTokens)),
+        scm_cons(scm_from_utf8_symbol("predicted-ms"), optionalDouble(decision.predictedMs)));
+}
+
+// Scheme wrapper: Statistics the router of a session decides by, one
+// alist per backend; unknown values are #f
+SCM caichat_route_stats(SCM session_id_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+
+    std::vector<RoutingClient::BackendStats> stats;
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            stats = routerOf(chat).getStats();
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
         return SCM_BOOL_F;
     }
+    SCM list = SCM_EOL;
+    for (auto it = stats.rbegin(); it != stats.rend(); ++it) {
+        SCM alist = scm_list_n(
+            scm_cons(scm_from_utf8_symbol("provider"), scm_from_utf8_string(it->provider.c_str())),
+            scm_cons(scm_from_utf8_symbol("model"), scm_from_utf8_string(it->model.c_str())),
+            scm_cons(scm_from_utf8_symbol("routed"), scm_from_uint64(it->routed)),
+            scm_cons(scm_from_utf8_symbol("in-flight"), scm_from_uint(it->inFlight)),
+            scm_cons(scm_from_utf8_symbol("ttfb-ms"), optionalDouble(it->ttfbMs)),
+            scm_cons(scm_from_utf8_symbol("tokens-per-second"), optionalDouble(it->tokensPerSecond)),
+            scm_cons(scm_from_utf8_symbol("error-rate"), optionalDouble(it->errorRate)),
+            SCM_UNDEFINED);
+        list = scm_cons(alist, list);
+    }
+    return list;
 }
 
 // Scheme wrapper: Simple ask function
@@ -65,10 +518,36 @@ SCM caichat_ask(SCM provider_scm, SCM message_scm) {
     std::string provider = scm_to_string(provider_scm);
     std::string message = scm_to_string(message_scm);
     
+    std::string response;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            auto client = createClient(provider);
+            response = client->ask(message);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(response.c_str());
+}
+
+// Scheme wrapper: Start an ask without waiting for the reply
+SCM caichat_ask_async(SCM provider_scm, SCM message_scm) {
+    std::string provider = scm_to_string(provider_scm);
+    std::string message = scm_to_string(message_scm);
+    
     try {
-        auto client = ClientFactory::createClient(provider);
-        std::string response = client->ask(message);
-        return scm_from_utf8_string(response.c_str());
+        PendingAsk pending;
+        pending.client = createClient(provider);
+        
+        std::vector<Message> messages;
+        messages.emplace_back(Role::User, message);
+        pending.result = pending.client->chatCompletionAsync(messages);
+        
+        std::lock_guard<std::mutex> lock(pendingAsksMutex);
+        unsigned long handle = nextAskHandle++;
+        pendingAsks[handle] = std::move(pending);
+        return scm_from_ulong(handle);
     } catch (const std::exception& e) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
                  scm_list_1(scm_from_utf8_string(e.what())));
@@ -76,19 +555,96 @@ SCM caichat_ask(SCM provider_scm, SCM message_scm) {
     }
 }
 
+// Scheme wrapper: Wait for an async ask and return its reply
+SCM caichat_await(SCM handle_scm) {
+    unsigned long handle = scm_to_ulong(handle_scm);
+    
+    PendingAsk pending;
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(pendingAsksMutex);
+        auto it = pendingAsks.find(handle);
+        if (it != pendingAsks.end()) {
+            pending = std::move(it->second);
+            pendingAsks.erase(it);
+            found = true;
+        }
+    }
+    if (!found) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string("Unknown async request")));
+        return SCM_BOOL_F;
+    }
+    
+    std::string response;
+    std::string error;
+    if (!withoutGuile(error, [&] { response = pending.result.get(); })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(response.c_str());
+}
+
+// Scheme wrapper: Ask many prompts with bounded concurrency
+// Returns a list of (ok . reply) / (error . message) pairs in input order
+SCM caichat_ask_batch(SCM provider_scm, SCM prompts_scm, SCM concurrency_scm) {
+    std::string provider = scm_to_string(provider_scm);
+    size_t concurrency = SCM_UNBNDP(concurrency_scm) ? 8 : scm_to_size_t(concurrency_scm);
+    
+    std::vector<std::string> prompts;
+    for (SCM rest = prompts_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        prompts.push_back(scm_to_string(scm_car(rest)));
+    }
+    
+    std::vector<BatchResult> results;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            auto client = createClient(provider);
+            BatchRunner runner(*client, concurrency);
+            results = runner.runPrompts(prompts);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    
+    SCM list = SCM_EOL;
+    for (auto it = results.rbegin(); it != results.rend(); ++it) {
+        SCM item = it->ok
+            ? scm_cons(scm_from_utf8_symbol("ok"), scm_from_utf8_string(it->content.c_str()))
+            : scm_cons(scm_from_utf8_symbol("error"), scm_from_utf8_string(it->error.c_str()));
+        list = scm_cons(item, list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Limit requests/min and tokens/min for a provider (0 = unlimited)
+SCM caichat_set_rate_limit(SCM provider_scm, SCM requests_scm, SCM tokens_scm) {
+    std::string provider = scm_to_string(provider_scm);
+    if (provider == "anthropic") {
+        provider = "claude";
+    } else if (provider == "local") {
+        provider = "ggml";
+    }
+    RateLimiter::forProvider(provider).configure(scm_to_double(requests_scm),
+                                                 scm_to_double(tokens_scm));
+    return SCM_BOOL_T;
+}
+
 // Scheme wrapper: Set system message
 SCM caichat_set_system_message(SCM session_id_scm, SCM message_scm) {
     std::string session_id = scm_to_string(session_id_scm);
     std::string message = scm_to_string(message_scm);
     
-    auto it = chatSessions.find(session_id);
-    if (it == chatSessions.end()) {
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            chat.setSystemMessage(message);
+        })) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string("Session not found")));
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
         return SCM_BOOL_F;
     }
-    
-    it->second->setSystemMessage(message);
     return SCM_BOOL_T;
 }
 
@@ -96,14 +652,67 @@ SCM caichat_set_system_message(SCM session_id_scm, SCM message_scm) {
 SCM caichat_clear_history(SCM session_id_scm) {
     std::string session_id = scm_to_string(session_id_scm);
     
-    auto it = chatSessions.find(session_id);
-    if (it == chatSessions.end()) {
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            chat.clearHistory();
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Set the history token budget of a session
+SCM caichat_set_context_budget(SCM session_id_scm, SCM tokens_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    size_t tokens = scm_to_size_t(tokens_scm);
+    
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            chat.setContextBudget(tokens);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Choose how a session trims its history ('sliding,
+// 'summarize or 'none) and whether the system message is pinned
+SCM caichat_set_history_policy(SCM session_id_scm, SCM policy_scm, SCM pin_system_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::string name = scm_is_symbol(policy_scm)
+        ? scm_to_string(scm_symbol_to_string(policy_scm)) : scm_to_string(policy_scm);
+    
+    TrimPolicy policy;
+    if (name == "sliding") {
+        policy = TrimPolicy::SlidingWindow;
+    } else if (name == "summarize") {
+        policy = TrimPolicy::SummarizeOldest;
+    } else if (name == "none") {
+        policy = TrimPolicy::None;
+    } else {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string("Session not found")));
+                 scm_list_1(scm_from_utf8_string("Unknown history policy")));
         return SCM_BOOL_F;
     }
     
-    it->second->clearHistory();
+    bool setPin = !SCM_UNBNDP(pin_system_scm);
+    bool pin = setPin && scm_is_true(pin_system_scm);
+    
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            chat.setTrimPolicy(policy);
+            if (setPin) {
+                chat.getConversation().setPinSystemMessage(pin);
+            }
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
     return SCM_BOOL_T;
 }
 
@@ -112,33 +721,1024 @@ SCM caichat_set_model_path(SCM session_id_scm, SCM path_scm) {
     std::string session_id = scm_to_string(session_id_scm);
     std::string path = scm_to_string(path_scm);
     
-    auto it = chatSessions.find(session_id);
-    if (it == chatSessions.end()) {
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            // Check if this is a GGML client
+            GGMLClient* ggmlClient = dynamic_cast<GGMLClient*>(chat.getClient()->getUnderlyingClient());
+            if (!ggmlClient) {
+                throw std::runtime_error("Session is not a GGML client");
+            }
+            ggmlClient->setModelPath(path);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Set inference threads (0 = all cores) and optionally
+// the context size of a local model session
+SCM caichat_set_local_threads(SCM session_id_scm, SCM threads_scm, SCM context_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    int threads = scm_to_int(threads_scm);
+    int context = SCM_UNBNDP(context_scm) ? 0 : scm_to_int(context_scm);
+    
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            GGMLClient* ggmlClient = dynamic_cast<GGMLClient*>(chat.getClient()->getUnderlyingClient());
+            if (!ggmlClient) {
+                throw std::runtime_error("Session is not a GGML client");
+            }
+            ggmlClient->setThreads(threads);
+            if (context > 0) {
+                ggmlClient->setContextSize(context);
+                chat.fitContextWindow();
+            }
+        })) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string("Session not found")));
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
         return SCM_BOOL_F;
     }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Close a session and release its client
+SCM caichat_close_session(SCM session_id_scm, SCM delete_log_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    bool delete_log = !SCM_UNBNDP(delete_log_scm) && scm_is_true(delete_log_scm);
+    
+    if (delete_log) {
+        std::shared_ptr<SessionJournal> journal;
+        SessionRegistry::SessionPtr session = SessionRegistry::instance().find(session_id);
+        if (session) {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            journal = std::move(session->journal);
+        }
+        if (!journal) {
+            std::lock_guard<std::mutex> lock(sessionJournalsMutex);
+            journal = journalFor("");
+        }
+        journal->remove(session_id);
+    }
+    return scm_from_bool(SessionRegistry::instance().close(session_id));
+}
+
+// Scheme wrapper: Write a session to its log in dir (default
+// $CAICHAT_SESSION_DIR or ~/.caichat/sessions) and keep logging every
+// change; returns the log's path
+SCM caichat_save_session(SCM session_id_scm, SCM dir_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::string dir = (!SCM_UNBNDP(dir_scm) && scm_is_string(dir_scm)) ? scm_to_string(dir_scm) : "";
     
-    // Check if this is a GGML client
-    GGMLClient* ggmlClient = dynamic_cast<GGMLClient*>(it->second->getClient());
-    if (ggmlClient) {
-        ggmlClient->setModelPath(path);
-        return SCM_BOOL_T;
+    std::string path;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            std::shared_ptr<SessionJournal> journal;
+            {
+                std::lock_guard<std::mutex> lock(sessionJournalsMutex);
+                journal = journalFor(dir);
+            }
+            SessionRegistry::SessionPtr session = SessionRegistry::instance().find(session_id);
+            if (!session) {
+                throw std::runtime_error("Session not found");
+            }
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->journal && session->journal != journal) {
+                session->journal->close(session_id);
+            }
+            session->journal = journal;
+            journal->record(session_id, session->provider, *session->chat);
+            journal->sync();
+            path = journal->pathFor(session_id);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(path.c_str());
+}
+
+// Scheme wrapper: Reopen a saved session under its old ID, logging on
+// where it left off
+SCM caichat_load_session(SCM session_id_scm, SCM dir_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::string dir = (!SCM_UNBNDP(dir_scm) && scm_is_string(dir_scm)) ? scm_to_string(dir_scm) : "";
+    
+    std::string id;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            std::lock_guard<std::mutex> lock(sessionJournalsMutex);
+            std::shared_ptr<SessionJournal> journal = journalFor(dir);
+            SessionSnapshot snapshot = SessionJournal::load(journal->pathFor(session_id));
+            if (!restoreSession(journal, snapshot)) {
+                throw std::runtime_error("Session already open: " + snapshot.id);
+            }
+            id = snapshot.id;
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_utf8_string(id.c_str());
+}
+
+// Scheme wrapper: Reopen every saved session in dir that is not open yet;
+// returns their IDs. Unreadable logs are skipped.
+SCM caichat_load_sessions(SCM dir_scm) {
+    std::string dir = (!SCM_UNBNDP(dir_scm) && scm_is_string(dir_scm)) ? scm_to_string(dir_scm) : "";
+    
+    std::vector<std::string> loaded;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            std::lock_guard<std::mutex> lock(sessionJournalsMutex);
+            std::shared_ptr<SessionJournal> journal = journalFor(dir);
+            for (const std::string& path : journal->list()) {
+                try {
+                    SessionSnapshot snapshot = SessionJournal::load(path);
+                    if (restoreSession(journal, snapshot)) {
+                        loaded.push_back(snapshot.id);
+                    }
+                } catch (const std::exception&) {
+                }
+            }
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    SCM list = SCM_EOL;
+    for (auto it = loaded.rbegin(); it != loaded.rend(); ++it) {
+        list = scm_cons(scm_from_utf8_string(it->c_str()), list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Close sessions idle for longer than the given number of
+// seconds, now and automatically from then on (0 disables)
+SCM caichat_set_session_idle_timeout(SCM seconds_scm) {
+    std::chrono::milliseconds timeout((long long)(scm_to_double(seconds_scm) * 1000));
+    SessionRegistry& registry = SessionRegistry::instance();
+    registry.setIdleTimeout(timeout);
+    size_t evicted = timeout.count() > 0 ? registry.evictIdle(timeout) : 0;
+    return scm_from_size_t(evicted);
+}
+
+// Scheme wrapper: Configure the shared HTTP connection pool, optionally
+// with the transfer and stall timeouts
+SCM caichat_set_connection_pool(SCM max_connections_scm, SCM idle_timeout_scm,
+                                SCM transfer_timeout_scm, SCM stall_timeout_scm) {
+    ConnectionPool& pool = ConnectionPool::instance();
+    pool.setMaxConnections(scm_to_size_t(max_connections_scm));
+    pool.setIdleTimeout(scm_to_long(idle_timeout_scm));
+    if (!SCM_UNBNDP(transfer_timeout_scm)) {
+        pool.setTimeouts(scm_to_long(transfer_timeout_scm),
+                         SCM_UNBNDP(stall_timeout_scm) ? pool.getStallTimeout()
+                                                       : scm_to_long(stall_timeout_scm));
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Enable the response cache, optionally with a byte limit
+// and a persistent file
+SCM caichat_cache_enable(SCM max_bytes_scm, SCM path_scm) {
+    size_t max_bytes = SCM_UNBNDP(max_bytes_scm) ? 64 * 1024 * 1024 : scm_to_size_t(max_bytes_scm);
+    std::string path = (!SCM_UNBNDP(path_scm) && scm_is_string(path_scm)) ? scm_to_string(path_scm) : "";
+    
+    try {
+        std::lock_guard<std::mutex> lock(responseCacheMutex);
+        if (!responseCache) {
+            responseCache = std::make_shared<ResponseCache>(max_bytes);
+        } else {
+            responseCache->setMaxBytes(max_bytes);
+        }
+        if (!path.empty()) {
+            responseCache->openDisk(path);
+        }
+    } catch (const std::exception& e) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(e.what())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Stop caching for clients created from now on
+SCM caichat_cache_disable() {
+    std::lock_guard<std::mutex> lock(responseCacheMutex);
+    responseCache.reset();
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Turn coalescing of identical in-flight requests on or
+// off for clients created from now on
+SCM caichat_coalesce_enable(SCM on_scm) {
+    coalescing.store(scm_is_true(on_scm), std::memory_order_relaxed);
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Drop all in-memory cache entries, including embeddings
+SCM caichat_cache_clear() {
+    {
+        std::lock_guard<std::mutex> lock(responseCacheMutex);
+        if (responseCache) {
+            responseCache->clear();
+        }
+    }
+    std::lock_guard<std::mutex> lock(embeddingClientsMutex);
+    if (embeddingCache) {
+        embeddingCache->clear();
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Cache counters as an association list
+SCM caichat_cache_stats() {
+    ResponseCache::Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(responseCacheMutex);
+        if (!responseCache) {
+            return SCM_BOOL_F;
+        }
+        stats = responseCache->getStats();
+    }
+    
+    SCM alist = SCM_EOL;
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("disk-entries"), scm_from_uint64(stats.diskEntries)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("bytes"), scm_from_uint64(stats.bytes)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("entries"), scm_from_uint64(stats.entries)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("evictions"), scm_from_uint64(stats.evictions)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("misses"), scm_from_uint64(stats.misses)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("disk-hits"), scm_from_uint64(stats.diskHits)), alist);
+    alist = scm_cons(scm_cons(scm_from_utf8_symbol("hits"), scm_from_uint64(stats.hits)), alist);
+    return alist;
+}
+
+// Scheme wrapper: Metrics of every provider and model as a list of
+// (provider model (requests . n) ... (phases (name count p50 p90 p99) ...)),
+// phase times in milliseconds
+SCM caichat_metrics() {
+    static const double QUANTILES[] = {0.5, 0.9, 0.99};
+    SCM list = SCM_EOL;
+    auto all = Metrics::instance().snapshot();
+    for (auto it = all.rbegin(); it != all.rend(); ++it) {
+        const ModelMetrics& metrics = *it->second;
+        SCM phases = SCM_EOL;
+        for (int phase = ModelMetrics::PHASES - 1; phase >= 0; --phase) {
+            const Histogram& histogram = metrics.phases[phase];
+            if (histogram.count() == 0) {
+                continue;
+            }
+            SCM times = SCM_EOL;
+            for (int q = 2; q >= 0; --q) {
+                times = scm_cons(scm_from_double(histogram.quantile(QUANTILES[q]) / 1000.0), times);
+            }
+            times = scm_cons(scm_from_uint64(histogram.count()), times);
+            phases = scm_cons(scm_cons(scm_from_utf8_symbol(ModelMetrics::phaseName(phase)), times),
+                              phases);
+        }
+        SCM alist = scm_list_1(scm_cons(scm_from_utf8_symbol("phases"), phases));
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("routed"), scm_from_uint64(metrics.routed.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("coalesced"), scm_from_uint64(metrics.coalesced.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("cache-misses"), scm_from_uint64(metrics.cacheMisses.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("cache-hits"), scm_from_uint64(metrics.cacheHits.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("hedges"), scm_from_uint64(metrics.hedges.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("retries"), scm_from_uint64(metrics.retries.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("cache-write-tokens"), scm_from_uint64(metrics.cacheWriteTokens.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("cache-read-tokens"), scm_from_uint64(metrics.cacheReadTokens.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("output-tokens"), scm_from_uint64(metrics.outputTokens.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("input-tokens"), scm_from_uint64(metrics.inputTokens.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("errors"), scm_from_uint64(metrics.errors.get())), alist);
+        alist = scm_cons(scm_cons(scm_from_utf8_symbol("requests"), scm_from_uint64(metrics.requests.get())), alist);
+        list = scm_cons(scm_cons2(scm_from_utf8_string(it->first.first.c_str()),
+                                  scm_from_utf8_string(it->first.second.c_str()), alist),
+                        list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Metrics in the Prometheus text format; with a path,
+// written to that file instead
+SCM caichat_metrics_prometheus(SCM path_scm) {
+    Metrics& metrics = Metrics::instance();
+    if (SCM_UNBNDP(path_scm)) {
+        return scm_from_utf8_string(metrics.renderPrometheus().c_str());
+    }
+    std::string path = scm_to_string(path_scm);
+    std::string error;
+    try {
+        metrics.writePrometheus(path);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    if (!error.empty()) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                  scm_list_1(scm_from_utf8_string(error.c_str())));
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Serve the Prometheus text on 127.0.0.1:port (0 stops);
+// returns the bound port
+SCM caichat_metrics_serve(SCM port_scm) {
+    int port = 0;
+    std::string error;
+    try {
+        port = Metrics::instance().serve(scm_to_int(port_scm));
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    if (!error.empty()) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                  scm_list_1(scm_from_utf8_string(error.c_str())));
+    }
+    return scm_from_int(port);
+}
+
+// Scheme wrapper: Turn recording on or off; metrics are kept
+SCM caichat_metrics_enable(SCM on_scm) {
+    Metrics::setEnabled(scm_is_true(on_scm));
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Zero all metrics
+SCM caichat_metrics_reset() {
+    Metrics::instance().reset();
+    return SCM_BOOL_T;
+}
+
+// Caching embedding client for a provider; for local models the model
+// argument is the GGUF path
+static std::shared_ptr<LLMClient> embeddingClient(const std::string& provider,
+                                                  const std::string& model) {
+    std::lock_guard<std::mutex> lock(embeddingClientsMutex);
+    std::shared_ptr<LLMClient>& client = embeddingClients[provider + '\n' + model];
+    if (!client) {
+        if (!embeddingCache) {
+            embeddingCache = std::make_shared<ResponseCache>(256 * 1024 * 1024);
+        }
+        bool local = provider == "ggml" || provider == "local";
+        client = std::make_shared<CachingClient>(
+            ClientFactory::createClient(provider, local ? model : ""), embeddingCache);
+    }
+    return client;
+}
+
+// Scheme wrapper: Embed a list of strings; returns a list of f32vectors
+SCM caichat_embed(SCM provider_scm, SCM texts_scm, SCM model_scm) {
+    std::string provider = scm_to_string(provider_scm);
+    std::string model = SCM_UNBNDP(model_scm) ? "" : scm_to_string(model_scm);
+    std::vector<std::string> texts;
+    for (SCM rest = texts_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        texts.push_back(scm_to_string(scm_car(rest)));
+    }
+    
+    std::vector<Embedding> embeddings;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            embeddings = embeddingClient(provider, model)->embed(texts, model);
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    
+    SCM list = SCM_EOL;
+    for (auto it = embeddings.rbegin(); it != embeddings.rend(); ++it) {
+        // Guile frees the buffer with the vector
+        float* data = static_cast<float*>(malloc(std::max<size_t>(it->size(), 1) * sizeof(float)));
+        std::copy(it->begin(), it->end(), data);
+        list = scm_cons(scm_take_f32vector(data, it->size()), list);
+    }
+    return list;
+}
+
+static std::shared_ptr<VectorIndex> findVectorIndex(const std::string& name) {
+    std::lock_guard<std::mutex> lock(vectorIndexesMutex);
+    auto it = vectorIndexes.find(name);
+    return it == vectorIndexes.end() ? nullptr : it->second;
+}
+
+// Copy an f32vector, vector or list of numbers into out
+static void scm_to_floats(SCM vector_scm, std::vector<float>& out) {
+    out.clear();
+    if (scm_is_true(scm_f32vector_p(vector_scm))) {
+        scm_t_array_handle handle;
+        size_t length;
+        ptrdiff_t step;
+        const float* elements = scm_f32vector_elements(vector_scm, &handle, &length, &step);
+        out.reserve(length);
+        for (size_t i = 0; i < length; ++i, elements += step) {
+            out.push_back(*elements);
+        }
+        scm_array_handle_release(&handle);
+    } else if (scm_is_vector(vector_scm)) {
+        size_t length = scm_c_vector_length(vector_scm);
+        out.reserve(length);
+        for (size_t i = 0; i < length; ++i) {
+            out.push_back((float)scm_to_double(scm_c_vector_ref(vector_scm, i)));
+        }
     } else {
+        for (SCM rest = vector_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+            out.push_back((float)scm_to_double(scm_car(rest)));
+        }
+    }
+}
+
+// Look up a named index and convert a vector argument for it; raises a
+// Scheme error if either is unusable
+static std::shared_ptr<VectorIndex> vectorIndexArgs(SCM name_scm, SCM vector_scm,
+                                                    std::vector<float>& vector) {
+    std::shared_ptr<VectorIndex> index = findVectorIndex(scm_to_string(name_scm));
+    if (!index) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string("Vector index not found")));
+    }
+    scm_to_floats(vector_scm, vector);
+    if (vector.size() != index->getDimension()) {
+        index.reset();   // scm_throw does not run destructors
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string("Vector has the wrong dimension")));
+    }
+    return index;
+}
+
+// Scheme wrapper: Create (or replace) a named vector index. Options are
+// symbols: 'cosine or 'dot, 'f32 or 'int8, 'hnsw or 'exact
+SCM caichat_vector_index_create(SCM name_scm, SCM dimension_scm, SCM options_scm) {
+    std::string name = scm_to_string(name_scm);
+    size_t dimension = scm_to_size_t(dimension_scm);
+    if (dimension == 0) {
         scm_throw(scm_from_utf8_symbol("caichat-error"), 
-                 scm_list_1(scm_from_utf8_string("Session is not a GGML client")));
+                 scm_list_1(scm_from_utf8_string("Vector dimension must be positive")));
         return SCM_BOOL_F;
     }
+    
+    VectorIndex::Options options;
+    for (SCM rest = options_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        std::string option = scm_to_string(scm_symbol_to_string(scm_car(rest)));
+        if (option == "cosine") {
+            options.metric = VectorIndex::Metric::Cosine;
+        } else if (option == "dot") {
+            options.metric = VectorIndex::Metric::InnerProduct;
+        } else if (option == "f32") {
+            options.storage = VectorIndex::Storage::Float32;
+        } else if (option == "int8") {
+            options.storage = VectorIndex::Storage::Int8;
+        } else if (option == "hnsw") {
+            options.mode = VectorIndex::Mode::HNSW;
+        } else if (option == "exact") {
+            options.mode = VectorIndex::Mode::Exact;
+        } else {
+            scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                     scm_list_1(scm_from_utf8_string("Unknown vector index option")));
+            return SCM_BOOL_F;
+        }
+    }
+    
+    auto index = std::make_shared<VectorIndex>(dimension, options);
+    std::lock_guard<std::mutex> lock(vectorIndexesMutex);
+    vectorIndexes[name] = index;
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Add or replace the vector stored under id
+SCM caichat_vector_index_add(SCM name_scm, SCM id_scm, SCM vector_scm) {
+    std::string id = scm_to_string(id_scm);
+    std::vector<float> vector;
+    std::shared_ptr<VectorIndex> index = vectorIndexArgs(name_scm, vector_scm, vector);
+    
+    // Graph insertion costs thousands of distance evaluations
+    std::string error;
+    if (!withoutGuile(error, [&] { index->add(id, vector.data()); })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: k nearest vectors as a list of (id . score), best first
+SCM caichat_vector_index_search(SCM name_scm, SCM vector_scm, SCM k_scm) {
+    size_t k = SCM_UNBNDP(k_scm) ? 5 : scm_to_size_t(k_scm);
+    std::vector<float> query;
+    std::shared_ptr<VectorIndex> index = vectorIndexArgs(name_scm, vector_scm, query);
+    
+    std::vector<VectorIndex::Result> results;
+    std::string error;
+    if (!withoutGuile(error, [&] { results = index->search(query.data(), k); })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    
+    SCM list = SCM_EOL;
+    for (auto it = results.rbegin(); it != results.rend(); ++it) {
+        list = scm_cons(scm_cons(scm_from_utf8_string(it->id.c_str()),
+                                 scm_from_double(it->score)), list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Remove a vector; #f if the index does not hold id
+SCM caichat_vector_index_remove(SCM name_scm, SCM id_scm) {
+    std::shared_ptr<VectorIndex> index = findVectorIndex(scm_to_string(name_scm));
+    if (!index) {
+        return SCM_BOOL_F;
+    }
+    return scm_from_bool(index->remove(scm_to_string(id_scm)));
+}
+
+// Scheme wrapper: Number of vectors in an index, #f if it does not exist
+SCM caichat_vector_index_size(SCM name_scm) {
+    std::shared_ptr<VectorIndex> index = findVectorIndex(scm_to_string(name_scm));
+    return index ? scm_from_size_t(index->size()) : SCM_BOOL_F;
+}
+
+static std::shared_ptr<KnowledgeBase> findKnowledgeBase(const std::string& name) {
+    std::lock_guard<std::mutex> lock(knowledgeBasesMutex);
+    auto it = knowledgeBases.find(name);
+    return it == knowledgeBases.end() ? nullptr : it->second;
+}
+
+// Look up a knowledge base argument, raising a Scheme error if it is not open
+static std::shared_ptr<KnowledgeBase> knowledgeBaseArg(SCM name_scm) {
+    std::shared_ptr<KnowledgeBase> kb = findKnowledgeBase(scm_to_string(name_scm));
+    if (!kb) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string("Knowledge base not open")));
+    }
+    return kb;
+}
+
+// Embed through the provider recorded in the knowledge base's settings
+static void attachEmbedder(KnowledgeBase& kb) {
+    std::string provider = kb.getSetting("embedding-provider");
+    if (provider.empty()) {
+        kb.setEmbedder(nullptr);
+        return;
+    }
+    std::string model = kb.getSetting("embedding-model");
+    std::shared_ptr<LLMClient> client = embeddingClient(provider, model);
+    kb.setEmbedder([client, model](const std::vector<std::string>& texts) {
+        return client->embed(texts, model);
+    });
+}
+
+// ((id length metadata) ...) or ((doc-id text metadata score) ...)
+static SCM documentList(const std::vector<KnowledgeBase::DocumentInfo>& docs) {
+    SCM list = SCM_EOL;
+    for (auto it = docs.rbegin(); it != docs.rend(); ++it) {
+        list = scm_cons(scm_list_3(scm_from_utf8_string(it->id.c_str()),
+                                   scm_from_size_t(it->length),
+                                   scm_from_utf8_string(it->metadata.c_str())), list);
+    }
+    return list;
+}
+
+static SCM hitList(const std::vector<KnowledgeBase::Hit>& hits) {
+    SCM list = SCM_EOL;
+    for (auto it = hits.rbegin(); it != hits.rend(); ++it) {
+        list = scm_cons(scm_list_4(scm_from_utf8_string(it->docId.c_str()),
+                                   scm_from_utf8_string(it->text.c_str()),
+                                   scm_from_utf8_string(it->metadata.c_str()),
+                                   scm_from_double(it->score)), list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Open (creating if needed) the knowledge base file at
+// path under name
+SCM caichat_kb_open(SCM name_scm, SCM path_scm, SCM description_scm) {
+    std::string name = scm_to_string(name_scm);
+    std::string path = scm_to_string(path_scm);
+    std::string description = SCM_UNBNDP(description_scm) ? "" : scm_to_string(description_scm);
+    
+    std::shared_ptr<KnowledgeBase> kb = findKnowledgeBase(name);
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            if (!kb || kb->getPath() != path) {
+                kb = std::make_shared<KnowledgeBase>(path);
+                attachEmbedder(*kb);
+            }
+            if (!description.empty() && kb->getSetting("description") != description) {
+                kb->setSetting("description", description);
+            }
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    
+    std::lock_guard<std::mutex> lock(knowledgeBasesMutex);
+    knowledgeBases[name] = kb;
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Whether a knowledge base is open under name
+SCM caichat_kb_open_p(SCM name_scm) {
+    return scm_from_bool((bool)findKnowledgeBase(scm_to_string(name_scm)));
+}
+
+// Scheme wrapper: Close a knowledge base; its file stays on disk
+SCM caichat_kb_close(SCM name_scm) {
+    std::string name = scm_to_string(name_scm);
+    std::lock_guard<std::mutex> lock(knowledgeBasesMutex);
+    return scm_from_bool(knowledgeBases.erase(name) > 0);
+}
+
+// Scheme wrapper: Embed documents and queries with provider (and model);
+// remembered in the knowledge base
+SCM caichat_kb_set_embedder(SCM name_scm, SCM provider_scm, SCM model_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::string provider = scm_to_string(provider_scm);
+    std::string model = SCM_UNBNDP(model_scm) ? "" : scm_to_string(model_scm);
+    
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            kb->setSetting("embedding-provider", provider);
+            kb->setSetting("embedding-model", model);
+            attachEmbedder(*kb);
+        })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Chunk size and overlap in bytes for new documents
+SCM caichat_kb_set_chunking(SCM name_scm, SCM max_chars_scm, SCM overlap_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    kb->setChunking(scm_to_size_t(max_chars_scm), scm_to_size_t(overlap_scm));
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Add or replace a document; with an embedding it is
+// stored as one chunk with that vector
+SCM caichat_kb_add_doc(SCM name_scm, SCM id_scm, SCM content_scm, SCM metadata_scm,
+                       SCM embedding_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::string id = scm_to_string(id_scm);
+    std::string content = scm_to_string(content_scm);
+    std::string metadata = scm_to_string(metadata_scm);
+    bool embedded = !SCM_UNBNDP(embedding_scm) && !scm_is_null(embedding_scm);
+    Embedding embedding;
+    if (embedded) {
+        scm_to_floats(embedding_scm, embedding);
+    }
+    
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            if (embedded) {
+                kb->addDocument(id, content, metadata, embedding);
+            } else {
+                kb->addDocument(id, content, metadata);
+            }
+        })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Add a list of (id content metadata) documents, embedding
+// all their chunks together
+SCM caichat_kb_add_docs(SCM name_scm, SCM docs_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::vector<KnowledgeBase::Document> docs;
+    for (SCM rest = docs_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        SCM doc = scm_car(rest);
+        docs.push_back(KnowledgeBase::Document{scm_to_string(scm_car(doc)),
+                                               scm_to_string(scm_cadr(doc)),
+                                               scm_to_string(scm_caddr(doc))});
+    }
+    
+    std::string error;
+    if (!withoutGuile(error, [&] { kb->addDocuments(docs); })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_size_t(docs.size());
+}
+
+// Scheme wrapper: Stream files into a knowledge base; returns the number
+// of chunks added
+SCM caichat_kb_ingest(SCM name_scm, SCM paths_scm, SCM metadata_scm, SCM workers_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::vector<std::string> paths;
+    for (SCM rest = paths_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+        paths.push_back(scm_to_string(scm_car(rest)));
+    }
+    std::string metadata = SCM_UNBNDP(metadata_scm) ? "" : scm_to_string(metadata_scm);
+    size_t workers = SCM_UNBNDP(workers_scm) ? 4 : scm_to_size_t(workers_scm);
+    
+    size_t added = 0;
+    std::string error;
+    if (!withoutGuile(error, [&] { added = kb->ingestFiles(paths, metadata, workers); })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_size_t(added);
+}
+
+// Scheme wrapper: Remove a document; #f if it does not exist
+SCM caichat_kb_remove_doc(SCM name_scm, SCM id_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::string id = scm_to_string(id_scm);
+    bool removed = false;
+    std::string error;
+    if (!withoutGuile(error, [&] { removed = kb->removeDocument(id); })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_bool(removed);
+}
+
+// Scheme wrapper: Documents as a list of (id length metadata)
+SCM caichat_kb_list_docs(SCM name_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    return documentList(kb->listDocuments());
+}
+
+// Scheme wrapper: Up to k chunks (default 5) ranked for a string by
+// keywords and similarity, or similar to a vector, as a list of
+// (doc-id text metadata score)
+SCM caichat_kb_search(SCM name_scm, SCM query_scm, SCM k_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    size_t k = SCM_UNBNDP(k_scm) ? 5 : scm_to_size_t(k_scm);
+    bool text = scm_is_string(query_scm);
+    std::string query;
+    Embedding vector;
+    if (text) {
+        query = scm_to_string(query_scm);
+    } else {
+        scm_to_floats(query_scm, vector);
+    }
+    
+    std::vector<KnowledgeBase::Hit> hits;
+    std::string error;
+    if (!withoutGuile(error, [&] {
+            hits = text ? kb->search(query, k) : kb->searchVector(vector, k);
+        })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return hitList(hits);
+}
+
+// Scheme wrapper: Best chunks for a string query that fit in a token
+// budget, from the top k (default 20), as a list of
+// (doc-id text metadata score)
+SCM caichat_kb_search_context(SCM name_scm, SCM query_scm, SCM tokens_scm, SCM k_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    std::string query = scm_to_string(query_scm);
+    size_t tokens = scm_to_size_t(tokens_scm);
+    size_t k = SCM_UNBNDP(k_scm) ? 20 : scm_to_size_t(k_scm);
+    
+    std::vector<KnowledgeBase::Hit> hits;
+    std::string error;
+    if (!withoutGuile(error, [&] { hits = kb->searchContext(query, tokens, k); })) {
+        kb.reset();
+        scm_throw(scm_from_utf8_symbol("caichat-error"), 
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return hitList(hits);
+}
+
+// Scheme wrapper: Share of embedding similarity in hybrid search
+// scores, from 0 (keywords only) to 1 (embeddings only)
+SCM caichat_kb_set_hybrid_weight(SCM name_scm, SCM weight_scm) {
+    std::shared_ptr<KnowledgeBase> kb = knowledgeBaseArg(name_scm);
+    kb->setHybridWeight((float)scm_to_double(weight_scm));
+    return SCM_BOOL_T;
+}
+
+// Read a Scheme string or symbol
+static std::string nameArg(SCM name_scm) {
+    return scm_is_symbol(name_scm) ? scm_to_string(scm_symbol_to_string(name_scm))
+                                   : scm_to_string(name_scm);
+}
+
+// Scheme wrapper: Tokens of a text, or of a request made of
+// ((role content) ...) framing included, as counted for model
+SCM caichat_count_tokens(SCM input_scm, SCM model_scm) {
+    std::string model = SCM_UNBNDP(model_scm) ? "" : scm_to_string(model_scm);
+    size_t tokens = 0;
+    std::string error;
+    if (scm_is_string(input_scm)) {
+        std::string text = scm_to_string(input_scm);
+        withoutGuile(error, [&] { tokens = countTokens(text, model); });
+    } else {
+        std::vector<Message> messages;
+        for (SCM rest = input_scm; scm_is_pair(rest) && error.empty(); rest = scm_cdr(rest)) {
+            SCM msg = scm_car(rest);
+            try {
+                messages.emplace_back(parseRole(nameArg(scm_car(msg))), scm_to_string(scm_cadr(msg)));
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+        }
+        if (error.empty()) {
+            withoutGuile(error, [&] { tokens = countTokens(messages, model); });
+        }
+    }
+    if (!error.empty()) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_size_t(tokens);
+}
+
+// Scheme wrapper: Count tokens of models named prefix... with the
+// tiktoken or GGUF vocabulary at path
+SCM caichat_set_tokenizer(SCM prefix_scm, SCM path_scm) {
+    std::string prefix = scm_to_string(prefix_scm);
+    std::string path = scm_to_string(path_scm);
+    std::string error;
+    if (!withoutGuile(error, [&] { Tokenizer::setVocabulary(prefix, path); })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Store messages, given as ((role content) ...), as atoms
+// of the session in one batch
+SCM caichat_atoms_store_conversation(SCM session_id_scm, SCM messages_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    std::vector<Message> messages;
+    std::string error;
+    try {
+        for (SCM rest = messages_scm; scm_is_pair(rest); rest = scm_cdr(rest)) {
+            SCM msg = scm_car(rest);
+            messages.emplace_back(parseRole(nameArg(scm_car(msg))), scm_to_string(scm_cadr(msg)));
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    if (error.empty()) {
+        withoutGuile(error, [&] {
+            ConversationLog(AtomStore::instance(), session_id).write(messages);
+        });
+    }
+    if (!error.empty()) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return scm_from_size_t(messages.size());
+}
+
+// Scheme wrapper: Write each completed turn of a session into the
+// AtomStore, or stop when enable is #f
+SCM caichat_atoms_log_session(SCM session_id_scm, SCM enable_scm) {
+    std::string session_id = scm_to_string(session_id_scm);
+    bool enable = SCM_UNBNDP(enable_scm) || scm_is_true(enable_scm);
+
+    std::string error;
+    if (!withSession(session_id, error, [&](ChatCompletion& chat) {
+            if (!enable) {
+                chat.setTurnObserver(nullptr);
+                return;
+            }
+            auto log = std::make_shared<ConversationLog>(AtomStore::instance(), session_id);
+            chat.setTurnObserver([log](const std::vector<Message>& history, size_t first) {
+                log->write(history.data() + first, history.size() - first);
+            });
+        })) {
+        scm_throw(scm_from_utf8_symbol("caichat-error"),
+                 scm_list_1(scm_from_utf8_string(error.c_str())));
+        return SCM_BOOL_F;
+    }
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: (EvaluationLink (PredicateNode "description")
+// (ListLink (ConceptNode name) (ConceptNode description)))
+SCM caichat_atoms_add_concept(SCM name_scm, SCM description_scm) {
+    std::string name = nameArg(name_scm);
+    std::string description = scm_to_string(description_scm);
+    AtomBatch batch;
+    AtomBatch::Ref concept = batch.node(AtomType::ConceptNode, name);
+    batch.link(AtomType::EvaluationLink,
+               {batch.node(AtomType::PredicateNode, "description"),
+                batch.link(AtomType::ListLink,
+                           {concept, batch.node(AtomType::ConceptNode, description)})});
+    AtomStore::instance().commit(batch);
+    return SCM_BOOL_T;
+}
+
+// Scheme wrapper: Concepts related to name as ((name . shared-links) ...),
+// most related first; #f if there is no such concept
+SCM caichat_atoms_related(SCM name_scm, SCM limit_scm) {
+    std::string name = nameArg(name_scm);
+    size_t limit = SCM_UNBNDP(limit_scm) ? 0 : scm_to_size_t(limit_scm);
+    AtomStore& store = AtomStore::instance();
+    if (store.findNode(AtomType::ConceptNode, name) == NO_ATOM) {
+        return SCM_BOOL_F;
+    }
+    auto related = store.related(name, limit);
+    SCM list = SCM_EOL;
+    for (auto it = related.rbegin(); it != related.rend(); ++it) {
+        list = scm_cons(scm_cons(scm_from_utf8_string(it->first.c_str()),
+                                 scm_from_size_t(it->second)), list);
+    }
+    return list;
+}
+
+// Scheme wrapper: Atom counts of the store
+SCM caichat_atoms_stats() {
+    AtomStore& store = AtomStore::instance();
+    return scm_list_3(scm_cons(scm_from_utf8_symbol("atoms"), scm_from_size_t(store.size())),
+                      scm_cons(scm_from_utf8_symbol("nodes"), scm_from_size_t(store.nodeCount())),
+                      scm_cons(scm_from_utf8_symbol("links"), scm_from_size_t(store.linkCount())));
 }
 
 // Initialize the module
 extern "C" void init_caichat_bindings() {
     scm_c_define_gsubr("caichat-create-client", 2, 0, 0, (scm_t_subr)caichat_create_client);
     scm_c_define_gsubr("caichat-send-message", 2, 0, 0, (scm_t_subr)caichat_send_message);
+    scm_c_define_gsubr("caichat-send-message-stream", 3, 0, 0, (scm_t_subr)caichat_send_message_stream);
+    scm_c_define_gsubr("caichat-send-message-with-tools", 2, 1, 0, (scm_t_subr)caichat_send_message_with_tools);
+    scm_c_define_gsubr("caichat-tools-set-root", 1, 0, 0, (scm_t_subr)caichat_tools_set_root);
+    scm_c_define_gsubr("caichat-tools-load", 0, 1, 0, (scm_t_subr)caichat_tools_load);
+    scm_c_define_gsubr("caichat-tools-list", 0, 0, 0, (scm_t_subr)caichat_tools_list);
+    scm_c_define_gsubr("caichat-tools-set-timeout", 1, 1, 0, (scm_t_subr)caichat_tools_set_timeout);
+    scm_c_define_gsubr("caichat-tools-set-parallel", 1, 0, 0, (scm_t_subr)caichat_tools_set_parallel);
+    scm_c_define_gsubr("caichat-run-tool", 2, 0, 0, (scm_t_subr)caichat_run_tool);
     scm_c_define_gsubr("caichat-ask-internal", 2, 0, 0, (scm_t_subr)caichat_ask);
+    scm_c_define_gsubr("caichat-ask-async-internal", 2, 0, 0, (scm_t_subr)caichat_ask_async);
+    scm_c_define_gsubr("caichat-await", 1, 0, 0, (scm_t_subr)caichat_await);
+    scm_c_define_gsubr("caichat-ask-batch-internal", 2, 1, 0, (scm_t_subr)caichat_ask_batch);
+    scm_c_define_gsubr("caichat-set-rate-limit", 3, 0, 0, (scm_t_subr)caichat_set_rate_limit);
     scm_c_define_gsubr("caichat-set-system-message", 2, 0, 0, (scm_t_subr)caichat_set_system_message);
     scm_c_define_gsubr("caichat-clear-history", 1, 0, 0, (scm_t_subr)caichat_clear_history);
+    scm_c_define_gsubr("caichat-close-session", 1, 1, 0, (scm_t_subr)caichat_close_session);
+    scm_c_define_gsubr("caichat-save-session", 1, 1, 0, (scm_t_subr)caichat_save_session);
+    scm_c_define_gsubr("caichat-load-session", 1, 1, 0, (scm_t_subr)caichat_load_session);
+    scm_c_define_gsubr("caichat-load-sessions", 0, 1, 0, (scm_t_subr)caichat_load_sessions);
+    scm_c_define_gsubr("caichat-set-session-idle-timeout", 1, 0, 0, (scm_t_subr)caichat_set_session_idle_timeout);
+    scm_c_define_gsubr("caichat-set-context-budget", 2, 0, 0, (scm_t_subr)caichat_set_context_budget);
+    scm_c_define_gsubr("caichat-set-history-policy", 2, 1, 0, (scm_t_subr)caichat_set_history_policy);
     scm_c_define_gsubr("caichat-set-model-path", 2, 0, 0, (scm_t_subr)caichat_set_model_path);
+    scm_c_define_gsubr("caichat-set-local-threads", 2, 1, 0, (scm_t_subr)caichat_set_local_threads);
+    scm_c_define_gsubr("caichat-set-hedge-options", 2, 2, 0, (scm_t_subr)caichat_set_hedge_options);
+    scm_c_define_gsubr("caichat-set-route-options", 1, 3, 0, (scm_t_subr)caichat_set_route_options);
+    scm_c_define_gsubr("caichat-set-latency-slo", 2, 0, 0, (scm_t_subr)caichat_set_latency_slo);
+    scm_c_define_gsubr("caichat-last-route", 1, 0, 0, (scm_t_subr)caichat_last_route);
+    scm_c_define_gsubr("caichat-route-stats", 1, 0, 0, (scm_t_subr)caichat_route_stats);
+    scm_c_define_gsubr("caichat-set-connection-pool", 2, 2, 0, (scm_t_subr)caichat_set_connection_pool);
+    scm_c_define_gsubr("caichat-cache-enable", 0, 2, 0, (scm_t_subr)caichat_cache_enable);
+    scm_c_define_gsubr("caichat-cache-disable", 0, 0, 0, (scm_t_subr)caichat_cache_disable);
+    scm_c_define_gsubr("caichat-coalesce-enable", 1, 0, 0, (scm_t_subr)caichat_coalesce_enable);
+    scm_c_define_gsubr("caichat-cache-clear", 0, 0, 0, (scm_t_subr)caichat_cache_clear);
+    scm_c_define_gsubr("caichat-cache-stats", 0, 0, 0, (scm_t_subr)caichat_cache_stats);
+    scm_c_define_gsubr("caichat-metrics", 0, 0, 0, (scm_t_subr)caichat_metrics);
+    scm_c_define_gsubr("caichat-metrics-prometheus", 0, 1, 0, (scm_t_subr)caichat_metrics_prometheus);
+    scm_c_define_gsubr("caichat-metrics-serve", 1, 0, 0, (scm_t_subr)caichat_metrics_serve);
+    scm_c_define_gsubr("caichat-metrics-enable", 1, 0, 0, (scm_t_subr)caichat_metrics_enable);
+    scm_c_define_gsubr("caichat-metrics-reset", 0, 0, 0, (scm_t_subr)caichat_metrics_reset);
+    scm_c_define_gsubr("caichat-embed", 2, 1, 0, (scm_t_subr)caichat_embed);
+    scm_c_define_gsubr("caichat-kb-open", 2, 1, 0, (scm_t_subr)caichat_kb_open);
+    scm_c_define_gsubr("caichat-kb-open?", 1, 0, 0, (scm_t_subr)caichat_kb_open_p);
+    scm_c_define_gsubr("caichat-kb-close", 1, 0, 0, (scm_t_subr)caichat_kb_close);
+    scm_c_define_gsubr("caichat-kb-set-embedder", 2, 1, 0, (scm_t_subr)caichat_kb_set_embedder);
+    scm_c_define_gsubr("caichat-kb-set-chunking", 3, 0, 0, (scm_t_subr)caichat_kb_set_chunking);
+    scm_c_define_gsubr("caichat-kb-add-doc", 4, 1, 0, (scm_t_subr)caichat_kb_add_doc);
+    scm_c_define_gsubr("caichat-kb-add-docs", 2, 0, 0, (scm_t_subr)caichat_kb_add_docs);
+    scm_c_define_gsubr("caichat-kb-ingest", 2, 2, 0, (scm_t_subr)caichat_kb_ingest);
+    scm_c_define_gsubr("caichat-kb-remove-doc", 2, 0, 0, (scm_t_subr)caichat_kb_remove_doc);
+    scm_c_define_gsubr("caichat-kb-list-docs", 1, 0, 0, (scm_t_subr)caichat_kb_list_docs);
+    scm_c_define_gsubr("caichat-kb-search", 2, 1, 0, (scm_t_subr)caichat_kb_search);
+    scm_c_define_gsubr("caichat-kb-search-context", 3, 1, 0, (scm_t_subr)caichat_kb_search_context);
+    scm_c_define_gsubr("caichat-kb-set-hybrid-weight", 2, 0, 0, (scm_t_subr)caichat_kb_set_hybrid_weight);
+    scm_c_define_gsubr("caichat-vector-index-create", 2, 0, 1, (scm_t_subr)caichat_vector_index_create);
+    scm_c_define_gsubr("caichat-vector-index-add", 3, 0, 0, (scm_t_subr)caichat_vector_index_add);
+    scm_c_define_gsubr("caichat-vector-index-search", 2, 1, 0, (scm_t_subr)caichat_vector_index_search);
+    scm_c_define_gsubr("caichat-vector-index-remove", 2, 0, 0, (scm_t_subr)caichat_vector_index_remove);
+    scm_c_define_gsubr("caichat-vector-index-size", 1, 0, 0, (scm_t_subr)caichat_vector_index_size);
+    scm_c_define_gsubr("caichat-count-tokens", 1, 1, 0, (scm_t_subr)caichat_count_tokens);
+    scm_c_define_gsubr("caichat-set-tokenizer", 2, 0, 0, (scm_t_subr)caichat_set_tokenizer);
+    scm_c_define_gsubr("caichat-atoms-store-conversation", 2, 0, 0, (scm_t_subr)caichat_atoms_store_conversation);
+    scm_c_define_gsubr("caichat-atoms-log-session", 1, 1, 0, (scm_t_subr)caichat_atoms_log_session);
+    scm_c_define_gsubr("caichat-atoms-add-concept", 2, 0, 0, (scm_t_subr)caichat_atoms_add_concept);
+    scm_c_define_gsubr("caichat-atoms-related", 1, 1, 0, (scm_t_subr)caichat_atoms_related);
+    scm_c_define_gsubr("caichat-atoms-stats", 0, 0, 0, (scm_t_subr)caichat_atoms_stats);
 }
 
 } // namespace caichat
@@ -0,0 +1,718 @@
+#include "SessionJournal.h"
+#include "Hash.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+// File layout: 8-byte magic, then records of [RecordHeader][payload] in
+// native byte order. A payload is a sequence of 32- and 64-bit integers
+// and strings, each string a 32-bit length followed by its bytes. The
+// first record is always a RECORD_CONFIG.
+static const char SESSION_MAGIC[8] = {'C', 'A', 'I', 'S', 'E', 'S', 'S', '1'};
+
+enum RecordType : uint32_t {
+    RECORD_CONFIG = 1,    // id, provider, model, model path, budget, policy, pin
+    RECORD_SYSTEM = 2,    // system message, summary
+    RECORD_MESSAGE = 3,   // role, content, tool call id, tool calls (id, name, arguments)
+    RECORD_DROP = 4       // number of oldest turns trimmed from the history
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t length;     // of the payload
+    uint64_t checksum;   // of the type and payload; a mismatch marks a torn tail
+};
+
+// A log is rewritten once it is more than twice its live content plus this
+static const uint64_t COMPACT_SLACK = 64 * 1024;
+
+static uint64_t recordChecksum(uint32_t type, const char* payload, size_t length) {
+    return Hasher().update((uint64_t)type).update(payload, length).digest();
+}
+
+static void putU32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putU64(std::string& out, uint64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(std::string& out, const std::string& text) {
+    putU32(out, (uint32_t)text.size());
+    out += text;
+}
+
+static size_t beginRecord(std::string& out) {
+    size_t start = out.size();
+    out.append(sizeof(RecordHeader), '\0');
+    return start;
+}
+
+static void endRecord(std::string& out, size_t start, uint32_t type) {
+    RecordHeader header;
+    header.type = type;
+    header.length = (uint32_t)(out.size() - start - sizeof(RecordHeader));
+    header.checksum = recordChecksum(type, out.data() + start + sizeof(RecordHeader), header.length);
+    std::memcpy(&out[start], &header, sizeof(header));
+}
+
+static void encodeConfig(std::string& out, const std::string& id, const std::string& provider,
+                         const std::string& model, const std::string& modelPath,
+                         size_t tokenBudget, TrimPolicy policy, bool pinSystem) {
+    size_t start = beginRecord(out);
+    putString(out, id);
+    putString(out, provider);
+    putString(out, model);
+    putString(out, modelPath);
+    putU64(out, tokenBudget);
+    putU32(out, (uint32_t)policy);
+    putU32(out, pinSystem ? 1 : 0);
+    endRecord(out, start, RECORD_CONFIG);
+}
+
+static void encodeSystem(std::string& out, const std::string& systemMessage, const std::string& summary) {
+    size_t start = beginRecord(out);
+    putString(out, systemMessage);
+    putString(out, summary);
+    endRecord(out, start, RECORD_SYSTEM);
+}
+
+static void encodeMessage(std::string& out, const Message& msg) {
+    size_t start = beginRecord(out);
+    putU32(out, (uint32_t)msg.role);
+    putString(out, msg.content);
+    putString(out, msg.toolCallId);
+    putU32(out, (uint32_t)msg.toolCalls.size());
+    for (const ToolCall& call : msg.toolCalls) {
+        putString(out, call.id);
+        putString(out, call.name);
+        putString(out, call.arguments);
+    }
+    endRecord(out, start, RECORD_MESSAGE);
+}
+
+// Bytes encodeMessage writes for msg
+static size_t messageSize(const Message& msg) {
+    size_t size = sizeof(RecordHeader) + 4 + 4 + msg.content.size() + 4 + msg.toolCallId.size() + 4;
+    for (const ToolCall& call : msg.toolCalls) {
+        size += 12 + call.id.size() + call.name.size() + call.arguments.size();
+    }
+    return size;
+}
+
+static void encodeDrop(std::string& out, uint64_t count) {
+    size_t start = beginRecord(out);
+    putU64(out, count);
+    endRecord(out, start, RECORD_DROP);
+}
+
+// Bounds-checked payload reader; ok turns false on overrun
+struct PayloadReader {
+    const char* p;
+    const char* end;
+    bool ok;
+
+    PayloadReader(const char* data, size_t length) : p(data), end(data + length), ok(true) {}
+
+    template <typename T>
+    T number() {
+        T value = 0;
+        if ((size_t)(end - p) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::string string() {
+        uint32_t length = number<uint32_t>();
+        if (!ok || (size_t)(end - p) < length) {
+            ok = false;
+            return std::string();
+        }
+        std::string text(p, length);
+        p += length;
+        return text;
+    }
+};
+
+// Two messages are the same history entry if they share their text
+static bool sameMessage(const Message& a, const Message& b) {
+    return a.role == b.role && &a.content.str() == &b.content.str() &&
+           a.toolCallId == b.toolCallId && a.toolCalls.size() == b.toolCalls.size();
+}
+
+static std::string localModelPath(ChatCompletion& chat) {
+    GGMLClient* ggml = dynamic_cast<GGMLClient*>(chat.getClient()->getUnderlyingClient());
+    return ggml ? ggml->getModelPath() : std::string();
+}
+
+static void writeAll(int fd, const std::string& data, const std::string& path) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write session log " + path + ": " + std::strerror(errno));
+        }
+        written += (size_t)n;
+    }
+}
+
+static void makeDirectories(const std::string& path) {
+    for (size_t i = 1; i <= path.size(); ++i) {
+        if (i == path.size() || path[i] == '/') {
+            std::string prefix = path.substr(0, i);
+            if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+                throw std::runtime_error("Failed to create session directory " + prefix + ": " +
+                                         std::strerror(errno));
+            }
+        }
+    }
+}
+
+std::unique_ptr<ChatCompletion> SessionSnapshot::restore(std::unique_ptr<LLMClient> client) const {
+    if (!modelPath.empty()) {
+        if (GGMLClient* ggml = dynamic_cast<GGMLClient*>(client->getUnderlyingClient())) {
+            ggml->setModelPath(modelPath);
+        }
+    }
+    std::unique_ptr<ChatCompletion> chat(new ChatCompletion(std::move(client), model));
+    ConversationHistory& history = chat->getConversation();
+    history.setTokenBudget(tokenBudget);
+    history.setTrimPolicy(policy);
+    history.setPinSystemMessage(pinSystem);
+    history.setSystemMessage(systemMessage);
+    history.setSummary(summary);
+    for (const Message& msg : turns) {
+        history.append(msg);
+    }
+    return chat;
+}
+
+/**
+ * An open log and what it holds, to tell what a record() has to add
+ */
+struct SessionJournal::Log {
+    struct Turn {
+        Message message;   // shares its text with the session's history
+        size_t bytes;
+    };
+
+    std::mutex mutex;   // held by record(); the flusher only takes it to dup fd
+    int fd = -1;        // -1 until written, or after a failed write: rewrite
+    std::string path;
+    uint64_t fileBytes = 0;
+    uint64_t liveBytes = 0;   // size of a freshly written log of the same state
+    bool queued = false;      // in pending; guarded by the journal mutex
+
+    std::string provider;
+    std::string model;
+    std::string modelPath;
+    size_t tokenBudget = 0;
+    TrimPolicy policy = TrimPolicy::SlidingWindow;
+    bool pinSystem = true;
+    std::string systemMessage;
+    std::string summary;
+    uint64_t revision = 0;
+    size_t headBytes = 0;   // magic, config and system records
+    std::deque<Turn> turns;
+
+    ~Log() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Take the state of chat as what the log holds
+    void capture(const std::string& id, const std::string& providerSpec, ChatCompletion& chat) {
+        ConversationHistory& history = chat.getConversation();
+        provider = providerSpec;
+        model = chat.getModel();
+        modelPath = localModelPath(chat);
+        tokenBudget = history.getTokenBudget();
+        policy = history.getTrimPolicy();
+        pinSystem = history.getPinSystemMessage();
+        systemMessage = history.getSystemMessage();
+        summary = history.getSummary();
+        revision = history.getRevision();
+
+        std::string head(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+        encodeConfig(head, id, provider, model, modelPath, tokenBudget, policy, pinSystem);
+        encodeSystem(head, systemMessage, summary);
+        headBytes = head.size();
+
+        turns.clear();
+        liveBytes = headBytes;
+        const std::vector<Message>& messages = history.getMessages();
+        for (size_t i = history.firstTurn(); i < messages.size(); ++i) {
+            turns.push_back({messages[i], messageSize(messages[i])});
+            liveBytes += turns.back().bytes;
+        }
+    }
+};
+
+SessionJournal::SessionJournal(const std::string& dir, std::chrono::milliseconds interval)
+    : directory(dir), syncInterval(interval), stopping(false) {
+    while (directory.size() > 1 && directory.back() == '/') {
+        directory.pop_back();
+    }
+    makeDirectories(directory);
+}
+
+SessionJournal::~SessionJournal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    sync();
+}
+
+std::string SessionJournal::defaultDirectory() {
+    const char* dir = std::getenv("CAICHAT_SESSION_DIR");
+    if (dir && *dir) {
+        return dir;
+    }
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.caichat/sessions";
+}
+
+// Ids become file names with anything but letters, digits and -_,+@
+// percent-encoded
+std::string SessionJournal::pathFor(const std::string& id) const {
+    static const char HEX[] = "0123456789ABCDEF";
+    std::string name;
+    for (unsigned char c : id) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == ',' || c == '+' || c == '@') {
+            name += (char)c;
+        } else {
+            name += '%';
+            name += HEX[c >> 4];
+            name += HEX[c & 15];
+        }
+    }
+    return directory + "/" + name + ".session";
+}
+
+SessionJournal::LogPtr SessionJournal::logFor(const std::string& id, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    LogPtr& log = logs[id];
+    if (!log) {
+        log = std::make_shared<Log>();
+        log->path = path;
+    }
+    return log;
+}
+
+void SessionJournal::record(const std::string& id, const std::string& provider, ChatCompletion& chat) {
+    LogPtr log = logFor(id, pathFor(id));
+    std::lock_guard<std::mutex> lock(log->mutex);
+    if (log->fd < 0) {
+        rewrite(*log, id, provider, chat);
+        return;
+    }
+
+    ConversationHistory& history = chat.getConversation();
+    const std::vector<Message>& messages = history.getMessages();
+    size_t first = history.firstTurn();
+    std::string records;
+
+    std::string modelPath = localModelPath(chat);
+    if (provider != log->provider || chat.getModel() != log->model || modelPath != log->modelPath ||
+        history.getTokenBudget() != log->tokenBudget || history.getTrimPolicy() != log->policy ||
+        history.getPinSystemMessage() != log->pinSystem) {
+        log->provider = provider;
+        log->model = chat.getModel();
+        log->modelPath = modelPath;
+        log->tokenBudget = history.getTokenBudget();
+        log->policy = history.getTrimPolicy();
+        log->pinSystem = history.getPinSystemMessage();
+        encodeConfig(records, id, log->provider, log->model, log->modelPath,
+                     log->tokenBudget, log->policy, log->pinSystem);
+    }
+
+    // With the revision unchanged the history has only grown; otherwise
+    // find where its turns start among the logged ones
+    if (history.getRevision() != log->revision) {
+        if (history.getSystemMessage() != log->systemMessage || history.getSummary() != log->summary) {
+            log->systemMessage = history.getSystemMessage();
+            log->summary = history.getSummary();
+            encodeSystem(records, log->systemMessage, log->summary);
+        }
+        size_t dropped = log->turns.size();
+        if (first < messages.size()) {
+            for (size_t i = 0; i < log->turns.size(); ++i) {
+                if (sameMessage(log->turns[i].message, messages[first])) {
+                    dropped = i;
+                    break;
+                }
+            }
+        }
+        size_t kept = log->turns.size() - dropped;
+        bool extends = kept <= messages.size() - first;
+        for (size_t i = 0; extends && i < kept; ++i) {
+            extends = sameMessage(log->turns[dropped + i].message, messages[first + i]);
+        }
+        if (!extends) {
+            rewrite(*log, id, provider, chat);
+            return;
+        }
+        if (dropped > 0) {
+            encodeDrop(records, dropped);
+            for (size_t i = 0; i < dropped; ++i) {
+                log->liveBytes -= log->turns.front().bytes;
+                log->turns.pop_front();
+            }
+        }
+        log->revision = history.getRevision();
+    }
+
+    for (size_t i = first + log->turns.size(); i < messages.size(); ++i) {
+        size_t before = records.size();
+        encodeMessage(records, messages[i]);
+        log->turns.push_back({messages[i], records.size() - before});
+        log->liveBytes += records.size() - before;
+    }
+    if (records.empty()) {
+        return;
+    }
+    if (log->fileBytes + records.size() > 2 * log->liveBytes + COMPACT_SLACK) {
+        rewrite(*log, id, provider, chat);
+        return;
+    }
+
+    try {
+        writeAll(log->fd, records, log->path);
+    } catch (...) {
+        // Whatever part was written is a torn record; start over next time
+        ::close(log->fd);
+        log->fd = -1;
+        throw;
+    }
+    log->fileBytes += records.size();
+    std::chrono::milliseconds interval;
+    {
+        std::lock_guard<std::mutex> journalLock(mutex);
+        interval = syncInterval;
+    }
+    if (interval.count() == 0) {
+        ::fdatasync(log->fd);
+    } else {
+        schedule(log);
+    }
+}
+
+// Write the whole session to a temporary file and rename it over the log
+void SessionJournal::rewrite(Log& log, const std::string& id, const std::string& provider,
+                             ChatCompletion& chat) {
+    log.capture(id, provider, chat);
+    std::string data;
+    data.reserve(log.liveBytes);
+    data.append(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+    encodeConfig(data, id, log.provider, log.model, log.modelPath,
+                 log.tokenBudget, log.policy, log.pinSystem);
+    encodeSystem(data, log.systemMessage, log.summary);
+    for (const Log::Turn& turn : log.turns) {
+        encodeMessage(data, turn.message);
+    }
+
+    std::string temporary = log.path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create session log " + temporary + ": " + std::strerror(errno));
+    }
+    try {
+        writeAll(fd, data, temporary);
+        if (::fdatasync(fd) != 0 || ::rename(temporary.c_str(), log.path.c_str()) != 0) {
+            throw std::runtime_error("Failed to replace session log " + log.path + ": " + std::strerror(errno));
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+
+    if (log.fd >= 0) {
+        ::close(log.fd);
+    }
+    log.fd = fd;
+    log.fileBytes = data.size();
+}
+
+void SessionJournal::attach(const SessionSnapshot& snapshot, ChatCompletion& chat) {
+    LogPtr log = logFor(snapshot.id, snapshot.path);
+    std::lock_guard<std::mutex> lock(log->mutex);
+    int fd = ::open(snapshot.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    // Drop a torn tail so appends follow the last intact record
+    if (fd < 0 || ::ftruncate(fd, (off_t)snapshot.logBytes) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return;   // the next record() rewrites the log
+    }
+    log->capture(snapshot.id, snapshot.provider, chat);
+    if (log->fd >= 0) {
+        ::close(log->fd);
+    }
+    log->fd = fd;
+    log->fileBytes = snapshot.logBytes;
+}
+
+void SessionJournal::schedule(const LogPtr& log) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (log->queued) {
+        return;
+    }
+    log->queued = true;
+    pending.push_back(log);
+    if (!flusher.joinable() && !stopping) {
+        flusher = std::thread(&SessionJournal::flushLoop, this);
+    }
+    wake.notify_one();
+}
+
+// Group commit: the first write after a sync opens a window, and every
+// log written within it is synced once when it closes
+void SessionJournal::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        wake.wait_for(lock, syncInterval, [this] { return stopping; });
+        std::vector<LogPtr> batch;
+        batch.swap(pending);
+        for (const LogPtr& log : batch) {
+            log->queued = false;
+        }
+        lock.unlock();
+        for (const LogPtr& log : batch) {
+            syncLog(*log);
+        }
+        lock.lock();
+    }
+}
+
+// fdatasync on a duplicate, so record() can keep appending meanwhile
+void SessionJournal::syncLog(Log& log) {
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(log.mutex);
+        if (log.fd < 0) {
+            return;
+        }
+        fd = ::dup(log.fd);
+    }
+    if (fd >= 0) {
+        ::fdatasync(fd);
+        ::close(fd);
+    }
+}
+
+void SessionJournal::sync() {
+    std::vector<LogPtr> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(pending);
+        for (const LogPtr& log : batch) {
+            log->queued = false;
+        }
+    }
+    for (const LogPtr& log : batch) {
+        syncLog(*log);
+    }
+}
+
+void SessionJournal::close(const std::string& id) {
+    LogPtr log;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = logs.find(id);
+        if (it == logs.end()) {
+            return;
+        }
+        log = std::move(it->second);
+        logs.erase(it);
+    }
+    syncLog(*log);
+}
+
+bool SessionJournal::remove(const std::string& id) {
+    std::string path = pathFor(id);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = logs.find(id);
+        if (it != logs.end()) {
+            path = it->second->path;
+            logs.erase(it);
+        }
+    }
+    return ::unlink(path.c_str()) == 0;
+}
+
+void SessionJournal::setSyncInterval(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(mutex);
+    syncInterval = interval;
+}
+
+std::vector<std::string> SessionJournal::list() const {
+    std::vector<std::string> paths;
+    DIR* dir = ::opendir(directory.c_str());
+    if (!dir) {
+        return paths;
+    }
+    static const std::string SUFFIX = ".session";
+    while (struct dirent* entry = ::readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > SUFFIX.size() &&
+            name.compare(name.size() - SUFFIX.size(), SUFFIX.size(), SUFFIX) == 0) {
+            paths.push_back(directory + "/" + name);
+        }
+    }
+    ::closedir(dir);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+SessionSnapshot SessionJournal::load(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open session log " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SESSION_MAGIC)) {
+        ::close(fd);
+        throw std::runtime_error("Not a caichat session log: " + path);
+    }
+    size_t size = (size_t)st.st_size;
+    void* region = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("Failed to map session log " + path);
+    }
+    const char* data = static_cast<const char*>(region);
+    struct Unmap {
+        void* region;
+        size_t size;
+        ~Unmap() { munmap(region, size); }
+    } unmap = {region, size};
+
+    if (std::memcmp(data, SESSION_MAGIC, sizeof(SESSION_MAGIC)) != 0) {
+        throw std::runtime_error("Not a caichat session log: " + path);
+    }
+
+    SessionSnapshot snapshot;
+    snapshot.path = path;
+    bool configured = false;
+    size_t first = 0;   // turns before it were trimmed
+    uint64_t offset = sizeof(SESSION_MAGIC);
+    snapshot.logBytes = offset;
+    while (offset + sizeof(RecordHeader) <= size) {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        const char* payload = data + offset + sizeof(header);
+        if (header.length > size - offset - sizeof(header) ||
+            recordChecksum(header.type, payload, header.length) != header.checksum) {
+            break;
+        }
+
+        PayloadReader in(payload, header.length);
+        switch (header.type) {
+        case RECORD_CONFIG: {
+            std::string id = in.string();
+            std::string provider = in.string();
+            std::string model = in.string();
+            std::string modelPath = in.string();
+            uint64_t budget = in.number<uint64_t>();
+            uint32_t policy = in.number<uint32_t>();
+            uint32_t pin = in.number<uint32_t>();
+            if (in.ok && policy <= (uint32_t)TrimPolicy::SummarizeOldest) {
+                snapshot.id = std::move(id);
+                snapshot.provider = std::move(provider);
+                snapshot.model = std::move(model);
+                snapshot.modelPath = std::move(modelPath);
+                snapshot.tokenBudget = (size_t)budget;
+                snapshot.policy = (TrimPolicy)policy;
+                snapshot.pinSystem = pin != 0;
+                configured = true;
+            }
+            break;
+        }
+        case RECORD_SYSTEM: {
+            std::string systemMessage = in.string();
+            std::string summary = in.string();
+            if (in.ok) {
+                snapshot.systemMessage = std::move(systemMessage);
+                snapshot.summary = std::move(summary);
+            }
+            break;
+        }
+        case RECORD_MESSAGE: {
+            uint32_t role = in.number<uint32_t>();
+            std::string content = in.string();
+            std::string toolCallId = in.string();
+            uint32_t calls = in.number<uint32_t>();
+            if (!in.ok || role > (uint32_t)Role::Tool) {
+                break;
+            }
+            Message msg((Role)role, std::move(content));
+            msg.toolCallId = std::move(toolCallId);
+            for (uint32_t i = 0; i < calls && in.ok; ++i) {
+                ToolCall call;
+                call.id = in.string();
+                call.name = in.string();
+                call.arguments = in.string();
+                msg.toolCalls.push_back(std::move(call));
+            }
+            if (in.ok) {
+                snapshot.turns.push_back(std::move(msg));
+            }
+            break;
+        }
+        case RECORD_DROP: {
+            uint64_t count = in.number<uint64_t>();
+            if (in.ok) {
+                first += (size_t)std::min<uint64_t>(count, snapshot.turns.size() - first);
+            }
+            break;
+        }
+        default:
+            break;   // written by a newer version
+        }
+
+        offset += sizeof(header) + header.length;
+        snapshot.logBytes = offset;
+    }
+    if (!configured) {
+        throw std::runtime_error("Not a caichat session log: " + path);
+    }
+    snapshot.turns.erase(snapshot.turns.begin(), snapshot.turns.begin() + first);
+    return snapshot;
+}
+
+} // namespace caichat
+} // namespace opencog
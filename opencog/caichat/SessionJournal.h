@@ -0,0 +1,150 @@
+#ifndef SESSIONJOURNAL_H
+#define SESSIONJOURNAL_H
+
+#include "ChatCompletion.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Saved state of a chat session, as read back from its log
+ */
+struct SessionSnapshot {
+    std::string id;
+    std::string provider;     // as given to ClientFactory, e.g. "openai" or "hedge:openai,claude"
+    std::string model;
+    std::string modelPath;    // GGUF file of a ggml session
+    std::string systemMessage;
+    std::string summary;
+    size_t tokenBudget = 0;
+    TrimPolicy policy = TrimPolicy::SlidingWindow;
+    bool pinSystem = true;
+    std::vector<Message> turns;   // the conversation after the system message
+
+    std::string path;         // log it was read from
+    uint64_t logBytes = 0;    // length of its intact records
+
+    /**
+     * A session in this state, talking through client
+     */
+    std::unique_ptr<ChatCompletion> restore(std::unique_ptr<LLMClient> client) const;
+};
+
+/**
+ * Append-only binary logs of chat sessions, one file per session in a
+ * directory, for warm restarts and for moving sessions between
+ * processes.
+ *
+ * record() is called after anything that may have changed a session and
+ * appends only the difference to what its log holds: new messages, a
+ * changed system message or summary, the number of oldest turns the
+ * history trimmed, new settings. Messages still in the history are
+ * recognized by their shared text, so the check is proportional to the
+ * change. Anything else (a cleared history, a replaced message) and a
+ * log grown to more than twice its live content rewrite the log through
+ * a renamed temporary file.
+ *
+ * Appends are written at once but made durable in groups: the first
+ * write after a sync starts a window of syncInterval, after which one
+ * background thread runs fdatasync on every log written in it. A crash
+ * loses at most that window; a torn final record is dropped on load.
+ * Interval 0 syncs each write before record() returns.
+ *
+ * load() reads a log through mmap. Provider API keys are never stored;
+ * restored clients take them from the environment. The encoded request
+ * prefix is not stored either, as the first turn after a restore
+ * rebuilds it in one pass.
+ */
+class SessionJournal {
+public:
+    explicit SessionJournal(const std::string& directory,
+                            std::chrono::milliseconds syncInterval = std::chrono::milliseconds(50));
+    ~SessionJournal();
+
+    SessionJournal(const SessionJournal&) = delete;
+    SessionJournal& operator=(const SessionJournal&) = delete;
+
+    /**
+     * $CAICHAT_SESSION_DIR, else ~/.caichat/sessions
+     */
+    static std::string defaultDirectory();
+
+    const std::string& getDirectory() const { return directory; }
+
+    /**
+     * Log file of a session id
+     */
+    std::string pathFor(const std::string& id) const;
+
+    /**
+     * Bring the log of session id up to date with chat. The first call
+     * for an id writes the whole session, replacing any older log.
+     */
+    void record(const std::string& id, const std::string& provider, ChatCompletion& chat);
+
+    /**
+     * Continue the log a restored session was loaded from instead of
+     * rewriting it on the next record()
+     */
+    void attach(const SessionSnapshot& snapshot, ChatCompletion& chat);
+
+    /**
+     * Stop tracking id after syncing its log; the file stays
+     */
+    void close(const std::string& id);
+
+    /**
+     * Stop tracking id and delete its log; false if there was none
+     */
+    bool remove(const std::string& id);
+
+    /**
+     * Sync every pending write now
+     */
+    void sync();
+
+    void setSyncInterval(std::chrono::milliseconds interval);
+
+    /**
+     * Paths of the logs in the directory
+     */
+    std::vector<std::string> list() const;
+
+    /**
+     * Read a log; throws if it is not a session log
+     */
+    static SessionSnapshot load(const std::string& path);
+
+private:
+    struct Log;
+    typedef std::shared_ptr<Log> LogPtr;
+
+    LogPtr logFor(const std::string& id, const std::string& path);
+    void rewrite(Log& log, const std::string& id, const std::string& provider, ChatCompletion& chat);
+    void schedule(const LogPtr& log);
+    void flushLoop();
+    static void syncLog(Log& log);
+
+    std::string directory;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, LogPtr> logs;
+    std::vector<LogPtr> pending;   // written since the last sync
+    std::chrono::milliseconds syncInterval;
+    std::condition_variable wake;
+    std::thread flusher;
+    bool stopping;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // SESSIONJOURNAL_H
@@ -0,0 +1,148 @@
+#include "SessionRegistry.h"
+#include "SessionJournal.h"
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+SessionRegistry::Session::Session(std::unique_ptr<ChatCompletion> c, const std::string& providerSpec)
+    : chat(std::move(c)), provider(providerSpec), lastUsed(SessionRegistry::now()) {
+}
+
+SessionRegistry::Session::~Session() {
+    if (journal) {
+        journal->close(id);
+    }
+}
+
+SessionRegistry& SessionRegistry::instance() {
+    static SessionRegistry registry;
+    return registry;
+}
+
+SessionRegistry::SessionRegistry()
+    : nextId(1), idleTimeout(0), lastSweep(now()) {
+}
+
+int64_t SessionRegistry::now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SessionRegistry::Shard& SessionRegistry::shardFor(const std::string& id) {
+    return shards[std::hash<std::string>()(id) % SHARDS];
+}
+
+std::string SessionRegistry::add(const std::string& provider, std::unique_ptr<ChatCompletion> chat) {
+    // Sweep at most once per half timeout, piggybacking on session creation
+    int64_t timeout = idleTimeout.load();
+    if (timeout > 0) {
+        int64_t last = lastSweep.load();
+        int64_t current = now();
+        if (current - last > timeout / 2 && lastSweep.compare_exchange_strong(last, current)) {
+            evictIdle(std::chrono::milliseconds(timeout));
+        }
+    }
+    
+    std::string id = provider + "-" + std::to_string(nextId++);
+    SessionPtr session = std::make_shared<Session>(std::move(chat), provider);
+    session->id = id;
+    
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions[id] = std::move(session);
+    return id;
+}
+
+bool SessionRegistry::insert(const std::string& id, SessionPtr session) {
+    // Keep later generated IDs clear of a restored "<provider>-<n>"
+    size_t dash = id.rfind('-');
+    if (dash != std::string::npos && dash + 1 < id.size() &&
+        id.find_first_not_of("0123456789", dash + 1) == std::string::npos) {
+        uint64_t n = std::strtoull(id.c_str() + dash + 1, nullptr, 10);
+        uint64_t next = nextId.load();
+        while (next <= n && !nextId.compare_exchange_weak(next, n + 1)) {
+        }
+    }
+    
+    session->id = id;
+    session->lastUsed = now();
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.sessions.emplace(id, std::move(session)).second;
+}
+
+SessionRegistry::SessionPtr SessionRegistry::find(const std::string& id) {
+    SessionPtr session;
+    {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(id);
+        if (it == shard.sessions.end()) {
+            return nullptr;
+        }
+        session = it->second;
+    }
+    session->lastUsed = now();
+    return session;
+}
+
+bool SessionRegistry::close(const std::string& id) {
+    SessionPtr session;
+    {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(id);
+        if (it == shard.sessions.end()) {
+            return false;
+        }
+        session = std::move(it->second);
+        shard.sessions.erase(it);
+    }
+    // The session (and its client) is destroyed here, outside the shard lock,
+    // unless a turn still holds a reference
+    return true;
+}
+
+size_t SessionRegistry::evictIdle(std::chrono::milliseconds maxIdle) {
+    int64_t cutoff = now() - maxIdle.count();
+    size_t removed = 0;
+    
+    for (Shard& shard : shards) {
+        std::vector<SessionPtr> evicted;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end(); ) {
+                Session& session = *it->second;
+                std::unique_lock<std::mutex> busy(session.mutex, std::try_to_lock);
+                if (session.lastUsed < cutoff && busy.owns_lock()) {
+                    busy.unlock();
+                    evicted.push_back(std::move(it->second));
+                    it = shard.sessions.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        removed += evicted.size();
+    }
+    return removed;
+}
+
+void SessionRegistry::setIdleTimeout(std::chrono::milliseconds timeout) {
+    idleTimeout = timeout.count();
+}
+
+size_t SessionRegistry::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.sessions.size();
+    }
+    return total;
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,103 @@
+#ifndef SESSIONREGISTRY_H
+#define SESSIONREGISTRY_H
+
+#include "ChatCompletion.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace opencog {
+namespace caichat {
+
+class SessionJournal;
+
+/**
+ * Process-wide table of chat sessions addressed by unique IDs.
+ *
+ * The table is split into shards with their own locks, which are held
+ * only for the lookup itself. Each session carries a mutex that
+ * serializes its turns, so a slow request in one conversation never
+ * blocks another. Sessions are reference counted: closing or evicting a
+ * session while a turn is running lets that turn finish normally.
+ *
+ * A session with a journal has its log closed, but kept, when the last
+ * reference goes.
+ */
+class SessionRegistry {
+public:
+    struct Session {
+        Session(std::unique_ptr<ChatCompletion> c, const std::string& providerSpec);
+        ~Session();
+
+        std::mutex mutex;   // held for the duration of a turn
+        std::unique_ptr<ChatCompletion> chat;
+        std::string id;
+        std::string provider;   // as given to ClientFactory
+        std::shared_ptr<SessionJournal> journal;   // logs each change; guarded by mutex
+        std::atomic<int64_t> lastUsed;   // steady clock, milliseconds
+    };
+    typedef std::shared_ptr<Session> SessionPtr;
+
+    static SessionRegistry& instance();
+
+    /**
+     * Register a session and return its new ID ("<provider>-<n>")
+     */
+    std::string add(const std::string& provider, std::unique_ptr<ChatCompletion> chat);
+
+    /**
+     * Register a session under a given ID, e.g. one restored from a log;
+     * false if the ID is taken. IDs from add() are numbered after it.
+     */
+    bool insert(const std::string& id, SessionPtr session);
+
+    /**
+     * Session by ID, or nullptr. Marks the session as used.
+     */
+    SessionPtr find(const std::string& id);
+
+    /**
+     * Remove a session; returns false if it did not exist
+     */
+    bool close(const std::string& id);
+
+    /**
+     * Remove sessions unused for longer than maxIdle, skipping any with a
+     * turn in progress. Returns the number removed.
+     */
+    size_t evictIdle(std::chrono::milliseconds maxIdle);
+
+    /**
+     * Evict idle sessions automatically as new ones are added; 0 disables
+     * (the default)
+     */
+    void setIdleTimeout(std::chrono::milliseconds timeout);
+
+    size_t size() const;
+
+private:
+    SessionRegistry();
+
+    static const size_t SHARDS = 16;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, SessionPtr> sessions;
+    };
+
+    Shard& shardFor(const std::string& id);
+    static int64_t now();
+
+    Shard shards[SHARDS];
+    std::atomic<uint64_t> nextId;
+    std::atomic<int64_t> idleTimeout;   // milliseconds
+    std::atomic<int64_t> lastSweep;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // SESSIONREGISTRY_H
@@ -0,0 +1,53 @@
+#include "Text.h"
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+
+namespace opencog {
+namespace caichat {
+
+Text::Text(std::string text) {
+    if (!text.empty()) {
+        buffer = std::make_shared<const std::string>(std::move(text));
+    }
+}
+
+Text::Text(const char* text) : Text(std::string(text)) {
+}
+
+const std::string& Text::none() {
+    static const std::string empty;
+    return empty;
+}
+
+// Set elements never move, so their addresses stay valid. Never freed,
+// so names outlive static destructors that may still use them.
+struct NameTable {
+    std::shared_timed_mutex mutex;
+    std::unordered_set<std::string> names;
+};
+
+static const std::string* intern(const std::string& name) {
+    static NameTable* table = new NameTable();
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(table->mutex);
+        auto it = table->names.find(name);
+        if (it != table->names.end()) {
+            return &*it;
+        }
+    }
+    std::unique_lock<std::shared_timed_mutex> lock(table->mutex);
+    return &*table->names.insert(name).first;
+}
+
+Name::Name() : Name(std::string()) {
+}
+
+Name::Name(const std::string& name) : text(intern(name)) {
+}
+
+Name::Name(const char* name) : Name(std::string(name)) {
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,61 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <memory>
+#include <string>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Immutable, reference-counted text. Copies share one buffer, so message
+ * content is stored once however many histories, request copies and
+ * replies hold it; a std::string moved in is adopted without copying.
+ * Safe to share between threads.
+ */
+class Text {
+public:
+    Text() {}
+    Text(std::string text);
+    Text(const char* text);
+
+    const std::string& str() const { return buffer ? *buffer : none(); }
+    operator const std::string&() const { return str(); }
+
+    const char* c_str() const { return str().c_str(); }
+    size_t size() const { return buffer ? buffer->size() : 0; }
+    bool empty() const { return !buffer; }
+
+private:
+    static const std::string& none();
+
+    std::shared_ptr<const std::string> buffer;   // null for ""
+};
+
+/**
+ * Interned name, e.g. of a provider or model: one immutable copy per
+ * distinct value for the life of the process. Copies are pointer copies
+ * and comparisons pointer comparisons; order is by identity, not text.
+ */
+class Name {
+public:
+    Name();
+    Name(const std::string& name);
+    Name(const char* name);
+
+    const std::string& str() const { return *text; }
+    operator const std::string&() const { return *text; }
+    bool empty() const { return text->empty(); }
+
+    bool operator==(const Name& other) const { return text == other.text; }
+    bool operator!=(const Name& other) const { return text != other.text; }
+    bool operator<(const Name& other) const { return text < other.text; }
+
+private:
+    const std::string* text;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // TEXT_H
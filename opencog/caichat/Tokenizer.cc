@@ -0,0 +1,708 @@
+#include "Tokenizer.h"
+#include "ConversationHistory.h"
+#include "Hash.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace opencog {
+namespace caichat {
+
+const size_t Tokenizer::MESSAGE_TOKENS;
+const size_t Tokenizer::REPLY_TOKENS;
+const uint32_t Tokenizer::NO_RANK;
+
+// Pieces longer than this are merged in slices, keeping the quadratic
+// merge loop bounded on long runs of whitespace or symbols
+static const size_t MAX_PIECE = 512;
+
+namespace {
+
+// Read-only mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : data(nullptr), size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open vocabulary " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat vocabulary " + path);
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map vocabulary " + path);
+            }
+            data = static_cast<const char*>(map);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data;
+    size_t size;
+};
+
+enum class CharClass : uint8_t { Letter, Number, Space, Newline, Other };
+
+// Approximates the Unicode \p{L}, \p{N} and \s classes: ASCII exactly,
+// common punctuation, symbol, digit and space blocks beyond it, and
+// every other code point as a letter
+CharClass classify(uint32_t c) {
+    if (c < 0x80) {
+        if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+            return CharClass::Letter;
+        }
+        if (c >= '0' && c <= '9') {
+            return CharClass::Number;
+        }
+        if (c == '\n' || c == '\r') {
+            return CharClass::Newline;
+        }
+        if (c == ' ' || c == '\t' || c == '\v' || c == '\f') {
+            return CharClass::Space;
+        }
+        return CharClass::Other;
+    }
+    if (c == 0x85 || c == 0xa0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200a) ||
+        c == 0x2028 || c == 0x2029 || c == 0x202f || c == 0x205f || c == 0x3000) {
+        return CharClass::Space;
+    }
+    if ((c >= 0x660 && c <= 0x669) || (c >= 0x6f0 && c <= 0x6f9) || (c >= 0x966 && c <= 0x96f) ||
+        (c >= 0xff10 && c <= 0xff19) || c == 0xb2 || c == 0xb3 || c == 0xb9 ||
+        (c >= 0xbc && c <= 0xbe) || (c >= 0x2070 && c <= 0x2089) || (c >= 0x2150 && c <= 0x2189) ||
+        (c >= 0x2460 && c <= 0x249b)) {
+        return CharClass::Number;
+    }
+    if ((c < 0xc0 && c != 0xaa && c != 0xb5 && c != 0xba) || c == 0xd7 || c == 0xf7 ||
+        (c >= 0x300 && c <= 0x36f) || (c >= 0x2000 && c <= 0x2bff) ||
+        (c >= 0x3000 && c <= 0x303f) || (c >= 0xfe00 && c <= 0xfe0f) ||
+        (c >= 0xfe30 && c <= 0xfe4f) || (c >= 0xff00 && c <= 0xff0f) ||
+        (c >= 0xff1a && c <= 0xff20) || (c >= 0xff3b && c <= 0xff40) ||
+        (c >= 0xff5b && c <= 0xff65) || (c >= 0x1f000 && c <= 0x1faff)) {
+        return CharClass::Other;
+    }
+    return CharClass::Letter;
+}
+
+// Code point at s[i]; invalid UTF-8 reads as one byte of punctuation
+uint32_t decodeAt(const unsigned char* s, size_t n, size_t i, size_t& length) {
+    unsigned char b = s[i];
+    length = 1;
+    if (b < 0x80) {
+        return b;
+    }
+    size_t extra = b >= 0xf8 ? 0 : b >= 0xf0 ? 3 : b >= 0xe0 ? 2 : b >= 0xc0 ? 1 : 0;
+    if (extra == 0 || i + extra >= n) {
+        return 0xfffd;
+    }
+    uint32_t c = b & (0x3f >> extra);
+    for (size_t k = 1; k <= extra; ++k) {
+        if ((s[i + k] & 0xc0) != 0x80) {
+            return 0xfffd;
+        }
+        c = (c << 6) | (s[i + k] & 0x3f);
+    }
+    length = extra + 1;
+    return c;
+}
+
+struct Scanner {
+    const unsigned char* s;
+    size_t n;
+
+    CharClass classAt(size_t i) const {
+        size_t length;
+        return i < n ? classify(decodeAt(s, n, i, length)) : CharClass::Newline;
+    }
+
+    size_t skip(size_t i, CharClass a, CharClass b, size_t limit = SIZE_MAX) const {
+        for (size_t count = 0; i < n && count < limit; ++count) {
+            size_t length;
+            CharClass k = classify(decodeAt(s, n, i, length));
+            if (k != a && k != b) {
+                break;
+            }
+            i += length;
+        }
+        return i;
+    }
+
+    // End of the piece starting at i, following cl100k_base:
+    //   's|'t|'re|'ve|'m|'ll|'d  [^\r\n\p{L}\p{N}]?\p{L}+  \p{N}{1,3}
+    //    ?[^\s\p{L}\p{N}]+[\r\n]*  \s*[\r\n]+  \s+(?!\S)  \s+
+    size_t next(size_t i) const {
+        size_t length;
+        uint32_t c = decodeAt(s, n, i, length);
+        CharClass k = classify(c);
+
+        if (c == '\'' && i + 1 < n) {
+            char a = (char)(s[i + 1] | 0x20);
+            char b = i + 2 < n ? (char)(s[i + 2] | 0x20) : 0;
+            if (a == 's' || a == 't' || a == 'm' || a == 'd') {
+                return i + 2;
+            }
+            if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) {
+                return i + 3;
+            }
+        }
+        if (k == CharClass::Letter) {
+            return skip(i, CharClass::Letter, CharClass::Letter);
+        }
+        if ((k == CharClass::Space || k == CharClass::Other) &&
+            classAt(i + length) == CharClass::Letter) {
+            return skip(i + length, CharClass::Letter, CharClass::Letter);
+        }
+        if (k == CharClass::Number) {
+            return skip(i, CharClass::Number, CharClass::Number, 3);
+        }
+        size_t j = c == ' ' && classAt(i + 1) == CharClass::Other ? i + 1 : i;
+        if (classAt(j) == CharClass::Other) {
+            j = skip(j, CharClass::Other, CharClass::Other);
+            return skip(j, CharClass::Newline, CharClass::Newline);
+        }
+
+        // Whitespace: up to its last line break, else all of it but the
+        // space that leads the next piece
+        size_t end = i;
+        size_t lastBreak = SIZE_MAX;
+        while (end < n) {
+            size_t step;
+            CharClass w = classify(decodeAt(s, n, end, step));
+            if (w != CharClass::Space && w != CharClass::Newline) {
+                break;
+            }
+            if (w == CharClass::Newline) {
+                lastBreak = end;
+            }
+            end += step;
+        }
+        if (lastBreak != SIZE_MAX) {
+            return lastBreak + 1;
+        }
+        if (end == n || end - i == 1) {
+            return end;
+        }
+        size_t last = end - 1;
+        while (last > i && (s[last] & 0xc0) == 0x80) {
+            --last;
+        }
+        return last > i ? last : end;
+    }
+};
+
+struct Base64Table {
+    int8_t values[256];
+
+    Base64Table() {
+        std::memset(values, -1, sizeof(values));
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int k = 0; k < 64; ++k) {
+            values[(unsigned char)alphabet[k]] = (int8_t)k;
+        }
+    }
+};
+
+void appendBase64(std::string& out, const char* p, size_t n) {
+    static const Base64Table table;
+    uint32_t bits = 0;
+    int count = 0;
+    for (size_t k = 0; k < n && p[k] != '='; ++k) {
+        int v = table.values[(unsigned char)p[k]];
+        if (v < 0) {
+            throw std::runtime_error("Invalid base64 in tiktoken vocabulary");
+        }
+        bits = (bits << 6) | (uint32_t)v;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out += (char)((bits >> count) & 0xff);
+        }
+    }
+}
+
+// GGUF reader over the mapping; every read checks the bounds
+struct GGUFReader {
+    const char* p;
+    const char* end;
+
+    void need(size_t n) const {
+        if ((size_t)(end - p) < n) {
+            throw std::runtime_error("Truncated GGUF file");
+        }
+    }
+
+    template <typename T>
+    T read() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::pair<const char*, size_t> string() {
+        uint64_t length = read<uint64_t>();
+        need(length);
+        std::pair<const char*, size_t> s(p, (size_t)length);
+        p += length;
+        return s;
+    }
+
+    // Skip a value of GGUF type
+    void skip(uint32_t type) {
+        static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 1, 0, 0, 8, 8, 8};
+        if (type == 8) {
+            string();
+        } else if (type == 9) {
+            uint32_t elementType = read<uint32_t>();
+            uint64_t count = read<uint64_t>();
+            if (elementType != 8 && elementType != 9 && elementType < 13) {
+                need(count * sizes[elementType]);
+                p += count * sizes[elementType];
+                return;
+            }
+            for (uint64_t k = 0; k < count; ++k) {
+                skip(elementType);
+            }
+        } else if (type < 13) {
+            need(sizes[type]);
+            p += sizes[type];
+        } else {
+            throw std::runtime_error("Unknown GGUF value type " + std::to_string(type));
+        }
+    }
+
+    std::vector<std::pair<const char*, size_t>> strings() {
+        uint32_t elementType = read<uint32_t>();
+        uint64_t count = read<uint64_t>();
+        if (elementType != 8) {
+            throw std::runtime_error("Expected a GGUF string array");
+        }
+        std::vector<std::pair<const char*, size_t>> values;
+        values.reserve((size_t)std::min<uint64_t>(count, (uint64_t)(end - p) / 8));
+        for (uint64_t k = 0; k < count; ++k) {
+            values.push_back(string());
+        }
+        return values;
+    }
+};
+
+// GPT-2 spells token bytes as printable code points: bytes that are
+// printable stand for themselves, the rest map to 256 + n in byte order
+struct GPT2Decoder {
+    int16_t bytes[324];
+
+    GPT2Decoder() {
+        std::memset(bytes, -1, sizeof(bytes));
+        int next = 256;
+        for (int b = 0; b < 256; ++b) {
+            bool printable = (b >= 33 && b <= 126) || (b >= 161 && b <= 172) || (b >= 174 && b <= 255);
+            bytes[printable ? b : next++] = (int16_t)b;
+        }
+    }
+};
+
+bool gpt2Bytes(const char* text, size_t length, std::string& out) {
+    static const GPT2Decoder decoder;
+    out.clear();
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(text);
+    for (size_t i = 0; i < length; ) {
+        size_t step;
+        uint32_t c = decodeAt(s, length, i, step);
+        if (c >= 324 || decoder.bytes[c] < 0) {
+            return false;
+        }
+        out += (char)decoder.bytes[c];
+        i += step;
+    }
+    return true;
+}
+
+} // namespace
+
+Tokenizer::Tokenizer() {
+    std::memset(byteIds, 0, sizeof(byteIds));
+}
+
+const Tokenizer::Token* Tokenizer::find(const char* bytes, size_t length) const {
+    if (slots.empty()) {
+        return nullptr;
+    }
+    uint64_t hash = hashBytes(bytes, length);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i] != NO_RANK; i = (i + 1) & mask) {
+        const Token& token = tokens[slots[i]];
+        if (token.hash == hash && token.length == length &&
+            std::memcmp(pool.data() + token.offset, bytes, length) == 0) {
+            return &token;
+        }
+    }
+    return nullptr;
+}
+
+void Tokenizer::add(const std::string& bytes, uint32_t id, uint32_t rank) {
+    if (bytes.empty() || find(bytes.data(), bytes.size())) {
+        return;   // the first of duplicate spellings wins
+    }
+    tokens.push_back({hashBytes(bytes.data(), bytes.size()), (uint32_t)pool.size(),
+                      (uint32_t)bytes.size(), id, rank});
+    pool += bytes;
+    if (tokens.size() * 2 > slots.size()) {
+        buildIndex();
+    } else {
+        size_t mask = slots.size() - 1;
+        size_t i = tokens.back().hash & mask;
+        while (slots[i] != NO_RANK) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = (uint32_t)(tokens.size() - 1);
+    }
+}
+
+// Rebuild the index at twice the tokens, at most half full
+void Tokenizer::buildIndex() {
+    size_t size = 1024;
+    while (size < tokens.size() * 4) {
+        size *= 2;
+    }
+    slots.assign(size, NO_RANK);
+    size_t mask = size - 1;
+    for (uint32_t t = 0; t < tokens.size(); ++t) {
+        size_t i = tokens[t].hash & mask;
+        while (slots[i] != NO_RANK) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = t;
+    }
+}
+
+std::shared_ptr<const Tokenizer> Tokenizer::load(const std::string& path) {
+    MappedFile file(path);
+    try {
+        if (file.size >= 4 && std::memcmp(file.data, "GGUF", 4) == 0) {
+            return loadGGUF(file.data, file.size);
+        }
+        return loadTiktoken(file.data, file.size);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
+
+std::shared_ptr<const Tokenizer> Tokenizer::loadTiktoken(const char* data, size_t size) {
+    std::shared_ptr<Tokenizer> tokenizer(new Tokenizer());
+    std::string bytes;
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', (size_t)(end - p)));
+        if (!eol) {
+            eol = end;
+        }
+        const char* space = static_cast<const char*>(std::memchr(p, ' ', (size_t)(eol - p)));
+        if (space) {
+            uint64_t rank = 0;
+            const char* digit = space + 1;
+            for (; digit < eol && *digit >= '0' && *digit <= '9'; ++digit) {
+                rank = rank * 10 + (uint64_t)(*digit - '0');
+            }
+            if (digit == space + 1 || rank >= NO_RANK) {
+                throw std::runtime_error("Invalid rank in tiktoken vocabulary");
+            }
+            bytes.clear();
+            appendBase64(bytes, p, (size_t)(space - p));
+            tokenizer->add(bytes, (uint32_t)rank, (uint32_t)rank);
+        }
+        p = eol + 1;
+    }
+    for (int b = 0; b < 256; ++b) {
+        char c = (char)b;
+        const Token* token = tokenizer->find(&c, 1);
+        if (!token) {
+            throw std::runtime_error("Vocabulary lacks byte " + std::to_string(b));
+        }
+        tokenizer->byteIds[b] = token->id;
+    }
+    return tokenizer;
+}
+
+std::shared_ptr<const Tokenizer> Tokenizer::loadGGUF(const char* data, size_t size) {
+    GGUFReader reader{data + 4, data + size};
+    uint32_t version = reader.read<uint32_t>();
+    if (version < 2) {
+        throw std::runtime_error("GGUF version " + std::to_string(version) + " is not supported");
+    }
+    reader.read<uint64_t>();   // tensor count
+    uint64_t pairs = reader.read<uint64_t>();
+
+    std::string model;
+    std::vector<std::pair<const char*, size_t>> vocabulary;
+    std::vector<std::pair<const char*, size_t>> merges;
+    for (uint64_t k = 0; k < pairs; ++k) {
+        auto key = reader.string();
+        std::string name(key.first, key.second);
+        uint32_t type = reader.read<uint32_t>();
+        if (name == "tokenizer.ggml.model" && type == 8) {
+            auto value = reader.string();
+            model.assign(value.first, value.second);
+        } else if (name == "tokenizer.ggml.tokens" && type == 9) {
+            vocabulary = reader.strings();
+        } else if (name == "tokenizer.ggml.merges" && type == 9) {
+            merges = reader.strings();
+        } else {
+            reader.skip(type);
+        }
+    }
+    if (model != "gpt2") {
+        throw std::runtime_error("Tokenizer model '" + model + "' is not byte-level BPE");
+    }
+    if (vocabulary.empty() || vocabulary.size() >= NO_RANK) {
+        throw std::runtime_error("GGUF file has no usable vocabulary");
+    }
+
+    std::shared_ptr<Tokenizer> tokenizer(new Tokenizer());
+    std::string bytes;
+    for (size_t id = 0; id < vocabulary.size(); ++id) {
+        // Tokens that do not spell bytes are control tokens; never merged into
+        if (gpt2Bytes(vocabulary[id].first, vocabulary[id].second, bytes)) {
+            tokenizer->add(bytes, (uint32_t)id, bytes.size() == 1 ? 0 : NO_RANK);
+        }
+    }
+    // A merge's rank is its position; the token it produces takes it
+    std::string left;
+    std::string right;
+    for (size_t m = 0; m < merges.size(); ++m) {
+        const char* text = merges[m].first;
+        size_t length = merges[m].second;
+        const char* space = static_cast<const char*>(std::memchr(text, ' ', length));
+        if (!space || !gpt2Bytes(text, (size_t)(space - text), left) ||
+            !gpt2Bytes(space + 1, (size_t)(text + length - space - 1), right)) {
+            continue;
+        }
+        left += right;
+        Token* token = const_cast<Token*>(tokenizer->find(left.data(), left.size()));
+        if (token && token->rank == NO_RANK) {
+            token->rank = (uint32_t)m;
+        }
+    }
+    for (int b = 0; b < 256; ++b) {
+        char c = (char)b;
+        const Token* token = tokenizer->find(&c, 1);
+        tokenizer->byteIds[b] = token ? token->id : 0;
+    }
+    return tokenizer;
+}
+
+template <typename Emit>
+size_t Tokenizer::mergePiece(const char* piece, size_t length, Emit emit) const {
+    if (length == 1) {
+        emit(byteIds[(unsigned char)piece[0]]);
+        return 1;
+    }
+    const Token* whole = find(piece, length);
+    if (whole && whole->rank != NO_RANK) {
+        emit(whole->id);
+        return 1;
+    }
+
+    // Byte pair merging as in tiktoken: parts[i] is the start of a part and
+    // the rank of joining it with the next one; the lowest rank merges first
+    auto rankOf = [&](size_t start, size_t end) {
+        const Token* token = find(piece + start, end - start);
+        return token ? token->rank : NO_RANK;
+    };
+    static thread_local std::vector<std::pair<size_t, uint32_t>> parts;
+    parts.clear();
+    for (size_t i = 0; i + 1 < length; ++i) {
+        parts.emplace_back(i, rankOf(i, i + 2));
+    }
+    parts.emplace_back(length - 1, NO_RANK);
+    parts.emplace_back(length, NO_RANK);
+
+    auto joined = [&](size_t i) {
+        return i + 3 < parts.size() ? rankOf(parts[i].first, parts[i + 3].first) : NO_RANK;
+    };
+    for (;;) {
+        uint32_t best = NO_RANK;
+        size_t at = 0;
+        for (size_t i = 0; i + 1 < parts.size(); ++i) {
+            if (parts[i].second < best) {
+                best = parts[i].second;
+                at = i;
+            }
+        }
+        if (best == NO_RANK) {
+            break;
+        }
+        if (at > 0) {
+            parts[at - 1].second = joined(at - 1);
+        }
+        parts[at].second = joined(at);
+        parts.erase(parts.begin() + (long)at + 1);
+    }
+
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+        size_t start = parts[i].first;
+        size_t end = parts[i + 1].first;
+        const Token* token = end - start == 1 ? nullptr : find(piece + start, end - start);
+        emit(token ? token->id : byteIds[(unsigned char)piece[start]]);
+    }
+    return parts.size() - 1;
+}
+
+template <typename Emit>
+size_t Tokenizer::run(const char* text, size_t length, Emit emit) const {
+    Scanner scanner{reinterpret_cast<const unsigned char*>(text), length};
+    size_t total = 0;
+    for (size_t i = 0; i < length; ) {
+        size_t end = scanner.next(i);
+        while (end - i > MAX_PIECE) {
+            // Cut on a character boundary
+            size_t cut = i + MAX_PIECE;
+            while (cut > i + 1 && (text[cut] & 0xc0) == 0x80) {
+                --cut;
+            }
+            total += mergePiece(text + i, cut - i, emit);
+            i = cut;
+        }
+        total += mergePiece(text + i, end - i, emit);
+        i = end;
+    }
+    return total;
+}
+
+size_t Tokenizer::count(const char* text, size_t length) const {
+    return run(text, length, [](uint32_t) {});
+}
+
+void Tokenizer::encode(const std::string& text, std::vector<uint32_t>& ids) const {
+    run(text.data(), text.size(), [&ids](uint32_t id) { ids.push_back(id); });
+}
+
+namespace {
+
+// Vocabularies by model-name prefix, and loaded tokenizers by path
+// (nullptr for files that could not be loaded)
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::string> vocabularies;
+    std::map<std::string, std::shared_ptr<const Tokenizer>> loaded;
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+bool startsWith(const std::string& text, const char* prefix) {
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+// tiktoken encoding of an OpenAI model family
+const char* encodingFor(const std::string& model) {
+    static const char* const o200k[] = {"gpt-4o", "gpt-4.1", "gpt-4.5", "gpt-5", "chatgpt-4o",
+                                        "o1", "o3", "o4"};
+    for (const char* prefix : o200k) {
+        if (startsWith(model, prefix)) {
+            return "o200k_base";
+        }
+    }
+    return "cl100k_base";
+}
+
+std::string tokenizerDirectory() {
+    const char* dir = std::getenv("CAICHAT_TOKENIZER_DIR");
+    if (dir && *dir) {
+        return dir;
+    }
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.caichat/tokenizers";
+}
+
+} // namespace
+
+std::shared_ptr<const Tokenizer> Tokenizer::forModel(const std::string& model) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::string path;
+    size_t matched = 0;
+    for (const auto& entry : r.vocabularies) {
+        if (startsWith(model, entry.first.c_str()) && (path.empty() || entry.first.size() > matched)) {
+            path = entry.second;
+            matched = entry.first.size();
+        }
+    }
+    if (path.empty()) {
+        if (model.size() > 5 && model.compare(model.size() - 5, 5, ".gguf") == 0) {
+            path = model;
+        } else {
+            path = tokenizerDirectory() + "/" + encodingFor(model) + ".tiktoken";
+        }
+    }
+
+    auto it = r.loaded.find(path);
+    if (it != r.loaded.end()) {
+        return it->second;
+    }
+    std::shared_ptr<const Tokenizer> tokenizer;
+    try {
+        tokenizer = load(path);
+    } catch (const std::exception&) {
+        // Missing or unusable: callers fall back to estimates
+    }
+    r.loaded[path] = tokenizer;
+    return tokenizer;
+}
+
+void Tokenizer::setVocabulary(const std::string& prefix, const std::string& path) {
+    std::shared_ptr<const Tokenizer> tokenizer = load(path);
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.vocabularies[prefix] = path;
+    r.loaded[path] = tokenizer;
+}
+
+size_t countTokens(const std::vector<Message>& messages, const std::string& model) {
+    std::shared_ptr<const Tokenizer> tokenizer = Tokenizer::forModel(model);
+    size_t total = 0;
+    for (const Message& msg : messages) {
+        if (!tokenizer) {
+            total += ConversationHistory::estimateTokens(msg.content);
+            continue;
+        }
+        total += Tokenizer::MESSAGE_TOKENS + tokenizer->count(msg.content);
+        for (const ToolCall& call : msg.toolCalls) {
+            total += tokenizer->count(call.name) + tokenizer->count(call.arguments);
+        }
+    }
+    return total + (tokenizer ? Tokenizer::REPLY_TOKENS : 1);
+}
+
+size_t countTokens(const std::string& text, const std::string& model) {
+    std::shared_ptr<const Tokenizer> tokenizer = Tokenizer::forModel(model);
+    return tokenizer ? tokenizer->count(text) : (text.size() + 3) / 4;
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,122 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include "LLMClient.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Byte-level BPE tokenizer for counting the tokens of requests.
+ *
+ * Vocabularies load from tiktoken files ("<base64 token> <rank>" per
+ * line, e.g. cl100k_base.tiktoken) or from the vocabulary and merges of
+ * a GGUF model using the gpt2 tokenizer; both files are read through
+ * mmap. Token bytes sit back to back in one pool and are found through
+ * an open-addressing table keyed by their hash, so rank lookups during
+ * merging neither allocate nor compare strings beyond a hash match.
+ *
+ * Text is first split with the cl100k_base pre-tokenization rules
+ * (contractions, letter runs, up to three digits, punctuation runs,
+ * whitespace), evaluated by hand over UTF-8 rather than by a regex
+ * engine. Pieces found whole in the vocabulary cost one lookup; others
+ * are merged pair by pair in rank order. Encodings whose own rules
+ * differ, such as o200k_base, count within a few percent.
+ *
+ * A loaded tokenizer is immutable and may be shared between threads.
+ */
+class Tokenizer {
+public:
+    /**
+     * Framing tokens around each chat message, and before the reply
+     */
+    static const size_t MESSAGE_TOKENS = 3;
+    static const size_t REPLY_TOKENS = 3;
+
+    /**
+     * Load a tiktoken or GGUF file, told apart by the GGUF magic
+     */
+    static std::shared_ptr<const Tokenizer> load(const std::string& path);
+
+    /**
+     * Tokenizer for a model, loaded once and shared: the vocabulary set
+     * for the longest matching model-name prefix, the model file itself
+     * for names ending in ".gguf", else the tiktoken encoding of the
+     * model family from $CAICHAT_TOKENIZER_DIR (default
+     * ~/.caichat/tokenizers). Claude models use cl100k_base as the
+     * nearest public vocabulary. nullptr when no file is available.
+     */
+    static std::shared_ptr<const Tokenizer> forModel(const std::string& model);
+
+    /**
+     * Use the vocabulary at path for models whose names start with
+     * prefix ("" matches every model)
+     */
+    static void setVocabulary(const std::string& prefix, const std::string& path);
+
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
+    size_t count(const char* text, size_t length) const;
+    size_t count(const std::string& text) const { return count(text.data(), text.size()); }
+
+    /**
+     * Append the token ids of text
+     */
+    void encode(const std::string& text, std::vector<uint32_t>& ids) const;
+
+    size_t vocabularySize() const { return tokens.size(); }
+
+private:
+    static const uint32_t NO_RANK = 0xffffffffu;
+
+    struct Token {
+        uint64_t hash;
+        uint32_t offset;   // into pool
+        uint32_t length;
+        uint32_t id;
+        uint32_t rank;     // merge priority; NO_RANK if no merge produces it
+    };
+
+    Tokenizer();
+
+    static std::shared_ptr<const Tokenizer> loadTiktoken(const char* data, size_t size);
+    static std::shared_ptr<const Tokenizer> loadGGUF(const char* data, size_t size);
+
+    void add(const std::string& bytes, uint32_t id, uint32_t rank);
+    void buildIndex();
+    const Token* find(const char* bytes, size_t length) const;
+
+    // Calls emit(id) for each token of one pre-tokenized piece; returns
+    // the number of tokens
+    template <typename Emit>
+    size_t mergePiece(const char* piece, size_t length, Emit emit) const;
+    template <typename Emit>
+    size_t run(const char* text, size_t length, Emit emit) const;
+
+    std::string pool;
+    std::vector<Token> tokens;
+    std::vector<uint32_t> slots;   // indexes into tokens, NO_RANK when empty
+    uint32_t byteIds[256];
+};
+
+/**
+ * Tokens of a chat request to model, framing included. Uses the model's
+ * tokenizer when its vocabulary is available and
+ * ConversationHistory::estimateTokens otherwise.
+ */
+size_t countTokens(const std::vector<Message>& messages, const std::string& model = "");
+
+/**
+ * Tokens of a plain text, without framing
+ */
+size_t countTokens(const std::string& text, const std::string& model = "");
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // TOKENIZER_H
@@ -0,0 +1,358 @@
+#include "ToolExecutor.h"
+#include "JSONScanner.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace opencog {
+namespace caichat {
+
+// Script languages and their interpreters, as in Argcfile.sh
+static const char* const LANGUAGES[][2] = {
+    {"sh", "bash"},
+    {"js", "node"},
+    {"py", "python"},
+};
+
+static bool fileExists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+ToolExecutor::ToolExecutor(const std::string& root)
+    : ToolExecutor(root, Options()) {
+}
+
+ToolExecutor::ToolExecutor(const std::string& root, const Options& opts)
+    : rootDir(root), options(opts) {
+    if (rootDir.empty()) {
+        const char* envRoot = std::getenv("LLM_ROOT_DIR");
+        rootDir = (envRoot && *envRoot) ? envRoot : ".";
+    }
+}
+
+size_t ToolExecutor::loadTools() {
+    return loadDeclarations(rootDir + "/functions.json", "");
+}
+
+size_t ToolExecutor::loadAgent(const std::string& agent) {
+    return loadDeclarations(rootDir + "/agents/" + agent + "/functions.json", agent);
+}
+
+// Command line of a declared function, or empty if its script is missing
+std::vector<std::string> ToolExecutor::commandFor(const std::string& name,
+                                                  const std::string& agent) const {
+    for (const auto& language : LANGUAGES) {
+        std::string lang = language[0];
+        if (!agent.empty()) {
+            if (fileExists(rootDir + "/agents/" + agent + "/tools." + lang)) {
+                return {language[1], rootDir + "/scripts/run-agent." + lang, agent, name};
+            }
+        } else if (fileExists(rootDir + "/tools/" + name + "." + lang)) {
+            return {language[1], rootDir + "/scripts/run-tool." + lang, name};
+        }
+    }
+    return {};
+}
+
+size_t ToolExecutor::loadDeclarations(const std::string& file, const std::string& agent) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to read " + file + " (run `argc build` first)");
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    JSONValue root(text);
+    if (root.type() != JSONValue::Array) {
+        throw std::runtime_error("Invalid function declarations in " + file);
+    }
+    std::vector<Tool> loaded;
+    root.forEach([&](const JSONValue& item) {
+        Tool tool;
+        item.getString({"name"}, tool.definition.name);
+        item.getString({"description"}, tool.definition.description);
+        tool.definition.parameters = item.find({"parameters"}).raw();
+        bool agentFunction = false;
+        item.find({"agent"}).asBool(agentFunction);
+        if (!tool.definition.name.empty()) {
+            tool.argv = commandFor(tool.definition.name, agentFunction ? agent : "");
+            loaded.push_back(std::move(tool));
+        }
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Tool& tool : loaded) {
+        std::string name = tool.definition.name;
+        tools[name] = std::move(tool);
+    }
+    return loaded.size();
+}
+
+void ToolExecutor::addTool(const ToolDefinition& definition, const std::vector<std::string>& argv) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Tool& tool = tools[definition.name];
+    tool.definition = definition;
+    tool.argv = argv;
+}
+
+std::vector<ToolDefinition> ToolExecutor::getDefinitions(const std::vector<std::string>& names) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ToolDefinition> definitions;
+    if (names.empty()) {
+        for (const auto& entry : tools) {
+            definitions.push_back(entry.second.definition);
+        }
+        return definitions;
+    }
+    for (const std::string& name : names) {
+        auto it = tools.find(name);
+        if (it == tools.end()) {
+            throw std::runtime_error("Unknown tool: " + name);
+        }
+        definitions.push_back(it->second.definition);
+    }
+    return definitions;
+}
+
+bool ToolExecutor::hasTool(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tools.count(name) != 0;
+}
+
+void ToolExecutor::setTimeout(const std::string& name, unsigned timeoutMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timeouts[name] = timeoutMs;
+}
+
+void ToolExecutor::setOptions(const Options& opts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    options = opts;
+}
+
+ToolExecutor::Options ToolExecutor::getOptions() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return options;
+}
+
+// Environment of a tool process: ours, with output sent to stdout
+static std::vector<std::string> toolEnvironment() {
+    std::vector<std::string> env;
+    for (char** var = environ; var && *var; ++var) {
+        if (std::strncmp(*var, "LLM_OUTPUT=", 11) != 0) {
+            env.push_back(*var);
+        }
+    }
+    env.push_back("LLM_OUTPUT=/dev/stdout");
+    return env;
+}
+
+static std::vector<char*> pointers(std::vector<std::string>& strings) {
+    std::vector<char*> result;
+    for (std::string& s : strings) {
+        result.push_back(&s[0]);
+    }
+    result.push_back(nullptr);
+    return result;
+}
+
+ToolResult ToolExecutor::run(const ToolCall& call) const {
+    ToolResult result;
+    result.callId = call.id;
+    result.name = call.name;
+
+    std::vector<std::string> argv;
+    unsigned timeoutMs;
+    size_t maxOutput;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tools.find(call.name);
+        if (it == tools.end()) {
+            result.output = "Unknown tool: " + call.name;
+            return result;
+        }
+        argv = it->second.argv;
+        auto timeout = timeouts.find(call.name);
+        timeoutMs = timeout != timeouts.end() ? timeout->second : options.timeoutMs;
+        maxOutput = options.maxOutputBytes;
+    }
+    if (argv.empty()) {
+        result.output = "No script found for tool " + call.name;
+        return result;
+    }
+    argv.push_back(call.arguments.empty() ? "{}" : call.arguments);
+
+    // Close-on-exec pipes, so children spawned concurrently do not hold
+    // each other's write ends open
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) != 0) {
+        result.output = std::string("Failed to create pipe: ") + std::strerror(errno);
+        return result;
+    }
+    if (pipe2(err, O_CLOEXEC) != 0) {
+        result.output = std::string("Failed to create pipe: ") + std::strerror(errno);
+        close(out[0]);
+        close(out[1]);
+        return result;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, err[1], 2);
+
+    // Own process group, so a timeout also stops the tool's children;
+    // default signal handling whatever the calling thread has set up
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+
+    std::vector<std::string> env = toolEnvironment();
+    std::vector<char*> argvPointers = pointers(argv);
+    std::vector<char*> envPointers = pointers(env);
+    pid_t pid;
+    int spawnError = posix_spawnp(&pid, argvPointers[0], &actions, &attr,
+                                  argvPointers.data(), envPointers.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(out[1]);
+    close(err[1]);
+    if (spawnError != 0) {
+        close(out[0]);
+        close(err[0]);
+        result.output = "Failed to start " + argv[0] + ": " + std::strerror(spawnError);
+        return result;
+    }
+
+    // Collect both streams until they close or the deadline passes
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::string errors;
+    pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    int streams = 2;
+    char buffer[16384];
+    while (streams > 0) {
+        long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - Clock::now()).count();
+        if (remaining <= 0) {
+            result.timedOut = true;
+            break;
+        }
+        int ready = poll(fds, 2, (int)std::min<long>(remaining, 1000000));
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < 2 && ready > 0; ++i) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                std::string& target = i == 0 ? result.output : errors;
+                size_t room = maxOutput > target.size() ? maxOutput - target.size() : 0;
+                target.append(buffer, std::min<size_t>((size_t)n, room));
+            } else if (n == 0 || errno != EINTR) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --streams;
+            }
+        }
+    }
+    if (result.timedOut) {
+        kill(-pid, SIGKILL);
+    }
+    for (const pollfd& fd : fds) {
+        if (fd.fd >= 0) {
+            close(fd.fd);
+        }
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (WIFEXITED(status)) {
+        result.exitStatus = WEXITSTATUS(status);
+    }
+    result.ok = !result.timedOut && result.exitStatus == 0;
+    if (!result.ok && !errors.empty()) {
+        if (!result.output.empty() && result.output.back() != '\n') {
+            result.output += '\n';
+        }
+        result.output += errors;
+    }
+    return result;
+}
+
+std::vector<ToolResult> ToolExecutor::runAll(const std::vector<ToolCall>& calls) const {
+    std::vector<ToolResult> results(calls.size());
+    size_t workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        workers = std::min(std::max<size_t>(options.maxParallel, 1), calls.size());
+    }
+    if (workers <= 1) {
+        for (size_t i = 0; i < calls.size(); ++i) {
+            results[i] = run(calls[i]);
+        }
+        return results;
+    }
+
+    // The calling thread is one of the workers
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < calls.size(); i = next++) {
+            results[i] = run(calls[i]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
+
+Message ToolExecutor::toMessage(const ToolResult& result) {
+    std::string content;
+    if (result.timedOut) {
+        content = "Error: the tool timed out\n" + result.output;
+    } else if (!result.ok) {
+        content = (result.exitStatus > 0
+                   ? "Error: the tool exited with status " + std::to_string(result.exitStatus) + "\n"
+                   : std::string("Error: ")) + result.output;
+    } else {
+        content = result.output.empty() ? "(no output)" : result.output;
+    }
+    Message message(Role::Tool, std::move(content));
+    message.toolCallId = result.callId;
+    return message;
+}
+
+} // namespace caichat
+} // namespace opencog
@@ -0,0 +1,124 @@
+#ifndef TOOLEXECUTOR_H
+#define TOOLEXECUTOR_H
+
+#include "LLMClient.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * Outcome of one tool call
+ */
+struct ToolResult {
+    std::string callId;
+    std::string name;
+    std::string output;    // stdout, with stderr appended on failure
+    int exitStatus = -1;   // -1 if the process did not exit normally
+    bool timedOut = false;
+    bool ok = false;
+};
+
+/**
+ * Runs the model's function calls as subprocesses.
+ *
+ * Tools come from the declaration files built by `argc build`:
+ * functions.json in the root directory for tools/, and
+ * agents/<name>/functions.json for an agent's functions. A tool runs as
+ * `<interpreter> scripts/run-tool.<lang> <name> <arguments-json>` and an
+ * agent function as `<interpreter> scripts/run-agent.<lang> <agent>
+ * <name> <arguments-json>`, started with posix_spawn so the arguments are
+ * never re-parsed by a shell. Output is read through pipes; a call that
+ * outlives its timeout has its whole process group killed.
+ *
+ * Calls of one turn run concurrently, at most maxParallel at a time, so
+ * a turn takes about as long as its slowest tool.
+ */
+class ToolExecutor {
+public:
+    struct Options {
+        size_t maxParallel = 8;
+        unsigned timeoutMs = 60000;          // per call, unless set per tool
+        size_t maxOutputBytes = 256 * 1024;  // longer output is truncated
+    };
+
+    /**
+     * @param rootDir Directory holding tools/, agents/ and scripts/;
+     *                "" uses $LLM_ROOT_DIR, else the current directory
+     */
+    explicit ToolExecutor(const std::string& rootDir = "");
+    ToolExecutor(const std::string& rootDir, const Options& options);
+
+    /**
+     * Load the tool declarations (root functions.json)
+     * @return Number of functions loaded
+     */
+    size_t loadTools();
+
+    /**
+     * Load an agent's functions and the shared tools it uses
+     * @return Number of functions loaded
+     */
+    size_t loadAgent(const std::string& agent);
+
+    /**
+     * Run name with argv plus the arguments JSON as last argument,
+     * replacing any declaration of that name
+     */
+    void addTool(const ToolDefinition& definition, const std::vector<std::string>& argv);
+
+    /**
+     * Declarations of the named tools, or of all tools if names is empty.
+     * Throws std::runtime_error for an unknown name.
+     */
+    std::vector<ToolDefinition> getDefinitions(const std::vector<std::string>& names = {}) const;
+
+    bool hasTool(const std::string& name) const;
+
+    /**
+     * Timeout of one tool, overriding the default
+     */
+    void setTimeout(const std::string& name, unsigned timeoutMs);
+    void setOptions(const Options& options);
+    Options getOptions() const;
+
+    /**
+     * Run one call; failures are reported in the result, not thrown
+     */
+    ToolResult run(const ToolCall& call) const;
+
+    /**
+     * Run all calls of a turn concurrently; results are in call order
+     */
+    std::vector<ToolResult> runAll(const std::vector<ToolCall>& calls) const;
+
+    /**
+     * Tool message carrying a result back to the model
+     */
+    static Message toMessage(const ToolResult& result);
+
+    const std::string& getRootDir() const { return rootDir; }
+
+private:
+    struct Tool {
+        ToolDefinition definition;
+        std::vector<std::string> argv;   // without the arguments JSON
+    };
+
+    size_t loadDeclarations(const std::string& file, const std::string& agent);
+    std::vector<std::string> commandFor(const std::string& name, const std::string& agent) const;
+
+    std::string rootDir;
+    mutable std::mutex mutex;
+    std::map<std::string, Tool> tools;
+    std::map<std::string, unsigned> timeouts;
+    Options options;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // TOOLEXECUTOR_H
@@ -0,0 +1,414 @@
+#include "VectorIndex.h"
+#include "VectorKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+
+namespace opencog {
+namespace caichat {
+
+VectorIndex::VectorIndex(size_t dim)
+    : VectorIndex(dim, Options()) {
+}
+
+VectorIndex::VectorIndex(size_t dim, const Options& opts)
+    : dimension(dim), options(opts), liveCount(0), entryPoint(0), maxLevel(-1), rng(42) {
+    if (dimension == 0) {
+        throw std::invalid_argument("Vector dimension must be positive");
+    }
+    if (options.M < 2) {
+        options.M = 2;
+    }
+}
+
+const float* VectorIndex::prepareQuery(const float* query, std::vector<float>& buffer) const {
+    if (options.metric != Metric::Cosine) {
+        return query;
+    }
+    buffer.assign(query, query + dimension);
+    kernels::normalize(buffer.data(), dimension);
+    return buffer.data();
+}
+
+void VectorIndex::store(Node node, const float* vector) {
+    size_t offset = (size_t)node * dimension;
+    if (options.storage == Storage::Float32) {
+        if (vectors.size() < offset + dimension) {
+            vectors.resize(offset + dimension);
+        }
+        std::copy(vector, vector + dimension, vectors.begin() + offset);
+    } else {
+        if (codes.size() < offset + dimension) {
+            codes.resize(offset + dimension);
+            scales.resize(node + 1);
+        }
+        scales[node] = kernels::quantize(vector, &codes[offset], dimension);
+    }
+}
+
+float VectorIndex::similarity(const float* query, Node node) const {
+    size_t offset = (size_t)node * dimension;
+    if (options.storage == Storage::Float32) {
+        return kernels::dot(query, &vectors[offset], dimension);
+    }
+    return kernels::dotInt8(query, &codes[offset], dimension) * scales[node];
+}
+
+float VectorIndex::nodeSimilarity(Node a, Node b) const {
+    if (options.storage == Storage::Float32) {
+        return similarity(&vectors[(size_t)a * dimension], b);
+    }
+    thread_local std::vector<float> decoded;
+    decoded.resize(dimension);
+    const int8_t* code = &codes[(size_t)a * dimension];
+    for (size_t i = 0; i < dimension; ++i) {
+        decoded[i] = code[i] * scales[a];
+    }
+    return similarity(decoded.data(), b);
+}
+
+void VectorIndex::add(const std::string& id, const float* vector) {
+    std::vector<float> prepared(vector, vector + dimension);
+    if (options.metric == Metric::Cosine) {
+        kernels::normalize(prepared.data(), dimension);
+    }
+
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    auto it = nodesById.find(id);
+    if (it != nodesById.end()) {
+        if (options.mode == Mode::Exact) {
+            store(it->second, prepared.data());
+            return;
+        }
+        // Graph nodes are never moved; retire the old one
+        deleted[it->second] = 1;
+        --liveCount;
+    }
+
+    Node node = (Node)ids.size();
+    ids.push_back(id);
+    deleted.push_back(0);
+    store(node, prepared.data());
+    nodesById[id] = node;
+    ++liveCount;
+
+    if (options.mode == Mode::HNSW) {
+        insertGraph(node, prepared.data());
+    }
+}
+
+bool VectorIndex::remove(const std::string& id) {
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    auto it = nodesById.find(id);
+    if (it == nodesById.end()) {
+        return false;
+    }
+    Node node = it->second;
+    nodesById.erase(it);
+    --liveCount;
+
+    if (options.mode == Mode::HNSW) {
+        // Removed nodes still route searches but are never returned
+        deleted[node] = 1;
+        return true;
+    }
+
+    // Exact mode: move the last vector into the hole to stay contiguous
+    Node last = (Node)ids.size() - 1;
+    if (node != last) {
+        size_t from = (size_t)last * dimension;
+        size_t to = (size_t)node * dimension;
+        if (options.storage == Storage::Float32) {
+            std::copy(vectors.begin() + from, vectors.begin() + from + dimension, vectors.begin() + to);
+        } else {
+            std::copy(codes.begin() + from, codes.begin() + from + dimension, codes.begin() + to);
+            scales[node] = scales[last];
+        }
+        ids[node] = std::move(ids[last]);
+        nodesById[ids[node]] = node;
+    }
+    ids.pop_back();
+    deleted.pop_back();
+    if (options.storage == Storage::Float32) {
+        vectors.resize(ids.size() * dimension);
+    } else {
+        codes.resize(ids.size() * dimension);
+        scales.resize(ids.size());
+    }
+    return true;
+}
+
+bool VectorIndex::contains(const std::string& id) const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return nodesById.count(id) > 0;
+}
+
+size_t VectorIndex::size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return liveCount;
+}
+
+void VectorIndex::setEfSearch(size_t ef) {
+    std::unique_lock<std::shared_timed_mutex> lock(mutex);
+    options.efSearch = std::max<size_t>(ef, 1);
+}
+
+std::vector<VectorIndex::Result> VectorIndex::search(const float* query, size_t k) const {
+    if (options.mode == Mode::Exact) {
+        return searchExact(query, k);
+    }
+
+    std::vector<float> buffer;
+    const float* q = prepareQuery(query, buffer);
+
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    std::vector<Result> results;
+    if (liveCount == 0 || k == 0) {
+        return results;
+    }
+
+    Node entry = greedyDescend(q, entryPoint, maxLevel, 0);
+    std::vector<Candidate> found = searchLayer(q, entry, std::max(options.efSearch, k), 0, true);
+    for (size_t i = 0; i < found.size() && i < k; ++i) {
+        results.push_back({ids[found[i].node], found[i].score});
+    }
+    return results;
+}
+
+std::vector<VectorIndex::Result> VectorIndex::searchExact(const float* query, size_t k) const {
+    std::vector<float> buffer;
+    const float* q = prepareQuery(query, buffer);
+
+    // Min-heap of the best k seen so far
+    auto worse = [](const Candidate& a, const Candidate& b) { return a.score > b.score; };
+    std::vector<Candidate> heap;
+    heap.reserve(k + 1);
+
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    if (k == 0) {
+        return std::vector<Result>();
+    }
+    for (Node node = 0; node < (Node)ids.size(); ++node) {
+        if (deleted[node]) {
+            continue;
+        }
+        float score = similarity(q, node);
+        if (heap.size() < k) {
+            heap.push_back({score, node});
+            std::push_heap(heap.begin(), heap.end(), worse);
+        } else if (score > heap.front().score) {
+            std::pop_heap(heap.begin(), heap.end(), worse);
+            heap.back() = {score, node};
+            std::push_heap(heap.begin(), heap.end(), worse);
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), worse);
+    std::vector<Result> results;
+    results.reserve(heap.size());
+    for (const Candidate& c : heap) {
+        results.push_back({ids[c.node], c.score});
+    }
+    return results;
+}
+
+// HNSW
+
+int VectorIndex::randomLevel() {
+    std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.0);
+    double level = -std::log(uniform(rng)) / std::log((double)options.M);
+    return std::min((int)level, 16);
+}
+
+VectorIndex::Node* VectorIndex::links(Node node, int level) {
+    if (level == 0) {
+        return &level0[(size_t)node * (1 + maxLinks(0))];
+    }
+    return &upperLinks[node][(size_t)(level - 1) * (1 + maxLinks(level))];
+}
+
+const VectorIndex::Node* VectorIndex::links(Node node, int level) const {
+    return const_cast<VectorIndex*>(this)->links(node, level);
+}
+
+VectorIndex::Node VectorIndex::greedyDescend(const float* query, Node entry,
+                                             int fromLevel, int toLevel) const {
+    Node current = entry;
+    float best = similarity(query, current);
+    for (int level = fromLevel; level > toLevel; --level) {
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            const Node* l = links(current, level);
+            for (Node i = 1; i <= l[0]; ++i) {
+                float score = similarity(query, l[i]);
+                if (score > best) {
+                    best = score;
+                    current = l[i];
+                    improved = true;
+                }
+            }
+        }
+    }
+    return current;
+}
+
+std::vector<VectorIndex::Candidate> VectorIndex::searchLayer(const float* query, Node entry,
+                                                             size_t ef, int level,
+                                                             bool liveOnly) const {
+    // Visited marks are per thread and stamped with a search counter, so
+    // they never need clearing between searches
+    thread_local std::vector<uint32_t> visited;
+    thread_local uint32_t stamp = 0;
+    if (visited.size() < ids.size()) {
+        visited.resize(ids.size(), 0);
+    }
+    if (++stamp == 0) {
+        std::fill(visited.begin(), visited.end(), 0);
+        stamp = 1;
+    }
+
+    auto better = [](const Candidate& a, const Candidate& b) { return a.score < b.score; };
+    auto worse = [](const Candidate& a, const Candidate& b) { return a.score > b.score; };
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(better)> frontier(better);
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(worse)> found(worse);
+
+    float score = similarity(query, entry);
+    visited[entry] = stamp;
+    frontier.push({score, entry});
+    if (!liveOnly || !deleted[entry]) {
+        found.push({score, entry});
+    }
+    float bound = found.empty() ? -std::numeric_limits<float>::infinity() : found.top().score;
+
+    while (!frontier.empty()) {
+        Candidate current = frontier.top();
+        if (current.score < bound && found.size() >= ef) {
+            break;
+        }
+        frontier.pop();
+
+        const Node* l = links(current.node, level);
+        for (Node i = 1; i <= l[0]; ++i) {
+            Node next = l[i];
+            if (visited[next] == stamp) {
+                continue;
+            }
+            visited[next] = stamp;
+            score = similarity(query, next);
+            if (found.size() < ef || score > bound) {
+                frontier.push({score, next});
+                if (!liveOnly || !deleted[next]) {
+                    found.push({score, next});
+                    if (found.size() > ef) {
+                        found.pop();
+                    }
+                }
+                if (!found.empty()) {
+                    bound = found.top().score;
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> result(found.size());
+    for (size_t i = result.size(); i > 0; --i) {
+        result[i - 1] = found.top();
+        found.pop();
+    }
+    return result;
+}
+
+// Candidates are sorted best first, scored against the node being linked.
+// A candidate is preferred if it is closer to that node than to any
+// neighbour already chosen, which keeps links pointing in diverse
+// directions; remaining slots are filled with the best of the rest.
+std::vector<VectorIndex::Node> VectorIndex::selectNeighbors(std::vector<Candidate> candidates,
+                                                            size_t count) const {
+    std::vector<Node> selected;
+    if (candidates.size() <= count) {
+        for (const Candidate& c : candidates) {
+            selected.push_back(c.node);
+        }
+        return selected;
+    }
+
+    std::vector<Node> pruned;
+    for (const Candidate& c : candidates) {
+        if (selected.size() >= count) {
+            break;
+        }
+        bool diverse = true;
+        for (Node s : selected) {
+            if (nodeSimilarity(c.node, s) > c.score) {
+                diverse = false;
+                break;
+            }
+        }
+        (diverse ? selected : pruned).push_back(c.node);
+    }
+    for (size_t i = 0; i < pruned.size() && selected.size() < count; ++i) {
+        selected.push_back(pruned[i]);
+    }
+    return selected;
+}
+
+void VectorIndex::connect(Node node, int level, const std::vector<Node>& neighbors) {
+    Node* own = links(node, level);
+    own[0] = (Node)neighbors.size();
+    std::copy(neighbors.begin(), neighbors.end(), own + 1);
+
+    size_t capacity = maxLinks(level);
+    for (Node neighbor : neighbors) {
+        Node* l = links(neighbor, level);
+        if (l[0] < capacity) {
+            l[1 + l[0]] = node;
+            ++l[0];
+            continue;
+        }
+
+        // Full: re-select the neighbour's links including the new node
+        std::vector<Candidate> candidates;
+        candidates.reserve(capacity + 1);
+        for (Node i = 1; i <= l[0]; ++i) {
+            candidates.push_back({nodeSimilarity(neighbor, l[i]), l[i]});
+        }
+        candidates.push_back({nodeSimilarity(neighbor, node), node});
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+        std::vector<Node> kept = selectNeighbors(std::move(candidates), capacity);
+        l[0] = (Node)kept.size();
+        std::copy(kept.begin(), kept.end(), l + 1);
+    }
+}
+
+void VectorIndex::insertGraph(Node node, const float* query) {
+    int level = randomLevel();
+    levels.push_back(level);
+    level0.resize(level0.size() + 1 + maxLinks(0), 0);
+    upperLinks.emplace_back((size_t)level * (1 + maxLinks(1)), 0);
+
+    if (maxLevel < 0) {
+        entryPoint = node;
+        maxLevel = level;
+        return;
+    }
+
+    Node current = greedyDescend(query, entryPoint, maxLevel, level);
+    for (int l = std::min(level, maxLevel); l >= 0; --l) {
+        std::vector<Candidate> candidates = searchLayer(query, current, options.efConstruction, l, false);
+        current = candidates.front().node;
+        connect(node, l, selectNeighbors(std::move(candidates), options.M));
+    }
+
+    if (level > maxLevel) {
+        maxLevel = level;
+        entryPoint = node;
+    }
+}
+
+} // namespace caichat
+} // namespace opencog
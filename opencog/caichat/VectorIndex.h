@@ -0,0 +1,145 @@
+#ifndef VECTORINDEX_H
+#define VECTORINDEX_H
+
+#include <cstdint>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog {
+namespace caichat {
+
+/**
+ * In-memory nearest-neighbour index over fixed-dimension float vectors.
+ *
+ * Vectors live in one contiguous array, either as float32 or as int8
+ * codes with a per-vector scale (4x smaller, slightly less precise).
+ * Similarity kernels use AVX2/FMA or NEON when the CPU supports them.
+ *
+ * Exact mode scans every vector. HNSW mode maintains a hierarchical
+ * navigable small-world graph for approximate search in roughly
+ * logarithmic time; searchExact() remains available for reference.
+ *
+ * Searches may run concurrently; adds and removes take an exclusive lock.
+ */
+class VectorIndex {
+public:
+    enum class Metric {
+        Cosine,        // vectors are normalized on insert and query
+        InnerProduct
+    };
+
+    enum class Storage {
+        Float32,
+        Int8
+    };
+
+    enum class Mode {
+        Exact,
+        HNSW
+    };
+
+    struct Options {
+        Metric metric = Metric::Cosine;
+        Storage storage = Storage::Float32;
+        Mode mode = Mode::HNSW;
+        size_t M = 16;                 // graph degree (2M on the bottom layer)
+        size_t efConstruction = 200;   // candidate list size while inserting
+        size_t efSearch = 64;          // candidate list size while searching
+    };
+
+    struct Result {
+        std::string id;
+        float score;   // higher is more similar
+    };
+
+    explicit VectorIndex(size_t dimension);
+    VectorIndex(size_t dimension, const Options& options);
+
+    VectorIndex(const VectorIndex&) = delete;
+    VectorIndex& operator=(const VectorIndex&) = delete;
+
+    /**
+     * Insert a vector of getDimension() floats, replacing any vector
+     * already stored under id
+     */
+    void add(const std::string& id, const float* vector);
+
+    /**
+     * Remove a vector; returns false if id is unknown
+     */
+    bool remove(const std::string& id);
+
+    bool contains(const std::string& id) const;
+
+    /**
+     * k most similar vectors, best first, using the index's mode
+     */
+    std::vector<Result> search(const float* query, size_t k) const;
+
+    /**
+     * k most similar vectors by scanning every vector
+     */
+    std::vector<Result> searchExact(const float* query, size_t k) const;
+
+    void setEfSearch(size_t ef);
+
+    size_t size() const;
+    size_t getDimension() const { return dimension; }
+    const Options& getOptions() const { return options; }
+
+private:
+    typedef uint32_t Node;
+
+    // Similarity between a prepared query and a stored node
+    float similarity(const float* query, Node node) const;
+    float nodeSimilarity(Node a, Node b) const;
+    void store(Node node, const float* vector);
+    const float* prepareQuery(const float* query, std::vector<float>& buffer) const;
+
+    // HNSW internals
+    int randomLevel();
+    Node* links(Node node, int level);
+    const Node* links(Node node, int level) const;
+    size_t maxLinks(int level) const { return level == 0 ? 2 * options.M : options.M; }
+    struct Candidate {
+        float score;
+        Node node;
+    };
+    std::vector<Candidate> searchLayer(const float* query, Node entry, size_t ef,
+                                       int level, bool liveOnly) const;
+    std::vector<Node> selectNeighbors(std::vector<Candidate> candidates, size_t count) const;
+    void connect(Node node, int level, const std::vector<Node>& neighbors);
+    void insertGraph(Node node, const float* query);
+    Node greedyDescend(const float* query, Node entry, int fromLevel, int toLevel) const;
+
+    size_t dimension;
+    Options options;
+
+    mutable std::shared_timed_mutex mutex;
+
+    // Node storage, indexed by Node
+    std::vector<float> vectors;     // Float32 storage
+    std::vector<int8_t> codes;      // Int8 storage
+    std::vector<float> scales;      // Int8 storage
+    std::vector<std::string> ids;
+    std::vector<uint8_t> deleted;
+    std::unordered_map<std::string, Node> nodesById;
+    size_t liveCount;
+
+    // Graph: level 0 in one flat array of [count, M0 links] per node, upper
+    // levels per node as consecutive [count, M links] blocks
+    std::vector<Node> level0;
+    std::vector<std::vector<Node>> upperLinks;
+    std::vector<int> levels;
+    Node entryPoint;
+    int maxLevel;
+    std::mt19937 rng;
+};
+
+} // namespace caichat
+} // namespace opencog
+
+#endif // VECTORINDEX_H
@@ -0,0 +1,202 @@
+#include "VectorKernels.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAICHAT_KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define CAICHAT_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace opencog {
+namespace caichat {
+namespace kernels {
+
+typedef float (*DotFn)(const float*, const float*, size_t);
+typedef float (*DotInt8Fn)(const float*, const int8_t*, size_t);
+
+// Portable versions; four accumulators let the compiler pipeline the adds
+static float dotScalar(const float* a, const float* b, size_t n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float dotInt8Scalar(const float* a, const int8_t* b, size_t n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef CAICHAT_KERNELS_X86
+
+// Compiled for AVX2+FMA regardless of the baseline flags and only called
+// after a CPUID check, so the library still runs on older processors
+__attribute__((target("avx2,fma")))
+static float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float dotAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i + 8 <= n) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        i += 8;
+    }
+    float sum = horizontalSum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float dotInt8AVX2(const float* a, const int8_t* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(bytes, 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), lo, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), hi, acc1);
+    }
+    float sum = horizontalSum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#endif // CAICHAT_KERNELS_X86
+
+#ifdef CAICHAT_KERNELS_NEON
+
+static float dotNEON(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static float dotInt8NEON(const float* a, const int8_t* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t wide = vmovl_s8(vld1_s8(b + i));
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide)));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), lo);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), hi);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#endif // CAICHAT_KERNELS_NEON
+
+struct Dispatch {
+    DotFn dot;
+    DotInt8Fn dotInt8;
+    const char* name;
+};
+
+static Dispatch select() {
+#ifdef CAICHAT_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {dotAVX2, dotInt8AVX2, "avx2"};
+    }
+#endif
+#ifdef CAICHAT_KERNELS_NEON
+    return {dotNEON, dotInt8NEON, "neon"};
+#endif
+    return {dotScalar, dotInt8Scalar, "scalar"};
+}
+
+static const Dispatch& dispatch() {
+    static const Dispatch selected = select();
+    return selected;
+}
+
+float dot(const float* a, const float* b, size_t n) {
+    return dispatch().dot(a, b, n);
+}
+
+float dotInt8(const float* a, const int8_t* b, size_t n) {
+    return dispatch().dotInt8(a, b, n);
+}
+
+float normalize(float* v, size_t n) {
+    float norm = std::sqrt(dot(v, v, n));
+    if (norm > 0) {
+        float inverse = 1.0f / norm;
+        for (size_t i = 0; i < n; ++i) {
+            v[i] *= inverse;
+        }
+    }
+    return norm;
+}
+
+float quantize(const float* v, int8_t* codes, size_t n) {
+    float maxAbs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        maxAbs = std::fmax(maxAbs, std::fabs(v[i]));
+    }
+    float scale = maxAbs > 0 ? maxAbs / 127.0f : 1.0f;
+    float inverse = 1.0f / scale;
+    for (size_t i = 0; i < n; ++i) {
+        codes[i] = (int8_t)std::lrint(v[i] * inverse);
+    }
+    return scale;
+}
+
+const char* name() {
+    return dispatch().name;
+}
+
+} // namespace kernels
+} // namespace caichat
+} // namespace opencog
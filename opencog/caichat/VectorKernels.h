@@ -0,0 +1,40 @@
+#ifndef VECTORKERNELS_H
+#define VECTORKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace opencog {
+namespace caichat {
+namespace kernels {
+
+/**
+ * Dot product of two float vectors
+ */
+float dot(const float* a, const float* b, size_t n);
+
+/**
+ * Dot product of a float vector with int8 codes (unscaled)
+ */
+float dotInt8(const float* a, const int8_t* b, size_t n);
+
+/**
+ * Scale v to unit length in place; returns the original norm
+ */
+float normalize(float* v, size_t n);
+
+/**
+ * Quantize v to int8 codes with a single scale (v[i] ~ codes[i] * scale)
+ */
+float quantize(const float* v, int8_t* codes, size_t n);
+
+/**
+ * Instruction set chosen at startup: "avx2", "neon" or "scalar"
+ */
+const char* name();
+
+} // namespace kernels
+} // namespace caichat
+} // namespace opencog
+
+#endif // VECTORKERNELS_H
@@ -2,47 +2,63 @@
 (define-module (opencog caichat atomspace)
   #:use-module (opencog caichat init)
   #:use-module (opencog caichat config)
+  #:use-module (srfi srfi-1)
   #:export (caichat-atomspace-store-conversation
+            caichat-atomspace-log-session
             caichat-atomspace-query-knowledge
             caichat-atomspace-add-concept
-            caichat-atomspace-get-related))
+            caichat-atomspace-get-related
+            caichat-atomspace-stats))
 
-;; Store conversation in AtomSpace (placeholder implementation)
+;; Atoms live in the C++ library's atom table: nodes and links are
+;; deduplicated through a hash index, every atom keeps its incoming set,
+;; and each call below writes its atoms in one batch. A conversation is
+;; stored as
+;;   (MemberLink (ItemNode "<session>/<n>") (ConceptNode "<session>"))
+;;   (EvaluationLink (PredicateNode "role")
+;;                   (ListLink (ItemNode "<session>/<n>") (ConceptNode "user")))
+;;   (EvaluationLink (PredicateNode "content")
+;;                   (ListLink (ItemNode "<session>/<n>") (SentenceNode "...")))
+;;   (EvaluationLink (PredicateNode "next")
+;;                   (ListLink (ItemNode "<session>/<n-1>") (ItemNode "<session>/<n>")))
+
+;; Store conversation in AtomSpace
 (define (caichat-atomspace-store-conversation session-id messages)
-  "Store a conversation as atoms in the AtomSpace"
-  ;; This would create conversation atoms in a real OpenCog installation
-  ;; For now, it's a placeholder showing the intended structure
-  (display (format #f "Storing conversation ~a with ~a messages in AtomSpace\n" 
-                  session-id (length messages)))
-  (for-each (lambda (msg)
-              (display (format #f "  - ~a: ~a\n" 
-                              (car msg) (cadr msg))))
-            messages)
+  "Store messages, a list of (role content), as atoms of session-id.
+Messages are numbered after those already stored for the session."
+  (caichat-atoms-store-conversation session-id messages)
   #t)
 
+;; Log every turn of a chat session as it completes
+(define (caichat-atomspace-log-session session-id . args)
+  "Store each completed turn of session-id in the AtomSpace, one batch per
+turn. (caichat-atomspace-log-session id #f) stops logging."
+  (caichat-atoms-log-session session-id (if (null? args) #t (car args))))
+
 ;; Query knowledge using AtomSpace
 (define (caichat-atomspace-query-knowledge query)
-  "Query knowledge stored in AtomSpace"
-  ;; This would use PLN or other reasoning systems
-  (display (format #f "Querying AtomSpace for: ~a\n" query))
-  '(("result" . "This would contain atoms matching the query")
-    ("confidence" . 0.8)))
+  "Concepts named by the query, or by any of its words, with their related
+concepts: ((concept . related) ...), where related is ((name . links) ...)"
+  (filter-map (lambda (name)
+                (let ((related (caichat-atoms-related name)))
+                  (and related (cons name related))))
+              (delete-duplicates (cons query (string-tokenize query)))))
 
 ;; Add concept to AtomSpace
 (define (caichat-atomspace-add-concept concept-name description)
-  "Add a concept to the AtomSpace"
-  (display (format #f "Adding concept '~a' to AtomSpace: ~a\n" 
-                  concept-name description))
-  ;; In a real implementation, this would create:
-  ;; (ConceptNode "concept-name")
-  ;; (EvaluationLink 
-  ;;   (PredicateNode "description")
-  ;;   (ListLink (ConceptNode "concept-name") (ConceptNode "description")))
-  #t)
+  "Add a concept to the AtomSpace:
+(EvaluationLink (PredicateNode \"description\")
+                (ListLink (ConceptNode concept-name) (ConceptNode description)))"
+  (caichat-atoms-add-concept concept-name description))
 
 ;; Get related concepts
-(define (caichat-atomspace-get-related concept-name)
-  "Get concepts related to the given concept"
-  (display (format #f "Finding concepts related to: ~a\n" concept-name))
-  ;; This would use AtomSpace traversal and reasoning
-  '("related-concept-1" "related-concept-2" "related-concept-3"))
\ No newline at end of file
+(define (caichat-atomspace-get-related concept-name . args)
+  "Names of the concepts sharing a link with concept-name, most shared
+first; an optional limit caps the count"
+  (let ((related (apply caichat-atoms-related concept-name args)))
+    (if related (map car related) '())))
+
+;; Atom counts
+(define (caichat-atomspace-stats)
+  "Alist of the number of atoms, nodes and links stored"
+  (caichat-atoms-stats))
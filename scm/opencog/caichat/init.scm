@@ -5,10 +5,74 @@
   #:use-module (ice-9 rdelim)
   #:export (caichat-ask
             caichat-ask-internal
+            caichat-ask-async
+            caichat-ask-async-internal
+            caichat-await
+            caichat-ask-batch
+            caichat-ask-batch-internal
+            caichat-set-rate-limit
             caichat-create-client
             caichat-send-message
+            caichat-send-message-stream
+            caichat-send-message-with-tools
+            caichat-tools-set-root
+            caichat-tools-load
+            caichat-tools-list
+            caichat-tools-set-timeout
+            caichat-tools-set-parallel
+            caichat-run-tool
             caichat-set-system-message
             caichat-clear-history
+            caichat-close-session
+            caichat-save-session
+            caichat-load-session
+            caichat-load-sessions
+            caichat-set-session-idle-timeout
+            caichat-set-context-budget
+            caichat-set-history-policy
+            caichat-set-local-threads
+            caichat-set-connection-pool
+            caichat-set-hedge-options
+            caichat-set-route-options
+            caichat-set-latency-slo
+            caichat-last-route
+            caichat-route-stats
+            caichat-cache-enable
+            caichat-cache-disable
+            caichat-cache-clear
+            caichat-coalesce-enable
+            caichat-cache-stats
+            caichat-count-tokens
+            caichat-set-tokenizer
+            caichat-metrics
+            caichat-metrics-prometheus
+            caichat-metrics-serve
+            caichat-metrics-enable
+            caichat-metrics-reset
+            caichat-embed
+            caichat-kb-open
+            caichat-kb-open?
+            caichat-kb-close
+            caichat-kb-set-embedder
+            caichat-kb-set-chunking
+            caichat-kb-add-doc
+            caichat-kb-add-docs
+            caichat-kb-ingest
+            caichat-kb-remove-doc
+            caichat-kb-list-docs
+            caichat-kb-search
+            caichat-kb-search-context
+            caichat-kb-set-hybrid-weight
+            caichat-vector-index-create
+            caichat-vector-index-add
+            caichat-vector-index-search
+            caichat-vector-index-remove
+            caichat-vector-index-size
+            caichat-atoms-store-conversation
+            caichat-atoms-log-session
+            caichat-atoms-add-concept
+            caichat-atoms-related
+            caichat-atoms-stats
             caichat-repl
             caichat-ask-about-atom
             caichat-create-knowledge-base
@@ -16,6 +80,7 @@
             caichat-setup-openai
             caichat-setup-claude
             caichat-setup-ggml
+            caichat-setup-routing
             caichat-save-config
             caichat-load-config))
 
@@ -33,6 +98,18 @@
   "Ask a question using the default LLM provider"
   (caichat-ask-internal *default-provider* message))
 
+;; Non-blocking ask with default provider; returns a handle for caichat-await
+(define (caichat-ask-async message)
+  "Start a question on the default LLM provider without waiting for the reply"
+  (caichat-ask-async-internal *default-provider* message))
+
+;; Batch ask with default provider
+(define (caichat-ask-batch prompts . args)
+  "Ask many prompts concurrently; returns (ok . reply) or (error . message) per prompt"
+  (if (null? args)
+      (caichat-ask-batch-internal *default-provider* prompts)
+      (caichat-ask-batch-internal *default-provider* prompts (car args))))
+
 ;; Interactive REPL
 (define (caichat-repl)
   "Start an interactive chat session"
@@ -44,12 +121,17 @@
       (let ((input (read-line)))
         (cond
          ((or (string=? input "quit") (string=? input "exit"))
+          (caichat-close-session session-id)
           (display "Goodbye!\n"))
          ((string=? input "")
           (loop))
          (else
           (display "Assistant: ")
-          (display (caichat-send-message session-id input))
+          (force-output)
+          (caichat-send-message-stream session-id input
+                                       (lambda (token)
+                                         (display token)
+                                         (force-output)))
           (newline)
           (newline)
           (loop)))))))
@@ -94,6 +176,13 @@
   (set! *default-provider* "ggml")
   #t)
 
+(define (caichat-setup-routing . backends)
+  "Route default-provider requests among backends, cheapest first,
+e.g. (caichat-setup-routing \"ggml\" \"openai/gpt-4o-mini\" \"claude\")"
+  (set! *default-provider*
+        (string-append "route:" (string-join backends ",")))
+  #t)
+
 (define (caichat-save-config filename)
   "Save configuration to file"
   (with-output-to-file filename
@@ -4,87 +4,139 @@
   #:use-module (opencog caichat config)
   #:export (caichat-rag-create-kb
             caichat-rag-add-doc
+            caichat-rag-add-docs
+            caichat-rag-ingest
+            caichat-rag-remove-doc
+            caichat-rag-set-embedder
             caichat-rag-query
             caichat-rag-search
             caichat-rag-list-docs))
 
-;; Knowledge base storage (simple in-memory for now)
-(define *knowledge-bases* '())
+;; Knowledge bases are files managed by the C++ library; documents,
+;; chunks and embeddings are stored on disk and survive restarts.
+;; Metadata is kept as its printed representation.
 
-;; Document structure: (id content metadata embeddings)
-(define (make-document id content metadata)
-  "Create a document structure"
-  (list id content metadata '()))
+;; Directory holding one <name>.kb file per knowledge base
+(define (kb-directory)
+  (or (getenv "CAICHAT_KB_DIR")
+      (caichat-config-get 'kb-directory #f)
+      (string-append (or (getenv "HOME") ".") "/.caichat/kb")))
+
+(define (make-directories path)
+  (unless (or (string-null? path) (file-exists? path))
+    (make-directories (dirname path))
+    (mkdir path)))
+
+(define (kb-file name)
+  (string-append (kb-directory) "/" name ".kb"))
+
+(define (metadata->string metadata)
+  (call-with-output-string (lambda (port) (write metadata port))))
+
+(define (string->metadata text)
+  (if (string-null? text)
+      '()
+      (call-with-input-string text read)))
+
+(define (kb-missing kb-name)
+  (display (format #f "Knowledge base '~a' not found\n" kb-name))
+  #f)
 
 ;; Create knowledge base
 (define (caichat-rag-create-kb name description)
-  "Create a new knowledge base"
-  (let ((kb (list name description '())))  ; (name description documents)
-    (set! *knowledge-bases* 
-          (assoc-set! *knowledge-bases* name kb))
-    (display (format #f "Created knowledge base: ~a\n" name))
-    #t))
+  "Create a new knowledge base, or open the existing one of that name"
+  (make-directories (kb-directory))
+  (caichat-kb-open name (kb-file name) description)
+  (display (format #f "Created knowledge base: ~a\n" name))
+  #t)
 
 ;; Add document to knowledge base
-(define (caichat-rag-add-doc kb-name doc-id content metadata)
-  "Add a document to the specified knowledge base"
-  (let ((kb (assoc-ref *knowledge-bases* kb-name)))
-    (if kb
-        (let* ((documents (caddr kb))
-               (new-doc (make-document doc-id content metadata))
-               (updated-docs (cons new-doc documents))
-               (updated-kb (list (car kb) (cadr kb) updated-docs)))
-          (set! *knowledge-bases* 
-                (assoc-set! *knowledge-bases* kb-name updated-kb))
-          (display (format #f "Added document '~a' to knowledge base '~a'\n" 
-                          doc-id kb-name))
-          #t)
-        (begin
-          (display (format #f "Knowledge base '~a' not found\n" kb-name))
-          #f))))
-
-;; Simple text search (placeholder for semantic search)
-(define (caichat-rag-search kb-name query)
-  "Search for relevant documents in the knowledge base"
-  (let ((kb (assoc-ref *knowledge-bases* kb-name)))
-    (if kb
-        (let ((documents (caddr kb)))
-          (filter (lambda (doc)
-                    (let ((content (cadr doc)))
-                      (string-contains content query)))
-                  documents))
-        '())))
+(define (caichat-rag-add-doc kb-name doc-id content metadata . args)
+  "Add or replace a document, optionally with its embedding vector"
+  (if (caichat-kb-open? kb-name)
+      (begin
+        (apply caichat-kb-add-doc kb-name doc-id content
+               (metadata->string metadata) args)
+        (display (format #f "Added document '~a' to knowledge base '~a'\n"
+                        doc-id kb-name))
+        #t)
+      (kb-missing kb-name)))
+
+;; Add many (id content metadata) documents, embedding them in one batch
+(define (caichat-rag-add-docs kb-name docs)
+  "Add a list of (doc-id content metadata) documents to the specified knowledge base"
+  (if (caichat-kb-open? kb-name)
+      (caichat-kb-add-docs kb-name
+                           (map (lambda (doc)
+                                  (list (car doc) (cadr doc)
+                                        (metadata->string (caddr doc))))
+                                docs))
+      (kb-missing kb-name)))
+
+;; Stream files into the knowledge base, one document per file
+(define (caichat-rag-ingest kb-name paths . args)
+  "Chunk, embed and store files; returns the number of chunks added"
+  (if (caichat-kb-open? kb-name)
+      (let ((metadata (if (null? args) '() (car args))))
+        (caichat-kb-ingest kb-name paths (metadata->string metadata)))
+      (kb-missing kb-name)))
+
+(define (caichat-rag-remove-doc kb-name doc-id)
+  "Remove a document from the specified knowledge base"
+  (and (caichat-kb-open? kb-name)
+       (caichat-kb-remove-doc kb-name doc-id)))
+
+;; Embedding provider of a knowledge base, stored with it
+(define (caichat-rag-set-embedder kb-name provider . args)
+  "Embed documents and string queries of a knowledge base with provider (and model)"
+  (if (caichat-kb-open? kb-name)
+      (apply caichat-kb-set-embedder kb-name provider args)
+      (kb-missing kb-name)))
+
+;; Search by similarity when the query is an embedding; a string query is
+;; ranked by keywords, mixed with similarity when the knowledge base has
+;; an embedder. Results are (doc-id chunk-text metadata score), at most
+;; k (default 5).
+(define (caichat-rag-search kb-name query . args)
+  "Search for relevant document chunks in the knowledge base"
+  (if (caichat-kb-open? kb-name)
+      (map (lambda (hit)
+             (list (car hit) (cadr hit) (string->metadata (caddr hit)) (cadddr hit)))
+           (apply caichat-kb-search kb-name query args))
+      '()))
 
 ;; RAG query with context
 (define (caichat-rag-query kb-name query . args)
   "Query the LLM with relevant context from the knowledge base"
-  (let* ((provider (if (null? args) 
+  (let* ((provider (if (null? args)
                        (caichat-config-get 'default-provider "openai")
                        (car args)))
-         (relevant-docs (caichat-rag-search kb-name query))
+         (relevant-docs (if (caichat-kb-open? kb-name)
+                            (caichat-kb-search-context
+                             kb-name query
+                             (caichat-config-get 'rag-context-tokens 2000))
+                            '()))
          (context (if (null? relevant-docs)
                       ""
-                      (string-join 
+                      (string-join
                        (map (lambda (doc)
-                              (format #f "Document: ~a\nContent: ~a\n" 
+                              (format #f "Document: ~a\nContent: ~a\n"
                                      (car doc) (cadr doc)))
                             relevant-docs)
                        "\n")))
          (augmented-query (if (string=? context "")
                              query
-                             (format #f "Context:\n~a\n\nQuestion: ~a" 
+                             (format #f "Context:\n~a\n\nQuestion: ~a"
                                     context query))))
     (caichat-ask-internal provider augmented-query)))
 
 ;; List documents in knowledge base
 (define (caichat-rag-list-docs kb-name)
   "List all documents in the specified knowledge base"
-  (let ((kb (assoc-ref *knowledge-bases* kb-name)))
-    (if kb
-        (let ((documents (caddr kb)))
-          (map (lambda (doc)
-                 (list (car doc)  ; doc-id
-                       (string-length (cadr doc))  ; content length
-                       (cadddr doc)))  ; metadata
-               documents))
-        '())))
\ No newline at end of file
+  (if (caichat-kb-open? kb-name)
+      (map (lambda (doc)
+             (list (car doc)  ; doc-id
+                   (cadr doc)  ; content length
+                   (string->metadata (caddr doc))))  ; metadata
+           (caichat-kb-list-docs kb-name))
+      '()))
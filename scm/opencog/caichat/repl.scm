@@ -48,6 +48,7 @@
       (cond
        ;; Handle commands
        ((or (string=? input "/quit") (string=? input "/exit"))
+        (caichat-close-session session-id)
         (display "Goodbye!\n"))
        
        ((string=? input "/help")
@@ -79,10 +80,12 @@
         (force-output)
         (catch 'caichat-error
           (lambda ()
-            (let ((response (caichat-send-message session-id input)))
-              (display response)
-              (newline)
-              (newline)))
+            (caichat-send-message-stream session-id input
+                                         (lambda (token)
+                                           (display token)
+                                           (force-output)))
+            (newline)
+            (newline))
           (lambda (key . args)
             (display "Error: ")
             (display (car args))
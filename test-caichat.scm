@@ -42,10 +42,16 @@
 ;; Test AtomSpace integration
 (display "\nTesting AtomSpace integration...\n")
 (caichat-atomspace-add-concept "TestConcept" "A test concept for demonstration")
+(caichat-atomspace-add-concept "TestConcept" "Another description")
 (test "AtomSpace add concept" #t #t)  ; Just test that it doesn't error
 
 (let ((related (caichat-atomspace-get-related "TestConcept")))
-  (test "AtomSpace get related" 3 (length related)))
+  (test "AtomSpace get related" 2 (length related)))
+
+(caichat-atomspace-store-conversation "test-session"
+                                      '((user "Hello") (assistant "Hi there")))
+(let ((query (caichat-atomspace-query-knowledge "test-session")))
+  (test "AtomSpace store conversation" 1 (length query)))
 
 ;; Test summary
 (display (format #f "\nTest Results: ~a/~a passed\n" passed-count test-count))
@@ -27,6 +27,9 @@ export CAICHAT_LIB_PATH="$BUILD_DIR/opencog/libcaichat.so"
 echo "Running basic functionality tests..."
 guile test-caichat.scm
 
+echo "Running parallel ask test..."
+guile test-parallel-ask.scm
+
 echo "Running example script..."
 guile example.scm
 
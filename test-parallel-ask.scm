@@ -0,0 +1,112 @@
+#!/usr/bin/env guile
+!#
+
+;; Wall-clock test for parallel caichat-ask calls against a local stub
+;; server. Every stub reply is delayed, so asks that really run in
+;; parallel finish in about one delay instead of one delay per ask.
+
+(use-modules (ice-9 threads)
+             (ice-9 rdelim)
+             (ice-9 binary-ports)
+             (opencog caichat init))
+
+(define stub-port 18931)
+(define stub-delay 0.25)   ; seconds per reply
+(define ask-count 8)
+
+(define stub-reply
+  "{\"choices\":[{\"message\":{\"role\":\"assistant\",\"content\":\"pong\"}}]}")
+
+(define test-count 0)
+(define passed-count 0)
+
+(define (test name expected actual)
+  "Run a test case"
+  (set! test-count (+ test-count 1))
+  (if (equal? expected actual)
+      (begin
+        (set! passed-count (+ passed-count 1))
+        (display (format #f "✓ PASS: ~a\n" name)))
+      (display (format #f "✗ FAIL: ~a (expected ~a, got ~a)\n"
+                      name expected actual))))
+
+;; Stub server: one thread per connection, one request per connection
+(define (read-content-length port)
+  "Read the request head and return its Content-Length"
+  (let loop ((length 0))
+    (let ((line (read-line port)))
+      (cond
+       ((or (eof-object? line) (string-null? (string-trim-both line)))
+        length)
+       ((string-prefix-ci? "content-length:" line)
+        (loop (string->number (string-trim-both (substring line 15)))))
+       (else
+        (loop length))))))
+
+(define (serve-connection port)
+  (let ((length (read-content-length port)))
+    (get-bytevector-n port length)
+    (usleep (inexact->exact (round (* stub-delay 1000000))))
+    (display (string-append "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: application/json\r\n"
+                            "Content-Length: "
+                            (number->string (string-length stub-reply)) "\r\n"
+                            "Connection: close\r\n\r\n"
+                            stub-reply)
+             port)
+    (force-output port)
+    (close-port port)))
+
+(define (start-stub-server)
+  (let ((server (socket PF_INET SOCK_STREAM 0)))
+    (setsockopt server SOL_SOCKET SO_REUSEADDR 1)
+    (bind server AF_INET INADDR_LOOPBACK stub-port)
+    (listen server 64)
+    (call-with-new-thread
+     (lambda ()
+       (let loop ()
+         (let ((client (car (accept server))))
+           (call-with-new-thread (lambda () (serve-connection client)))
+           (loop)))))))
+
+(define (elapsed-seconds thunk)
+  "Run thunk and return (result . seconds)"
+  (let* ((start (get-internal-real-time))
+         (result (thunk)))
+    (cons result
+          (exact->inexact (/ (- (get-internal-real-time) start)
+                             internal-time-units-per-second)))))
+
+(start-stub-server)
+(setenv "OPENAI_BASE_URL" (format #f "http://127.0.0.1:~a" stub-port))
+(setenv "OPENAI_API_KEY" "test-key")
+
+(display "Testing single ask against the stub server...\n")
+(test "Single ask" "pong" (caichat-ask "ping"))
+
+;; n-par-map rather than par-map: the futures pool behind par-map is
+;; sized by processor count and may have a single worker on small hosts
+(display (format #f "\nTesting ~a parallel asks (~as stub delay each)...\n"
+                 ask-count stub-delay))
+;; Each ask gets its own prompt: with coalescing enabled, identical requests
+;; in flight together become one provider request and would not test anything
+(let* ((prompts (map (lambda (i) (format #f "ping ~a" i)) (iota ask-count)))
+       (run (elapsed-seconds
+             (lambda ()
+               (n-par-map ask-count caichat-ask prompts))))
+       (replies (car run))
+       (seconds (cdr run))
+       (sequential (* ask-count stub-delay)))
+  (display (format #f "  ~,3fs wall clock (~,3fs if sequential)\n" seconds sequential))
+  (test "Parallel replies" (make-list ask-count "pong") replies)
+  (test "Parallel speedup" #t (< seconds (/ sequential 2))))
+
+;; Test summary
+(display (format #f "\nTest Results: ~a/~a passed\n" passed-count test-count))
+(if (= passed-count test-count)
+    (begin
+      (display "All tests passed!\n")
+      (exit 0))
+    (begin
+      (display "Some tests failed!\n")
+      (exit 1)))